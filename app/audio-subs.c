@@ -254,6 +254,10 @@ void audio_ctlpipe_write(audio_ctlpipe_id cmd, ...)
         args.dr.mixformat = va_arg(arg_list, gint);
         arg_size = sizeof(args.dr);
         break;
+    case AUDIO_CTLPIPE_SET_REALTIME:
+        args.ip.cmd = AUDIO_CTLPIPE_SET_REALTIME;
+        arg_size = sizeof(args.ip);
+        break;
     default:
         g_assert_not_reached();
     }
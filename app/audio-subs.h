@@ -41,7 +41,8 @@ typedef enum audio_ctlpipe_id {
     AUDIO_CTLPIPE_SET_MIXER, /* st_mixer* */
     AUDIO_CTLPIPE_SET_TEMPO, /* int */
     AUDIO_CTLPIPE_SET_BPM, /* int */
-    AUDIO_CTLPIPE_DATA_REQUESTED /* pointer, int, int, int */
+    AUDIO_CTLPIPE_DATA_REQUESTED, /* pointer, int, int, int */
+    AUDIO_CTLPIPE_SET_REALTIME /* void */
 } audio_ctlpipe_id;
 
 typedef enum audio_backpipe_id {
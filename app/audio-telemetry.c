@@ -0,0 +1,237 @@
+/*
+ * The Real SoundTracker - audio thread performance telemetry
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "audio-telemetry.h"
+
+#define TELEMETRY_PENDING_EVENTS 32
+
+/* The audio thread accumulates the data privately and merges them into the
+   shared copy only if it can take the mutex without waiting, so it is
+   never blocked by the GUI */
+static telemetry_stats pending;
+static telemetry_event pending_events[TELEMETRY_PENDING_EVENTS];
+static guint num_pending_events = 0;
+static gint reset_requested = 0;
+
+/* Reported by the drivers, picked up by the audio thread */
+static gint xruns_reported = 0;
+/* Used by the audio thread only */
+static guint32 last_render_us = 0;
+
+/* Protected by the mutex */
+static GMutex mutex;
+static telemetry_stats stats;
+static telemetry_event events_log[TELEMETRY_LOG_SIZE];
+static guint log_head = 0, log_len = 0;
+
+static inline gdouble
+telemetry_load(const guint32 render_us,
+    const guint32 deadline_us)
+{
+    return deadline_us ? (gdouble)render_us / deadline_us : 0.0;
+}
+
+static void
+telemetry_add_event(const telemetry_event_type type,
+    const gint64 now,
+    const guint32 render_us,
+    const guint32 deadline_us,
+    const gint songpos,
+    const gint patno,
+    const gint patpos,
+    const gint tick)
+{
+    telemetry_event* e;
+
+    /* The counters are still correct if the log overflows */
+    if (num_pending_events == TELEMETRY_PENDING_EVENTS)
+        return;
+
+    e = &pending_events[num_pending_events++];
+    e->type = type;
+    e->time = now;
+    e->songpos = songpos;
+    e->patno = patno;
+    e->patpos = patpos;
+    e->tick = tick;
+    e->render_us = render_us;
+    e->deadline_us = deadline_us;
+}
+
+static void
+telemetry_merge(void)
+{
+    guint i;
+
+    stats.num_blocks += pending.num_blocks;
+    stats.render_us_total += pending.render_us_total;
+    stats.deadline_us_total += pending.deadline_us_total;
+    stats.last_render_us = pending.last_render_us;
+    stats.last_deadline_us = pending.last_deadline_us;
+    if (telemetry_load(pending.max_render_us, pending.max_deadline_us)
+        > telemetry_load(stats.max_render_us, stats.max_deadline_us)) {
+        stats.max_render_us = pending.max_render_us;
+        stats.max_deadline_us = pending.max_deadline_us;
+    }
+    stats.num_overruns += pending.num_overruns;
+    stats.num_xruns += pending.num_xruns;
+    for (i = 0; i < TELEMETRY_NUM_BUCKETS; i++)
+        stats.histogram[i] += pending.histogram[i];
+
+    for (i = 0; i < num_pending_events; i++) {
+        events_log[log_head] = pending_events[i];
+        log_head = (log_head + 1) % TELEMETRY_LOG_SIZE;
+        if (log_len < TELEMETRY_LOG_SIZE)
+            log_len++;
+    }
+
+    memset(&pending, 0, sizeof(pending));
+    num_pending_events = 0;
+}
+
+void
+audio_telemetry_block(const guint32 render_us,
+    const guint32 deadline_us,
+    const gint songpos,
+    const gint patno,
+    const gint patpos,
+    const gint tick)
+{
+    const gdouble load = telemetry_load(render_us, deadline_us);
+    const gint64 now = g_get_real_time();
+    gint xruns, i;
+
+    if (g_atomic_int_compare_and_exchange(&reset_requested, 1, 0)) {
+        memset(&pending, 0, sizeof(pending));
+        num_pending_events = 0;
+    }
+
+    last_render_us = render_us;
+    pending.num_blocks++;
+    pending.render_us_total += render_us;
+    pending.deadline_us_total += deadline_us;
+    pending.last_render_us = render_us;
+    pending.last_deadline_us = deadline_us;
+    if (load > telemetry_load(pending.max_render_us, pending.max_deadline_us)) {
+        pending.max_render_us = render_us;
+        pending.max_deadline_us = deadline_us;
+    }
+    pending.histogram[MIN((gint)(load / TELEMETRY_BUCKET_WIDTH), TELEMETRY_NUM_BUCKETS - 1)]++;
+
+    if (render_us > deadline_us) {
+        pending.num_overruns++;
+        telemetry_add_event(TELEMETRY_EVENT_OVERRUN, now, render_us, deadline_us,
+            songpos, patno, patpos, tick);
+    }
+
+    do
+        xruns = g_atomic_int_get(&xruns_reported);
+    while (xruns && !g_atomic_int_compare_and_exchange(&xruns_reported, xruns, 0));
+    pending.num_xruns += xruns;
+    for (i = 0; i < xruns; i++)
+        telemetry_add_event(TELEMETRY_EVENT_XRUN, now, render_us, deadline_us,
+            songpos, patno, patpos, tick);
+
+    if (g_mutex_trylock(&mutex)) {
+        telemetry_merge();
+        g_mutex_unlock(&mutex);
+    }
+}
+
+void
+audio_telemetry_xrun(void)
+{
+    g_atomic_int_inc(&xruns_reported);
+}
+
+guint32
+audio_telemetry_last_render_us(void)
+{
+    return last_render_us;
+}
+
+guint
+audio_telemetry_get(telemetry_stats* s,
+    telemetry_event* events)
+{
+    guint i;
+
+    g_mutex_lock(&mutex);
+    *s = stats;
+    for (i = 0; i < log_len; i++)
+        events[i] = events_log[(log_head + TELEMETRY_LOG_SIZE - log_len + i) % TELEMETRY_LOG_SIZE];
+    g_mutex_unlock(&mutex);
+
+    return i;
+}
+
+void
+audio_telemetry_reset(void)
+{
+    g_mutex_lock(&mutex);
+    memset(&stats, 0, sizeof(stats));
+    log_head = log_len = 0;
+    g_atomic_int_set(&reset_requested, 1);
+    g_mutex_unlock(&mutex);
+}
+
+gboolean
+audio_telemetry_dump(FILE* f)
+{
+    telemetry_stats s;
+    telemetry_event* events = g_new(telemetry_event, TELEMETRY_LOG_SIZE);
+    const guint num_events = audio_telemetry_get(&s, events);
+    guint i;
+
+    fprintf(f, "# SoundTracker audio thread telemetry\n\n");
+    fprintf(f, "blocks: %" G_GUINT64_FORMAT "\n", s.num_blocks);
+    fprintf(f, "average load: %.1f%%\n", 100.0 * telemetry_load(s.render_us_total, s.deadline_us_total));
+    fprintf(f, "maximum load: %.1f%% (%u of %u us)\n",
+        100.0 * telemetry_load(s.max_render_us, s.max_deadline_us), s.max_render_us, s.max_deadline_us);
+    fprintf(f, "overruns: %u\n", s.num_overruns);
+    fprintf(f, "driver xruns: %u\n", s.num_xruns);
+
+    fprintf(f, "\n# load histogram\n");
+    for (i = 0; i < TELEMETRY_NUM_BUCKETS; i++) {
+        const gint from = 100.0 * i * TELEMETRY_BUCKET_WIDTH + 0.5;
+
+        if (i < TELEMETRY_NUM_BUCKETS - 1)
+            fprintf(f, "%3d-%3d%%: %u\n", from, (gint)(100.0 * (i + 1) * TELEMETRY_BUCKET_WIDTH + 0.5), s.histogram[i]);
+        else
+            fprintf(f, "   >=%3d%%: %u\n", from, s.histogram[i]);
+    }
+
+    fprintf(f, "\n# events: time, type, order position, pattern, row, tick, render us, deadline us\n");
+    for (i = 0; i < num_events; i++) {
+        const telemetry_event* e = &events[i];
+        const time_t t = e->time / G_USEC_PER_SEC;
+        struct tm tm;
+        gchar buf[32];
+
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+        fprintf(f, "%s.%03d %s %d %d %d %d %u %u\n", buf, (gint)(e->time % G_USEC_PER_SEC / 1000),
+            e->type == TELEMETRY_EVENT_OVERRUN ? "overrun" : "xrun",
+            e->songpos, e->patno, e->patpos, e->tick, e->render_us, e->deadline_us);
+    }
+    g_free(events);
+
+    return !ferror(f);
+}
@@ -0,0 +1,79 @@
+/*
+ * The Real SoundTracker - audio thread performance telemetry (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _AUDIO_TELEMETRY_H
+#define _AUDIO_TELEMETRY_H
+
+#include <stdio.h>
+
+#include <glib.h>
+
+/* Every block requested by the output driver is timed and compared with
+   its deadline, that is the duration of the block. Blocks rendered longer
+   than that (overruns) and the xruns reported by the drivers are logged
+   with the song position at the beginning of the block. */
+
+/* Load histogram in steps of 10%, the last bucket is 200% and more */
+#define TELEMETRY_NUM_BUCKETS 21
+#define TELEMETRY_BUCKET_WIDTH 0.1
+#define TELEMETRY_LOG_SIZE 256
+
+typedef enum {
+    TELEMETRY_EVENT_OVERRUN,
+    TELEMETRY_EVENT_XRUN
+} telemetry_event_type;
+
+typedef struct {
+    telemetry_event_type type;
+    gint64 time; /* Wall clock, microseconds since the Epoch */
+    gint songpos, patno, patpos, tick; /* -1 if the song wasn't playing */
+    guint32 render_us, deadline_us; /* Of the block, the last one for xruns */
+} telemetry_event;
+
+typedef struct {
+    guint64 num_blocks;
+    guint64 render_us_total, deadline_us_total;
+    guint32 last_render_us, last_deadline_us;
+    guint32 max_render_us, max_deadline_us; /* Of the block with the highest load */
+    guint32 num_overruns, num_xruns;
+    guint32 histogram[TELEMETRY_NUM_BUCKETS];
+} telemetry_stats;
+
+/* Called by the audio thread for every block requested by the driver */
+void audio_telemetry_block(const guint32 render_us,
+    const guint32 deadline_us,
+    const gint songpos,
+    const gint patno,
+    const gint patpos,
+    const gint tick);
+/* Can be called by the drivers from any thread, even a realtime one */
+void audio_telemetry_xrun(void);
+/* The render time of the last block, us; for the drivers' commit(), which
+   is called by the audio thread right after the block is rendered */
+guint32 audio_telemetry_last_render_us(void);
+
+/* Copies the statistics and the events in the order of occurrence; the
+   events array must hold TELEMETRY_LOG_SIZE entries. Returns the number of
+   events. */
+guint audio_telemetry_get(telemetry_stats* stats,
+    telemetry_event* events);
+void audio_telemetry_reset(void);
+/* Writes a human-readable report; returns FALSE on write errors */
+gboolean audio_telemetry_dump(FILE* f);
+
+#endif /* _AUDIO_TELEMETRY_H */
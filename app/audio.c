@@ -19,6 +19,7 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#define _GNU_SOURCE /* For CPU affinity */
 #include <config.h>
 
 #include <pthread.h>
@@ -35,19 +36,28 @@
 #ifdef _POSIX_PRIORITY_SCHEDULING
 #include <sched.h>
 #endif
+#ifdef HAVE_MLOCKALL
+#include <sys/mman.h>
+#endif
 
 #include <glib.h>
 #include <glib/gi18n.h>
 
 #include "audio.h"
 #include "audio-subs.h"
+#include "audio-telemetry.h"
+#include "channel-freeze.h"
 #include "driver.h"
-#include "endian-conv.h"
 #include "errors.h"
 #include "event-waiter.h"
+#include "gui.h"
 #include "gui-settings.h"
 #include "gui-subs.h"
+#include "level-meter.h"
 #include "main.h"
+#if defined(DRIVER_ALSA)
+#include "midi.h"
+#endif
 #include "mixer.h"
 #include "poll.h"
 #include "time-buffer.h"
@@ -55,6 +65,7 @@
 #include "xm-player.h"
 
 st_mixer* mixer = NULL;
+void* mixer_object = NULL;
 st_driver* playback_driver = NULL;
 st_driver* editing_driver = NULL;
 st_driver* current_driver = NULL;
@@ -65,13 +76,25 @@ void* file_driver_object = NULL;
 
 gint8 player_mute_channels[32];
 
+/* The player driven by the audio thread */
+static xmplayer* player = NULL;
+/* Speeds up the tracing when the playback starts in the middle of the song */
+static tracer_cache* trace_cache = NULL;
+
 /* Time buffers for Visual<->Audio synchronization */
 
 time_buffer* audio_playerpos_tb;
 time_buffer* audio_clipping_indicator_tb;
+time_buffer* audio_levels_tb;
 time_buffer* audio_mixer_position_tb;
 time_buffer* audio_channels_status_tb;
 
+/* MIDI input; the events taken from the queue for the current block */
+time_buffer* audio_midi_tb;
+static gint audio_midi_active = FALSE;
+static audio_midi_event audio_midi_events[256];
+static guint audio_midi_num_events;
+
 static guint32 audio_visual_feedback_counter;
 static guint32 audio_visual_feedback_clipping;
 static guint32 audio_visual_feedback_update_interval = 2000; // just a dummy value
@@ -79,6 +102,18 @@ static guint32 audio_visual_feedback_update_interval = 2000; // just a dummy val
 static const guint audio_visual_feedback_updates_per_second = 50;
 static const guint audio_visual_feedback_smear_clipping = 3; // keep clipflag on for how long
 
+/* Level meters; they are fed with every mixed block and published together
+   with the other visual feedback */
+static loudness_meter* audio_loudness;
+static gint audio_loudness_rate, audio_loudness_channels;
+static float audio_levels_sum_sq[32], audio_levels_peak[32];
+static guint32 audio_levels_num_samples;
+
+/* Frozen channels follow the song position; they are played live after
+   tempo changes from outside the song until the playback is restarted */
+static gint audio_freeze_songpos;
+static gboolean audio_freeze_suspended;
+
 /* Event waiters */
 
 event_waiter* audio_songpos_ew;
@@ -91,6 +126,13 @@ static int confirm_tempo = 0, confirm_bpm = 0;
 /* Internal variables */
 
 static int nice_value = 0;
+
+/* Realtime mode; the requested settings are applied by the audio thread
+   itself, render workers check the generation before every job */
+static audio_realtime_settings rt_requested;
+static gint rt_generation = 0, rt_applied_generation = 0;
+static GMutex rt_mutex;
+static gboolean rt_active = FALSE, rt_locked = FALSE;
 static int ctlpipe;
 static pthread_t threadid;
 
@@ -99,7 +141,7 @@ static gboolean playing_noloop;
 
 // --- for audio_mix() "main loop":
 
-static int mixfmt_req, mixfmt, mixfmt_conv;
+static int mixfmt_req;
 static int mixfreq_req;
 static int audio_numchannels;
 static float audio_ampfactor_f = 0.25;
@@ -114,17 +156,197 @@ static guint prev_bufsize = 0;
 // Hardcoded, should be changed while implementing the virtual channels support
 static st_mixer_buffer chan_buffers[64] = {{NULL, 0}};
 static void* mix_buffer = NULL;
+static float* meter_buffer = NULL;
 static gboolean clipflag = FALSE;
 
-#define MIXFMT_16 1
-#define MIXFMT_STEREO 2
+/* Conversion from the mix bus straight into the driver's buffer. The bus
+   holds either int or float values which are multiplied by the gain,
+   clipped to 16-bit range, down- or upmixed if the mixer can't provide the
+   required number of channels and stored in the driver's sample format all
+   in one pass. The converters are generated for each (bus format, channel
+   mode, output format) combination. Their loops are branch-free and use
+   only float arithmetic for the gain, so that the compiler vectorizes them;
+   GCC doesn't do it at -O2 unless asked explicitly. They return TRUE if
+   clipping has occured. */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define MIX_VECTORIZE __attribute__((optimize("tree-vectorize")))
+#else
+#define MIX_VECTORIZE
+#endif
+
+typedef gboolean (*mix_convert_func)(void* restrict dest,
+    const void* restrict src,
+    const guint32 count,
+    const float gain);
+
+enum {
+    MIX_MODE_DIRECT_MONO = 0,
+    MIX_MODE_DIRECT_STEREO,
+    MIX_MODE_DOWNMIX,
+    MIX_MODE_UPMIX,
+    MIX_MODE_LAST
+};
+
+enum {
+    MIX_DST_S16 = 0,
+    MIX_DST_S16_SWAPPED,
+    MIX_DST_U16,
+    MIX_DST_U16_SWAPPED,
+    MIX_DST_S8,
+    MIX_DST_U8,
+    MIX_DST_LAST
+};
+
+#define MIX_GET(v, s) { \
+        const float _a = (float)(s) * gain; \
+        const float _b = CLAMP(_a, -32768.0f, 32767.0f); \
+        clip |= (_a != _b); \
+        v = (gint32)_b; \
+    }
 
-#define MIXFMT_CONV_TO_16 1
-#define MIXFMT_CONV_TO_8 2
-#define MIXFMT_CONV_TO_UNSIGNED 4
-#define MIXFMT_CONV_TO_STEREO 8
-#define MIXFMT_CONV_TO_MONO 16
-#define MIXFMT_CONV_BYTESWAP 32
+#define MIX_PUT_S16(d, v) (d) = (gint16)(v)
+#define MIX_PUT_S16_SWAPPED(d, v) (d) = GUINT16_SWAP_LE_BE((guint16)(v))
+#define MIX_PUT_U16(d, v) (d) = (guint16)((v) + 32768)
+#define MIX_PUT_U16_SWAPPED(d, v) (d) = GUINT16_SWAP_LE_BE((guint16)((v) + 32768))
+#define MIX_PUT_S8(d, v) (d) = (gint8)((v) >> 8)
+#define MIX_PUT_U8(d, v) (d) = (guint8)(((v) >> 8) + 128)
+
+#define MIX_LOOP_DIRECT_MONO(GET, PUT) \
+    for (i = 0; i < count; i++) { \
+        gint32 v; \
+        GET(v, s[i]); \
+        PUT(d[i], v); \
+    }
+
+#define MIX_LOOP_DIRECT_STEREO(GET, PUT) \
+    for (i = 0; i < count << 1; i++) { \
+        gint32 v; \
+        GET(v, s[i]); \
+        PUT(d[i], v); \
+    }
+
+#define MIX_LOOP_DOWNMIX(GET, PUT) \
+    for (i = 0; i < count; i++) { \
+        gint32 l, r; \
+        GET(l, s[i << 1]); \
+        GET(r, s[(i << 1) + 1]); \
+        PUT(d[i], (l + r) / 2); \
+    }
+
+#define MIX_LOOP_UPMIX(GET, PUT) \
+    for (i = 0; i < count; i++) { \
+        gint32 v; \
+        GET(v, s[i]); \
+        PUT(d[i << 1], v); \
+        PUT(d[(i << 1) + 1], v); \
+    }
+
+#define MIX_CONVERT_FUNC(src, src_t, mode, dst, dst_t) \
+    static MIX_VECTORIZE gboolean \
+    mix_convert_##src##_##mode##_##dst(void* restrict dest, \
+        const void* restrict source, \
+        const guint32 count, \
+        const float gain) \
+    { \
+        const src_t* restrict s = source; \
+        dst_t* restrict d = dest; \
+        guint32 i; \
+        gint clip = 0; \
+\
+        MIX_LOOP_##mode(MIX_GET, MIX_PUT_##dst) \
+        return clip != 0; \
+    }
+
+#define MIX_CONVERT_FUNCS(src, src_t, mode) \
+    MIX_CONVERT_FUNC(src, src_t, mode, S16, gint16) \
+    MIX_CONVERT_FUNC(src, src_t, mode, S16_SWAPPED, guint16) \
+    MIX_CONVERT_FUNC(src, src_t, mode, U16, guint16) \
+    MIX_CONVERT_FUNC(src, src_t, mode, U16_SWAPPED, guint16) \
+    MIX_CONVERT_FUNC(src, src_t, mode, S8, gint8) \
+    MIX_CONVERT_FUNC(src, src_t, mode, U8, guint8)
+
+#define MIX_CONVERT_ROW(src, mode) { \
+        mix_convert_##src##_##mode##_S16, \
+        mix_convert_##src##_##mode##_S16_SWAPPED, \
+        mix_convert_##src##_##mode##_U16, \
+        mix_convert_##src##_##mode##_U16_SWAPPED, \
+        mix_convert_##src##_##mode##_S8, \
+        mix_convert_##src##_##mode##_U8 \
+    }
+
+MIX_CONVERT_FUNCS(INT, gint32, DIRECT_MONO)
+MIX_CONVERT_FUNCS(INT, gint32, DIRECT_STEREO)
+MIX_CONVERT_FUNCS(INT, gint32, DOWNMIX)
+MIX_CONVERT_FUNCS(INT, gint32, UPMIX)
+MIX_CONVERT_FUNCS(FLOAT, float, DIRECT_MONO)
+MIX_CONVERT_FUNCS(FLOAT, float, DIRECT_STEREO)
+MIX_CONVERT_FUNCS(FLOAT, float, DOWNMIX)
+MIX_CONVERT_FUNCS(FLOAT, float, UPMIX)
+
+static const mix_convert_func mix_convert_funcs[ST_MIXER_BUFFER_FORMAT_LAST][MIX_MODE_LAST][MIX_DST_LAST] = {
+    [ST_MIXER_BUFFER_FORMAT_INT] = {
+        MIX_CONVERT_ROW(INT, DIRECT_MONO),
+        MIX_CONVERT_ROW(INT, DIRECT_STEREO),
+        MIX_CONVERT_ROW(INT, DOWNMIX),
+        MIX_CONVERT_ROW(INT, UPMIX)
+    },
+    [ST_MIXER_BUFFER_FORMAT_FLOAT] = {
+        MIX_CONVERT_ROW(FLOAT, DIRECT_MONO),
+        MIX_CONVERT_ROW(FLOAT, DIRECT_STEREO),
+        MIX_CONVERT_ROW(FLOAT, DOWNMIX),
+        MIX_CONVERT_ROW(FLOAT, UPMIX)
+    }
+};
+
+/* Conversion parameters of a mix bus for the given mixer and output format */
+typedef struct {
+    mix_convert_func convert;
+    gint dst;
+    gboolean bus_stereo;
+    gsize frame_size;
+} mix_format;
+
+static mix_format mix_fmt = { NULL };
+
+/* Offline rendering. The player runs sequentially, and its requests to the
+   mixer are recorded per channel together with the lengths of the blocks
+   rendered between them. Then the channels are rendered over the whole
+   window concurrently and summed in the same order as mix() does, so the
+   result is bit-identical to one of the sequential rendering. */
+
+typedef enum {
+    RENDER_EVENT_STARTNOTE = 0,
+    RENDER_EVENT_STOPNOTE,
+    RENDER_EVENT_SMPLPOS,
+    RENDER_EVENT_SMPLEND,
+    RENDER_EVENT_FREQ,
+    RENDER_EVENT_VOLUME,
+    RENDER_EVENT_PANNING,
+    RENDER_EVENT_CUTOFF,
+    RENDER_EVENT_RESO
+} render_event_type;
+
+typedef struct {
+    guint block; /* The event takes place before this block is rendered */
+    render_event_type type;
+    union {
+        st_mixer_sample_info* si;
+        guint32 offset;
+        float value;
+    } arg;
+} render_event;
+
+static gboolean render_recording = FALSE;
+static GArray* render_blocks = NULL; /* Lengths of the blocks, guint32 */
+static GArray* render_events[32];
+static st_mixer_buffer render_buffers[32];
+static void* render_data[32];
+static gsize render_data_size = 0;
+static GThreadPool* render_pool = NULL;
+static GMutex render_mutex;
+static GCond render_cond;
+static gint render_pending;
 
 /* Oscilloscope buffers */
 
@@ -136,26 +358,202 @@ gboolean scopebuf_ready;
 
 void audio_prepare_for_playing(void);
 
+/* Returns 0 or errno. Empty mask means all the CPUs. */
+static gint
+rt_set_affinity(const guint64 mask)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t set;
+    gint i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < MIN(64, CPU_SETSIZE); i++)
+        if (!mask || mask & (G_GUINT64_CONSTANT(1) << i))
+            CPU_SET(i, &set);
+
+    /* Pid 0 is the calling thread */
+    return sched_setaffinity(0, sizeof(set), &set) ? errno : 0;
+#else
+    return mask ? ENOSYS : 0;
+#endif
+}
+
 static void
-audio_raise_priority(void)
+rt_report(GString* failed,
+    const gchar* what,
+    const gint err)
 {
-// The RT code tends to crash my kernel :-(
-#if defined(_POSIX_PRIORITY_SCHEDULING) && 0
-    struct sched_param sp;
-    sp.sched_priority = 40;
+    g_string_append_printf(failed, "\n%s: %s", what, g_strerror(err));
+}
 
-    if (sched_setscheduler(0, SCHED_FIFO, &sp) == 0) {
-        printf(">> running as realtime process now\n");
-    } else {
-        fprintf(stderr, "WARNING: Can't get realtime priority (try running as root)!\n");
+/* Touches the stack the audio thread can use, so that it doesn't get page
+   faults later */
+static void
+rt_prefault_stack(void)
+{
+    volatile guint8 dummy[256 * 1024];
+    gsize i;
+
+    for (i = 0; i < sizeof(dummy); i += 4096)
+        dummy[i] = 0;
+}
+
+static void
+audio_realtime_enter(const audio_realtime_settings* s)
+{
+    GString* failed = g_string_new(NULL);
+    gint err;
+
+#ifdef _POSIX_PRIORITY_SCHEDULING
+    {
+        const int policy = s->round_robin ? SCHED_RR : SCHED_FIFO;
+        struct sched_param sp;
+
+        sp.sched_priority = CLAMP(s->priority,
+            sched_get_priority_min(policy), sched_get_priority_max(policy));
+        if ((err = pthread_setschedparam(pthread_self(), policy, &sp)))
+            rt_report(failed, s->round_robin ? _("SCHED_RR scheduling") : _("SCHED_FIFO scheduling"), err);
     }
 #else
-    if (nice_value == 0) {
+    rt_report(failed, _("Realtime scheduling"), ENOSYS);
+#endif
+
+    /* With MCL_FUTURE the buffers allocated later, the sample data of the
+       modules loaded afterwards including, are locked and faulted in on
+       allocation as well */
+    if (s->lock_memory) {
+#ifdef HAVE_MLOCKALL
+        if (mlockall(MCL_CURRENT | MCL_FUTURE))
+            rt_report(failed, _("Memory locking"), errno);
+        else {
+            rt_locked = TRUE;
+            rt_prefault_stack();
+        }
+#else
+        rt_report(failed, _("Memory locking"), ENOSYS);
+#endif
+    } else if (rt_locked) {
+#ifdef HAVE_MLOCKALL
+        munlockall();
+#endif
+        rt_locked = FALSE;
+    }
+
+    if ((err = rt_set_affinity(s->audio_cpus)))
+        rt_report(failed, _("Audio thread CPU affinity"), err);
+#ifndef HAVE_SCHED_SETAFFINITY
+    if (s->worker_cpus)
+        rt_report(failed, _("Rendering threads CPU affinity"), ENOSYS);
+#endif
+
+    rt_active = TRUE;
+    if (failed->len) {
+        gchar* msg = g_strdup_printf(_("The realtime mode of the audio thread is active only partially. "
+                                       "The following couldn't be obtained:\n%s"), failed->str);
+
+        error_warning(msg);
+        g_free(msg);
+    }
+    g_string_free(failed, TRUE);
+}
+
+static void
+audio_realtime_leave(void)
+{
+#ifdef _POSIX_PRIORITY_SCHEDULING
+    struct sched_param sp;
+
+    sp.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+#endif
+#ifdef HAVE_MLOCKALL
+    if (rt_locked)
+        munlockall();
+#endif
+    rt_locked = FALSE;
+    rt_set_affinity(0);
+    rt_active = FALSE;
+}
+
+void
+audio_realtime_raise_thread(void)
+{
+#ifdef _POSIX_PRIORITY_SCHEDULING
+    audio_realtime_settings s;
+
+    g_mutex_lock(&rt_mutex);
+    s = rt_requested;
+    g_mutex_unlock(&rt_mutex);
+
+    if (s.enabled) {
+        const int policy = s.round_robin ? SCHED_RR : SCHED_FIFO;
+        struct sched_param sp;
+        gint err;
+
+        sp.sched_priority = CLAMP(s.priority - 1,
+            sched_get_priority_min(policy), sched_get_priority_max(policy));
+        if ((err = pthread_setschedparam(pthread_self(), policy, &sp)))
+            g_warning("Can't set realtime scheduling of the thread: %s", g_strerror(err));
+    }
+#endif
+}
+
+static void
+audio_raise_priority(void)
+{
+    audio_realtime_settings s;
+    gint gen;
+
+    g_mutex_lock(&rt_mutex);
+    s = rt_requested;
+    gen = rt_generation;
+    g_mutex_unlock(&rt_mutex);
+
+    if (gen != rt_applied_generation) {
+        rt_applied_generation = gen;
+        if (s.enabled)
+            audio_realtime_enter(&s);
+        else if (rt_active)
+            audio_realtime_leave();
+    }
+
+    if (!rt_active && nice_value == 0) {
         if (!nice(-14)) {
             nice_value = -14;
         }
     }
-#endif
+}
+
+void
+audio_set_realtime(const audio_realtime_settings* s)
+{
+    g_mutex_lock(&rt_mutex);
+    rt_requested = *s;
+    rt_generation++;
+    g_mutex_unlock(&rt_mutex);
+
+    audio_ctlpipe_write(AUDIO_CTLPIPE_SET_REALTIME);
+}
+
+void
+audio_realtime_pin_worker(void)
+{
+    static GPrivate applied = G_PRIVATE_INIT(NULL);
+    guint64 mask;
+    gint gen, err;
+
+    g_mutex_lock(&rt_mutex);
+    gen = rt_generation;
+    mask = rt_requested.enabled ? rt_requested.worker_cpus : 0;
+    g_mutex_unlock(&rt_mutex);
+
+    /* The generation is stored incremented to tell it from unset */
+    if (GPOINTER_TO_INT(g_private_get(&applied)) == gen + 1)
+        return;
+    g_private_set(&applied, GINT_TO_POINTER(gen + 1));
+
+    if ((err = rt_set_affinity(mask)))
+        g_warning("Can't set CPU affinity of the rendering thread: %s", g_strerror(err));
 }
 
 static void
@@ -163,7 +561,8 @@ audio_ctlpipe_init_player(void)
 {
     g_assert(xm != NULL);
 
-    xmplayer_init_module();
+    xmplayer_init_module(player, xm);
+    tracer_cache_clear(trace_cache);
 }
 
 static gboolean
@@ -195,21 +594,23 @@ audio_ctlpipe_play_song(int songpos,
     playing_noloop = !looped;
 
     if (gui_settings.permanent_channels) { /* Tracing only if really needed */
-        xmplayer_init_play_song(0, 0, TRUE);
+        xmplayer_init_play_song(player, 0, 0, TRUE);
 
         if (songpos > 0 || patpos > 0) { /* Tracing! */
             int i;
+            void* tracer = tracer_new();
 
-            tracer_setnumch(audio_numchannels);
-            tracer_trace(playback_driver->get_play_rate(playback_driver_object), songpos, patpos);
-            xmplayer_init_play_song(songpos, patpos, FALSE);
+            tracer_setnumch(tracer, audio_numchannels);
+            tracer_trace(player, tracer, trace_cache, playback_driver->get_play_rate(playback_driver_object), songpos, patpos);
+            xmplayer_init_play_song(player, songpos, patpos, FALSE);
 
             for (i = 0; i < audio_numchannels; i++)
                 if (gui_settings.permanent_channels & (1 << i))
-                    mixer->loadchsettings(i);
+                    mixer->loadchsettings(mixer_object, i, tracer);
+            tracer_destroy(tracer);
         }
     } else {
-        xmplayer_init_play_song(songpos, patpos, TRUE);
+        xmplayer_init_play_song(player, songpos, patpos, TRUE);
     }
 
     /* When driver is opened, xmplayer can already be called. So all initialzation
@@ -234,19 +635,30 @@ audio_prepare_for_rendering(audio_render_target target,
 
     audio_prepare_for_playing();
     playing_noloop = TRUE;
-    if (target == AUDIO_RENDER_SONG)
-        xmplayer_init_play_song(0, 0, TRUE);
-    else
-        xmplayer_init_play_pattern(pattern, patpos, FALSE, stoppos, ch_start, num_ch);
+    if (target == AUDIO_RENDER_SONG) {
+        /* The module could have been changed without the player being notified */
+        xmplayer_init_module(player, xm);
+        xmplayer_init_play_song(player, pattern, patpos, TRUE);
+        if (stoppos >= 0)
+            xmplayer_set_song_end(player, stoppos);
+    } else
+        xmplayer_init_play_pattern(player, pattern, patpos, FALSE, stoppos, ch_start, num_ch);
 }
 
 void
 audio_cleanup_after_rendering(void)
 {
-    xmplayer_stop();
+    xmplayer_stop(player);
     playing = 0;
 }
 
+void
+audio_validate_trace_cache(void)
+{
+    if (xm)
+        tracer_cache_validate(trace_cache, xm);
+}
+
 static void
 audio_ctlpipe_play_pattern(int pattern,
     int patpos,
@@ -266,7 +678,7 @@ audio_ctlpipe_play_pattern(int pattern,
     if (only1row) {
         if (DRIVER_OPEN(editing)) {
             audio_prepare_for_playing();
-            xmplayer_init_play_pattern(pattern, patpos, only1row, -1, -1, -1);
+            xmplayer_init_play_pattern(player, pattern, patpos, only1row, -1, -1, -1);
             a = AUDIO_BACKPIPE_PLAYING_NOTE_STARTED;
         } else {
             a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
@@ -275,7 +687,7 @@ audio_ctlpipe_play_pattern(int pattern,
         if (DRIVER_OPEN(playback)) {
             audio_prepare_for_playing();
             playing_noloop = !looped;
-            xmplayer_init_play_pattern(pattern, patpos, only1row, stoppos, ch_start, num_ch);
+            xmplayer_init_play_pattern(player, pattern, patpos, only1row, stoppos, ch_start, num_ch);
             a = AUDIO_BACKPIPE_PLAYING_PATTERN_STARTED;
         } else {
             a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
@@ -305,7 +717,7 @@ audio_ctlpipe_play_note(int channel,
     if (!playing)
         return;
 
-    xmplayer_play_note(channel, note, instrument, all);
+    xmplayer_play_note(player, channel, note, instrument, all);
 }
 
 static void
@@ -332,7 +744,7 @@ audio_ctlpipe_play_note_full(int channel,
     if (!playing)
         return;
 
-    xmplayer_play_note_full(channel, note, sample, offset, playend, all, inst, smpl);
+    xmplayer_play_note_full(player, channel, note, sample, offset, playend, all, inst, smpl);
 }
 
 static void
@@ -341,7 +753,7 @@ audio_ctlpipe_play_note_keyoff(int channel)
     if (!playing)
         return;
 
-    xmplayer_play_note_keyoff(channel);
+    xmplayer_play_note_keyoff(player, channel);
 }
 
 static void
@@ -350,7 +762,7 @@ audio_ctlpipe_stop_note(int channel)
     if (!playing)
         return;
 
-    xmplayer_stop_note(channel);
+    xmplayer_stop_note(player, channel);
 }
 
 static void
@@ -361,9 +773,10 @@ audio_ctlpipe_stop_playing(void)
             current_driver->release(current_driver_object);
             current_driver = NULL;
         }
-        xmplayer_stop();
+        xmplayer_stop(player);
         current_driver_object = NULL;
         playing = 0;
+        g_atomic_int_set(&audio_midi_active, FALSE);
     }
 
     if (set_songpos_wait_for != -1) {
@@ -376,10 +789,77 @@ audio_ctlpipe_stop_playing(void)
     audio_raise_priority();
 }
 
+gboolean
+audio_midi_accepting(void)
+{
+    return g_atomic_int_get(&audio_midi_active);
+}
+
+static void
+audio_midi_collect(gpointer data,
+    gpointer user_data)
+{
+    /* Can't overflow, the array is as long as the queue */
+    audio_midi_events[audio_midi_num_events++] = *(audio_midi_event*)data;
+}
+
+/* The block represents the interval of the same length just before the
+   data request, the MIDI events are applied at their positions in it */
+static void
+audio_mix_midi(void* sndbuf, int fragsize, int mixfreq, int format, gint64 now)
+{
+    const double end = (double)now / G_USEC_PER_SEC;
+    gint8* buf = sndbuf;
+    gint done = 0;
+    guint i;
+
+    audio_midi_num_events = 0;
+    if (playing) {
+        time_buffer_foreach(audio_midi_tb, end, audio_midi_collect, NULL);
+        if (!g_atomic_int_get(&audio_midi_active)) {
+            /* Stale ones, queued before the previous stop */
+            audio_midi_num_events = 0;
+            g_atomic_int_set(&audio_midi_active, TRUE);
+        }
+    }
+
+    for (i = 0; i < audio_midi_num_events; i++) {
+        const audio_midi_event* e = &audio_midi_events[i];
+        gint offset = mixfreq > 0 ? fragsize + lrint((e->time - end) * mixfreq) : 0;
+
+        offset = CLAMP(offset, done, fragsize);
+        if (offset > done) {
+            audio_mix(buf, offset - done, mixfreq, format, TRUE, NULL);
+            buf += (offset - done) * mix_fmt.frame_size;
+            done = offset;
+        }
+
+        switch (e->type) {
+        case AUDIO_MIDI_NOTE:
+            xmplayer_play_note(player, e->channel, e->note, e->instrument, FALSE);
+            break;
+        case AUDIO_MIDI_KEYOFF:
+            xmplayer_play_note_keyoff(player, e->channel);
+            break;
+        }
+    }
+
+    if (fragsize > done)
+        audio_mix(buf, fragsize - done, mixfreq, format, TRUE, NULL);
+}
+
 static void
 audio_ctlpipe_mix(void* sndbuf, int fragsize, int mixfreq, int format)
 {
-    audio_mix(sndbuf, fragsize, mixfreq, format, TRUE, NULL);
+    const gint64 start = g_get_monotonic_time();
+    /* The position the block starts at */
+    const gint songpos = playing ? player->songpos : -1, patno = playing ? player->patno : -1;
+    const gint patpos = playing ? player->patpos : -1, tick = playing ? player->curtick : -1;
+
+    audio_mix_midi(sndbuf, fragsize, mixfreq, format, start);
+    if (mixfreq > 0)
+        audio_telemetry_block(g_get_monotonic_time() - start, (gint64)fragsize * G_USEC_PER_SEC / mixfreq,
+            songpos, patno, patpos, tick);
     if (current_driver && current_driver->commit)
         current_driver->commit(current_driver_object);
 }
@@ -389,7 +869,7 @@ audio_ctlpipe_set_songpos(int songpos)
 {
     g_assert(playing);
 
-    xmplayer_set_songpos(songpos);
+    xmplayer_set_songpos(player, songpos);
     if (set_songpos_wait_for != -1) {
         /* confirm previous request */
         event_waiter_confirm(audio_songpos_ew, 0.0);
@@ -400,7 +880,8 @@ audio_ctlpipe_set_songpos(int songpos)
 static void
 audio_ctlpipe_set_tempo(int tempo)
 {
-    xmplayer_set_tempo(tempo);
+    audio_freeze_suspended = TRUE;
+    xmplayer_set_tempo(player, tempo);
     if (confirm_tempo != 0) {
         /* confirm previous request */
         event_waiter_confirm(audio_tempo_ew, 0.0);
@@ -411,7 +892,8 @@ audio_ctlpipe_set_tempo(int tempo)
 static void
 audio_ctlpipe_set_bpm(int bpm)
 {
-    xmplayer_set_bpm(bpm);
+    audio_freeze_suspended = TRUE;
+    xmplayer_set_bpm(player, bpm);
     if (confirm_bpm != 0) {
         /* confirm previous request */
         event_waiter_confirm(audio_bpm_ew, 0.0);
@@ -424,7 +906,7 @@ audio_ctlpipe_set_pattern(int pattern)
 {
     g_assert(playing);
 
-    xmplayer_set_pattern(pattern);
+    xmplayer_set_pattern(player, pattern);
 }
 
 void
@@ -537,11 +1019,21 @@ audio_thread(void)
             break;
         case AUDIO_CTLPIPE_SET_MIXER:
             result = (read(ctlpipe, &b, sizeof(b)) != sizeof(b));
-            mixer = b;
+            if (b != mixer) {
+                void* old_object = mixer_object;
+                st_mixer* old_mixer = mixer;
+
+                mixer_object = ((st_mixer*)b)->new();
+                mixer = b;
+                player->mixer = mixer;
+                player->mixer_object = mixer_object;
+                if (old_mixer)
+                    old_mixer->destroy(old_object);
+            }
             if (playing) {
-                mixer->reset();
+                mixer->reset(mixer_object);
                 mixfmt_req = -666;
-                mixer->setnumch(audio_numchannels);
+                mixer->setnumch(mixer_object, audio_numchannels);
             }
             prev_bufsize = 0; /* To force buffers reallocation */
             break;
@@ -553,6 +1045,9 @@ audio_thread(void)
             readpipe(ctlpipe, a, 1 * sizeof(a[0]));
             audio_ctlpipe_set_bpm(a[0]);
             break;
+        case AUDIO_CTLPIPE_SET_REALTIME:
+            audio_raise_priority();
+            break;
         case AUDIO_CTLPIPE_DATA_REQUESTED:
             readpipe(ctlpipe, &b, sizeof(b));
             readpipe(ctlpipe, a, 3 * sizeof(a[0]));
@@ -585,13 +1080,20 @@ audio_init(void)
 
     memset(player_mute_channels, 0, sizeof(player_mute_channels));
 
-    if (!(audio_playerpos_tb = time_buffer_new()))
+    /* Capacities are chosen to hold a few seconds of the output latency at
+       the highest BPM and feedback rates */
+    if (!(audio_playerpos_tb = time_buffer_new(sizeof(audio_player_pos), 1024)))
+        return FALSE;
+    if (!(audio_clipping_indicator_tb = time_buffer_new(sizeof(audio_clipping_indicator), 256)))
         return FALSE;
-    if (!(audio_clipping_indicator_tb = time_buffer_new()))
+    if (!(audio_levels_tb = time_buffer_new(sizeof(audio_levels), 256)))
         return FALSE;
-    if (!(audio_mixer_position_tb = time_buffer_new()))
+    audio_loudness = loudness_meter_new();
+    if (!(audio_mixer_position_tb = time_buffer_new(sizeof(audio_mixer_position), 256)))
         return FALSE;
-    if (!(audio_channels_status_tb = time_buffer_new()))
+    if (!(audio_channels_status_tb = time_buffer_new(sizeof(audio_channel_status), 4096)))
+        return FALSE;
+    if (!(audio_midi_tb = time_buffer_new(sizeof(audio_midi_event), G_N_ELEMENTS(audio_midi_events))))
         return FALSE;
     if (!(audio_songpos_ew = event_waiter_new()))
         return FALSE;
@@ -599,6 +1101,9 @@ audio_init(void)
         return FALSE;
     if (!(audio_bpm_ew = event_waiter_new()))
         return FALSE;
+    player = xmplayer_new(xm, mixer, mixer_object);
+    player->live = TRUE;
+    trace_cache = tracer_cache_new();
 
     if (0 == pthread_create(&threadid, NULL, (void* (*)(void*))audio_thread, NULL))
         return TRUE;
@@ -606,82 +1111,110 @@ audio_init(void)
     return FALSE;
 }
 
+void audio_init_mixer(st_mixer* newmixer)
+{
+    g_assert(mixer == NULL);
+
+    mixer = newmixer;
+    mixer_object = mixer->new();
+    player->mixer = mixer;
+    player->mixer_object = mixer_object;
+}
+
 void audio_set_mixer(st_mixer* newmixer)
 {
     audio_ctlpipe_write(AUDIO_CTLPIPE_SET_MIXER, newmixer);
 }
 
 static void
-mixer_mix_format(STMixerFormat m, int s)
+mixer_mix_format(mix_format* f,
+    st_mixer* mx,
+    void* mx_object,
+    STMixerFormat m,
+    int s)
 {
-    g_assert(mixer != NULL);
+    gint mode;
+
+    g_assert(mx != NULL);
 
-    mixfmt_conv = 0;
-    mixfmt = 0;
+    /* The bus always holds values of 16-bit range, 8-bit output is
+       obtained by the converter */
+    if (!mx->setmixformat(mx_object, 16))
+        g_error("Weird mixer. No 16 bits mode.\n");
 
     switch (m) {
-    case ST_MIXER_FORMAT_S16_BE:
     case ST_MIXER_FORMAT_S16_LE:
-    case ST_MIXER_FORMAT_U16_BE:
+#ifdef WORDS_BIGENDIAN
+        f->dst = MIX_DST_S16_SWAPPED;
+#else
+        f->dst = MIX_DST_S16;
+#endif
+        break;
+    case ST_MIXER_FORMAT_S16_BE:
+#ifdef WORDS_BIGENDIAN
+        f->dst = MIX_DST_S16;
+#else
+        f->dst = MIX_DST_S16_SWAPPED;
+#endif
+        break;
     case ST_MIXER_FORMAT_U16_LE:
-        if (mixer->setmixformat(16)) {
-            mixfmt = MIXFMT_16;
-        } else if (mixer->setmixformat(8)) {
-            mixfmt_conv |= MIXFMT_CONV_TO_16;
-        } else {
-            g_error("Weird mixer. No 8 or 16 bits modes.\n");
-        }
+#ifdef WORDS_BIGENDIAN
+        f->dst = MIX_DST_U16_SWAPPED;
+#else
+        f->dst = MIX_DST_U16;
+#endif
+        break;
+    case ST_MIXER_FORMAT_U16_BE:
+#ifdef WORDS_BIGENDIAN
+        f->dst = MIX_DST_U16;
+#else
+        f->dst = MIX_DST_U16_SWAPPED;
+#endif
         break;
     case ST_MIXER_FORMAT_S8:
+        f->dst = MIX_DST_S8;
+        break;
     case ST_MIXER_FORMAT_U8:
-        if (mixer->setmixformat(8)) {
-        } else if (mixer->setmixformat(16)) {
-            mixfmt = MIXFMT_16;
-            mixfmt_conv |= MIXFMT_CONV_TO_8;
-        } else {
-            g_error("Weird mixer. No 8 or 16 bits modes.\n");
-        }
+        f->dst = MIX_DST_U8;
         break;
     default:
         g_error("Unknown argument for STMixerFormat.\n");
         break;
     }
 
-    if (mixfmt & MIXFMT_16) {
-        switch (m) {
-#ifdef WORDS_BIGENDIAN
-        case ST_MIXER_FORMAT_S16_LE:
-        case ST_MIXER_FORMAT_U16_LE:
-#else
-        case ST_MIXER_FORMAT_S16_BE:
-        case ST_MIXER_FORMAT_U16_BE:
-#endif
-            mixfmt_conv |= MIXFMT_CONV_BYTESWAP;
-            break;
-        default:
-            break;
-        }
-    }
+    mode = s ? MIX_MODE_DIRECT_STEREO : MIX_MODE_DIRECT_MONO;
+    if (!mx->setstereo(mx_object, s))
+        mode = s ? MIX_MODE_UPMIX : MIX_MODE_DOWNMIX;
+    f->bus_stereo = (mode == MIX_MODE_DIRECT_STEREO || mode == MIX_MODE_DOWNMIX);
 
-    switch (m) {
-    case ST_MIXER_FORMAT_U16_LE:
-    case ST_MIXER_FORMAT_U16_BE:
-    case ST_MIXER_FORMAT_U8:
-        mixfmt_conv |= MIXFMT_CONV_TO_UNSIGNED;
+    f->convert = mix_convert_funcs[mx->buffer_format][mode][f->dst];
+    f->frame_size = mixer_get_resolution(m) << (s ? 1 : 0);
+}
+
+/* Fills the output buffer with silence of the driver's format */
+static void*
+mix_silence(void* dest, const guint32 count)
+{
+    guint32 i, num_samples = count * mix_fmt.frame_size;
+
+    switch (mix_fmt.dst) {
+    case MIX_DST_U16:
+        for (i = 0; i < num_samples >> 1; i++)
+            MIX_PUT_U16(((guint16*)dest)[i], 0);
+        break;
+    case MIX_DST_U16_SWAPPED:
+        for (i = 0; i < num_samples >> 1; i++)
+            MIX_PUT_U16_SWAPPED(((guint16*)dest)[i], 0);
+        break;
+    case MIX_DST_U8:
+        memset(dest, 0x80, num_samples);
         break;
     default:
+        memset(dest, 0, num_samples);
         break;
     }
 
-    mixfmt |= s ? MIXFMT_STEREO : 0;
-    if (!mixer->setstereo(s)) {
-        if (s) {
-            mixfmt &= ~MIXFMT_STEREO;
-            mixfmt_conv |= MIXFMT_CONV_TO_STEREO;
-        } else {
-            mixfmt_conv |= MIXFMT_CONV_TO_MONO;
-        }
-    }
+    return dest + count * mix_fmt.frame_size;
 }
 
 void audio_prepare_for_playing(void)
@@ -690,7 +1223,7 @@ void audio_prepare_for_playing(void)
 
     g_assert(mixer != NULL);
 
-    mixer->reset();
+    mixer->reset(mixer_object);
     mixfmt_req = -666;
     pitchbend = pitchbend_req;
 
@@ -706,10 +1239,18 @@ void audio_prepare_for_playing(void)
 
     time_buffer_clear(audio_playerpos_tb);
     time_buffer_clear(audio_clipping_indicator_tb);
+    time_buffer_clear(audio_levels_tb);
     time_buffer_clear(audio_mixer_position_tb);
     time_buffer_clear(audio_channels_status_tb);
     audio_visual_feedback_counter = audio_visual_feedback_update_interval;
     audio_visual_feedback_clipping = 0;
+    loudness_meter_reset(audio_loudness);
+    memset(audio_levels_sum_sq, 0, sizeof(audio_levels_sum_sq));
+    memset(audio_levels_peak, 0, sizeof(audio_levels_peak));
+    audio_levels_num_samples = 0;
+    channel_freeze_stop();
+    audio_freeze_songpos = -1;
+    audio_freeze_suspended = FALSE;
 
     event_waiter_reset(audio_songpos_ew);
     event_waiter_reset(audio_tempo_ew);
@@ -732,83 +1273,174 @@ void audio_prepare_for_playing(void)
     scopebuf_ready = TRUE;
 }
 
-static void*
-mix(void* dest, const guint32 count, const gboolean stereo)
+static inline gint
+mix_int_divisor(const gint numchannels)
+{
+    /* modules with many channels get additional amplification here */
+    return (4.0 * log(numchannels) / log(4.0)) * 64.0 * 8.0;// TODO table
+}
+
+/* Gain of the conversion from the mix bus into the output */
+static inline float
+mix_gain(const STMixerBufferFormat format,
+    const gint numchannels,
+    const float ampf,
+    const gint ampi)
+{
+    return format == ST_MIXER_BUFFER_FORMAT_INT ? (float)ampi / mix_int_divisor(numchannels) : ampf;
+}
+
+/* Sums up the channel buffers into the bus, the part of the bus no channel
+   has processed is cleared */
+static void
+mix_sum(void* bus,
+    const st_mixer_buffer* buffers,
+    const gint numchannels,
+    const STMixerBufferFormat format,
+    const guint32 count,
+    const gboolean stereo)
 {
     guint32 num_processed, already_processed = 0;
     guint i, j, num_samples = stereo ? count << 1 : count;
-    gint16* outbuf = dest;
 
-    clipflag = FALSE;
-    if (mixer->buffer_format == ST_MIXER_BUFFER_FORMAT_INT) {
-        /* modules with many channels get additional amplification here */
-        gint t = (4.0 * log(audio_numchannels) / log(4.0)) * 64.0 * 8.0;// TODO table
-
-        for (i = 0; i < audio_numchannels; i++) {
-            num_processed = stereo ? chan_buffers[i].num_processed << 1 : chan_buffers[i].num_processed;
+    if (format == ST_MIXER_BUFFER_FORMAT_INT) {
+        for (i = 0; i < numchannels; i++) {
+            num_processed = stereo ? buffers[i].num_processed << 1 : buffers[i].num_processed;
 
             if (!num_processed)
                 continue;
             for (j = 0; j < MIN(num_processed, already_processed); j++)
-                ((gint*)mix_buffer)[j] += ((gint*)chan_buffers[i].buffer)[j];
+                ((gint*)bus)[j] += ((gint*)buffers[i].buffer)[j];
             if (num_processed > already_processed) {
                 for (j = already_processed; j < num_processed; j++)
-                    ((gint*)mix_buffer)[j] = ((gint*)chan_buffers[i].buffer)[j];
+                    ((gint*)bus)[j] = ((gint*)buffers[i].buffer)[j];
                 already_processed = num_processed;
             }
         }
-
-        for (j = 0; j < already_processed; j++) {
-            gint32 a, b;
-
-            a = ((gint32*)mix_buffer)[j];
-            a *= audio_ampfactor_i; /* amplify */
-            a /= t;
-
-            b = CLAMP(a, -32768, 32767);
-            if (a != b) {
-                clipflag = TRUE;
-            }
-
-            *outbuf++ = b;
-        }
     } else {
-        for (i = 0; i < audio_numchannels; i++) {
-            num_processed = stereo ? (chan_buffers[i].num_processed << 1) : chan_buffers[i].num_processed;
+        for (i = 0; i < numchannels; i++) {
+            num_processed = stereo ? (buffers[i].num_processed << 1) : buffers[i].num_processed;
 
             if (!num_processed)
                 continue;
             for (j = 0; j < MIN(num_processed, already_processed); j++)
-                ((float*)mix_buffer)[j] += ((float*)chan_buffers[i].buffer)[j];
+                ((float*)bus)[j] += ((float*)buffers[i].buffer)[j];
             if (num_processed > already_processed) {
                 for (j = already_processed; j < num_processed; j++)
-                    ((float*)mix_buffer)[j] = ((float*)chan_buffers[i].buffer)[j];
+                    ((float*)bus)[j] = ((float*)buffers[i].buffer)[j];
                 already_processed = num_processed;
             }
         }
+    }
+    /* We are forced to clear the rest of the bus since it is not rendered */
+    if (already_processed < num_samples) {
+        gsize ssize = mixer_get_buffer_sizeof(format);
+
+        memset(bus + already_processed * ssize, 0,
+            (num_samples - already_processed) * ssize);
+    }
+}
 
-        for (j = 0; j < already_processed; j++) {
-            float a = ((float*)mix_buffer)[j] * audio_ampfactor_f;
+static void*
+mix(void* dest, const guint32 count, const gboolean stereo)
+{
+    mix_sum(mix_buffer, chan_buffers, audio_numchannels, mixer->buffer_format, count, stereo);
+    clipflag = mix_fmt.convert(dest, mix_buffer, count,
+        mix_gain(mixer->buffer_format, audio_numchannels, audio_ampfactor_f, audio_ampfactor_i));
 
-            if (a < -32768.0) {
-                a = -32768.0;
-                clipflag = TRUE;
-            }
-            if (a > 32767.0) {
-                a = 32767.0;
-                clipflag = TRUE;
-            }
-            *outbuf++ = (gint16)a;
-        }
+    return dest + count * mix_fmt.frame_size;
+}
+
+/* Measures the channels and the bus of the last mix() call with the same
+   gain as the conversion into the output has */
+static void
+audio_levels_measure(const guint32 count, const gboolean stereo)
+{
+    const guint32 num_samples = stereo ? count << 1 : count;
+    guint32 i;
+
+    if (mixer->buffer_format == ST_MIXER_BUFFER_FORMAT_INT) {
+        const float scale = (float)audio_ampfactor_i / mix_int_divisor(audio_numchannels) / 32768.0;
+        const gint* restrict src = mix_buffer;
+
+        for (i = 0; i < audio_numchannels; i++)
+            level_accumulate_int(chan_buffers[i].buffer,
+                stereo ? chan_buffers[i].num_processed << 1 : chan_buffers[i].num_processed,
+                scale, &audio_levels_sum_sq[i], &audio_levels_peak[i]);
+        for (i = 0; i < num_samples; i++)
+            meter_buffer[i] = src[i] * scale;
+    } else {
+        const float scale = audio_ampfactor_f / 32768.0;
+        const float* restrict src = mix_buffer;
+
+        for (i = 0; i < audio_numchannels; i++)
+            level_accumulate_float(chan_buffers[i].buffer,
+                stereo ? chan_buffers[i].num_processed << 1 : chan_buffers[i].num_processed,
+                scale, &audio_levels_sum_sq[i], &audio_levels_peak[i]);
+        for (i = 0; i < num_samples; i++)
+            meter_buffer[i] = src[i] * scale;
     }
-    /* Clear the rest of the buffer (if necessary) */
-    if (already_processed < num_samples) {
-        already_processed = num_samples - already_processed;
-        /* We are forced to clear the rest of buffer since it is not rendered */
-        memset(outbuf, 0, already_processed << 1);/* 16 bit */
+    loudness_meter_process(audio_loudness, meter_buffer, count);
+    audio_levels_num_samples += num_samples;
+}
+
+static void
+audio_levels_publish(void)
+{
+    audio_levels l;
+    guint i;
+
+    loudness_meter_get(audio_loudness, &l.momentary, &l.short_term);
+    for (i = 0; i < 32; i++) {
+        /* Every channel is measured over the whole interval, the parts
+           it hasn't processed are silent */
+        l.rms[i] = audio_levels_num_samples ? sqrtf(audio_levels_sum_sq[i] / audio_levels_num_samples) : 0.0;
+        l.peak[i] = audio_levels_peak[i];
     }
+    time_buffer_add(audio_levels_tb, &l, audio_mixer_current_time);
 
-    return dest + (num_samples << 1);
+    memset(audio_levels_sum_sq, 0, sizeof(audio_levels_sum_sq));
+    memset(audio_levels_peak, 0, sizeof(audio_levels_peak));
+    audio_levels_num_samples = 0;
+}
+
+/* Replaces the output of the channels being played from the freeze caches */
+static void
+audio_freeze_fill(const guint32 count)
+{
+    guint32 mask = channel_freeze_get_active();
+    gint i;
+
+    for (i = 0; mask && i < audio_numchannels; i++, mask >>= 1)
+        if (mask & 1) {
+            const guint32 n = channel_freeze_read(i, chan_buffers[i].buffer, count);
+
+            chan_buffers[i].num_processed = player_mute_channels[i] ? 0 : n;
+        }
+}
+
+/* Called after every player tick, switches the frozen channels between
+   their caches and the live voices */
+static void
+audio_freeze_follow(void)
+{
+    guint32 started;
+    gint i;
+
+    if (pitchbend != 0.0 || audio_freeze_suspended || player->playmode != PLAYING_SONG) {
+        channel_freeze_stop();
+        audio_freeze_songpos = -1;
+        return;
+    }
+    if (player->songpos == audio_freeze_songpos)
+        return;
+
+    audio_freeze_songpos = player->songpos;
+    started = channel_freeze_seek(mixer, mixfreq_req, mix_fmt.bus_stereo,
+        player->songpos, player->patpos);
+    for (i = 0; started; i++, started >>= 1)
+        if (started & 1)
+            mixer->stopnote(mixer_object, i);
 }
 
 static void*
@@ -817,9 +1449,9 @@ mixer_mix_and_handle_scopes(void* dest,
     gboolean simple)
 {
     int n;
-    audio_clipping_indicator* c;
-    audio_mixer_position* p;
-    gboolean stereo = (mixfmt_conv & MIXFMT_CONV_TO_MONO) || (mixfmt & MIXFMT_STEREO);
+    audio_clipping_indicator c;
+    audio_mixer_position p;
+    gboolean stereo = mix_fmt.bus_stereo;
 
     /* Check buffers' size and update if necessary (tracer doesn't need this) */
     if (mixer->setbuffers && count > prev_bufsize) {
@@ -827,7 +1459,7 @@ mixer_mix_and_handle_scopes(void* dest,
         gsize ssize = mixer_get_buffer_sizeof(mixer->buffer_format);
 
         if (!prev_bufsize) /* Pref_bufsize == 0 indicates mixer change */
-            mixer->setbuffers(chan_buffers);
+            mixer->setbuffers(mixer_object, chan_buffers);
         prev_bufsize = count << 1;
         for (i = 0; i < audio_numchannels; i++) {
             if (chan_buffers[i].buffer)
@@ -837,12 +1469,14 @@ mixer_mix_and_handle_scopes(void* dest,
         if (mix_buffer)
             g_free(mix_buffer);
         mix_buffer = calloc(prev_bufsize, stereo  ? ssize << 1 : ssize);
+        g_free(meter_buffer);
+        meter_buffer = g_new(float, prev_bufsize << 1);
     }
 
     // See comments in audio.h for Oscilloscope stuff
 
     if (simple) {
-        mixer->render(count, NULL, 0, NULL, 0.0);
+        mixer->render(mixer_object, count, NULL, 0, NULL, 0.0);
         return mix(dest, count, stereo);
     }
 
@@ -856,11 +1490,14 @@ mixer_mix_and_handle_scopes(void* dest,
         }
 
         gui_settings.gui_display_scopes && scopebuf_ready ?
-            mixer->render(n, scopebufs, scopebuf_end.offset,
+            mixer->render(mixer_object, n, scopebufs, scopebuf_end.offset,
                 audio_channels_status_tb, audio_current_playback_time_bent) :
-            mixer->render(n, NULL, 0,
+            mixer->render(mixer_object, n, NULL, 0,
                 audio_channels_status_tb, audio_current_playback_time_bent);
+        if (mixer->setbuffers)
+            audio_freeze_fill(n);
         dest = mix(dest, n, stereo);
+        audio_levels_measure(n, stereo);
 
         scopebuf_end.offset += n;
         scopebuf_end.time += (double)n / scopebuf_freq;
@@ -879,17 +1516,15 @@ mixer_mix_and_handle_scopes(void* dest,
         if (audio_visual_feedback_counter == 0) {
             /* Get up-to-date info from mixer about current sample positions */
             audio_visual_feedback_counter = audio_visual_feedback_update_interval;
-            if ((p = g_new(audio_mixer_position, 1))) {
-                mixer->dumpstatus(p->dump);
-                time_buffer_add(audio_mixer_position_tb, p, audio_mixer_current_time);
-            }
-            if ((c = g_new(audio_clipping_indicator, 1))) {
-                c->clipping = audio_visual_feedback_clipping;
-                if (audio_visual_feedback_clipping) {
-                    audio_visual_feedback_clipping--;
-                }
-                time_buffer_add(audio_clipping_indicator_tb, c, audio_mixer_current_time);
+            mixer->dumpstatus(mixer_object, p.dump);
+            time_buffer_add(audio_mixer_position_tb, &p, audio_mixer_current_time);
+
+            c.clipping = audio_visual_feedback_clipping;
+            if (audio_visual_feedback_clipping) {
+                audio_visual_feedback_clipping--;
             }
+            time_buffer_add(audio_clipping_indicator_tb, &c, audio_mixer_current_time);
+            audio_levels_publish();
         }
 
         if (scopebuf_end.time - scopebuf_start.time >= (double)scopebuf_length / scopebuf_freq) {
@@ -912,207 +1547,721 @@ mixer_mix(void* dest,
     guint32 count,
     gboolean simple)
 {
-    static int bufsize = 0;
-    static void* buf = NULL;
-    int b, i, c, d;
-    void* ende;
-
     if (count == 0)
         return dest;
 
     g_assert(mixer != NULL);
 
+    if (render_recording) {
+        g_array_append_val(render_blocks, count);
+        return dest;
+    }
+
     /* The mixer doesn't have to support a format that the driver
-       requires. This routine converts between any formats if
-       necessary: 16 bits / 8 bits, mono / stereo, little endian / big
-       endian, unsigned / signed */
+       requires; mix() converts between the mix bus and any driver format
+       in a single pass, see mix_convert_funcs[] */
+    return mixer_mix_and_handle_scopes(dest, count, simple);
+}
 
-    if (mixfmt_conv == 0) {
-        return mixer_mix_and_handle_scopes(dest, count, simple);
-    }
+static inline void
+render_record(const gint channel, render_event* e)
+{
+    e->block = render_blocks->len;
+    g_array_append_vals(render_events[channel], e, 1);
+}
 
-    b = count;
-    c = 8;
-    d = 1;
-    if (mixfmt & MIXFMT_16) {
-        b *= 2;
-        c = 16;
-    }
-    if ((mixfmt & MIXFMT_STEREO) || (mixfmt_conv & MIXFMT_CONV_TO_MONO)) {
-        b *= 2;
-        d = 2;
+static void
+render_apply(const gint channel, const render_event* e)
+{
+    switch (e->type) {
+    case RENDER_EVENT_STARTNOTE:
+        mixer->startnote(mixer_object, channel, e->arg.si);
+        break;
+    case RENDER_EVENT_STOPNOTE:
+        mixer->stopnote(mixer_object, channel);
+        break;
+    case RENDER_EVENT_SMPLPOS:
+        mixer->setsmplpos(mixer_object, channel, e->arg.offset);
+        break;
+    case RENDER_EVENT_SMPLEND:
+        mixer->setsmplend(mixer_object, channel, e->arg.offset);
+        break;
+    case RENDER_EVENT_FREQ:
+        mixer->setfreq(mixer_object, channel, e->arg.value);
+        break;
+    case RENDER_EVENT_VOLUME:
+        mixer->setvolume(mixer_object, channel, e->arg.value);
+        break;
+    case RENDER_EVENT_PANNING:
+        mixer->setpanning(mixer_object, channel, e->arg.value);
+        break;
+    case RENDER_EVENT_CUTOFF:
+        mixer->setchcutoff(mixer_object, channel, e->arg.value);
+        break;
+    case RENDER_EVENT_RESO:
+        mixer->setchreso(mixer_object, channel, e->arg.value);
+        break;
     }
+}
+
+/* Replays the recorded events of one channel and renders it block by block
+   into its own stream. The part of a block the mixer hasn't processed is
+   zeroed, this is equivalent to skipping it in mix() */
+static void
+render_channel(gpointer data, gpointer user_data)
+{
+    const gint channel = GPOINTER_TO_INT(data) - 1;
+    const GArray* events = render_events[channel];
+    const gsize frame_size = mixer_get_buffer_sizeof(mixer->buffer_format) << (mix_fmt.bus_stereo ? 1 : 0);
+    guint8* buf = render_data[channel];
+    guint b, e = 0;
 
-    if (b > bufsize) {
-        g_free(buf);
-        buf = g_new(guint8, b);
-        bufsize = b;
+    if (!user_data)
+        audio_realtime_pin_worker();
+
+    for (b = 0; b <= render_blocks->len; b++) {
+        guint32 len, processed;
+
+        for (; e < events->len && g_array_index(events, render_event, e).block == b; e++)
+            render_apply(channel, &g_array_index(events, render_event, e));
+        if (b == render_blocks->len)
+            break;
+
+        len = g_array_index(render_blocks, guint32, b);
+        render_buffers[channel].buffer = buf;
+        mixer->renderchannel(mixer_object, channel, len);
+        processed = MIN(render_buffers[channel].num_processed, len);
+        memset(buf + processed * frame_size, 0, (len - processed) * frame_size);
+        buf += len * frame_size;
     }
 
-    g_assert(buf != NULL);
-    ende = mixer_mix_and_handle_scopes(buf, count, simple);
+    if (user_data)
+        return; /* Rendered by the calling thread */
+    g_mutex_lock(&render_mutex);
+    if (!--render_pending)
+        g_cond_signal(&render_cond);
+    g_mutex_unlock(&render_mutex);
+}
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_MONO) {
-        if (mixfmt & MIXFMT_16) {
-            gint16 *a = buf, *b = buf;
-            for (i = 0; i < count; i++, a += 2, b += 1)
-                *b = (a[0] + a[1]) / 2;
-        } else {
-            gint8 *a = buf, *b = buf;
-            for (i = 0; i < count; i++, a += 2, b += 1)
-                *b = (a[0] + a[1]) / 2;
+static gboolean
+render_init(void)
+{
+    guint i;
+    glong num_cpus;
+
+    if (render_blocks)
+        return render_pool != NULL;
+
+    render_blocks = g_array_new(FALSE, FALSE, sizeof(guint32));
+    for (i = 0; i < 32; i++)
+        render_events[i] = g_array_new(FALSE, FALSE, sizeof(render_event));
+
+    num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus > 1)
+        render_pool = g_thread_pool_new(render_channel, NULL, num_cpus - 1, FALSE, NULL);
+
+    return render_pool != NULL;
+}
+
+guint32
+audio_mix_offline(void* dest,
+    const guint32 count,
+    const gint mixfreq,
+    const gint mixformat,
+    gboolean* clipping)
+{
+    guint32 num_rendered, num_samples, j;
+    gsize size;
+    gint i;
+    gboolean clip;
+
+    g_assert(mixer != NULL);
+
+    if (!mixer->renderchannel || !mixer->setbuffers || !render_init())
+        return audio_mix(dest, count, mixfreq, mixformat, FALSE, clipping);
+
+    /* Run the player and collect the requests to the mixer */
+    g_array_set_size(render_blocks, 0);
+    for (i = 0; i < 32; i++)
+        g_array_set_size(render_events[i], 0);
+    render_recording = TRUE;
+    num_rendered = audio_mix(NULL, count, mixfreq, mixformat, FALSE, NULL);
+    render_recording = FALSE;
+
+    num_samples = mix_fmt.bus_stereo ? num_rendered << 1 : num_rendered;
+    size = num_samples * mixer_get_buffer_sizeof(mixer->buffer_format);
+    if (size > render_data_size) {
+        for (i = 0; i < 32; i++) {
+            g_free(render_data[i]);
+            render_data[i] = g_malloc(size);
         }
-        d = 1;
+        render_data_size = size;
     }
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_8) {
-        gint16* a = buf;
-        gint8* b = dest;
-        for (i = 0; i < count * d; i++)
-            *b++ = *a++ >> 8;
-        c = 8;
-        ende = b;
-    } else if (mixfmt_conv & MIXFMT_CONV_TO_16) {
-        gint8* a = buf;
-        gint16* b = dest;
-        for (i = 0; i < count * d; i++)
-            *b++ = *a++ << 8;
-        c = 16;
-        ende = b;
+    /* Render the channels, the calling thread takes the first one */
+    mixer->setbuffers(mixer_object, render_buffers);
+    render_pending = audio_numchannels - 1;
+    for (i = 1; i < audio_numchannels; i++)
+        g_thread_pool_push(render_pool, GINT_TO_POINTER(i + 1), NULL);
+    render_channel(GINT_TO_POINTER(1), GINT_TO_POINTER(TRUE));
+    g_mutex_lock(&render_mutex);
+    while (render_pending)
+        g_cond_wait(&render_cond, &render_mutex);
+    g_mutex_unlock(&render_mutex);
+    mixer->setbuffers(mixer_object, chan_buffers);
+
+    /* Sum up in the channel order */
+    if (mixer->buffer_format == ST_MIXER_BUFFER_FORMAT_INT) {
+        gint* bus = render_data[0];
+
+        for (i = 1; i < audio_numchannels; i++) {
+            const gint* buf = render_data[i];
+
+            for (j = 0; j < num_samples; j++)
+                bus[j] += buf[j];
+        }
     } else {
-        memcpy(dest, buf, count * d * (c / 8));
-        ende = dest + (count * d * (c / 8));
-    }
+        float* bus = render_data[0];
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_UNSIGNED) {
-        if (c == 16) {
-            gint16* a = dest;
-            guint16* b = dest;
-            for (i = 0; i < count * d; i++)
-                *b++ = *a++ + 32768;
-        } else {
-            gint8* a = dest;
-            guint8* b = dest;
-            for (i = 0; i < count * d; i++)
-                *b++ = *a++ + 128;
+        for (i = 1; i < audio_numchannels; i++) {
+            const float* buf = render_data[i];
+
+            for (j = 0; j < num_samples; j++)
+                bus[j] += buf[j];
         }
     }
 
-    if (mixfmt_conv & MIXFMT_CONV_BYTESWAP) {
-        le_16_array_to_host_order(dest, count * d);
+    clip = mix_fmt.convert(dest, render_data[0], num_rendered,
+        mix_gain(mixer->buffer_format, audio_numchannels, audio_ampfactor_f, audio_ampfactor_i));
+    if (clipping)
+        *clipping = clip;
+
+    return num_rendered;
+}
+
+/* Standalone renderers. Each one owns a player and a mixer instance, so it
+   can run in any thread concurrently with the audio thread. */
+
+struct audio_renderer {
+    st_mixer* mixer;
+    void* mixer_object;
+    xmplayer* player;
+    mix_format format;
+    gint mixfreq;
+    float ampf;
+    gint ampi;
+    st_mixer_buffer buffers[32];
+    void* bus;
+    float* fbus; /* For the level measurement */
+    peak_meter* meter;
+    guint32 bufsize;
+    double current_time, next_tick_time;
+};
+
+audio_renderer*
+audio_renderer_new(XM* xm,
+    st_mixer* mx,
+    const gint mixfreq,
+    const gint mixformat)
+{
+    audio_renderer* r;
+
+    g_assert(xm != NULL);
+    g_assert(mx != NULL);
+
+    if (!mx->setbuffers)
+        return NULL;
+
+    r = g_new0(audio_renderer, 1);
+    r->mixer = mx;
+    r->mixer_object = mx->new();
+    r->player = xmplayer_new(xm, mx, r->mixer_object);
+    r->mixfreq = mixfreq;
+    /* The amplification is taken as it is at the moment of creation */
+    r->ampf = audio_ampfactor_f;
+    r->ampi = audio_ampfactor_i;
+
+    mixer_mix_format(&r->format, mx, r->mixer_object, mixformat & 15,
+        (mixformat & ST_MIXER_FORMAT_STEREO) != 0);
+    mx->setmixfreq(r->mixer_object, mixfreq);
+
+    return r;
+}
+
+void
+audio_renderer_destroy(audio_renderer* r)
+{
+    guint i;
+
+    xmplayer_destroy(r->player);
+    r->mixer->destroy(r->mixer_object);
+    for (i = 0; i < 32; i++)
+        g_free(r->buffers[i].buffer);
+    g_free(r->bus);
+    g_free(r->fbus);
+    if (r->meter)
+        peak_meter_destroy(r->meter);
+    g_free(r);
+}
+
+void
+audio_renderer_start(audio_renderer* r,
+    const gint songpos,
+    const gint stoppos)
+{
+    r->mixer->reset(r->mixer_object);
+    xmplayer_init_module(r->player, r->player->xm);
+    xmplayer_init_play_song(r->player, songpos, 0, TRUE);
+    if (stoppos >= 0)
+        xmplayer_set_song_end(r->player, stoppos);
+
+    r->current_time = r->next_tick_time = 0.0;
+    if (r->meter)
+        peak_meter_reset(r->meter);
+}
+
+gint
+audio_renderer_get_songpos(const audio_renderer* r)
+{
+    return r->player->songpos;
+}
+
+gdouble
+audio_renderer_get_time(const audio_renderer* r)
+{
+    return r->player->current_time;
+}
+
+static void
+audio_renderer_set_bufsize(audio_renderer* r,
+    const guint32 count)
+{
+    guint i;
+    const gsize frame_size = mixer_get_buffer_sizeof(r->mixer->buffer_format) << (r->format.bus_stereo ? 1 : 0);
+
+    r->bufsize = count;
+    for (i = 0; i < 32; i++) {
+        g_free(r->buffers[i].buffer);
+        r->buffers[i].buffer = g_malloc0(count * frame_size);
     }
+    g_free(r->bus);
+    r->bus = g_malloc0(count * frame_size);
+    g_free(r->fbus);
+    r->fbus = g_new0(float, count << 1);
+    r->mixer->setbuffers(r->mixer_object, r->buffers);
+}
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_STEREO) {
-        g_assert(d == 1);
-        if (c == 16) {
-            gint16 *a = dest, *b = dest;
-            ende = b;
-            for (i = 0, a += count, b += 2 * count; i < count; i++, a -= 1, b -= 2)
-                b[-1] = b[-2] = a[-1];
-        } else {
-            gint8 *a = dest, *b = dest;
-            ende = b;
-            for (i = 0, a += count, b += 2 * count; i < count; i++, a -= 1, b -= 2)
-                b[-1] = b[-2] = a[-1];
+static gboolean
+mix_is_silent(const void* bus,
+    const STMixerBufferFormat format,
+    const guint32 num_samples)
+{
+    guint32 i;
+    gint nonzero = 0;
+
+    if (format == ST_MIXER_BUFFER_FORMAT_INT)
+        for (i = 0; i < num_samples; i++)
+            nonzero |= ((const gint*)bus)[i];
+    else
+        for (i = 0; i < num_samples; i++)
+            nonzero |= (((const float*)bus)[i] != 0.0f);
+
+    return !nonzero;
+}
+
+/* Runs the player and the mixer, block() is called for every rendered
+   block between the player ticks with the offset of the block in frames,
+   tick() (if not NULL) after every tick */
+static guint32
+audio_renderer_run(audio_renderer* r,
+    const guint32 count,
+    void (*block)(audio_renderer* r, guint32 offset, guint32 num_frames, gpointer data),
+    void (*tick)(const xmplayer* p, gpointer data),
+    gpointer data)
+{
+    guint32 count_cur = count;
+
+    if (count > r->bufsize)
+        audio_renderer_set_bufsize(r, count);
+
+    while (count_cur && !r->player->looped) {
+        guint32 samples_left = MAX((r->next_tick_time - r->current_time) * r->mixfreq, 0.0);
+        gboolean newtick = TRUE;
+
+        if (samples_left > count_cur) {
+            samples_left = count_cur;
+            newtick = FALSE;
+        }
+
+        if (samples_left) {
+            r->mixer->render(r->mixer_object, samples_left, NULL, 0, NULL, 0.0);
+            block(r, count - count_cur, samples_left, data);
+        }
+        count_cur -= samples_left;
+        r->current_time += (double)samples_left / r->mixfreq;
+
+        if (newtick) {
+            r->next_tick_time = xmplayer_play(r->player, FALSE);
+            if (tick)
+                tick(r->player, data);
         }
     }
 
-    return ende;
+    return count - count_cur;
 }
 
-void driver_setnumch(int numchannels)
+typedef struct {
+    audio_renderer_stem* stems;
+    guint num_stems;
+} audio_renderer_stems_data;
+
+static void
+audio_renderer_stems_block(audio_renderer* r,
+    guint32 offset,
+    guint32 num_frames,
+    gpointer data)
+{
+    audio_renderer_stems_data* sd = data;
+    guint k;
+    /* The stems have the same gain as the whole mix, so they sum up to it */
+    const float gain = mix_gain(r->mixer->buffer_format, r->player->nchan, r->ampf, r->ampi);
+
+    for (k = 0; k < sd->num_stems; k++) {
+        audio_renderer_stem* st = &sd->stems[k];
+        const gint first = MIN(st->first, r->player->nchan);
+        const gint num = MIN(st->num, r->player->nchan - first);
+
+        mix_sum(r->bus, r->buffers + first, num, r->mixer->buffer_format,
+            num_frames, r->format.bus_stereo);
+        if (!st->audible)
+            st->audible = !mix_is_silent(r->bus, r->mixer->buffer_format,
+                r->format.bus_stereo ? num_frames << 1 : num_frames);
+        st->clipping |= r->format.convert(st->dest + offset * r->format.frame_size, r->bus,
+            num_frames, gain);
+    }
+}
+
+guint32
+audio_renderer_mix_stems(audio_renderer* r,
+    audio_renderer_stem stems[],
+    const guint num_stems,
+    const guint32 count)
+{
+    audio_renderer_stems_data sd = { stems, num_stems };
+    guint k;
+
+    for (k = 0; k < num_stems; k++)
+        stems[k].audible = stems[k].clipping = FALSE;
+
+    return audio_renderer_run(r, count, audio_renderer_stems_block, NULL, &sd);
+}
+
+/* The levels are measured on the whole mix before clipping, in the units of
+   the 16-bit output at the amplification 1.0 */
+static void
+audio_renderer_measure_block(audio_renderer* r,
+    guint32 offset,
+    guint32 num_frames,
+    gpointer data)
+{
+    const guint32 num_samples = r->format.bus_stereo ? num_frames << 1 : num_frames;
+    float* restrict dst = r->fbus;
+    guint32 i;
+
+    mix_sum(r->bus, r->buffers, r->player->nchan, r->mixer->buffer_format,
+        num_frames, r->format.bus_stereo);
+    if (r->mixer->buffer_format == ST_MIXER_BUFFER_FORMAT_INT) {
+        const gint* restrict src = r->bus;
+        const float scale = 8.0 / mix_int_divisor(r->player->nchan);
+
+        for (i = 0; i < num_samples; i++)
+            dst[i] = src[i] * scale;
+    } else {
+        const float* restrict src = r->bus;
+
+        for (i = 0; i < num_samples; i++)
+            dst[i] = src[i] * 0.25f;
+    }
+    peak_meter_process(r->meter, dst, num_frames);
+}
+
+guint32
+audio_renderer_measure(audio_renderer* r,
+    const guint32 count,
+    float* sample_peak,
+    float* true_peak)
+{
+    guint32 num_rendered;
+
+    if (!r->meter)
+        r->meter = peak_meter_new(r->format.bus_stereo ? 2 : 1);
+    num_rendered = audio_renderer_run(r, count, audio_renderer_measure_block, NULL, NULL);
+    peak_meter_get(r->meter, sample_peak, true_peak);
+
+    return num_rendered;
+}
+
+typedef struct {
+    void (*block)(const st_mixer_buffer buffers[], const guint32 num_frames, gpointer data);
+    void (*tick)(const xmplayer* p, gpointer data);
+    gpointer data;
+} audio_renderer_raw_data;
+
+static void
+audio_renderer_raw_block(audio_renderer* r,
+    guint32 offset,
+    guint32 num_frames,
+    gpointer data)
+{
+    audio_renderer_raw_data* rd = data;
+
+    rd->block(r->buffers, num_frames, rd->data);
+}
+
+static void
+audio_renderer_raw_tick(const xmplayer* p,
+    gpointer data)
+{
+    audio_renderer_raw_data* rd = data;
+
+    rd->tick(p, rd->data);
+}
+
+guint32
+audio_renderer_render_raw(audio_renderer* r,
+    const guint32 count,
+    void (*block)(const st_mixer_buffer buffers[], const guint32 num_frames, gpointer data),
+    void (*tick)(const xmplayer* p, gpointer data),
+    gpointer data)
+{
+    audio_renderer_raw_data rd = { block, tick, data };
+
+    return audio_renderer_run(r, count, audio_renderer_raw_block,
+        tick ? audio_renderer_raw_tick : NULL, &rd);
+}
+
+gboolean
+audio_renderer_is_stereo(const audio_renderer* r)
+{
+    return r->format.bus_stereo;
+}
+
+/* Only the player of the audio thread is recorded for the offline rendering
+   and reports to the time buffers; other players just drive their mixers */
+static inline gboolean
+driver_recording(xmplayer* p)
+{
+    return render_recording && p == player;
+}
+
+void driver_setnumch(xmplayer* p, int numchannels)
 {
     g_assert(numchannels >= 1 && numchannels <= 32);
-    audio_numchannels = numchannels;
-    mixer->setnumch(numchannels);
-    prev_bufsize = 0;
+    if (p == player) {
+        audio_numchannels = numchannels;
+        prev_bufsize = 0;
+    }
+    p->mixer->setnumch(p->mixer_object, numchannels);
 }
 
-void driver_startnote(const gint channel,
+void driver_startnote(xmplayer* p, const gint channel,
     st_mixer_sample_info* si,
     const gint inst,
     const gint smpl,
     const gint note)
 {
     if (si->length != 0) {
-        audio_channel_status* p;
-
-        p = g_new(audio_channel_status, 1);
-        p->command = AUDIO_COMMAND_START_PLAYING;
-        p->channel = channel;
-        p->instr = inst;
-        p->sample = smpl;
-        p->note = note;
-        time_buffer_add(audio_channels_status_tb, p,
-            audio_current_playback_time_bent);
+        if (p == player) {
+            audio_channel_status s;
+
+            s.command = AUDIO_COMMAND_START_PLAYING;
+            s.channel = channel;
+            s.instr = inst;
+            s.sample = smpl;
+            s.note = note;
+            time_buffer_add(audio_channels_status_tb, &s,
+                audio_current_playback_time_bent);
+        }
 
-        mixer->startnote(channel, si);
+        if (driver_recording(p)) {
+            render_event e = { .type = RENDER_EVENT_STARTNOTE, .arg.si = si };
+
+            render_record(channel, &e);
+        } else if (!(p == player && (channel_freeze_get_active() & (1u << channel))))
+            /* Frozen channels are played from the cache without voices */
+            p->mixer->startnote(p->mixer_object, channel, si);
     }
 }
 
-void driver_stopnote(int channel)
+void driver_stopnote(xmplayer* p, int channel)
 {
-    audio_channel_status* p;
+    if (driver_recording(p)) {
+        render_event e = { .type = RENDER_EVENT_STOPNOTE };
+
+        render_record(channel, &e);
+    } else
+        p->mixer->stopnote(p->mixer_object, channel);
 
-    mixer->stopnote(channel);
+    if (p == player) {
+        audio_channel_status s;
 
-    p = g_new(audio_channel_status, 1);
-    p->command = AUDIO_COMMAND_STOP_PLAYING;
-    p->channel = channel;
-    time_buffer_add(audio_channels_status_tb, p,
-        audio_current_playback_time_bent);
+        s.command = AUDIO_COMMAND_STOP_PLAYING;
+        s.channel = channel;
+        time_buffer_add(audio_channels_status_tb, &s,
+            audio_current_playback_time_bent);
+    }
 }
 
-void driver_setsmplpos(int channel,
+void driver_setsmplpos(xmplayer* p, int channel,
     guint32 offset)
 {
-    mixer->setsmplpos(channel, offset);
+    if (driver_recording(p)) {
+        render_event e = { .type = RENDER_EVENT_SMPLPOS, .arg.offset = offset };
+
+        render_record(channel, &e);
+    } else
+        p->mixer->setsmplpos(p->mixer_object, channel, offset);
 }
 
-void driver_setsmplend(int channel,
+void driver_setsmplend(xmplayer* p, int channel,
     guint32 offset)
 {
-    mixer->setsmplend(channel, offset);
+    if (driver_recording(p)) {
+        render_event e = { .type = RENDER_EVENT_SMPLEND, .arg.offset = offset };
+
+        render_record(channel, &e);
+    } else
+        p->mixer->setsmplend(p->mixer_object, channel, offset);
 }
 
-void driver_setfreq(int channel,
+void driver_setfreq(xmplayer* p, int channel,
     float frequency)
 {
-    mixer->setfreq(channel, frequency * ((100.0 + pitchbend) / 100.0));
+    if (p == player)
+        frequency *= (100.0 + pitchbend) / 100.0;
+    if (driver_recording(p)) {
+        render_event e = { .type = RENDER_EVENT_FREQ, .arg.value = frequency };
+
+        render_record(channel, &e);
+    } else
+        p->mixer->setfreq(p->mixer_object, channel, frequency);
 }
 
-void driver_setvolume(int channel,
+void driver_setvolume(xmplayer* p, int channel,
     float volume)
 {
     g_assert(volume >= 0.0 && volume <= 1.0);
 
-    mixer->setvolume(channel, volume);
+    if (driver_recording(p)) {
+        render_event e = { .type = RENDER_EVENT_VOLUME, .arg.value = volume };
+
+        render_record(channel, &e);
+    } else
+        p->mixer->setvolume(p->mixer_object, channel, volume);
 }
 
-void driver_setpanning(int channel,
+void driver_setpanning(xmplayer* p, int channel,
     float panning)
 {
     g_assert(panning >= -1.0 && panning <= +1.0);
 
-    mixer->setpanning(channel, panning);
+    if (driver_recording(p)) {
+        render_event e = { .type = RENDER_EVENT_PANNING, .arg.value = panning };
+
+        render_record(channel, &e);
+    } else
+        p->mixer->setpanning(p->mixer_object, channel, panning);
 }
 
-void driver_set_ch_filter_freq(int channel,
+void driver_set_ch_filter_freq(xmplayer* p, int channel,
     float freq)
 {
-    if (mixer->setchcutoff) {
-        mixer->setchcutoff(channel, freq);
+    if (p->mixer->setchcutoff) {
+        if (driver_recording(p)) {
+            render_event e = { .type = RENDER_EVENT_CUTOFF, .arg.value = freq };
+
+            render_record(channel, &e);
+        } else
+            p->mixer->setchcutoff(p->mixer_object, channel, freq);
     }
 }
 
-void driver_set_ch_filter_reso(int channel,
+void driver_set_ch_filter_reso(xmplayer* p, int channel,
     float freq)
 {
-    if (mixer->setchreso) {
-        mixer->setchreso(channel, freq);
+    if (p->mixer->setchreso) {
+        if (driver_recording(p)) {
+            render_event e = { .type = RENDER_EVENT_RESO, .arg.value = freq };
+
+            render_record(channel, &e);
+        } else
+            p->mixer->setchreso(p->mixer_object, channel, freq);
     }
 }
 
+gboolean
+driver_midi_enabled(xmplayer* p)
+{
+#if defined(DRIVER_ALSA)
+    return p == player && p->mixer == mixer && !render_recording && current_driver != NULL;
+#else
+    return FALSE;
+#endif
+}
+
+#if defined(DRIVER_ALSA)
+static double
+driver_midi_delay(void)
+{
+    return audio_current_playback_time_bent - current_driver->get_play_time(current_driver_object);
+}
+#endif
+
+void driver_midi_note_on(xmplayer* p, int midich,
+    int note,
+    int velocity)
+{
+#if defined(DRIVER_ALSA)
+    if (driver_midi_enabled(p))
+        midi_output_note_on(driver_midi_delay(), midich, note, velocity);
+#endif
+}
+
+void driver_midi_note_off(xmplayer* p, int midich,
+    int note)
+{
+#if defined(DRIVER_ALSA)
+    if (driver_midi_enabled(p))
+        midi_output_note_off(driver_midi_delay(), midich, note);
+#endif
+}
+
+void driver_midi_program(xmplayer* p, int midich,
+    int program)
+{
+#if defined(DRIVER_ALSA)
+    if (driver_midi_enabled(p))
+        midi_output_program(driver_midi_delay(), midich, program);
+#endif
+}
+
+void driver_midi_bend(xmplayer* p, int midich,
+    int value)
+{
+#if defined(DRIVER_ALSA)
+    if (driver_midi_enabled(p))
+        midi_output_bend(driver_midi_delay(), midich, value);
+#endif
+}
+
+void driver_midi_reset(xmplayer* p)
+{
+#if defined(DRIVER_ALSA)
+    if (p == player && p->mixer == mixer && !render_recording)
+        midi_output_reset();
+#endif
+}
+
 guint32 audio_mix(void* dest,
     const guint32 count,
     const gint mixfreq,
@@ -1124,21 +2273,26 @@ guint32 audio_mix(void* dest,
     gint count_cur = count;
     static gboolean stop_issued = FALSE;
 
-    if (!(playing_noloop && player_looped))
+    if (!(playing_noloop && player->looped))
         stop_issued = FALSE;
 
     // Set mixer parameters
     if (mixfmt_req != mixformat) {
         mixfmt_req = mixformat;
-        mixer_mix_format(mixformat & 15, (mixformat & ST_MIXER_FORMAT_STEREO) != 0);
+        mixer_mix_format(&mix_fmt, mixer, mixer_object, mixformat & 15, (mixformat & ST_MIXER_FORMAT_STEREO) != 0);
     }
     scopebuf_freq = mixfreq_req = mixfreq;
-    mixer->setmixfreq(mixfreq);
+    mixer->setmixfreq(mixer_object, mixfreq);
 
     audio_visual_feedback_update_interval = mixfreq / audio_visual_feedback_updates_per_second;
+    if (mixfreq != audio_loudness_rate || (mix_fmt.bus_stereo ? 2 : 1) != audio_loudness_channels) {
+        audio_loudness_rate = mixfreq;
+        audio_loudness_channels = mix_fmt.bus_stereo ? 2 : 1;
+        loudness_meter_configure(audio_loudness, audio_loudness_channels, mixfreq);
+    }
 
     while (count_cur) {
-        audio_player_pos* p;
+        audio_player_pos p;
         // Mix either until the next time is reached when we should call the XM player,
         // or until the current mixing buffer is full.
         int samples_left = (audio_next_tick_time_bent - audio_current_playback_time_bent) * mixfreq;
@@ -1149,22 +2303,17 @@ guint32 audio_mix(void* dest,
             nonewtick = TRUE;
         }
 
-        if (playing_noloop && player_looped) {
+        if (playing_noloop && player->looped) {
             if (full) {
                 /* "noloop" playing mode, make rest of buffer silent */
-                memset(dest, 0,
-                    samples_left * ((mixfmt & MIXFMT_16) ? 2 : 1)
-                        * ((mixfmt & MIXFMT_STEREO) ? 2 : 1));
+                dest = mix_silence(dest, samples_left);
 
                 if (!stop_issued) {
                     stop_issued = TRUE;
-                    p = g_new(audio_player_pos, 1);
                     /* Issue "STOP_PLAYING" synchronous command
                        with time corresponding to the last non-empty sample */
-                    if (p) {
-                        p->command = AUDIO_COMMAND_STOP_PLAYING;
-                        time_buffer_add(audio_playerpos_tb, p, audio_current_playback_time_bent);
-                    }
+                    p.command = AUDIO_COMMAND_STOP_PLAYING;
+                    time_buffer_add(audio_playerpos_tb, &p, audio_current_playback_time_bent);
                 }
             } else
                 return count - count_cur;
@@ -1187,32 +2336,30 @@ guint32 audio_mix(void* dest,
 
             // The following three lines, and the stuff in driver_setfreq() contain all
             // necessary code to handle the pitchbending feature.
-            t = xmplayer_play(FALSE);
+            t = xmplayer_play(player, FALSE);
             audio_next_tick_time_bent += (t - audio_next_tick_time_unbent) * (100.0 / (100.0 + pitchbend));
             audio_next_tick_time_unbent = t;
+            if (full)
+                audio_freeze_follow();
 
-            if (full && !(playing_noloop && player_looped)) {
-                p = g_new(audio_player_pos, 1);
-
+            if (full && !(playing_noloop && player->looped)) {
                 // Update player position time buffer
-                if (p) {
-                    p->command = AUDIO_COMMAND_NONE;
-                    p->songpos = player_songpos;
-                    p->patpos = player_patpos;
-                    p->patno = player_patno;
-                    p->tempo = player_tempo;
-                    p->prev_tempo = audio_prev_tempo;
-                    audio_prev_tempo = player_tempo;
-                    p->bpm = player_bpm;
-                    p->curtick = curtick;
-                    p->next_tick_time = audio_next_tick_time_bent;
-                    p->prev_tick_time = audio_prev_tick_time;
-                    audio_prev_tick_time = audio_current_playback_time_bent;
-                    time_buffer_add(audio_playerpos_tb, p, audio_current_playback_time_bent);
-                }
+                p.command = AUDIO_COMMAND_NONE;
+                p.songpos = player->songpos;
+                p.patpos = player->patpos;
+                p.patno = player->patno;
+                p.tempo = player->tempo;
+                p.prev_tempo = audio_prev_tempo;
+                audio_prev_tempo = player->tempo;
+                p.bpm = player->bpm;
+                p.curtick = player->curtick;
+                p.next_tick_time = audio_next_tick_time_bent;
+                p.prev_tick_time = audio_prev_tick_time;
+                audio_prev_tick_time = audio_current_playback_time_bent;
+                time_buffer_add(audio_playerpos_tb, &p, audio_current_playback_time_bent);
 
                 // Confirm pending event requests
-                if (set_songpos_wait_for != -1 && player_songpos == set_songpos_wait_for) {
+                if (set_songpos_wait_for != -1 && player->songpos == set_songpos_wait_for) {
                     event_waiter_confirm(audio_songpos_ew, audio_current_playback_time_bent);
                     set_songpos_wait_for = -1;
                 }
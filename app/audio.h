@@ -32,6 +32,7 @@
 #include "event-waiter.h"
 #include "mixer.h"
 #include "time-buffer.h"
+#include "xm-player.h"
 
 /* === Synchronous commmunications via time buffers */
 
@@ -87,6 +88,20 @@ typedef struct {
 
 extern time_buffer* audio_clipping_indicator_tb;
 
+/* === Level meters time buffer
+
+   The levels are measured before clipping, relative to the full scale of
+   the output. The channel levels are linear and cover the interval since
+   the previous entry. */
+
+typedef struct {
+    double time;
+    float momentary, short_term; /* Loudness of the output, LUFS */
+    float rms[32], peak[32];
+} audio_levels;
+
+extern time_buffer* audio_levels_tb;
+
 /* === Mixer (sample) position time buffer */
 
 typedef struct {
@@ -106,6 +121,52 @@ typedef struct {
 
 extern time_buffer* audio_channels_status_tb;
 
+/* === MIDI input queue
+
+   The notes played on a MIDI keyboard go from the MIDI input thread to the
+   audio thread directly, not through the main loop. They are stamped with
+   the monotonic time they've been played at (s) and applied at the
+   corresponding frame of the next block mixed, so their timing is kept with
+   the constant latency of one block. The queue is read only while the audio
+   thread is mixing for the driver, see audio_midi_accepting(); otherwise
+   the notes must be sent through the control pipe. */
+
+typedef enum {
+    AUDIO_MIDI_NOTE,
+    AUDIO_MIDI_KEYOFF
+} audio_midi_event_id;
+
+typedef struct {
+    double time;
+    audio_midi_event_id type;
+    gint channel, note, instrument;
+} audio_midi_event;
+
+extern time_buffer* audio_midi_tb;
+
+gboolean audio_midi_accepting(void);
+
+/* === Realtime mode of the audio thread */
+
+typedef struct {
+    gboolean enabled;
+    gboolean round_robin; /* SCHED_RR instead of SCHED_FIFO */
+    gint priority;
+    gboolean lock_memory;
+    guint64 audio_cpus, worker_cpus; /* CPU masks, 0 means no pinning */
+} audio_realtime_settings;
+
+/* The settings are applied by the audio thread asynchronously, the
+   guarantees which couldn't be obtained are reported with a warning */
+void audio_set_realtime(const audio_realtime_settings* s);
+/* Pins the calling rendering thread to the worker CPUs of the realtime mode,
+   does nothing if the settings haven't changed since the previous call */
+void audio_realtime_pin_worker(void);
+/* Gives the calling thread the realtime scheduling just below the audio
+   thread if the realtime mode is enabled. Used by the MIDI input thread,
+   the settings are applied when it's started. */
+void audio_realtime_raise_thread(void);
+
 /* === Other stuff */
 
 typedef enum {
@@ -116,6 +177,7 @@ typedef enum {
 } audio_render_target;
 
 extern st_mixer* mixer;
+extern void* mixer_object;
 extern st_driver *playback_driver, *editing_driver, *current_driver;
 extern void *playback_driver_object, *editing_driver_object, *current_driver_object;
 
@@ -128,6 +190,9 @@ extern event_waiter* audio_bpm_ew;
 extern st_mixer* mixer;
 
 gboolean audio_init(void);
+/* Sets the initial mixer; can be called only before the playback has been
+   started the first time */
+void audio_init_mixer(st_mixer* mixer);
 void audio_set_mixer(st_mixer* mixer);
 /* Use the following two functions directly only for asynchronous rendering from
    the main thread. For sound playing communicate with the audio thread through
@@ -138,7 +203,16 @@ guint32 audio_mix(void* dest,
     const gint mixformat,
     const gboolean full,
     gboolean* clipping);
+/* The same as audio_mix(..., FALSE, ...), but the channels are rendered
+   concurrently; the result is identical */
+guint32 audio_mix_offline(void* dest,
+    const guint32 count,
+    const gint mixfreq,
+    const gint mixformat,
+    gboolean* clipping);
 void audio_set_amplification(float af);
+/* For AUDIO_RENDER_SONG pattern and stoppos are the first and the last song
+   positions to be rendered, stoppos < 0 means the end of the song */
 void audio_prepare_for_rendering(audio_render_target target,
     gint pattern,
     gint patpos,
@@ -147,31 +221,103 @@ void audio_prepare_for_rendering(audio_render_target target,
     gint num_ch);
 void audio_cleanup_after_rendering(void);
 gint audio_get_playback_rate();
+/* Drops the tracer keyframes made obsolete by the module changes. Called
+   by the GUI thread before starting the song, when the audio thread is
+   stopped. */
+void audio_validate_trace_cache(void);
+
+/* Standalone renderer with its own player and mixer instance, independent
+   from the audio thread. A renderer is to be used by one thread at a time,
+   different renderers can work concurrently. Returns NULL if the mixer
+   doesn't support it. */
+typedef struct audio_renderer audio_renderer;
+
+audio_renderer* audio_renderer_new(XM* xm,
+    st_mixer* mixer,
+    const gint mixfreq,
+    const gint mixformat);
+void audio_renderer_destroy(audio_renderer* r);
+/* Song positions from songpos to stoppos are rendered, stoppos < 0 means the
+   end of the song */
+void audio_renderer_start(audio_renderer* r,
+    const gint songpos,
+    const gint stoppos);
+/* A group of channels rendered into its own buffer */
+typedef struct {
+    void* dest;
+    gint first, num; /* Channels; the ones beyond the module's are ignored */
+    gboolean audible, clipping; /* Output, for the current call */
+} audio_renderer_stem;
+
+/* Renders the stems in one pass, the stems can overlap. Returns the number
+   of frames rendered, less than count at the end. */
+guint32 audio_renderer_mix_stems(audio_renderer* r,
+    audio_renderer_stem stems[],
+    const guint num_stems,
+    const guint32 count);
+/* Renders the whole mix without output and measures its sample and true
+   peak values since audio_renderer_start() before clipping. They are in the
+   units of 16-bit samples at the amplification 1.0, independent of the
+   renderer's one. Returns the number of frames rendered. */
+guint32 audio_renderer_measure(audio_renderer* r,
+    const guint32 count,
+    float* sample_peak,
+    float* true_peak);
+gint audio_renderer_get_songpos(const audio_renderer* r);
+/* The song time rendered since audio_renderer_start(), s */
+gdouble audio_renderer_get_time(const audio_renderer* r);
+/* Renders the raw output of the channels for caching: block() gets the
+   mixer's channel buffers for every rendered block, tick() is called after
+   every player tick. The buffers are in the mixer's format, interleaved
+   stereo if audio_renderer_is_stereo(). Returns the number of frames
+   rendered. */
+guint32 audio_renderer_render_raw(audio_renderer* r,
+    const guint32 count,
+    void (*block)(const st_mixer_buffer buffers[], const guint32 num_frames, gpointer data),
+    void (*tick)(const xmplayer* p, gpointer data),
+    gpointer data);
+gboolean audio_renderer_is_stereo(const audio_renderer* r);
 
 void readpipe(int fd, void* p, int count);
 
 /* --- Functions called by the player */
 
-void driver_setnumch(int numchannels);
-void driver_startnote(const gint channel,
+void driver_setnumch(xmplayer* p, int numchannels);
+void driver_startnote(xmplayer* p, const gint channel,
     st_mixer_sample_info* si,
     const gint inst,
     const gint smpl,
     const gint note);
-void driver_stopnote(int channel);
-void driver_setsmplpos(int channel,
+void driver_stopnote(xmplayer* p, int channel);
+void driver_setsmplpos(xmplayer* p, int channel,
     guint32 offset);
-void driver_setsmplend(int channel,
+void driver_setsmplend(xmplayer* p, int channel,
     guint32 offset);
-void driver_setfreq(int channel,
+void driver_setfreq(xmplayer* p, int channel,
     float frequency);
-void driver_setvolume(int channel,
+void driver_setvolume(xmplayer* p, int channel,
     float volume);
-void driver_setpanning(int channel,
+void driver_setpanning(xmplayer* p, int channel,
     float panning);
-void driver_set_ch_filter_freq(int channel,
+void driver_set_ch_filter_freq(xmplayer* p, int channel,
     float freq);
-void driver_set_ch_filter_reso(int channel,
+void driver_set_ch_filter_reso(xmplayer* p, int channel,
     float freq);
 
+/* MIDI output of the instruments which have it enabled. Only the playback
+   player sends the events, not the tracing or the rendering. Each event is
+   scheduled to reach the synth when the samples mixed at the same moment
+   reach the speakers, that is after the latency of the driver. */
+gboolean driver_midi_enabled(xmplayer* p);
+void driver_midi_note_on(xmplayer* p, int midich,
+    int note,
+    int velocity);
+void driver_midi_note_off(xmplayer* p, int midich,
+    int note);
+void driver_midi_program(xmplayer* p, int midich,
+    int program);
+void driver_midi_bend(xmplayer* p, int midich,
+    int value);
+void driver_midi_reset(xmplayer* p);
+
 #endif /* _ST_AUDIO_H */
@@ -49,6 +49,11 @@ static GtkWidget* audioconfig_mixer_list;
 static st_mixer* audioconfig_current_mixer = NULL;
 static gboolean audioconfig_disable_mixer_selection = FALSE;
 
+/* Realtime mode; the CPU lists are kept as entered */
+static audio_realtime_settings audioconfig_rt = { FALSE, FALSE, 40, TRUE, 0, 0 };
+static gchar *audioconfig_rt_audio_cpus = NULL, *audioconfig_rt_worker_cpus = NULL;
+static GtkWidget *rt_enable, *rt_policy, *rt_priority, *rt_lock, *rt_audio_cpus, *rt_worker_cpus;
+
 typedef struct audio_object {
     const char* title;
     const char* shorttitle;
@@ -208,6 +213,143 @@ audioconfig_notebook_add_page(GtkNotebook* nbook, guint n)
     gtk_notebook_append_page(nbook, box1, label);
 }
 
+/* Parses a list like "1,3-5", empty list means all the CPUs */
+static gboolean
+audioconfig_parse_cpus(const gchar* text,
+    guint64* mask)
+{
+    gchar** items = g_strsplit(text, ",", 0);
+    guint64 m = 0;
+    gboolean ok = TRUE;
+    gint i;
+
+    for (i = 0; ok && items[i]; i++) {
+        gchar *item = g_strstrip(items[i]), *end;
+        guint64 first, last;
+
+        if (!item[0])
+            continue;
+        first = last = g_ascii_strtoull(item, &end, 10);
+        if (end != item && *end == '-')
+            last = g_ascii_strtoull(end + 1, &end, 10);
+        if (end == item || *end || first > last || last > 63) {
+            ok = FALSE;
+            break;
+        }
+        for (; first <= last; first++)
+            m |= G_GUINT64_CONSTANT(1) << first;
+    }
+    g_strfreev(items);
+
+    if (ok)
+        *mask = m;
+    return ok;
+}
+
+static gboolean
+audioconfig_rt_set_cpus(GtkWidget* entry,
+    gchar** text,
+    guint64* mask)
+{
+    const gchar* t = gtk_entry_get_text(GTK_ENTRY(entry));
+
+    if (!audioconfig_parse_cpus(t, mask)) {
+        static GtkWidget* dialog = NULL;
+        gchar* msg = g_strdup_printf(_("Invalid CPU list: %s"), t);
+
+        gui_error_dialog(&dialog, msg, TRUE);
+        g_free(msg);
+        return FALSE;
+    }
+    g_free(*text);
+    *text = g_strdup(t);
+    return TRUE;
+}
+
+static void
+audioconfig_rt_apply(void)
+{
+    audio_realtime_settings s = audioconfig_rt;
+
+    if (!audioconfig_rt_set_cpus(rt_audio_cpus, &audioconfig_rt_audio_cpus, &s.audio_cpus)
+        || !audioconfig_rt_set_cpus(rt_worker_cpus, &audioconfig_rt_worker_cpus, &s.worker_cpus))
+        return;
+
+    s.enabled = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(rt_enable));
+    s.round_robin = gtk_combo_box_get_active(GTK_COMBO_BOX(rt_policy)) == 1;
+    s.priority = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(rt_priority));
+    s.lock_memory = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(rt_lock));
+    audioconfig_rt = s;
+    audio_set_realtime(&audioconfig_rt);
+}
+
+static GtkWidget*
+audioconfig_rt_entry(GtkWidget* table,
+    const gchar* title,
+    const gchar* text,
+    const gint row)
+{
+    GtkWidget *label, *entry;
+
+    label = gtk_label_new(title);
+    gtk_misc_set_alignment(GTK_MISC(label), 0.0, 0.5);
+    gtk_table_attach(GTK_TABLE(table), label, 0, 1, row, row + 1, GTK_FILL, 0, 0, 0);
+    entry = gtk_entry_new();
+    gtk_entry_set_text(GTK_ENTRY(entry), text ? text : "");
+    gtk_widget_set_tooltip_text(entry, _("Comma-separated CPU numbers or ranges, e.g. 2,3 or 2-3; "
+                                         "empty means any CPU"));
+    gtk_table_attach(GTK_TABLE(table), entry, 1, 2, row, row + 1, GTK_EXPAND | GTK_FILL, 0, 0, 0);
+
+    return entry;
+}
+
+static void
+audioconfig_realtime_frame(GtkWidget* mainbox)
+{
+    GtkWidget *frame, *box, *hbox, *table, *thing;
+
+    frame = gtk_frame_new(NULL);
+    gtk_frame_set_label(GTK_FRAME(frame), _("Realtime Mode"));
+    gtk_box_pack_start(GTK_BOX(mainbox), frame, FALSE, TRUE, 0);
+
+    box = gtk_vbox_new(FALSE, 2);
+    gtk_container_add(GTK_CONTAINER(frame), box);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 4);
+
+    rt_enable = gtk_check_button_new_with_label(_("Run the audio thread with realtime priority"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(rt_enable), audioconfig_rt.enabled);
+    gtk_box_pack_start(GTK_BOX(box), rt_enable, FALSE, TRUE, 0);
+
+    hbox = gtk_hbox_new(FALSE, 4);
+    gtk_box_pack_start(GTK_BOX(box), hbox, FALSE, TRUE, 0);
+    thing = gtk_label_new(_("Scheduling"));
+    gtk_box_pack_start(GTK_BOX(hbox), thing, FALSE, TRUE, 0);
+    rt_policy = gtk_combo_box_text_new();
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(rt_policy), "FIFO");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(rt_policy), _("Round-robin"));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(rt_policy), audioconfig_rt.round_robin ? 1 : 0);
+    gtk_box_pack_start(GTK_BOX(hbox), rt_policy, FALSE, TRUE, 0);
+    gui_put_labelled_spin_button(hbox, _("Priority"), 1, 99, &rt_priority, NULL, NULL, FALSE);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(rt_priority), audioconfig_rt.priority);
+
+    rt_lock = gtk_check_button_new_with_label(_("Lock all the memory including the sample data"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(rt_lock), audioconfig_rt.lock_memory);
+    gtk_box_pack_start(GTK_BOX(box), rt_lock, FALSE, TRUE, 0);
+
+    table = gtk_table_new(2, 2, FALSE);
+    gtk_table_set_col_spacings(GTK_TABLE(table), 4);
+    gtk_table_set_row_spacings(GTK_TABLE(table), 2);
+    gtk_box_pack_start(GTK_BOX(box), table, FALSE, TRUE, 0);
+    rt_audio_cpus = audioconfig_rt_entry(table, _("Audio thread CPUs"), audioconfig_rt_audio_cpus, 0);
+    rt_worker_cpus = audioconfig_rt_entry(table, _("Rendering threads CPUs"), audioconfig_rt_worker_cpus, 1);
+
+    hbox = gtk_hbox_new(FALSE, 4);
+    gtk_box_pack_start(GTK_BOX(box), hbox, FALSE, TRUE, 0);
+    thing = gtk_button_new_from_stock(GTK_STOCK_APPLY);
+    g_signal_connect(thing, "clicked", G_CALLBACK(audioconfig_rt_apply), NULL);
+    gtk_box_pack_end(GTK_BOX(hbox), thing, FALSE, TRUE, 0);
+}
+
 void audioconfig_dialog(void)
 {
     GtkWidget *mainbox, *thing, *nbook, *box2, *frame;
@@ -247,6 +389,8 @@ void audioconfig_dialog(void)
     audioconfig_mixer_list = thing;
     audioconfig_initialize_mixer_list();
 
+    audioconfig_realtime_frame(mainbox);
+
     gtk_widget_show_all(configwindow);
 }
 
@@ -306,6 +450,19 @@ void audioconfig_load_config(void)
                 d->activate(audio_driver_objects[i][n[i]], audio_objects[i].group);
         }
     }
+
+    audioconfig_rt.enabled = prefs_get_bool("realtime", "enabled", audioconfig_rt.enabled);
+    audioconfig_rt.round_robin = prefs_get_bool("realtime", "round-robin", audioconfig_rt.round_robin);
+    audioconfig_rt.priority = prefs_get_int("realtime", "priority", audioconfig_rt.priority);
+    audioconfig_rt.lock_memory = prefs_get_bool("realtime", "lock-memory", audioconfig_rt.lock_memory);
+    audioconfig_rt_audio_cpus = prefs_get_string("realtime", "audio-cpus", "");
+    audioconfig_rt_worker_cpus = prefs_get_string("realtime", "worker-cpus", "");
+    if (!audioconfig_parse_cpus(audioconfig_rt_audio_cpus, &audioconfig_rt.audio_cpus))
+        audioconfig_rt.audio_cpus = 0;
+    if (!audioconfig_parse_cpus(audioconfig_rt_worker_cpus, &audioconfig_rt.worker_cpus))
+        audioconfig_rt.worker_cpus = 0;
+    if (audioconfig_rt.enabled)
+        audio_set_realtime(&audioconfig_rt);
 }
 
 void audioconfig_load_mixer_config(void)
@@ -317,7 +474,7 @@ void audioconfig_load_mixer_config(void)
         for (l = mixers; l; l = l->next) {
             st_mixer* m = l->data;
             if (!strcmp(m->id, buf)) {
-                mixer = m;
+                audio_init_mixer(m);
                 audioconfig_current_mixer = m;
             }
         }
@@ -325,7 +482,7 @@ void audioconfig_load_mixer_config(void)
     }
 
     if (!audioconfig_current_mixer) {
-        mixer = mixers->data;
+        audio_init_mixer(mixers->data);
         audioconfig_current_mixer = mixers->data;
     }
 }
@@ -356,6 +513,13 @@ void audioconfig_save_config(void)
     }
 
     prefs_put_string("mixer", "mixer", audioconfig_current_mixer->id);
+
+    prefs_put_bool("realtime", "enabled", audioconfig_rt.enabled);
+    prefs_put_bool("realtime", "round-robin", audioconfig_rt.round_robin);
+    prefs_put_int("realtime", "priority", audioconfig_rt.priority);
+    prefs_put_bool("realtime", "lock-memory", audioconfig_rt.lock_memory);
+    prefs_put_string("realtime", "audio-cpus", audioconfig_rt_audio_cpus ? audioconfig_rt_audio_cpus : "");
+    prefs_put_string("realtime", "worker-cpus", audioconfig_rt_worker_cpus ? audioconfig_rt_worker_cpus : "");
 }
 
 void audioconfig_shutdown(void)
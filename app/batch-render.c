@@ -0,0 +1,283 @@
+/*
+ * The Real SoundTracker - rendering modules from the command line
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#if USE_SNDFILE
+#include <sndfile.h>
+#elif AUDIOFILE_VERSION
+#include <audiofile.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#include "audio.h"
+#include "audioconfig.h"
+#include "batch-render.h"
+#include "epoch.h"
+#include "gui-settings.h"
+#include "gui-subs.h"
+#include "main.h"
+#include "preferences.h"
+#include "xm.h"
+
+#if USE_SNDFILE || AUDIOFILE_VERSION
+/* Frames per audio_mix_offline() call */
+#define BATCH_RENDER_CHUNK 16384
+
+static gchar* opt_mixer = NULL;
+static gint opt_rate = 44100;
+static gint opt_channels = 2;
+static gint opt_bits = 16;
+static gdouble opt_amplification = 0.0;
+static gint opt_start = 0;
+static gint opt_end = -1;
+static gdouble opt_max_length = 0.0;
+static gchar* opt_output_dir = NULL;
+static gboolean opt_quiet = FALSE;
+static gchar** opt_files = NULL;
+
+static GOptionEntry batch_render_options[] = {
+    { "mixer", 'm', 0, G_OPTION_ARG_STRING, &opt_mixer, N_("Mixer to be used (kbfloat, integer32)"), N_("ID") },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &opt_rate, N_("Sampling rate, 44100 by default"), N_("HZ") },
+    { "channels", 'c', 0, G_OPTION_ARG_INT, &opt_channels, N_("Number of channels, 1 or 2"), N_("N") },
+    { "bits", 'b', 0, G_OPTION_ARG_INT, &opt_bits, N_("Sample resolution, 8 or 16"), N_("N") },
+    { "amplification", 'a', 0, G_OPTION_ARG_DOUBLE, &opt_amplification, N_("Amplification, -41...+20 dB"), N_("DB") },
+    { "start", 's', 0, G_OPTION_ARG_INT, &opt_start, N_("First song position to be rendered"), N_("POS") },
+    { "end", 'e', 0, G_OPTION_ARG_INT, &opt_end, N_("Last song position to be rendered"), N_("POS") },
+    { "max-length", 'l', 0, G_OPTION_ARG_DOUBLE, &opt_max_length, N_("Stop rendering after this time"), N_("SECONDS") },
+    { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output_dir,
+        N_("Render every input file into DIR/<name>.wav"), N_("DIR") },
+    { "quiet", 'q', 0, G_OPTION_ARG_NONE, &opt_quiet, N_("Don't print the progress"), NULL },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_files, NULL, NULL },
+    { NULL }
+};
+
+static gboolean
+batch_render_set_mixer(const gchar* id)
+{
+    GList* l;
+
+    for (l = mixers; l; l = l->next) {
+        st_mixer* m = l->data;
+
+        if (!id || !strcmp(m->id, id)) {
+            audio_init_mixer(m);
+            return TRUE;
+        }
+    }
+
+    fprintf(stderr, _("Unknown mixer: %s\n"), id);
+    return FALSE;
+}
+
+static gboolean
+batch_render_file(const gchar* in, const gchar* out)
+{
+    gchar* utf_name = g_filename_display_name(in);
+    gint16* sndbuf;
+    STMixerFormat format;
+    guint32 num_rendered, total = 0, max_frames;
+    gboolean success = TRUE;
+#if USE_SNDFILE
+    SNDFILE* outfile;
+    SF_INFO sfinfo;
+#else
+    AFfilehandle outfile;
+    AFfilesetup outfilesetup;
+#endif
+
+    xm = File_Load(in, utf_name);
+    g_free(utf_name);
+    if (!xm) {
+        fprintf(stderr, _("%s: can't load module\n"), in);
+        return FALSE;
+    }
+    if (opt_start >= xm->song_length || (opt_end >= 0 && opt_end < opt_start)) {
+        fprintf(stderr, _("%s: song positions are out of range\n"), in);
+        XM_Free(xm);
+        xm = NULL;
+        return FALSE;
+    }
+
+#if USE_SNDFILE
+    sfinfo.channels = opt_channels;
+    sfinfo.samplerate = opt_rate;
+    sfinfo.format = SF_FORMAT_WAV | (opt_bits == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_U8);
+
+    errno = 0;
+    outfile = sf_open(out, SFM_WRITE, &sfinfo);
+#else
+    outfilesetup = afNewFileSetup();
+    afInitFileFormat(outfilesetup, AF_FILE_WAVE);
+    afInitChannels(outfilesetup, AF_DEFAULT_TRACK, opt_channels);
+    afInitRate(outfilesetup, AF_DEFAULT_TRACK, opt_rate);
+    afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK,
+        opt_bits == 16 ? AF_SAMPFMT_TWOSCOMP : AF_SAMPFMT_UNSIGNED, opt_bits);
+    errno = 0;
+    outfile = afOpenFile(out, "w", outfilesetup);
+    afFreeFileSetup(outfilesetup);
+#endif
+    if (!outfile) {
+        fprintf(stderr, _("%s: can't open file for writing: %s\n"), out, g_strerror(errno));
+        XM_Free(xm);
+        xm = NULL;
+        return FALSE;
+    }
+
+    /* libsndfile can handle only 16-bit samples, even when it saves a 8-bit wav */
+#if !USE_SNDFILE
+    if (opt_bits == 16) {
+#endif
+#ifdef WORDS_BIGENDIAN
+        format = ST_MIXER_FORMAT_S16_BE;
+#else
+        format = ST_MIXER_FORMAT_S16_LE;
+#endif
+#if !USE_SNDFILE
+    } else
+        format = ST_MIXER_FORMAT_U8;
+#endif
+    format |= (opt_channels == 2 ? ST_MIXER_FORMAT_STEREO : 0);
+    sndbuf = g_new(gint16, BATCH_RENDER_CHUNK * 2);
+    max_frames = opt_max_length > 0.0 ? opt_max_length * opt_rate : G_MAXUINT32;
+
+    audio_prepare_for_rendering(AUDIO_RENDER_SONG, opt_start, 0, opt_end, 0, 0);
+    do {
+        guint32 num_samples = MIN(BATCH_RENDER_CHUNK, max_frames - total);
+        gint num_written;
+
+        num_rendered = audio_mix_offline(sndbuf, num_samples, opt_rate, format, NULL);
+#if USE_SNDFILE
+        num_written = sf_writef_short(outfile, sndbuf, num_rendered);
+#else
+        num_written = afWriteFrames(outfile, AF_DEFAULT_TRACK, sndbuf, num_rendered);
+#endif
+        if (num_written != num_rendered) {
+            fprintf(stderr, _("%s: an error occured while writing to file: %s\n"), out, g_strerror(errno));
+            success = FALSE;
+            break;
+        }
+        total += num_rendered;
+        if (num_rendered != num_samples)
+            break;
+    } while (total < max_frames);
+    audio_cleanup_after_rendering();
+
+#if USE_SNDFILE
+    sf_close(outfile);
+#else
+    afCloseFile(outfile);
+#endif
+    g_free(sndbuf);
+    XM_Free(xm);
+    xm = NULL;
+
+    if (success && !opt_quiet)
+        printf("%s -> %s (%u:%02u)\n", in, out,
+            total / opt_rate / 60, total / opt_rate % 60);
+
+    return success;
+}
+
+static gchar*
+batch_render_output_name(const gchar* in)
+{
+    gchar* base = g_path_get_basename(in);
+    gchar* dot = strrchr(base, '.');
+    gchar *name, *path;
+
+    if (dot && dot != base)
+        *dot = 0;
+    name = g_strconcat(base, ".wav", NULL);
+    path = g_build_filename(opt_output_dir, name, NULL);
+    g_free(name);
+    g_free(base);
+
+    return path;
+}
+
+#endif /* USE_SNDFILE || AUDIOFILE_VERSION */
+
+int batch_render_main(int argc, char* argv[])
+{
+#if USE_SNDFILE || AUDIOFILE_VERSION
+    GOptionContext* context;
+    GError* error = NULL;
+    guint i, num_files, failed = 0;
+
+    context = g_option_context_new(_("--render INPUT OUTPUT | --render -o DIR INPUT..."));
+    g_option_context_set_summary(context, _("Renders modules into WAV files without the GUI."));
+    g_option_context_add_main_entries(context, batch_render_options, PACKAGE);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    num_files = opt_files ? g_strv_length(opt_files) : 0;
+    if (opt_output_dir ? num_files < 1 : num_files != 2) {
+        fprintf(stderr, _("Wrong number of files, see --render --help\n"));
+        return 1;
+    }
+    if ((opt_channels != 1 && opt_channels != 2) || (opt_bits != 8 && opt_bits != 16)
+        || opt_rate < 8000 || opt_rate > 192000 || opt_start < 0
+        || opt_amplification < -41.0 || opt_amplification > 20.0
+        /* The length in frames must fit the frame counter */
+        || opt_max_length < 0.0 || opt_max_length * opt_rate >= G_MAXUINT32) {
+        fprintf(stderr, _("Invalid output parameters, see --render --help\n"));
+        return 1;
+    }
+
+    gui_headless = TRUE;
+    prefs_init();
+    gui_settings_load_config();
+    if (!batch_render_set_mixer(opt_mixer))
+        return 1;
+    audio_set_amplification(powf(10.0, opt_amplification / 20.0));
+
+    if (opt_output_dir) {
+        for (i = 0; i < num_files; i++) {
+            gchar* out = batch_render_output_name(opt_files[i]);
+
+            if (!batch_render_file(opt_files[i], out))
+                failed++;
+            g_free(out);
+        }
+    } else if (!batch_render_file(opt_files[0], opt_files[1]))
+        failed++;
+
+    prefs_close();
+    g_strfreev(opt_files);
+    epoch_shutdown();
+
+    return failed ? 1 : 0;
+#else
+    fprintf(stderr, _("SoundTracker is built without WAV writing support\n"));
+    return 1;
+#endif
+}
@@ -0,0 +1,28 @@
+/*
+ * The Real SoundTracker - rendering modules from the command line (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _BATCH_RENDER_H
+#define _BATCH_RENDER_H
+
+/* `soundtracker --render ...': renders the modules given in the command line
+   into WAV files faster than realtime without initializing GTK+. argv[0] is
+   the program name, the "--render" switch is already removed. Returns the
+   exit status. */
+int batch_render_main(int argc, char* argv[]);
+
+#endif /* _BATCH_RENDER_H */
@@ -0,0 +1,552 @@
+/*
+ * The Real SoundTracker - channel freezing
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "audio.h"
+#include "channel-freeze.h"
+#include "epoch.h"
+#include "main.h"
+#include "pattern-sync.h"
+#include "xm-player.h"
+
+/* The cache is allocated in chunks of this number of frames, so a long
+   song doesn't need a huge contiguous block */
+#define FREEZE_CHUNK 65536
+/* The number of frames rendered by one channel_freeze_step() call */
+#define FREEZE_STEP 16384
+/* Delay of the validation after an edit, ms */
+#define FREEZE_VALIDATE_DELAY 300
+
+#define FREEZE_NO_OFFSET G_MAXUINT32
+
+/* Frame offsets of the rows as they are first reached while playing the
+   song from the beginning; shared by the channels frozen together */
+typedef struct {
+    gint ref_count;
+    const st_mixer* mixer;
+    gint mixfreq;
+    gboolean stereo;
+    gint song_length;
+    guint32* row_offsets; /* [songpos * 256 + patpos] */
+} freeze_timeline;
+
+/* What the channel depends on in a pattern, as of the given generation
+   and notes counter of the pattern */
+typedef struct {
+    gint generation, notes; /* -1 if not hashed yet */
+    guint64 hash;
+    guint32 used[XM_NUM_INSTRUMENTS / 32]; /* The instruments of the channel */
+} freeze_pattern_key;
+
+typedef struct {
+    freeze_timeline* timeline;
+    guint64 fingerprint;
+    freeze_pattern_key* patterns; /* [XM_NUM_PATTERNS] */
+    gsize frame_size;
+    guint32 num_frames;
+    GPtrArray* chunks;
+} freeze_cache;
+
+struct channel_freeze_job {
+    XM* xm;
+    audio_renderer* renderer;
+    guint32 mask;
+    freeze_timeline* timeline;
+    freeze_cache* caches[32];
+    guint32 position;
+    gint songpos, patpos;
+    gboolean failed;
+};
+
+/* The caches are published by the main thread and read by the audio
+   thread inside its epoch critical section; the replaced ones are freed
+   with epoch_retire_full(). The audio thread plays the caches it has
+   found at the last seek, a channel whose cache has been replaced or
+   dropped since then goes live. */
+static freeze_cache* caches[32];
+/* Changed by the audio thread only */
+static guint active = 0;
+static const freeze_cache* playing[32];
+static guint32 positions[32];
+
+static guint validate_source = 0;
+
+static void
+freeze_timeline_unref(freeze_timeline* tl)
+{
+    if (!g_atomic_int_dec_and_test(&tl->ref_count))
+        return;
+    g_free(tl->row_offsets);
+    g_free(tl);
+}
+
+static void
+freeze_cache_free(freeze_cache* c)
+{
+    if (!c)
+        return;
+    freeze_timeline_unref(c->timeline);
+    g_ptr_array_free(c->chunks, TRUE);
+    g_free(c->patterns);
+    g_free(c);
+}
+
+/* 64-bit FNV-1a */
+#define FP_INIT G_GUINT64_CONSTANT(14695981039346656037)
+#define FP_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+static guint64
+fp_add(guint64 h,
+    const void* data,
+    const gsize len)
+{
+    const guint8* p = data;
+    gsize i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ p[i]) * FP_PRIME;
+
+    return h;
+}
+
+static guint64
+fp_add_int(guint64 h,
+    const gint v)
+{
+    return fp_add(h, &v, sizeof(v));
+}
+
+static guint64
+fp_add_envelope(guint64 h,
+    const STEnvelope* env)
+{
+    h = fp_add(h, env->points, env->num_points * sizeof(env->points[0]));
+    h = fp_add(h, &env->num_points, 1);
+    h = fp_add(h, &env->sustain_point, 1);
+    h = fp_add(h, &env->loop_start, 1);
+    h = fp_add(h, &env->loop_end, 1);
+
+    return fp_add(h, &env->flags, 1);
+}
+
+/* Hashes the channel's notes and the effects of all the channels in the
+   pattern, unless the pattern hasn't been changed since the last time */
+static void
+freeze_pattern_hash(const XMPattern* pat,
+    const gint channel,
+    const gint num_channels,
+    freeze_pattern_key* key)
+{
+    const gint generation = g_atomic_int_get(&pat->sync.generation);
+    const gint notes = pattern_sync_notes_counter(pat);
+    guint64 h = FP_INIT;
+    gint j, k;
+
+    if (key->generation == generation && key->notes == notes)
+        return;
+
+    memset(key->used, 0, sizeof(key->used));
+    h = fp_add_int(h, pat->length);
+    for (j = 0; j < num_channels; j++)
+        for (k = 0; k < pat->length; k++) {
+            const XMNote* n = &pat->channels[j][k];
+
+            if (j == channel) {
+                h = fp_add(h, n, sizeof(XMNote));
+                if (n->instrument && n->instrument <= XM_NUM_INSTRUMENTS)
+                    key->used[(n->instrument - 1) / 32] |= 1u << ((n->instrument - 1) % 32);
+            } else {
+                h = fp_add(h, &n->fxtype, 1);
+                h = fp_add(h, &n->fxparam, 1);
+            }
+        }
+
+    key->generation = generation;
+    key->notes = notes;
+    key->hash = h;
+}
+
+/* Covers everything the channel's sound depends on: its notes and
+   instruments, the song structure and the effects of all the channels
+   (they can change the tempo or jump). Other channels' notes and
+   instruments don't matter. The patterns are hashed again only if their
+   generation or notes counter has changed and the sample data are
+   represented by their generation (see pattern-sync.h and sample-sync.h),
+   so the check is cheap when only a few patterns have been edited. */
+static guint64
+freeze_fingerprint(XM* xm,
+    const gint channel,
+    freeze_pattern_key patterns[])
+{
+    guint32 used[XM_NUM_INSTRUMENTS / 32] = { 0 };
+    guint64 h = FP_INIT;
+    gint i, j;
+
+    h = fp_add_int(h, xm->flags);
+    h = fp_add_int(h, xm->num_channels);
+    h = fp_add_int(h, xm->tempo);
+    h = fp_add_int(h, xm->bpm);
+    h = fp_add_int(h, xm->song_length);
+    h = fp_add_int(h, xm->restart_position);
+    h = fp_add(h, xm->pattern_order_table, xm->song_length);
+
+    for (i = 0; i < xm->song_length; i++) {
+        const gint pat = xm->pattern_order_table[i];
+        freeze_pattern_key* key = &patterns[pat];
+
+        freeze_pattern_hash(&xm->patterns[pat], channel, xm->num_channels, key);
+        h = fp_add(h, &key->hash, sizeof(key->hash));
+        for (j = 0; j < G_N_ELEMENTS(used); j++)
+            used[j] |= key->used[j];
+    }
+
+    for (i = 0; i < XM_NUM_INSTRUMENTS; i++) {
+        const STInstrument* ins = &xm->instruments[i];
+
+        if (!(used[i / 32] & (1u << (i % 32))))
+            continue;
+
+        h = fp_add_int(h, i);
+        h = fp_add_envelope(h, &ins->vol_env);
+        h = fp_add_envelope(h, &ins->pan_env);
+        h = fp_add(h, &ins->vibtype, 1);
+        h = fp_add(h, &ins->vibrate, 1);
+        h = fp_add(h, &ins->vibdepth, 1);
+        h = fp_add(h, &ins->vibsweep, 1);
+        h = fp_add_int(h, ins->volfade);
+        h = fp_add(h, ins->samplemap, sizeof(ins->samplemap));
+
+        for (j = 0; j < XM_NUM_SAMPLES; j++) {
+            const STSample* s = &ins->samples[j];
+
+            if (!s->sample.length)
+                continue;
+
+            h = fp_add_int(h, j);
+            h = fp_add_int(h, s->sample.flags);
+            h = fp_add_int(h, s->sample.length);
+            h = fp_add_int(h, s->sample.loopstart);
+            h = fp_add_int(h, s->sample.loopend);
+            h = fp_add(h, &s->volume, 1);
+            h = fp_add(h, &s->finetune, 1);
+            h = fp_add(h, &s->panning, 1);
+            h = fp_add(h, &s->relnote, 1);
+            h = fp_add_int(h, g_atomic_int_get(&s->sample.sync.generation));
+            h = fp_add(h, &s->sample.data, sizeof(s->sample.data));
+        }
+    }
+
+    return h;
+}
+
+/* Appends num_frames frames to the cache, the ones the mixer hasn't
+   processed are silent */
+static gboolean
+freeze_cache_append(freeze_cache* c,
+    const st_mixer_buffer* buf,
+    const guint32 num_frames)
+{
+    const guint8* src = buf->buffer;
+    guint32 done = 0;
+
+    while (done < num_frames) {
+        const guint32 offset = c->num_frames % FREEZE_CHUNK;
+        const guint32 n = MIN(num_frames - done, FREEZE_CHUNK - offset);
+        const guint32 n_processed = CLAMP((gint64)buf->num_processed - done, 0, n);
+        guint8* dst;
+
+        if (!offset) {
+            gpointer chunk = g_try_malloc(FREEZE_CHUNK * c->frame_size);
+
+            if (!chunk)
+                return FALSE;
+            g_ptr_array_add(c->chunks, chunk);
+        }
+        dst = (guint8*)g_ptr_array_index(c->chunks, c->chunks->len - 1) + offset * c->frame_size;
+
+        memcpy(dst, src + done * c->frame_size, n_processed * c->frame_size);
+        memset(dst + n_processed * c->frame_size, 0, (n - n_processed) * c->frame_size);
+        c->num_frames += n;
+        done += n;
+    }
+
+    return TRUE;
+}
+
+static void
+freeze_block(const st_mixer_buffer buffers[],
+    const guint32 num_frames,
+    gpointer data)
+{
+    channel_freeze_job* job = data;
+    gint i;
+
+    for (i = 0; i < 32; i++)
+        if (job->caches[i] && !freeze_cache_append(job->caches[i], &buffers[i], num_frames))
+            job->failed = TRUE;
+    job->position += num_frames;
+}
+
+static void
+freeze_tick(const xmplayer* p,
+    gpointer data)
+{
+    channel_freeze_job* job = data;
+    freeze_timeline* tl = job->timeline;
+
+    if (p->songpos == job->songpos && p->patpos == job->patpos)
+        return;
+
+    job->songpos = p->songpos;
+    job->patpos = p->patpos;
+    if (p->songpos >= 0 && p->songpos < tl->song_length && p->patpos >= 0 && p->patpos < 256) {
+        guint32* offset = &tl->row_offsets[p->songpos * 256 + p->patpos];
+
+        /* Only the first pass matters, the song is rendered until it loops */
+        if (*offset == FREEZE_NO_OFFSET)
+            *offset = job->position;
+    }
+}
+
+channel_freeze_job*
+channel_freeze_begin(XM* xm,
+    st_mixer* mixer,
+    const guint32 mask,
+    const gint mixfreq)
+{
+    const gint format = ST_MIXER_FORMAT_S16_LE | ST_MIXER_FORMAT_STEREO;
+    channel_freeze_job* job;
+    audio_renderer* r;
+    gsize frame_size;
+    gint i;
+
+    g_assert(xm != NULL);
+
+    if (!(r = audio_renderer_new(xm, mixer, mixfreq, format)))
+        return NULL;
+
+    job = g_new0(channel_freeze_job, 1);
+    job->xm = xm;
+    job->renderer = r;
+    job->mask = mask & (xm->num_channels < 32 ? (1u << xm->num_channels) - 1 : 0xffffffff);
+    job->songpos = job->patpos = -1;
+
+    job->timeline = g_new(freeze_timeline, 1);
+    job->timeline->ref_count = 1;
+    job->timeline->mixer = mixer;
+    job->timeline->mixfreq = mixfreq;
+    job->timeline->stereo = audio_renderer_is_stereo(r);
+    job->timeline->song_length = xm->song_length;
+    job->timeline->row_offsets = g_new(guint32, xm->song_length * 256);
+    memset(job->timeline->row_offsets, 0xff, xm->song_length * 256 * sizeof(guint32));
+
+    frame_size = mixer_get_buffer_sizeof(mixer->buffer_format) << (job->timeline->stereo ? 1 : 0);
+    for (i = 0; i < 32; i++)
+        if (job->mask & (1u << i)) {
+            freeze_cache* c = g_new0(freeze_cache, 1);
+
+            c->timeline = job->timeline;
+            job->timeline->ref_count++;
+            c->patterns = g_new(freeze_pattern_key, XM_NUM_PATTERNS);
+            memset(c->patterns, 0xff, XM_NUM_PATTERNS * sizeof(freeze_pattern_key));
+            c->fingerprint = freeze_fingerprint(xm, i, c->patterns);
+            c->frame_size = frame_size;
+            c->chunks = g_ptr_array_new_with_free_func(g_free);
+            job->caches[i] = c;
+        }
+
+    audio_renderer_start(r, 0, -1);
+
+    return job;
+}
+
+gboolean
+channel_freeze_step(channel_freeze_job* job)
+{
+    const guint32 n = audio_renderer_render_raw(job->renderer, FREEZE_STEP,
+        freeze_block, freeze_tick, job);
+
+    return n == FREEZE_STEP && !job->failed;
+}
+
+gboolean
+channel_freeze_finish(channel_freeze_job* job,
+    const gboolean commit)
+{
+    freeze_cache* old[32] = { NULL };
+    const gboolean failed = job->failed;
+    gint i;
+
+    audio_renderer_destroy(job->renderer);
+
+    /* Switched to the new caches at the next seek */
+    if (commit && !failed)
+        for (i = 0; i < 32; i++)
+            if (job->caches[i]) {
+                old[i] = caches[i];
+                g_atomic_pointer_set(&caches[i], job->caches[i]);
+                job->caches[i] = NULL;
+            }
+
+    for (i = 0; i < 32; i++) {
+        epoch_retire_full(old[i], (GDestroyNotify)freeze_cache_free);
+        freeze_cache_free(job->caches[i]);
+    }
+    freeze_timeline_unref(job->timeline);
+    g_free(job);
+
+    return !failed;
+}
+
+void
+channel_unfreeze(const guint32 mask)
+{
+    gint i;
+
+    for (i = 0; i < 32; i++)
+        if (mask & (1u << i) && caches[i]) {
+            freeze_cache* old = caches[i];
+
+            g_atomic_pointer_set(&caches[i], NULL);
+            epoch_retire_full(old, (GDestroyNotify)freeze_cache_free);
+        }
+}
+
+guint32
+channel_freeze_get_frozen(void)
+{
+    guint32 mask = 0;
+    gint i;
+
+    /* The caches are changed only by the main thread */
+    for (i = 0; i < 32; i++)
+        if (caches[i])
+            mask |= 1u << i;
+
+    return mask;
+}
+
+void
+channel_freeze_validate(XM* xm)
+{
+    guint32 invalid = 0;
+    gint i;
+
+    for (i = 0; i < 32; i++)
+        if (caches[i] && (!xm || caches[i]->fingerprint != freeze_fingerprint(xm, i, caches[i]->patterns)))
+            invalid |= 1u << i;
+    if (invalid)
+        channel_unfreeze(invalid);
+}
+
+static gboolean
+validate_timeout(gpointer data)
+{
+    validate_source = 0;
+    channel_freeze_validate(xm);
+
+    return FALSE;
+}
+
+void
+channel_freeze_schedule_validate(void)
+{
+    if (!validate_source && channel_freeze_get_frozen())
+        validate_source = g_timeout_add(FREEZE_VALIDATE_DELAY, validate_timeout, NULL);
+}
+
+guint32
+channel_freeze_seek(const st_mixer* mixer,
+    const gint mixfreq,
+    const gboolean stereo,
+    const gint songpos,
+    const gint patpos)
+{
+    guint32 started = 0, prev;
+    gint i;
+
+    epoch_enter();
+    for (i = 0; i < 32; i++) {
+        const freeze_cache* c = g_atomic_pointer_get(&caches[i]);
+        const freeze_timeline* tl;
+
+        playing[i] = c;
+        if (!c)
+            continue;
+        tl = c->timeline;
+        if (tl->mixer == mixer && tl->mixfreq == mixfreq && tl->stereo == stereo &&
+            songpos >= 0 && songpos < tl->song_length && patpos >= 0 && patpos < 256 &&
+            tl->row_offsets[songpos * 256 + patpos] < c->num_frames) {
+            positions[i] = tl->row_offsets[songpos * 256 + patpos];
+            started |= 1u << i;
+        }
+    }
+    prev = g_atomic_int_get(&active);
+    g_atomic_int_set(&active, started);
+    epoch_leave();
+
+    return started & ~prev;
+}
+
+void
+channel_freeze_stop(void)
+{
+    g_atomic_int_set(&active, 0);
+}
+
+guint32
+channel_freeze_get_active(void)
+{
+    return g_atomic_int_get(&active);
+}
+
+guint32
+channel_freeze_read(const gint channel,
+    void* dest,
+    const guint32 count)
+{
+    const freeze_cache* c = playing[channel];
+    guint32 done = 0;
+
+    epoch_enter();
+    /* The cache seeked to is still the published one */
+    if (c && c == g_atomic_pointer_get(&caches[channel])
+        && (g_atomic_int_get(&active) & (1u << channel))) {
+        while (done < count && positions[channel] < c->num_frames) {
+            const guint32 offset = positions[channel] % FREEZE_CHUNK;
+            const guint32 n = MIN(MIN(count - done, FREEZE_CHUNK - offset), c->num_frames - positions[channel]);
+
+            memcpy((guint8*)dest + done * c->frame_size,
+                (guint8*)g_ptr_array_index(c->chunks, positions[channel] / FREEZE_CHUNK) + offset * c->frame_size,
+                n * c->frame_size);
+            positions[channel] += n;
+            done += n;
+        }
+    }
+    /* The end of the cache, the channel is played live from now on */
+    if (done < count)
+        g_atomic_int_and(&active, ~(1u << channel));
+    epoch_leave();
+
+    return done;
+}
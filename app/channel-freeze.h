@@ -0,0 +1,81 @@
+/*
+ * The Real SoundTracker - channel freezing (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _CHANNEL_FREEZE_H
+#define _CHANNEL_FREEZE_H
+
+#include <glib.h>
+
+#include "mixer.h"
+#include "xm.h"
+
+/* A frozen channel is rendered once over the whole song into a cache,
+   which is played back during the song playing instead of the channel's
+   voices. The cache is dropped as soon as the notes, the instruments or
+   the song structure it depends on are changed.
+
+   The cache holds the raw output of the mixer, so it is used only while
+   playing with the same mixer, rate and number of output channels, with
+   no pitchbend and no tempo changes from outside the song. Otherwise the
+   channel is played live as usual. */
+
+/* --- Main thread */
+
+typedef struct channel_freeze_job channel_freeze_job;
+
+/* Starts rendering of the channels in the mask; returns NULL if the mixer
+   doesn't support it. The job is to be performed by calling
+   channel_freeze_step() until it returns FALSE. */
+channel_freeze_job* channel_freeze_begin(XM* xm,
+    st_mixer* mixer,
+    const guint32 mask,
+    const gint mixfreq);
+gboolean channel_freeze_step(channel_freeze_job* job);
+/* Installs the caches if commit is TRUE; returns FALSE if the job has
+   failed due to lack of memory */
+gboolean channel_freeze_finish(channel_freeze_job* job,
+    const gboolean commit);
+
+void channel_unfreeze(const guint32 mask);
+guint32 channel_freeze_get_frozen(void);
+/* Drops the caches which don't match the module any more */
+void channel_freeze_validate(XM* xm);
+/* The same for the current module, deferred until the current edit is over */
+void channel_freeze_schedule_validate(void);
+
+/* --- Audio thread */
+
+/* Positions the caches to the row being started; returns the mask of the
+   channels which have been switched to their caches, their voices are to
+   be stopped */
+guint32 channel_freeze_seek(const st_mixer* mixer,
+    const gint mixfreq,
+    const gboolean stereo,
+    const gint songpos,
+    const gint patpos);
+/* All the channels are played live until the next seek */
+void channel_freeze_stop(void);
+guint32 channel_freeze_get_active(void);
+/* Copies the next count frames of the channel's cache into the buffer;
+   returns the number of frames copied, less than count if the cache has
+   ended or has been dropped */
+guint32 channel_freeze_read(const gint channel,
+    void* dest,
+    const guint32 count);
+
+#endif /* _CHANNEL_FREEZE_H */
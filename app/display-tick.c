@@ -0,0 +1,196 @@
+/*
+ * The Real SoundTracker - playback-synchronized display updates
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <gtk/gtk.h>
+
+#include "audio.h"
+#include "display-tick.h"
+#include "gui.h"
+
+#define DISPLAY_TICK_HIDDEN_FREQ 4 /* Hz */
+
+typedef struct {
+    guint id;
+    gint freq;
+    gint64 due; /* Monotonic time of the next call, us */
+    display_tick_func func;
+    gpointer data;
+    gboolean removed;
+} display_tick_client;
+
+static GSList* clients = NULL;
+static guint last_id = 0;
+static guint source_tag = 0;
+static gint source_freq = 0;
+static gboolean window_hidden = FALSE, window_watched = FALSE;
+static gint dispatching = 0; /* Nesting depth of display_tick_dispatch() */
+
+static display_tick_client*
+display_tick_find(const guint id)
+{
+    GSList* l;
+
+    for (l = clients; l; l = l->next) {
+        display_tick_client* c = l->data;
+
+        if (c->id == id && !c->removed)
+            return c;
+    }
+
+    return NULL;
+}
+
+static gboolean
+display_tick_dispatch(gpointer data)
+{
+    const gint64 now = g_get_monotonic_time();
+    /* A client is called if it's due before the middle of the next tick */
+    const gint64 tolerance = G_USEC_PER_SEC / source_freq / 2;
+    gdouble time;
+    GSList* l;
+
+    /* Can happen when the audio thread stops on its own, the subscribers
+       are removed after its message is read from the pipe */
+    if (current_driver_object == NULL)
+        return TRUE;
+
+    time = current_driver->get_play_time(current_driver_object);
+    /* A client can unsubscribe itself or the others (stopping the playback
+       at the end of the song removes all of them), the removed ones are
+       only marked while the list is being walked */
+    dispatching++;
+    for (l = clients; l; l = l->next) {
+        display_tick_client* c = l->data;
+
+        if (!c->removed && now + tolerance >= c->due) {
+            c->due = MAX(c->due + G_USEC_PER_SEC / c->freq, now);
+            c->func(time, c->data);
+        }
+    }
+    if (--dispatching)
+        return TRUE;
+
+    for (l = clients; l; ) {
+        display_tick_client* c = l->data;
+
+        l = l->next;
+        if (c->removed) {
+            clients = g_slist_remove(clients, c);
+            g_free(c);
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+display_tick_reschedule(void)
+{
+    gint freq = 0;
+    GSList* l;
+
+    for (l = clients; l; l = l->next) {
+        display_tick_client* c = l->data;
+
+        if (!c->removed)
+            freq = MAX(freq, c->freq);
+    }
+    if (window_hidden)
+        freq = MIN(freq, DISPLAY_TICK_HIDDEN_FREQ);
+
+    if (freq == source_freq)
+        return;
+
+    if (source_tag)
+        g_source_remove(source_tag);
+    source_tag = freq ? g_timeout_add(1000 / freq, display_tick_dispatch, NULL) : 0;
+    source_freq = freq;
+}
+
+static gboolean
+display_tick_window_state(GtkWidget* widget,
+    GdkEventWindowState* event,
+    gpointer data)
+{
+    const gboolean hidden = (event->new_window_state
+        & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+
+    if (hidden != window_hidden) {
+        window_hidden = hidden;
+        display_tick_reschedule();
+    }
+
+    return FALSE;
+}
+
+guint
+display_tick_add(const gint freq,
+    display_tick_func func,
+    gpointer data)
+{
+    display_tick_client* c = g_new(display_tick_client, 1);
+
+    g_assert(freq > 0);
+
+    if (!window_watched && mainwindow) {
+        g_signal_connect(mainwindow, "window-state-event",
+            G_CALLBACK(display_tick_window_state), NULL);
+        window_watched = TRUE;
+    }
+
+    c->id = ++last_id;
+    c->freq = freq;
+    c->due = 0;
+    c->func = func;
+    c->data = data;
+    c->removed = FALSE;
+    clients = g_slist_append(clients, c);
+    display_tick_reschedule();
+
+    return c->id;
+}
+
+void
+display_tick_set_freq(const guint id,
+    const gint freq)
+{
+    display_tick_client* c = display_tick_find(id);
+
+    g_assert(freq > 0);
+    g_return_if_fail(c != NULL);
+
+    c->freq = freq;
+    c->due = 0;
+    display_tick_reschedule();
+}
+
+void
+display_tick_remove(const guint id)
+{
+    display_tick_client* c = display_tick_find(id);
+
+    g_return_if_fail(c != NULL);
+
+    if (dispatching)
+        c->removed = TRUE;
+    else {
+        clients = g_slist_remove(clients, c);
+        g_free(c);
+    }
+    display_tick_reschedule();
+}
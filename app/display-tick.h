@@ -0,0 +1,40 @@
+/*
+ * The Real SoundTracker - playback-synchronized display updates (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_DISPLAY_TICK_H
+#define _ST_DISPLAY_TICK_H
+
+#include <glib.h>
+
+/* All the widgets following the playback are driven by a single timer.
+   The play time is sampled once per tick and passed to every subscriber
+   which is due, so they all show the same moment. The timer runs at the
+   highest subscribed rate, slows down while the main window is hidden and
+   is stopped when there are no subscribers. */
+
+typedef void (*display_tick_func)(const gdouble time, gpointer data);
+
+/* Returns the subscription id, never 0 */
+guint display_tick_add(const gint freq,
+    display_tick_func func,
+    gpointer data);
+void display_tick_set_freq(const guint id,
+    const gint freq);
+void display_tick_remove(const guint id);
+
+#endif /* _ST_DISPLAY_TICK_H */
@@ -46,7 +46,9 @@
 #include <glib/gprintf.h>
 #include <gtk/gtk.h>
 
+#include "audio-telemetry.h"
 #include "audioconfig.h"
+#include "driver-clock.h"
 #include "driver.h"
 #include "driver-subs.h"
 #include "errors.h"
@@ -113,7 +115,8 @@ typedef struct _alsa_driver {
     snd_pcm_uframes_t p_fragsize;
     guint mf;
 
-    double starttime;
+    guint64 written; /* Frames since the start of the playback */
+    driver_clock clock;
 
     gboolean verbose;
     gboolean hwtest;
@@ -997,6 +1000,7 @@ alsa_playing (void* data)
                     }
                     continue;
                 case -EPIPE:
+                    audio_telemetry_xrun();
                     if ((res = snd_pcm_prepare(d->soundfd)) < 0) {
                         alsa_error(N_("Stream preparation error"), res);
                         DRIVER_THREAD_ERROR
@@ -1014,16 +1018,22 @@ alsa_playing (void* data)
 
                 towrite -= w;
                 buffer += w << size;
+                d->written += w;
             }
-        } else {
-            snd_timestamp_t tstamp;
 
-            snd_pcm_status(d->soundfd, status);
-            snd_pcm_status_get_tstamp(status, &tstamp);
-            d->starttime = (double)tstamp.tv_sec + (double)tstamp.tv_usec / 1e6;
+            /* The frames written minus the queued ones have been played at
+               the moment of the last hardware pointer update */
+            if (!snd_pcm_status(d->soundfd, status)) {
+                snd_htimestamp_t htstamp;
 
+                snd_pcm_status_get_htstamp(status, &htstamp);
+                if (htstamp.tv_sec || htstamp.tv_nsec)
+                    driver_clock_update(&d->clock,
+                        (gdouble)((gint64)d->written - snd_pcm_status_get_delay(status)) / d->p_mixfreq,
+                        (gint64)htstamp.tv_sec * G_USEC_PER_SEC + htstamp.tv_nsec / 1000);
+            }
+        } else
             d->firstpoll = FALSE;
-        }
         d->callback(d->sndbuf, d->p_fragsize, d->p_mixfreq, d->mf);
     DRIVER_THREAD_LOOP_END(d)
 
@@ -1111,6 +1121,7 @@ alsa_new(gboolean playback,
     alsa_driver* d = g_new(alsa_driver, 1);
 
     d->callback = callback;
+    driver_clock_init(&d->clock);
     d->device = g_strdup("hw:0,0");
     d->bits = 8;
     d->stereo = 0;
@@ -1308,9 +1319,9 @@ alsa_open(void* dp)
         goto out;
     }
 
-    // need to enable timestamping explicitly, otherwise alsa_get_play_time()
-    // will always return zero and the pattern display will not scroll in sync
-    // with the audio output, at least on my (MK's) machine.
+    // need to enable timestamping explicitly, otherwise the playback clock
+    // never gets the hardware timestamps and the pattern display will not
+    // scroll in sync with the audio output, at least on my (MK's) machine.
     err = snd_pcm_sw_params_set_tstamp_mode(d->soundfd, d->swparams, SND_PCM_TSTAMP_ENABLE);
     if (err < 0) {
         alsa_error(d->playback ? N_("Unable to enable timestamping for playback")
@@ -1362,6 +1373,8 @@ alsa_open(void* dp)
     }
     /* Waking up the driver thread */
     d->firstpoll = TRUE;
+    d->written = 0;
+    driver_clock_reset(&d->clock);
     DRIVER_THREAD_RESUME(d)
     return TRUE;
 
@@ -1374,26 +1387,8 @@ static double
 alsa_get_play_time(void* dp)
 {
     alsa_driver* const d = dp;
-    double play_time;
-
-    snd_pcm_status_t* status;
-    snd_pcm_status_alloca(&status);
-    if (!status) {
-        g_message("alsa_get_play_time(): can't allocate status");
-        return 0;
-    }
-    if (snd_pcm_status(d->soundfd, status)) {
-        g_message("alsa_get_play_time(): can't retrieve status");
-        return 0;
-    }
-
-    snd_timestamp_t tstamp;
-    snd_pcm_status_get_tstamp(status, &tstamp);
-    play_time = (double)tstamp.tv_sec + (double)tstamp.tv_usec / 1e6 - d->starttime;
-
-    g_debug("alsa_get_play_time() -> %lf", play_time);
 
-    return play_time;
+    return driver_clock_get(&d->clock);
 }
 
 static inline int
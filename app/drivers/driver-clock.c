@@ -0,0 +1,119 @@
+/*
+ * The Real SoundTracker - smoothed playback clock for the output drivers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+
+#include "driver-clock.h"
+
+#define DRIVER_CLOCK_BANDWIDTH 0.5 /* Hz */
+#define DRIVER_CLOCK_MAX_OMEGA 0.5 /* Keeps the loop stable with rare updates */
+#define DRIVER_CLOCK_MAX_ERROR 0.1 /* s, the clock is resynchronized if exceeded */
+#define DRIVER_CLOCK_MAX_DEVIATION 0.05 /* Of the device rate from the nominal one */
+#define DRIVER_CLOCK_MIN_HORIZON 20000 /* us */
+#define DRIVER_CLOCK_INITIAL_HORIZON 100000 /* us */
+
+static inline gdouble
+driver_clock_extrapolate(const driver_clock* c,
+    const gint64 now)
+{
+    return c->position + c->speed * CLAMP(now - c->time, 0, c->horizon) / 1e6;
+}
+
+void
+driver_clock_init(driver_clock* c)
+{
+    c->generation = 0;
+    c->valid = FALSE;
+}
+
+void
+driver_clock_reset(driver_clock* c)
+{
+    g_atomic_int_inc(&c->generation);
+    c->valid = FALSE;
+    g_atomic_int_inc(&c->generation);
+}
+
+void
+driver_clock_update(driver_clock* c,
+    const gdouble position,
+    const gint64 when)
+{
+    gdouble predicted = 0.0, err = 0.0;
+    gint64 now;
+
+    /* The state is kept as of the time of the report, so the error and the
+       advance of the loop refer to the same moment */
+    if (c->valid) {
+        /* Reports not newer than the last one carry no information */
+        if (when <= c->time)
+            return;
+        predicted = c->position + c->speed * (when - c->time) / 1e6;
+        err = position - predicted;
+    }
+
+    g_atomic_int_inc(&c->generation);
+    /* The readers take the time before the state, so those which have got
+       the previous state can't have read it past this moment */
+    now = g_get_monotonic_time();
+    c->floor = c->valid ? MAX(c->floor, driver_clock_extrapolate(c, now)) : 0.0;
+    if (c->valid && fabs(err) < DRIVER_CLOCK_MAX_ERROR) {
+        /* The loop coefficients are recomputed for the actual interval
+           since the reports needn't be periodic */
+        const gdouble interval = (when - c->time) / 1e6;
+        const gdouble omega = MIN(2.0 * G_PI * DRIVER_CLOCK_BANDWIDTH * interval, DRIVER_CLOCK_MAX_OMEGA);
+
+        /* The phase error is corrected by the slope until the next report
+           rather than by a jump of the clock */
+        c->position = predicted;
+        c->ratio = CLAMP(c->ratio + omega * omega * err / interval,
+            1.0 - DRIVER_CLOCK_MAX_DEVIATION, 1.0 + DRIVER_CLOCK_MAX_DEVIATION);
+        c->speed = MAX(c->ratio + G_SQRT2 * omega * err / interval, 0.0);
+        /* The readers extrapolate from the time of the report, which can
+           lag behind the moment of the update */
+        c->horizon = MAX(2 * (when - c->time), DRIVER_CLOCK_MIN_HORIZON)
+            + MAX(now - when, 0);
+    } else {
+        /* The first report, a restart or an xrun. A resync back is held
+           by the floor, so the clock only waits for the new position. */
+        c->position = position;
+        c->ratio = c->speed = 1.0;
+        c->horizon = DRIVER_CLOCK_INITIAL_HORIZON + MAX(now - when, 0);
+        c->valid = TRUE;
+    }
+    c->time = when;
+    g_atomic_int_inc(&c->generation);
+}
+
+gdouble
+driver_clock_get(driver_clock* c)
+{
+    driver_clock s;
+    gint generation;
+    const gint64 now = g_get_monotonic_time();
+
+    /* The updates are short and never wait, so spinning is fine here */
+    do {
+        generation = g_atomic_int_get(&c->generation);
+        s = *c;
+    } while ((generation & 1) || g_atomic_int_get(&c->generation) != generation);
+
+    if (!s.valid)
+        return 0.0;
+    return MAX(driver_clock_extrapolate(&s, now), s.floor);
+}
@@ -0,0 +1,60 @@
+/*
+ * The Real SoundTracker - smoothed playback clock for the output drivers (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_DRIVER_CLOCK_H
+#define _ST_DRIVER_CLOCK_H
+
+#include <glib.h>
+
+/* The driver thread reports the play position whenever it learns it (the
+   hardware pointer, the number of frames written minus the queued ones and
+   so on) together with the CLOCK_MONOTONIC time it was valid at. The
+   reports are filtered by a second-order delay-locked loop, so the clock
+   read by the GUI advances continuously at the estimated device rate and
+   doesn't follow the jitter of the reports or the wall clock steps. The
+   clock never goes back until it's reset: when a report puts it behind
+   the value it could have been read as, it stays there until the new
+   estimate catches up. */
+
+typedef struct driver_clock {
+    gint generation; /* Odd while the parameters are being updated */
+    gboolean valid;
+    gint64 time; /* Monotonic time the last report was valid at, us */
+    gint64 horizon; /* How far the position can be extrapolated, us */
+    gdouble position; /* Estimated play position at that time, s */
+    gdouble speed; /* The slope including the phase correction */
+    gdouble ratio; /* Estimated device rate relative to the nominal one */
+    gdouble floor; /* The largest value the clock could have been read as, s */
+} driver_clock;
+
+/* Must be called before the first use */
+void driver_clock_init(driver_clock* c);
+/* Forgets the history; must be called when the position starts anew */
+void driver_clock_reset(driver_clock* c);
+/* Reports that the play position was position seconds at the monotonic
+   time when (in microseconds, as g_get_monotonic_time()). Must always be
+   called by the same thread. */
+void driver_clock_update(driver_clock* c,
+    const gdouble position,
+    const gint64 when);
+/* Returns the current play position in seconds, can be called by any
+   thread. The values returned to a thread never decrease between the
+   resets. */
+gdouble driver_clock_get(driver_clock* c);
+
+#endif /* _ST_DRIVER_CLOCK_H */
@@ -21,14 +21,21 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 
+#include "audio-subs.h"
+#include "audio-telemetry.h"
+#include "driver-clock.h"
 #include "driver.h"
+#include "gui-subs.h"
 #include "mixer.h"
+#include "preferences.h"
+#include "st-subs.h"
 
 #ifdef WORDS_BIGENDIAN
 const STMixerFormat format = ST_MIXER_FORMAT_S16_BE;
@@ -43,8 +50,8 @@ typedef struct dummy_driver {
     GtkWidget* configwidget;
     void* buf;
     gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixformat);
-    double outtime;
     double playtime;
+    driver_clock clock;
     gint prebuf;
 } dummy_driver;
 
@@ -74,6 +81,7 @@ dummy_new(gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixf
     dummy_driver* d = g_new(dummy_driver, 1);
 
     d->callback = callback;
+    driver_clock_init(&d->clock);
     dummy_make_config_widgets(d);
 
     return d;
@@ -100,13 +108,12 @@ static gboolean
 dummy_open(void* dp)
 {
     dummy_driver* const d = dp;
-    struct timeval tv;
 
     /* Buffer for fake rendering necessary for working scopes, time events and so on */
     d->buf = calloc(mixer_get_resolution(format) << mixer_is_format_stereo(format), bufsize);
 
-    gettimeofday(&tv, NULL);
     d->playtime = 0.0;
+    driver_clock_reset(&d->clock);
     d->prebuf = prebuffered;
 
     d->callback(d->buf, bufsize, rate, format);
@@ -118,7 +125,6 @@ static void
 dummy_commit(void* dp)
 {
     dummy_driver* const d = dp;
-    struct timeval tv;
     const struct timespec ts = {0, 900000000LL * bufsize / rate};
 
     if (d->prebuf)
@@ -127,23 +133,17 @@ dummy_commit(void* dp)
         nanosleep(&ts, NULL);
     d->callback(d->buf, bufsize, rate, format);
 
-    gettimeofday(&tv, NULL);
-    d->outtime = tv.tv_sec + tv.tv_usec / 1e6;
     d->playtime += (double)bufsize / rate;
+    /* One buffer is being "played" */
+    driver_clock_update(&d->clock, d->playtime - (double)bufsize / rate, g_get_monotonic_time());
 }
 
 static double
 dummy_get_play_time(void* dp)
 {
     dummy_driver* const d = dp;
-    struct timeval tv;
-    double playtime;
-
-    gettimeofday(&tv, NULL);
-    playtime = d->playtime + tv.tv_sec + tv.tv_usec / 1e6 - d->outtime -
-        (double)bufsize / rate;
 
-    return playtime > 0.0 ? playtime : 0.0;
+    return driver_clock_get(&d->clock);
 }
 
 st_driver driver_out_dummy = {
@@ -168,6 +168,328 @@ st_driver driver_out_dummy = {
     NULL,
 };
 
+/* Benchmark output: the buffers are requested as fast as the engine
+   can render them. The time spent on the mixing of each one is taken from
+   the audio telemetry at the commit, so the control pipe round trip
+   doesn't count. */
+
+static const guint bench_rates[] = { 44100, 48000, 96000 };
+#define BENCH_NUM_RATES ARRAY_SIZE(bench_rates)
+/* The run is stopped after this many periods, the render times are stored
+   in an array allocated in advance */
+#define BENCH_MAX_PERIODS (1 << 20)
+
+typedef struct bench_driver {
+    GtkWidget *configwidget, *period_spin, *deadline_spin, *duration_spin, *rate_combo, *result_label;
+    gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixformat);
+
+    /* Settings */
+    gint period; /* Frames */
+    gint deadline; /* Percents of the period duration */
+    gint duration; /* Seconds of the output, 0 means until the playing stops */
+    gint rate_index;
+
+    /* The current run, accessed only by the audio thread */
+    void* buf;
+    gint run_period, run_rate;
+    guint64 frames, max_frames;
+    guint32* times; /* Render time of each period, us */
+    guint num_times, max_times;
+    gboolean stopping;
+} bench_driver;
+
+typedef struct {
+    bench_driver* d;
+    gchar* text;
+} bench_report;
+
+static gint
+bench_compare_times(gconstpointer a,
+    gconstpointer b)
+{
+    const guint32 x = *(const guint32*)a, y = *(const guint32*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+bench_percentile(const guint32 sorted[],
+    const guint len,
+    const double p)
+{
+    const guint i = MIN((guint)(p * len), len - 1);
+
+    return sorted[i] / 1000.0;
+}
+
+static gboolean
+bench_show_report(gpointer data)
+{
+    bench_report* r = data;
+    static GtkWidget* dialog = NULL;
+
+    gtk_label_set_text(GTK_LABEL(r->d->result_label), r->text);
+    gui_message_dialog(&dialog, r->text, GTK_MESSAGE_INFO, N_("Benchmark"), TRUE);
+    g_free(r->text);
+    g_free(r);
+
+    return FALSE;
+}
+
+static void
+bench_update_settings(bench_driver* d)
+{
+    d->period = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(d->period_spin));
+    d->deadline = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(d->deadline_spin));
+    d->duration = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(d->duration_spin));
+    d->rate_index = gtk_combo_box_get_active(GTK_COMBO_BOX(d->rate_combo));
+}
+
+static void
+bench_update_controls(bench_driver* d)
+{
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(d->period_spin), d->period);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(d->deadline_spin), d->deadline);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(d->duration_spin), d->duration);
+    gtk_combo_box_set_active(GTK_COMBO_BOX(d->rate_combo), d->rate_index);
+}
+
+static void
+bench_make_config_widgets(bench_driver* d)
+{
+    GtkWidget *thing, *mainbox, *hbox;
+    GtkListStore* ls;
+    GtkTreeIter iter;
+    gint i;
+
+    d->configwidget = mainbox = gtk_vbox_new(FALSE, 2);
+
+    thing = gtk_label_new(_("Renders as fast as possible and measures the time spent on every period.\n"
+                            "Start playing to run the benchmark, the results are shown when it stops."));
+    gtk_label_set_line_wrap(GTK_LABEL(thing), TRUE);
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+
+    hbox = gtk_hbox_new(FALSE, 2);
+    gtk_box_pack_start(GTK_BOX(mainbox), hbox, FALSE, FALSE, 0);
+    thing = gtk_label_new(_("Frequency [Hz]:"));
+    gtk_box_pack_start(GTK_BOX(hbox), thing, FALSE, FALSE, 0);
+    ls = gtk_list_store_new(1, G_TYPE_STRING);
+    for (i = 0; i < BENCH_NUM_RATES; i++) {
+        gchar* buf = g_strdup_printf("%u", bench_rates[i]);
+
+        gtk_list_store_append(ls, &iter);
+        gtk_list_store_set(ls, &iter, 0, buf, -1);
+        g_free(buf);
+    }
+    d->rate_combo = gui_combo_new(ls);
+    g_signal_connect_swapped(d->rate_combo, "changed", G_CALLBACK(bench_update_settings), d);
+    gtk_box_pack_end(GTK_BOX(hbox), d->rate_combo, FALSE, FALSE, 0);
+
+    gui_put_labelled_spin_button(mainbox, _("Period size [frames]:"), 16, 16384,
+        &d->period_spin, NULL, NULL, FALSE);
+    gui_put_labelled_spin_button(mainbox, _("Deadline [% of the period]:"), 1, 100,
+        &d->deadline_spin, NULL, NULL, FALSE);
+    gui_put_labelled_spin_button(mainbox, _("Duration [s], 0 - until stopped:"), 0, 3600,
+        &d->duration_spin, NULL, NULL, FALSE);
+    bench_update_controls(d);
+    g_signal_connect_swapped(d->period_spin, "value-changed", G_CALLBACK(bench_update_settings), d);
+    g_signal_connect_swapped(d->deadline_spin, "value-changed", G_CALLBACK(bench_update_settings), d);
+    g_signal_connect_swapped(d->duration_spin, "value-changed", G_CALLBACK(bench_update_settings), d);
+
+    d->result_label = gtk_label_new(NULL);
+    gtk_label_set_selectable(GTK_LABEL(d->result_label), TRUE);
+    gtk_box_pack_start(GTK_BOX(mainbox), d->result_label, FALSE, TRUE, 0);
+
+    gtk_widget_show_all(mainbox);
+}
+
+static GtkWidget*
+bench_getwidget(void* dp)
+{
+    bench_driver* const d = dp;
+
+    return d->configwidget;
+}
+
+static void*
+bench_new(gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixformat))
+{
+    bench_driver* d = g_new0(bench_driver, 1);
+
+    d->callback = callback;
+    d->period = bufsize;
+    d->deadline = 100;
+    d->duration = 0;
+    d->rate_index = 0;
+    bench_make_config_widgets(d);
+
+    return d;
+}
+
+static void
+bench_destroy(void* dp)
+{
+    bench_driver* const d = dp;
+
+    gtk_widget_destroy(d->configwidget);
+    g_free(d->times);
+    g_free(dp);
+}
+
+static gboolean
+bench_open(void* dp)
+{
+    bench_driver* const d = dp;
+
+    d->run_period = d->period;
+    d->run_rate = bench_rates[CLAMP(d->rate_index, 0, BENCH_NUM_RATES - 1)];
+    d->max_frames = (guint64)d->duration * d->run_rate;
+    d->frames = 0;
+    d->stopping = FALSE;
+    d->max_times = d->max_frames
+        ? MIN((d->max_frames + d->run_period - 1) / d->run_period, BENCH_MAX_PERIODS)
+        : BENCH_MAX_PERIODS;
+    d->times = g_new(guint32, d->max_times);
+    d->num_times = 0;
+    d->buf = calloc(mixer_get_resolution(format) << mixer_is_format_stereo(format), d->run_period);
+
+    d->callback(d->buf, d->run_period, d->run_rate, format);
+
+    return TRUE;
+}
+
+static void
+bench_release(void* dp)
+{
+    bench_driver* const d = dp;
+    const double audio = (double)d->frames / d->run_rate;
+    const double period_ms = 1000.0 * d->run_period / d->run_rate;
+    const guint32 deadline_us = 10.0 * period_ms * d->deadline;
+    double render = 0.0;
+    bench_report* r;
+    guint i, missed = 0;
+
+    free(d->buf);
+    d->buf = NULL;
+    if (!d->num_times) {
+        g_free(d->times);
+        d->times = NULL;
+        return;
+    }
+
+    for (i = 0; i < d->num_times; i++) {
+        render += d->times[i] / 1e6;
+        if (d->times[i] > deadline_us)
+            missed++;
+    }
+    qsort(d->times, d->num_times, sizeof(d->times[0]), bench_compare_times);
+
+    r = g_new(bench_report, 1);
+    r->d = d;
+    r->text = g_strdup_printf(_("Rendered %.1f s in %.2f s, realtime factor %.1f\n"
+                                "Period %d frames at %d Hz (%.2f ms), deadline %.2f ms\n"
+                                "Render time per period, ms: median %.3f, 90%% %.3f, "
+                                "99%% %.3f, 99.9%% %.3f, worst %.3f\n"
+                                "Missed deadlines: %u of %u periods"),
+        audio, render, render > 0.0 ? audio / render : 0.0,
+        d->run_period, d->run_rate, period_ms, deadline_us / 1000.0,
+        bench_percentile(d->times, d->num_times, 0.5), bench_percentile(d->times, d->num_times, 0.9),
+        bench_percentile(d->times, d->num_times, 0.99), bench_percentile(d->times, d->num_times, 0.999),
+        d->times[d->num_times - 1] / 1000.0,
+        missed, d->num_times);
+    g_free(d->times);
+    d->times = NULL;
+    /* We're in the audio thread */
+    g_idle_add(bench_show_report, r);
+}
+
+static void
+bench_commit(void* dp)
+{
+    bench_driver* const d = dp;
+
+    if (d->num_times < d->max_times)
+        d->times[d->num_times++] = audio_telemetry_last_render_us();
+    d->frames += d->run_period;
+
+    if (d->num_times == d->max_times) {
+        if (!d->stopping) {
+            d->stopping = TRUE;
+            audio_ctlpipe_write(AUDIO_CTLPIPE_STOP_PLAYING);
+        }
+        return;
+    }
+
+    d->callback(d->buf, d->run_period, d->run_rate, format);
+}
+
+static double
+bench_get_play_time(void* dp)
+{
+    bench_driver* const d = dp;
+
+    return (double)d->frames / d->run_rate;
+}
+
+static int
+bench_get_play_rate(void* dp)
+{
+    bench_driver* const d = dp;
+
+    return bench_rates[CLAMP(d->rate_index, 0, BENCH_NUM_RATES - 1)];
+}
+
+static gboolean
+bench_loadsettings(void* dp,
+    const gchar* f)
+{
+    bench_driver* const d = dp;
+
+    d->period = prefs_get_int(f, "bench-period", d->period);
+    d->deadline = prefs_get_int(f, "bench-deadline", d->deadline);
+    d->duration = prefs_get_int(f, "bench-duration", d->duration);
+    d->rate_index = prefs_get_int(f, "bench-rate", d->rate_index);
+    bench_update_controls(d);
+
+    return TRUE;
+}
+
+static gboolean
+bench_savesettings(void* dp,
+    const gchar* f)
+{
+    bench_driver* const d = dp;
+
+    prefs_put_int(f, "bench-period", d->period);
+    prefs_put_int(f, "bench-deadline", d->deadline);
+    prefs_put_int(f, "bench-duration", d->duration);
+    prefs_put_int(f, "bench-rate", d->rate_index);
+
+    return TRUE;
+}
+
+st_driver driver_out_benchmark = {
+    "Benchmark",
+
+    bench_new,
+    bench_destroy,
+
+    bench_open,
+    bench_release,
+
+    bench_getwidget,
+    bench_loadsettings,
+    bench_savesettings,
+
+    NULL,
+    NULL,
+
+    bench_commit,
+
+    bench_get_play_time,
+    bench_get_play_rate,
+};
+
 st_driver driver_in_dummy = {
     "No Input",
 
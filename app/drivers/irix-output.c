@@ -40,6 +40,7 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 
+#include "driver-clock.h"
 #include "driver.h"
 #include "driver-subs.h"
 #include "errors.h"
@@ -62,8 +63,8 @@ typedef struct irix_driver {
     gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixformat);
 
     gboolean firstpoll;
-    double outtime;
     double playtime;
+    driver_clock clock;
     DRIVER_THREAD_STUFF
 } irix_driver;
 
@@ -71,17 +72,13 @@ static void*
 irix_playing(void* data)
 {
     irix_driver* const d = data;
-    struct timeval tv;
 
     DRIVER_THREAD_LOOP_BEGIN(d, TRUE)
         if (!d->firstpoll) {
             alWriteFrames(d->sgi_port, d->audiobuffer, d->sgi_fragsize);
 
-            if (1) {
-                gettimeofday(&tv, NULL);
-                d->outtime = tv.tv_sec + tv.tv_usec / 1e6;
-                d->playtime += (double)d->sgi_fragsize / 48000;
-            }
+            d->playtime += (double)d->sgi_fragsize / 48000;
+            driver_clock_update(&d->clock, d->playtime, g_get_monotonic_time());
         }
 
         d->firstpoll = FALSE;
@@ -123,6 +120,7 @@ irix_new(gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixfo
     d->sgi_fragsize = DEFAULT_SGI_FRAGSIZE;
     d->audiobuffer = NULL;
     d->callback = callback;
+    driver_clock_init(&d->clock);
 
     DRIVER_THREAD_INIT(d)
 
@@ -207,8 +205,8 @@ irix_open(void* dp)
 
     alSetFillPoint(d->sgi_port, d->sgi_fragsize / 2);
     d->firstpoll = FALSE;
-    d->outtime = 0.0;
     d->playtime = 0.0;
+    driver_clock_reset(&d->clock);
 
     DRIVER_THREAD_RESUME(d)
     return TRUE;
@@ -223,15 +221,7 @@ irix_get_play_time(void* dp)
 {
     irix_driver* const d = dp;
 
-    if (1) {
-        struct timeval tv;
-        double curtime;
-
-        gettimeofday(&tv, NULL);
-        curtime = tv.tv_sec + tv.tv_usec / 1e6;
-
-        return d->playtime + curtime - d->outtime;
-    }
+    return driver_clock_get(&d->clock);
 }
 
 static inline int
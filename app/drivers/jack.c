@@ -53,6 +53,8 @@
 #include <glib/gprintf.h>
 #include <gtk/gtk.h>
 
+#include "audio-telemetry.h"
+#include "driver-clock.h"
 #include "driver.h"
 #include "errors.h"
 #include "gui-subs.h"
@@ -123,8 +125,8 @@ typedef struct jack_driver {
     gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixformat);
     STMixerFormat mf;
 
-    nframes_t position, lastframes; /* frames since ST called open() and the last fragment size */
-    gdouble outtime; /* Time of the last output operation */
+    nframes_t position; /* frames since ST called open() */
+    driver_clock clock;
 //    jack_driver_transport transport; /* who do we serve? */
 } jack_driver;
 
@@ -161,11 +163,18 @@ jack_driver_declick_coeff(nframes_t total, nframes_t current)
     return (float)current / (float)total;
 }
 
+static inline void
+jack_driver_clock_update(jack_driver* d)
+{
+    /* The frames processed before the current cycle are being played since its start */
+    driver_clock_update(&d->clock, (gdouble)d->position / d->sample_rate,
+        g_get_monotonic_time() - (gint64)jack_frames_since_cycle_start(d->client) * G_USEC_PER_SEC / d->sample_rate);
+}
+
 static void
 jack_driver_process_core(nframes_t nframes, jack_driver* d)
 {
     audio_t *lbuf, *rbuf;
-    struct timeval tv;
     gint16* mix = d->mixbuf;
     nframes_t cnt = nframes;
     float gain = 1.0f;
@@ -179,10 +188,8 @@ jack_driver_process_core(nframes_t nframes, jack_driver* d)
 
     case JackDriverStateIsRolling:
         d->callback(mix, nframes, d->sample_rate, d->mf);
+        jack_driver_clock_update(d);
         d->position += nframes;
-        d->lastframes = nframes;
-        gettimeofday(&tv, NULL);
-        d->outtime = (gdouble)tv.tv_sec + (gdouble)tv.tv_usec * 1.0e-6;
         while (cnt--) {
             *(lbuf++) = sample_convert_s16_to_float(*mix++);
             *(rbuf++) = sample_convert_s16_to_float(*mix++);
@@ -191,10 +198,8 @@ jack_driver_process_core(nframes_t nframes, jack_driver* d)
 
     case JackDriverStateIsDeclicking:
         d->callback(mix, (gint)nframes, (gint)d->sample_rate, (gint)d->mf);
+        jack_driver_clock_update(d);
         d->position += nframes;
-        d->lastframes = nframes;
-        gettimeofday(&tv, NULL);
-        d->outtime = (gdouble)tv.tv_sec + (gdouble)tv.tv_usec * 1.0e-6;
         while (cnt--) {
             gain = jack_driver_declick_coeff(nframes, cnt);
             *(lbuf++) = gain * sample_convert_s16_to_float(*mix++);
@@ -254,6 +259,7 @@ jack_driver_process_wrapper(nframes_t nframes, void* arg)
 
         lbuf = (audio_t*)jack_port_get_buffer(rd->left, nframes);
         rbuf = (audio_t*)jack_port_get_buffer(rd->right, nframes);
+        jack_driver_clock_update(rd);
         rd->position += nframes;
 
         g_mutex_lock(&dd->sampling_mx);
@@ -336,6 +342,21 @@ jack_driver_sample_rate_callback(nframes_t nframes, void* arg)
     return 0;
 }
 
+static int
+jack_driver_xrun_callback(void* arg)
+{
+    jack_driver *d = arg, *pd;
+
+    g_assert(d->group != NULL);
+
+    /* Only the playback xruns are of interest */
+    pd = d->group->playback;
+    if (pd && pd->is_active && pd->state == JackDriverStateIsRolling)
+        audio_telemetry_xrun();
+
+    return 0;
+}
+
 static int
 jack_driver_buffer_size_callback(nframes_t nframes, void* arg)
 {
@@ -454,6 +475,7 @@ jack_driver_activate_do(jack_driver* d)
             jack_set_process_callback(d->client, jack_driver_process_wrapper, d);
             jack_set_sample_rate_callback(d->client, jack_driver_sample_rate_callback, d);
             jack_set_buffer_size_callback(d->client, jack_driver_buffer_size_callback, d);
+            jack_set_xrun_callback(d->client, jack_driver_xrun_callback, d);
             jack_on_shutdown(d->client, jack_driver_server_has_shutdown, d);
 
             if (jack_activate(d->client)) {
@@ -576,6 +598,7 @@ jack_driver_init(jack_driver* d)
     d->mf = ST_MIXER_FORMAT_S16_LE | ST_MIXER_FORMAT_STEREO;
 #endif
     d->state = JackDriverStateIsStopped;
+    driver_clock_init(&d->clock);
     g_mutex_init(&d->process_mx);
     g_cond_init(&d->state_cv);
     jack_driver_make_config_widgets(d);
@@ -614,8 +637,7 @@ jack_driver_open(void* dp)
         return FALSE;
     }
     d->position = 0;
-    d->lastframes = 0;
-    d->outtime = 0.0;
+    driver_clock_reset(&d->clock);
     d->state = JackDriverStateIsRolling;
 
     return TRUE;
@@ -740,12 +762,8 @@ static double
 jack_driver_get_play_time(void* dp)
 {
     jack_driver* const d = dp;
-    struct timeval tv;
-
-    gettimeofday(&tv, NULL);
 
-    return (double)(d->position - d->lastframes) / (double)d->sample_rate +
-        (gdouble)tv.tv_sec + (gdouble)tv.tv_usec * 1.0e-6 - d->outtime;
+    return driver_clock_get(&d->clock);
 }
 
 static inline int
@@ -46,6 +46,7 @@
 #include <gtk/gtk.h>
 
 #include "audio-subs.h"
+#include "driver-clock.h"
 #include "driver.h"
 #include "driver-subs.h"
 #include "errors.h"
@@ -82,8 +83,8 @@ typedef struct oss_driver {
     int p_mixfreq;
     int p_fragsize;
 
-    double outtime;
     double playtime;
+    driver_clock clock;
 
     gboolean sampling;
     DRIVER_THREAD_STUFF
@@ -96,7 +97,6 @@ oss_playing(void* data)
 {
     oss_driver* const d = data;
     int w;
-    struct timeval tv;
 
     DRIVER_THREAD_LOOP_BEGIN(d, TRUE)
         if (!d->firstpoll) {
@@ -111,10 +111,17 @@ oss_playing(void* data)
                 }
             }
 
-            if (!d->realtimecaps) {
-                gettimeofday(&tv, NULL);
-                d->outtime = tv.tv_sec + tv.tv_usec / 1e6;
+            if (d->realtimecaps) {
+                count_info info;
+
+                ioctl(d->soundfd, SNDCTL_DSP_GETOPTR, &info);
+                driver_clock_update(&d->clock,
+                    (double)info.bytes / (d->stereo + 1) / (d->bits / 8) / d->playrate, g_get_monotonic_time());
+            } else {
+                /* The write has returned, so all the fragments are queued */
                 d->playtime += (double)d->fragsize / d->playrate;
+                driver_clock_update(&d->clock,
+                    d->playtime - d->numfrags * ((double)d->fragsize / d->playrate), g_get_monotonic_time());
             }
         }
 
@@ -352,6 +359,7 @@ oss_new(gboolean sampling,
     DOUBLE_BUFFER_PREINIT(d)
     d->sampling = sampling;
     d->callback = callback;
+    driver_clock_init(&d->clock);
 
     DRIVER_THREAD_INIT(d)
 
@@ -530,6 +538,7 @@ oss_open(void* dp)
     } else {
         d->firstpoll = TRUE;
         d->playtime = 0;
+        driver_clock_reset(&d->clock);
     }
     DRIVER_THREAD_RESUME(d)
 
@@ -545,21 +554,7 @@ oss_get_play_time(void* dp)
 {
     oss_driver* const d = dp;
 
-    if (d->realtimecaps) {
-        count_info info;
-
-        ioctl(d->soundfd, SNDCTL_DSP_GETOPTR, &info);
-
-        return (double)info.bytes / (d->stereo + 1) / (d->bits / 8) / d->playrate;
-    } else {
-        struct timeval tv;
-        double curtime;
-
-        gettimeofday(&tv, NULL);
-        curtime = tv.tv_sec + tv.tv_usec / 1e6;
-
-        return d->playtime + curtime - d->outtime - d->numfrags * ((double)d->fragsize / d->playrate);
-    }
+    return driver_clock_get(&d->clock);
 }
 
 static inline int
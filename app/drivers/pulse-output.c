@@ -31,6 +31,8 @@
 #include <gtk/gtk.h>
 #include <time.h>
 
+#include "audio-telemetry.h"
+#include "driver-clock.h"
 #include "driver.h"
 #include "errors.h"
 #include "gui-subs.h"
@@ -56,6 +58,7 @@ typedef struct {
     STMixerFormat format;
     PulseState state;
     gdouble starttime;
+    driver_clock clock;
 
     void* sndbuf;
     size_t len;
@@ -139,10 +142,21 @@ stream_state_callback(pa_stream* s, void* dp) {
     pa_threaded_mainloop_signal(d->mainloop, 0);
 }
 
+static void
+stream_underflow_callback(pa_stream* s, void* dp)
+{
+    pulse_driver* const d = dp;
+
+    /* The stream is corked when not playing */
+    if (d->state == PULSE_STATE_RUNNING)
+        audio_telemetry_xrun();
+}
+
 static void
 stream_write_callback(pa_stream* s, size_t length, void* dp)
 {
     pulse_driver* const d = dp;
+    pa_usec_t usec;
 
     d->len = length;
     pa_stream_begin_write(s, &d->sndbuf, &d->len);
@@ -152,6 +166,9 @@ stream_write_callback(pa_stream* s, size_t length, void* dp)
 
         /* sndbuf length is in bytes, but mixing routine gets number of samples */
         d->callback(d->sndbuf, d->len >> 2, d->rate, d->format);
+        /* The stream time is interpolated by PulseAudio from its timing info */
+        if (!pa_stream_get_time(s, &usec))
+            driver_clock_update(&d->clock, (gdouble)usec / 1.0e6 - d->starttime, g_get_monotonic_time());
     } else {
         /* Silently ignore this case and feed PulseAudio with zeroes. This can happen
            on playback stopping */
@@ -221,6 +238,7 @@ pulse_activate(void* dp, const gchar* group)
     g_free(buf);
     pa_stream_set_state_callback(d->stream, stream_state_callback, dp);
     pa_stream_set_write_callback(d->stream, stream_write_callback, dp);
+    pa_stream_set_underflow_callback(d->stream, stream_underflow_callback, dp);
 
     /* recommended settings, i.e. server uses sensible values */
     buffer_attr.maxlength = (uint32_t)-1;
@@ -336,6 +354,7 @@ pulse_open(void* dp)
     pulse_driver* const d = dp;
 
     if (d->state == PULSE_STATE_READY) {
+        driver_clock_reset(&d->clock);
         pa_threaded_mainloop_lock(d->mainloop);
         pa_stream_cork(d->stream, 0, open_success_cb, dp);
         pa_threaded_mainloop_unlock(d->mainloop);
@@ -350,11 +369,9 @@ pulse_open(void* dp)
 static double
 pulse_get_play_time(void* dp)
 {
-    pa_usec_t usec;
     pulse_driver* const d = dp;
 
-    pa_stream_get_time(d->stream, &usec);
-    return (gdouble)usec / 1.0e6 - d->starttime;
+    return driver_clock_get(&d->clock);
 }
 
 static inline int
@@ -504,6 +521,7 @@ pulse_new(gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixf
     d->mainloop = NULL;
     d->state = PULSE_STATE_NOTREADY;
     d->rate = d->native_rate = 0;
+    driver_clock_init(&d->clock);
 #ifdef WORDS_BIGENDIAN
     d->format = ST_MIXER_FORMAT_U16_BE | ST_MIXER_FORMAT_STEREO;
 #elde
@@ -33,6 +33,7 @@
 #include <gtk/gtk.h>
 
 #include "audio-subs.h"
+#include "driver-clock.h"
 #include "driver.h"
 #include "errors.h"
 #include "gui-subs.h"
@@ -48,21 +49,20 @@ typedef struct sdl_driver {
     int mf;
     gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixformat);
 
-    double outtime;
     double playtime;
+    driver_clock clock;
 } sdl_driver;
 
 void sdl_callback(void* udata, Uint8* stream, int len)
 {
     sdl_driver* const d = udata;
-    struct timeval tv;
 
     len >>= 2;
     d->callback(stream, len, d->out_rate, d->mf);
 
-    gettimeofday(&tv, NULL);
-    d->outtime = tv.tv_sec + tv.tv_usec / 1e6;
     d->playtime += (double)len / d->out_rate;
+    driver_clock_update(&d->clock, d->playtime - (double)SDL_BUFSIZE / d->out_rate * 2.0,
+        g_get_monotonic_time());
 
     SDL_Delay(1);
 }
@@ -96,6 +96,7 @@ sdl_new(gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixfor
     d->out_rate = 44100;
     d->out_channels = 2;
     d->callback = callback;
+    driver_clock_init(&d->clock);
 
     sdl_make_config_widgets(d);
 
@@ -142,6 +143,7 @@ sdl_open(void* dp)
     d->mf |= ST_MIXER_FORMAT_STEREO;
 
     d->playtime = 0.0;
+    driver_clock_reset(&d->clock);
 
     SDL_PauseAudio(0);
     return TRUE;
@@ -151,13 +153,8 @@ static double
 sdl_get_play_time(void* dp)
 {
     sdl_driver* const d = dp;
-    struct timeval tv;
-    double curtime;
 
-    gettimeofday(&tv, NULL);
-    curtime = tv.tv_sec + tv.tv_usec / 1e6;
-
-    return d->playtime + curtime - d->outtime - (double)SDL_BUFSIZE / d->out_rate * 2.0;
+    return driver_clock_get(&d->clock);
 }
 
 static int
@@ -38,6 +38,7 @@
 #include <gtk/gtk.h>
 
 #include "audio-subs.h"
+#include "driver-clock.h"
 #include "driver.h"
 #include "driver-subs.h"
 #include "errors.h"
@@ -72,8 +73,8 @@ typedef struct sun_driver {
     int p_mixfreq;
     int p_bufsize;
 
-    double outtime;
     double playtime;
+    driver_clock clock;
 
     audio_info_t info;
     DRIVER_THREAD_STUFF
@@ -86,17 +87,23 @@ sun_playing(void* data)
 {
     sun_driver* const d = data;
     static int size;
-    static struct timeval tv;
 
     DRIVER_THREAD_LOOP_BEGIN(d, TRUE)
         if (!d->firstpoll) {
             size = (d->stereo + 1) * (d->bits / 8) * d->bufsize;
             write(d->soundfd, d->sndbuf, size);
 
-            if (!d->realtimecaps) {
-                gettimeofday(&tv, NULL);
-                d->outtime = tv.tv_sec + tv.tv_usec / 1e6;
+            if (d->realtimecaps) {
+                audio_offset_t ooffs;
+
+                ioctl(d->soundfd, AUDIO_GETOOFFS, &ooffs);
+                driver_clock_update(&d->clock,
+                    (double)ooffs.samples / (d->stereo + 1) / (d->bits / 8) / d->playrate, g_get_monotonic_time());
+            } else {
+                /* The write has returned, so all the buffers are queued */
                 d->playtime += (double)d->bufsize / d->playrate;
+                driver_clock_update(&d->clock,
+                    d->playtime - d->numbufs * ((double)d->bufsize / d->playrate), g_get_monotonic_time());
             }
         }
 
@@ -309,6 +316,7 @@ sun_new(gboolean (*callback)(void *buf, guint32 count, gint mixfreq, gint mixfor
     d->soundfd = -1;
     d->sndbuf = NULL;
     d->callback = callback;
+    driver_clock_init(&d->clock);
 
     DRIVER_THREAD_INIT(d)
 
@@ -494,6 +502,7 @@ sun_open(void* dp)
 
     d->firstpoll = TRUE;
     d->playtime = 0;
+    driver_clock_reset(&d->clock);
     DRIVER_THREAD_RESUME(d)
 
     return TRUE;
@@ -508,21 +517,7 @@ sun_get_play_time(void* dp)
 {
     sun_driver* const d = dp;
 
-    if (d->realtimecaps) {
-        static audio_offset_t ooffs;
-
-        ioctl(d->soundfd, AUDIO_GETOOFFS, &ooffs);
-
-        return (double)ooffs.samples / (d->stereo + 1) / (d->bits / 8) / d->playrate;
-    } else {
-        struct timeval tv;
-        double curtime;
-
-        gettimeofday(&tv, NULL);
-        curtime = tv.tv_sec + tv.tv_usec / 1e6;
-
-        return d->playtime + curtime - d->outtime - d->numbufs * ((double)d->bufsize / d->playrate);
-    }
+    return driver_clock_get(&d->clock);
 }
 
 static inline int
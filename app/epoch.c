@@ -0,0 +1,220 @@
+/*
+ * The Real SoundTracker - epoch-based reclamation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "epoch.h"
+
+#define EPOCH_RECLAIM_INTERVAL 200 /* ms */
+/* The retired blocks are also reclaimed by epoch_retire() once there are
+   this many of them, as the timer works only while the main loop runs
+   (not in the headless mode) */
+#define EPOCH_RECLAIM_THRESHOLD 64
+/* The same for the total size of the blocks retired with their size known
+   (the sample data) */
+#define EPOCH_RECLAIM_BYTES (16 << 20)
+
+/* Every reading thread has a record with the global epoch at the moment
+   it entered its critical section, 0 outside. A retired block is stamped
+   with the epoch and advances it, so the block can be freed when no
+   thread is inside a critical section which has been entered before. */
+
+typedef struct {
+    gint epoch;
+    guint depth;
+} epoch_reader;
+
+typedef struct {
+    gpointer data;
+    GDestroyNotify destroy;
+    gsize size;
+    gint epoch;
+} epoch_retired;
+
+static gint global_epoch = 1;
+
+static GMutex readers_mutex;
+static GSList* readers = NULL;
+
+static GMutex retired_mutex;
+static GSList* retired = NULL;
+static guint num_retired = 0;
+static gsize retired_bytes = 0;
+static guint reclaim_tag = 0;
+
+static void
+reader_free(gpointer data)
+{
+    g_mutex_lock(&readers_mutex);
+    readers = g_slist_remove(readers, data);
+    g_mutex_unlock(&readers_mutex);
+    g_free(data);
+}
+
+static GPrivate current_reader = G_PRIVATE_INIT(reader_free);
+
+static epoch_reader*
+get_reader(void)
+{
+    epoch_reader* r = g_private_get(&current_reader);
+
+    /* Only once per thread */
+    if (G_UNLIKELY(!r)) {
+        r = g_new0(epoch_reader, 1);
+        g_private_set(&current_reader, r);
+        g_mutex_lock(&readers_mutex);
+        readers = g_slist_prepend(readers, r);
+        g_mutex_unlock(&readers_mutex);
+    }
+
+    return r;
+}
+
+void
+epoch_enter(void)
+{
+    epoch_reader* r = get_reader();
+
+    if (!r->depth++)
+        g_atomic_int_set(&r->epoch, g_atomic_int_get(&global_epoch));
+}
+
+void
+epoch_leave(void)
+{
+    epoch_reader* r = g_private_get(&current_reader);
+
+    g_assert(r != NULL && r->depth > 0);
+    if (!--r->depth)
+        g_atomic_int_set(&r->epoch, 0);
+}
+
+/* Frees the retired blocks no reader can be using */
+static void
+epoch_collect(void)
+{
+    GSList *l, *next, *freed = NULL;
+    gint oldest = G_MAXINT;
+
+    g_mutex_lock(&readers_mutex);
+    for (l = readers; l; l = l->next) {
+        const gint epoch = g_atomic_int_get(&((epoch_reader*)l->data)->epoch);
+
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+    g_mutex_unlock(&readers_mutex);
+
+    g_mutex_lock(&retired_mutex);
+    for (l = retired; l; l = next) {
+        epoch_retired* r = l->data;
+
+        next = l->next;
+        if (r->epoch < oldest) {
+            retired = g_slist_remove_link(retired, l);
+            freed = g_slist_concat(l, freed);
+            num_retired--;
+            retired_bytes -= r->size;
+        }
+    }
+    g_mutex_unlock(&retired_mutex);
+
+    /* Outside the lock, the destroy functions may retire something else */
+    for (l = freed; l; l = l->next) {
+        epoch_retired* r = l->data;
+
+        r->destroy(r->data);
+        g_free(r);
+    }
+    g_slist_free(freed);
+}
+
+static gboolean
+epoch_reclaim(gpointer user_data)
+{
+    gboolean pending;
+
+    epoch_collect();
+
+    g_mutex_lock(&retired_mutex);
+    pending = (retired != NULL);
+    if (!pending)
+        reclaim_tag = 0;
+    g_mutex_unlock(&retired_mutex);
+
+    return pending;
+}
+
+static void
+epoch_retire_block(gpointer data,
+    GDestroyNotify destroy,
+    const gsize size)
+{
+    epoch_retired* r;
+    gboolean collect;
+
+    if (!data)
+        return;
+
+    /* Before the block is added: it can be still referenced by the caller,
+       so it is never freed synchronously */
+    g_mutex_lock(&retired_mutex);
+    collect = num_retired >= EPOCH_RECLAIM_THRESHOLD || retired_bytes >= EPOCH_RECLAIM_BYTES;
+    g_mutex_unlock(&retired_mutex);
+    if (collect)
+        epoch_collect();
+
+    r = g_new(epoch_retired, 1);
+    r->data = data;
+    r->destroy = destroy;
+    r->size = size;
+    /* The readers entering from now on don't touch the block */
+    r->epoch = g_atomic_int_add(&global_epoch, 1);
+
+    g_mutex_lock(&retired_mutex);
+    retired = g_slist_prepend(retired, r);
+    num_retired++;
+    retired_bytes += size;
+    if (!reclaim_tag)
+        reclaim_tag = g_timeout_add(EPOCH_RECLAIM_INTERVAL, epoch_reclaim, NULL);
+    g_mutex_unlock(&retired_mutex);
+}
+
+void
+epoch_retire(gpointer data)
+{
+    epoch_retire_block(data, g_free, 0);
+}
+
+void
+epoch_retire_full(gpointer data,
+    GDestroyNotify destroy)
+{
+    epoch_retire_block(data, destroy, 0);
+}
+
+void
+epoch_retire_sized(gpointer data,
+    const gsize size)
+{
+    epoch_retire_block(data, g_free, size);
+}
+
+void
+epoch_shutdown(void)
+{
+    epoch_collect();
+}
@@ -0,0 +1,49 @@
+/*
+ * The Real SoundTracker - epoch-based reclamation (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_EPOCH_H
+#define _ST_EPOCH_H
+
+#include <glib.h>
+
+/* The realtime readers (players and mixers) dereference the shared module
+   data only between epoch_enter() and epoch_leave(). These can be nested
+   and must be called by the same thread; they never wait. */
+void epoch_enter(void);
+void epoch_leave(void);
+
+/* Frees the memory block with g_free() when no reader can be using it any
+   longer, that is after every thread which has entered its critical
+   section before the call has left it. The block must be unreachable for
+   the readers entering from now on. */
+void epoch_retire(gpointer data);
+/* The same for a block which is freed with the destroy function. The
+   function can be called by any thread. */
+void epoch_retire_full(gpointer data,
+    GDestroyNotify destroy);
+
+/* The same as epoch_retire() for a large block of the given size, the
+   memory held by such blocks is reclaimed more eagerly */
+void epoch_retire_sized(gpointer data,
+    const gsize size);
+
+/* Frees the retired blocks at exit, must be called after the readers have
+   stopped so that nothing is left */
+void epoch_shutdown(void);
+
+#endif /* _ST_EPOCH_H */
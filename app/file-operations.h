@@ -41,6 +41,7 @@ enum {
     DIALOG_SAVE_RGN_SAMPLE, /* are not included in the "File" tab */
     DIALOG_LOAD_PATTERN,
     DIALOG_SAVE_PATTERN,
+    DIALOG_SAVE_TELEMETRY,
     DIALOG_LAST
 };
 
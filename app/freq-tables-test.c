@@ -0,0 +1,123 @@
+/*
+ * The Real SoundTracker - check of the frequency and cutoff tables
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "freq-tables.h"
+#include "xm.h"
+
+/* How far beyond the tables the computed fallback is checked */
+#define FALLBACK_SPAN 4096
+
+/* The float rounding of the exponent and of the result allows that much
+   relative error */
+#define TOLERANCE 1e-6
+
+/* The reference values, independent of the way the player computes them:
+   a sample is played at 8363 Hz at the pitch 0 (C-4 of a sample without
+   relative note and finetune), an octave doubles the frequency. The
+   cutoff 255 is the half of the mixing rate, 32 steps are an octave. */
+static double
+pitch_reference(long pitch)
+{
+    return 8363.0 * exp2(-(double)pitch / (12 * 256));
+}
+
+static double
+cutoff_reference(long cutoff)
+{
+    return 0.5 * exp2((cutoff - 255) / 32.0);
+}
+
+static int
+check(const char* what,
+    const long arg,
+    const double got,
+    const double expected,
+    const double tolerance)
+{
+    if (fabs(got - expected) <= fabs(expected) * tolerance)
+        return 0;
+
+    fprintf(stderr, "%s(%ld): %.9g, expected %.9g\n", what, arg, got, expected);
+    return 1;
+}
+
+int
+main(int argc,
+    char* argv[])
+{
+    int errors = 0;
+    long i;
+
+    freq_tables_init();
+
+    /* Octaves are exact powers of two */
+    errors += check("pitch_to_freq", 0, pitch_to_freq(0), 8363.0, 0.0);
+    errors += check("pitch_to_freq", PITCH_TABLE_MIN, pitch_to_freq(PITCH_TABLE_MIN), 8363.0 * 64, 0.0);
+    errors += check("pitch_to_freq", PITCH_TABLE_MAX, pitch_to_freq(PITCH_TABLE_MAX), 8363.0 / 256, 0.0);
+    for (i = PITCH_TABLE_MIN; i <= PITCH_TABLE_MAX; i += PITCH_OCTAVE)
+        errors += check("pitch_to_freq", i, pitch_to_freq(i), pitch_reference(i), 0.0);
+
+    for (i = PITCH_TABLE_MIN; i <= PITCH_TABLE_MAX; i++) {
+        errors += check("pitch_to_freq", i, pitch_to_freq(i), pitch_reference(i), TOLERANCE);
+        /* The table must give what the formula does */
+        errors += check("pitch table", i, freq_tables_pitch[i - PITCH_TABLE_MIN], (float)pitch_to_freq_calc(i), 0.0);
+        if (i > PITCH_TABLE_MIN && !(pitch_to_freq(i) <= pitch_to_freq(i - 1))) {
+            fprintf(stderr, "pitch_to_freq(%ld): not decreasing\n", i);
+            errors++;
+        }
+    }
+    for (i = 1; i <= FALLBACK_SPAN; i++) {
+        errors += check("pitch_to_freq", PITCH_TABLE_MIN - i,
+            pitch_to_freq(PITCH_TABLE_MIN - i), pitch_reference(PITCH_TABLE_MIN - i), TOLERANCE);
+        errors += check("pitch_to_freq", PITCH_TABLE_MAX + i,
+            pitch_to_freq(PITCH_TABLE_MAX + i), pitch_reference(PITCH_TABLE_MAX + i), TOLERANCE);
+    }
+
+    for (i = 255; i >= 0; i -= 32)
+        errors += check("cutoff_to_freq", i, cutoff_to_freq(i), cutoff_reference(i), 0.0);
+    errors += check("cutoff_to_freq", 255, cutoff_to_freq(255), 0.5, 0.0);
+    for (i = 0; i < G_N_ELEMENTS(freq_tables_cutoff); i++) {
+        errors += check("cutoff_to_freq", i, cutoff_to_freq(i), cutoff_reference(i), TOLERANCE);
+        errors += check("cutoff table", i, freq_tables_cutoff[i], (float)cutoff_to_freq_calc(i), 0.0);
+    }
+    for (i = 1; i <= 256; i++) {
+        errors += check("cutoff_to_freq", -i, cutoff_to_freq(-i), cutoff_reference(-i), TOLERANCE);
+        errors += check("cutoff_to_freq", 255 + i, cutoff_to_freq(255 + i), cutoff_reference(255 + i), TOLERANCE);
+    }
+
+    /* A quarter of the period is the peak, the second half mirrors the first one */
+    errors += check("sine", 0, freq_tables_sine[0], 0.0, 0.0);
+    errors += check("sine", 64, freq_tables_sine[64], 1.0, 0.0);
+    errors += check("sine", 192, freq_tables_sine[192], -1.0, 0.0);
+    for (i = 1; i < 128; i++) {
+        if (fabs(freq_tables_sine[i] + freq_tables_sine[i + 128]) > 1e-12
+            || fabs(freq_tables_sine[i] - freq_tables_sine[128 - i]) > 1e-12) {
+            fprintf(stderr, "sine(%ld): %.17g not symmetric\n", i, freq_tables_sine[i]);
+            errors++;
+        }
+        errors += check("sine", i, freq_tables_sine[i], sin(M_PI * i / 128), 1e-12);
+    }
+
+    if (errors)
+        fprintf(stderr, "%d mismatches\n", errors);
+
+    return errors ? 1 : 0;
+}
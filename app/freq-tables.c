@@ -0,0 +1,56 @@
+/*
+ * The Real SoundTracker - channel frequency and filter cutoff tables
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+
+#include "freq-tables.h"
+#include "xm.h"
+
+float freq_tables_pitch[PITCH_TABLE_MAX - PITCH_TABLE_MIN + 1];
+float freq_tables_cutoff[256];
+double freq_tables_sine[256];
+
+double
+pitch_to_freq_calc(int pitch)
+{
+    return 8363 * pow(2, ((float)(-pitch) / (float)PITCH_OCTAVE));
+}
+
+double
+cutoff_to_freq_calc(long cutoff)
+{
+    return 0.5 * pow(2, (float)(cutoff - 255) / 32.0);
+}
+
+void
+freq_tables_init(void)
+{
+    static gsize tables_initialized = 0;
+
+    if (g_once_init_enter(&tables_initialized)) {
+        int i;
+
+        for (i = PITCH_TABLE_MIN; i <= PITCH_TABLE_MAX; i++)
+            freq_tables_pitch[i - PITCH_TABLE_MIN] = pitch_to_freq_calc(i);
+        for (i = 0; i < G_N_ELEMENTS(freq_tables_cutoff); i++)
+            freq_tables_cutoff[i] = cutoff_to_freq_calc(i);
+        for (i = 0; i < G_N_ELEMENTS(freq_tables_sine); i++)
+            freq_tables_sine[i] = sin(2 * M_PI * (double)i / 256);
+        g_once_init_leave(&tables_initialized, 1);
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * The Real SoundTracker - channel frequency and filter cutoff tables (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_FREQ_TABLES_H
+#define _ST_FREQ_TABLES_H
+
+#include <glib.h>
+
+/* The frequencies and the filter cutoffs are looked up in the tables holding
+   exactly what the formulas give, as the mixers take them (as float). The
+   pitch table covers the range of freqrange() for the linear frequencies,
+   the Amiga ones fall into it too after the conversion by mcpGetNote8363().
+   The pitches outside (not clamped yet) are computed directly.
+
+   The pitch table has an entry per pitch unit, 168 KB. A coarser table
+   interpolated or scaled by the fractional step would not give the very
+   same float as the formula, and a channel only touches the few entries
+   around its current pitch, so the size costs no cache misses. */
+#define PITCH_TABLE_MIN (-72 * 256)
+#define PITCH_TABLE_MAX (96 * 256)
+
+extern float freq_tables_pitch[PITCH_TABLE_MAX - PITCH_TABLE_MIN + 1];
+extern float freq_tables_cutoff[256];
+/* One period of the sine waveform of vibrato and tremolo, the same as
+   sin(2 * M_PI * pos / 256) */
+extern double freq_tables_sine[256];
+
+/* Fills the tables, can be called any number of times by any thread */
+void freq_tables_init(void);
+
+/* The formulas the tables are filled with */
+double pitch_to_freq_calc(int pitch);
+double cutoff_to_freq_calc(long cutoff);
+
+static inline float
+pitch_to_freq(int pitch)
+{
+    if (pitch >= PITCH_TABLE_MIN && pitch <= PITCH_TABLE_MAX)
+        return freq_tables_pitch[pitch - PITCH_TABLE_MIN];
+
+    return pitch_to_freq_calc(pitch);
+}
+
+static inline float
+cutoff_to_freq(long cutoff)
+{
+    if (cutoff >= 0 && cutoff < G_N_ELEMENTS(freq_tables_cutoff))
+        return freq_tables_cutoff[cutoff];
+
+    return cutoff_to_freq_calc(cutoff);
+}
+
+#endif /* _ST_FREQ_TABLES_H */
@@ -1073,6 +1073,7 @@ void gui_settings_load_config(void)
     gui_settings.saveinstr_path = prefs_get_string(SECTION_ALWAYS, "saveinstr-path", "~");
     gui_settings.loadpat_path = prefs_get_string(SECTION_ALWAYS, "loadpat-path", "~");
     gui_settings.savepat_path = prefs_get_string(SECTION_ALWAYS, "savepat-path", "~");
+    gui_settings.savetelemetry_path = prefs_get_string(SECTION_ALWAYS, "savetelemetry-path", "~");
 
     gui_settings.rm_path = prefs_get_string(SECTION_ALWAYS, "rm-path", "rm");
     gui_settings.unzip_path = prefs_get_string(SECTION_ALWAYS, "unzip-path", "unzip");
@@ -1175,6 +1176,7 @@ void gui_settings_save_config_always(void)
     prefs_put_string(SECTION_ALWAYS, "saveinstr-path", gui_settings.saveinstr_path);
     prefs_put_string(SECTION_ALWAYS, "loadpat-path", gui_settings.loadpat_path);
     prefs_put_string(SECTION_ALWAYS, "savepat-path", gui_settings.savepat_path);
+    prefs_put_string(SECTION_ALWAYS, "savetelemetry-path", gui_settings.savetelemetry_path);
 
     prefs_put_string(SECTION_ALWAYS, "rm-path", gui_settings.rm_path);
     prefs_put_string(SECTION_ALWAYS, "unzip-path", gui_settings.unzip_path);
@@ -104,6 +104,7 @@ typedef struct gui_prefs {
     gchar* saveinstr_path;
     gchar* loadpat_path;
     gchar* savepat_path;
+    gchar* savetelemetry_path;
 
     gchar* rm_path;
     gchar* unzip_path;
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -37,6 +38,8 @@ const gint SIZES_MENU_TOOLBOX[] = {16, 22, 0};
 const gint SIZES_MENU[] = {16, 0};
 const gint SIZES_TOOLBOX[] = {22, 0};
 
+gboolean gui_headless = FALSE;
+
 int find_current_toggle(GtkWidget** widgets, int count)
 {
     int i;
@@ -393,6 +396,11 @@ GtkWidget* gui_button(const gchar* stock,
 
 void gui_message_dialog(GtkWidget** dialog, const gchar* text, GtkMessageType type, const gchar* title, gboolean need_update)
 {
+    if (gui_headless) {
+        fprintf(stderr, "%s %s\n", _(title), text);
+        return;
+    }
+
     if (!*dialog) {
         *dialog = gtk_message_dialog_new(GTK_WINDOW(mainwindow), GTK_DIALOG_MODAL, type,
             GTK_BUTTONS_CLOSE, "%s", text);
@@ -411,6 +419,12 @@ gui_errno_dialog(GtkWidget *parent, const gchar *text, const int err)
     gchar *buf = g_strdup_printf("%s: %s", text, g_strerror(err));
     static GtkWidget *dialog = NULL;
 
+    if (gui_headless) {
+        fprintf(stderr, "%s %s\n", _("Error!"), buf);
+        g_free(buf);
+        return;
+    }
+
     if (!dialog) {
         dialog = gtk_message_dialog_new(GTK_WINDOW(parent), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR,
                                         GTK_BUTTONS_CLOSE, "%s", buf);
@@ -429,6 +443,12 @@ gui_ok_cancel_modal(GtkWidget* parent, const gchar* text)
     gint response;
     static GtkWidget* dialog = NULL;
 
+    /* Nobody to ask, the safe answer is "no" */
+    if (gui_headless) {
+        fprintf(stderr, "%s %s\n", _("Question"), text);
+        return FALSE;
+    }
+
     if (!dialog) {
         dialog = gtk_message_dialog_new(GTK_WINDOW(parent), GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_OK_CANCEL,
             NULL);
@@ -473,12 +493,18 @@ gui_filename_from_utf8(const gchar* old_name)
     gchar* name = g_filename_from_utf8(old_name, -1, NULL, NULL, &error);
 
     if (!name) {
-        dialog = gtk_message_dialog_new(GTK_WINDOW(mainwindow), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
-            _("An error occured when filename character set conversion:\n%s\n"
-              "The file operation probably failed."),
-            error->message);
-        gtk_dialog_run(GTK_DIALOG(dialog));
-        gtk_widget_destroy(dialog);
+        if (gui_headless)
+            fprintf(stderr, _("An error occured when filename character set conversion:\n%s\n"
+                "The file operation probably failed."),
+                error->message);
+        else {
+            dialog = gtk_message_dialog_new(GTK_WINDOW(mainwindow), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+                _("An error occured when filename character set conversion:\n%s\n"
+                  "The file operation probably failed."),
+                error->message);
+            gtk_dialog_run(GTK_DIALOG(dialog));
+            gtk_widget_destroy(dialog);
+        }
         g_error_free(error);
     }
 
@@ -494,12 +520,18 @@ gui_filename_to_utf8(const gchar* old_name)
     gchar* name = g_filename_to_utf8(old_name, -1, NULL, NULL, &error);
 
     if (!name) {
-        dialog = gtk_message_dialog_new(GTK_WINDOW(mainwindow), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
-            _("An error occured when filename character set conversion:\n%s\n"
-              "The file operation probably failed."),
-            error->message);
-        gtk_dialog_run(GTK_DIALOG(dialog));
-        gtk_widget_destroy(dialog);
+        if (gui_headless)
+            fprintf(stderr, _("An error occured when filename character set conversion:\n%s\n"
+                "The file operation probably failed."),
+                error->message);
+        else {
+            dialog = gtk_message_dialog_new(GTK_WINDOW(mainwindow), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+                _("An error occured when filename character set conversion:\n%s\n"
+                  "The file operation probably failed."),
+                error->message);
+            gtk_dialog_run(GTK_DIALOG(dialog));
+            gtk_widget_destroy(dialog);
+        }
         g_error_free(error);
     }
 
@@ -256,6 +256,10 @@ GtkWidget* gui_button(const gchar* stock,
     const gboolean small,
     const gboolean fill);
 
+/* Set when running without the GUI, the dialogs below just print their
+   messages to stderr then */
+extern gboolean gui_headless;
+
 gboolean gui_delete_noop(void);
 void gui_set_escape_close(GtkWidget* window);
 gboolean gui_ok_cancel_modal(GtkWidget* window, const gchar* text);
@@ -45,8 +45,10 @@
 
 #include "audio.h"
 #include "audio-subs.h"
+#include "channel-freeze.h"
 #include "clock.h"
 #include "colors.h"
+#include "display-tick.h"
 #include "extspinbutton.h"
 #include "file-operations.h"
 #include "gui-settings.h"
@@ -58,8 +60,10 @@
 #include "main.h"
 #include "menubar.h"
 #include "module-info.h"
+#include "pattern-sync.h"
 #include "playlist.h"
 #include "preferences.h"
+#include "render-queue.h"
 #include "sample-editor.h"
 #include "scope-group.h"
 #include "st-subs.h"
@@ -85,11 +89,13 @@ static GtkWidget* gui_splash_label;
 static GtkWidget* gui_splash_close_button;
 
 static gint snch_id, inch_id, tempo_spin_id, bpm_spin_id, db_id;
-static gint chan_status_timer = -1;
+static guint chan_status_tick = 0;
 static gint curinst = 0;
 static GIOChannel *audio_backpipe_channel;
 static gchar* current_filename = NULL;
 static gboolean looping_cross = TRUE, stop_process;
+static GtkWidget* render_cancel_button;
+static guint render_queue_timer = 0;
 static GtkWidget *mainwindow_upper_hbox, *mainwindow_second_hbox;
 static GtkWidget* notebook;
 static GtkWidget *spin_editpat, *spin_patlen, *spin_numchans;
@@ -533,8 +539,11 @@ static const char* res_labels[] = { N_("8 bit"), N_("16 bit") };
 struct FormatDialog{
     gboolean is_stereo, is_16bit;
     guint freq;
+    gboolean with_stems; /* Set by the caller to offer the stems export */
+    gint group_size; /* Channels per file, 0 for the whole mix */
     GtkWidget* config_dialog;
     GtkWidget *prefs_channels_w[ARRAY_SIZE(channelslabels)], *prefs_res_w[ARRAY_SIZE(res_labels)];
+    GtkWidget *stems_toggle, *stems_spin;
     GtkTreeModel* model;
 };
 
@@ -636,12 +645,27 @@ format_dialog(struct FormatDialog* self,
         g_signal_connect(thing, "changed",
             G_CALLBACK(prefs_mixfreq_changed), self);
 
+        if (self->with_stems) {
+            box2 = gtk_hbox_new(FALSE, 4);
+            gtk_box_pack_start(GTK_BOX(mainbox), box2, FALSE, TRUE, 0);
+
+            self->stems_toggle = gtk_check_button_new_with_label(_("Separate file for every channels group of"));
+            gtk_widget_set_tooltip_text(self->stems_toggle,
+                _("All the groups are rendered in one pass, silent ones are skipped"));
+            gtk_box_pack_start(GTK_BOX(box2), self->stems_toggle, FALSE, TRUE, 0);
+            self->stems_spin = extspinbutton_new(GTK_ADJUSTMENT(gtk_adjustment_new(1.0, 1.0, 32.0, 1.0, 4.0, 0.0)), 0, 0, FALSE);
+            gtk_box_pack_end(GTK_BOX(box2), self->stems_spin, FALSE, TRUE, 0);
+        }
+
         thing = gtk_hseparator_new();
         gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, FALSE, 4);
         gtk_widget_show_all(self->config_dialog);
     }
     response = gtk_dialog_run(GTK_DIALOG(self->config_dialog));
     gtk_widget_hide(self->config_dialog);
+    if (self->with_stems)
+        self->group_size = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(self->stems_toggle)) ?
+            gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(self->stems_spin)) : 0;
 
     return response == GTK_RESPONSE_OK;
 }
@@ -692,24 +716,59 @@ show_process_window(const gchar* text)
     return dialog;
 }
 
-#define SNDBUF_SIZE 16384
+#define SNDBUF_SIZE 65536
 
 #if USE_SNDFILE || AUDIOFILE_VERSION
 static void
-save_wav(const gchar* fn, const gchar* path)
+render_queue_finished(const gchar* path,
+    const gint error,
+    const gboolean cancelled,
+    gpointer data)
 {
-    static struct FormatDialog fd = {0};
+    if (error)
+        gui_errno_dialog(mainwindow, _("An error occured while writing to file"), error);
+}
 
-    gint8* sndbuf;
-    STMixerFormat format;
-    guint32 num_samples, num_rendered;
-    GtkWidget* pw;
-#if USE_SNDFILE
-    SNDFILE* outfile;
-    SF_INFO sfinfo;
-#else
-    AFfilehandle outfile;
-#endif
+static gboolean
+render_queue_update(gpointer data)
+{
+    static gchar buf[256];
+    render_queue_status status;
+
+    if (!render_queue_poll(&status, render_queue_finished, NULL)) {
+        gtk_widget_hide(render_cancel_button);
+        gui_statusbar_update(STATUS_SONG_SAVED, FALSE);
+        render_queue_timer = 0;
+        return FALSE;
+    }
+
+    if (status.path) {
+        gchar* name = g_filename_display_basename(status.path);
+
+        if (status.num_waiting)
+            snprintf(buf, sizeof(buf), _("Rendering %s: %d%% (%u more in queue)"),
+                name, status.progress / 10, status.num_waiting);
+        else
+            snprintf(buf, sizeof(buf), _("Rendering %s: %d%%"), name, status.progress / 10);
+        g_free(name);
+        gui_statusbar_update_message(buf, FALSE);
+    }
+
+    return TRUE;
+}
+
+static void
+render_cancel_clicked(void)
+{
+    render_queue_cancel();
+}
+
+/* The module is rendered in background, so one can go on playing, editing
+   or even load other modules and render them as well */
+static void
+save_wav(const gchar* fn, const gchar* path)
+{
+    static struct FormatDialog fd = { .with_stems = TRUE };
 
     if (!format_dialog(&fd, N_("File output"),
         gui_settings.file_out_channels - 1,
@@ -720,95 +779,19 @@ save_wav(const gchar* fn, const gchar* path)
     gui_settings.file_out_resolution = (fd.is_16bit << 3) + 8;
     gui_settings.file_out_mixfreq = fd.freq;
 
-#if USE_SNDFILE
-    sfinfo.channels = gui_settings.file_out_channels;
-    sfinfo.samplerate = gui_settings.file_out_mixfreq;
-    sfinfo.format = SF_FORMAT_WAV |
-        (gui_settings.file_out_resolution == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_U8);
-
-    errno = 0;
-    outfile = sf_open(path, SFM_WRITE, &sfinfo);
-#else
-    AFfilesetup outfilesetup;
-
-    outfilesetup = afNewFileSetup();
-    afInitFileFormat(outfilesetup, AF_FILE_WAVE);
-    afInitChannels(outfilesetup, AF_DEFAULT_TRACK, gui_settings.file_out_channels);
-    afInitRate(outfilesetup, AF_DEFAULT_TRACK, gui_settings.file_out_mixfreq);
-    afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK,
-        gui_settings.file_out_resolution == 16 ? AF_SAMPFMT_TWOSCOMP : AF_SAMPFMT_UNSIGNED,
-        gui_settings.file_out_resolution);
-    errno = 0;
-    outfile = afOpenFile(path, "w", outfilesetup);
-    if (outfile)
-        afFreeFileSetup(outfilesetup);
-#endif
-
-    if (!outfile) {
+    if (!render_queue_add(xm, path, render_queue_format_from_name(path), gui_settings.file_out_channels,
+        gui_settings.file_out_resolution, gui_settings.file_out_mixfreq, 0, -1, fd.group_size)) {
         gui_errno_dialog(mainwindow, _("Can't open file for writing"), errno);
         return;
     }
 
-    /* In case we're running setuid root... */
-    if (chown(path, getuid(), getgid()) == -1)
+    /* In case we're running setuid root... (stems have other names) */
+    if (!fd.group_size && chown(path, getuid(), getgid()) == -1)
         gui_errno_dialog(mainwindow, _("Can't change file ownership"), errno);
 
-    sndbuf = malloc(SNDBUF_SIZE);
-    if (!sndbuf) {
-        static GtkWidget* dialog = NULL;
-
-        gui_error_dialog(&dialog, _("Can't allocate mix buffer."), FALSE);
-        return;
-    }
-
-    gui_play_stop();
-    audio_prepare_for_rendering(AUDIO_RENDER_SONG, 0, 0, 0, 0, 0);
-
-    num_samples = (SNDBUF_SIZE >> (gui_settings.file_out_channels - 1));
-#if USE_SNDFILE
-    /* libsndfile can handle only 16-bit samples, even when it saves a 8-bit wav */
-    num_samples = num_samples >> 1;
-#else
-    num_samples = num_samples >> (gui_settings.file_out_resolution >> 4);
-    if (gui_settings.file_out_resolution == 16) {
-#endif
-#ifdef WORDS_BIGENDIAN
-        format = ST_MIXER_FORMAT_S16_BE;
-#else
-        format = ST_MIXER_FORMAT_S16_LE;
-#endif
-#if !USE_SNDFILE
-    } else
-        format = ST_MIXER_FORMAT_U8;
-#endif
-    format |= (gui_settings.file_out_channels == 2 ? ST_MIXER_FORMAT_STEREO : 0);
-
-    pw = show_process_window(N_("Saving..."));
-    do {
-        gint num_written;
-
-        num_rendered = audio_mix(sndbuf, num_samples, gui_settings.file_out_mixfreq, format, FALSE, NULL);
-#if USE_SNDFILE
-        num_written = sf_writef_short(outfile, (short int*)sndbuf, num_rendered);
-#else
-        num_written = afWriteFrames(outfile, AF_DEFAULT_TRACK, sndbuf, num_rendered);
-#endif
-        if (num_written != num_rendered) {
-            gui_errno_dialog(mainwindow, _("An error occured while writing to file"), errno);
-            break;
-        }
-        while (gtk_events_pending())
-            gtk_main_iteration();
-    } while (num_rendered == num_samples && !stop_process);
-    gtk_widget_hide(pw);
-
-    audio_cleanup_after_rendering();
-#if USE_SNDFILE
-    sf_close(outfile);
-#else
-    afCloseFile(outfile);
-#endif
-    g_free(sndbuf);
+    gtk_widget_show(render_cancel_button);
+    if (!render_queue_timer)
+        render_queue_timer = g_timeout_add(200, render_queue_update, NULL);
 }
 #endif /* USE_SNDFILE || AUDIOFILE_VERSION */
 
@@ -860,7 +843,7 @@ gui_render_to_sample(audio_render_target what,
         }
         oldbuf = newbuf;
 
-        num_rendered = audio_mix(newbuf->data, num_samples, fd.freq, format, FALSE, NULL);
+        num_rendered = audio_mix_offline(newbuf->data, num_samples, fd.freq, format, NULL);
         newbuf->length = num_rendered << (fd.is_16bit + fd.is_stereo);
         length += newbuf->length;
 
@@ -878,7 +861,7 @@ gui_render_to_sample(audio_render_target what,
 
 void
 gui_song_to_sample(void) {
-    gui_render_to_sample(AUDIO_RENDER_SONG, 0, 0, 0, 0, 0);
+    gui_render_to_sample(AUDIO_RENDER_SONG, 0, 0, -1, 0, 0);
 }
 
 void
@@ -901,6 +884,51 @@ gui_block_to_sample(void) {
             row_start, row_start + n_rows, ch_start, n_ch);
 }
 
+void
+gui_freeze_track_toggle(void)
+{
+    static GtkWidget* dialog = NULL;
+    static gchar buf[64];
+    const gint ch = tracker->cursor_ch;
+    channel_freeze_job* job;
+    GtkWidget* pw;
+    gint rate;
+
+    if (channel_freeze_get_frozen() & (1u << ch)) {
+        channel_unfreeze(1u << ch);
+        snprintf(buf, sizeof(buf), _("Track %d is unfrozen"), ch + 1);
+        gui_statusbar_update_message(buf, FALSE);
+        return;
+    }
+
+    rate = audio_get_playback_rate();
+    if (rate == -1)
+        return;
+    if (!(job = channel_freeze_begin(xm, mixer, 1u << ch, rate))) {
+        gui_warning_dialog(&dialog, _("The current mixer doesn't support track freezing"), FALSE);
+        return;
+    }
+
+    pw = show_process_window(N_("Freezing..."));
+    while (channel_freeze_step(job) && !stop_process)
+        while (gtk_events_pending())
+            gtk_main_iteration();
+    gtk_widget_hide(pw);
+
+    if (!channel_freeze_finish(job, !stop_process))
+        gui_oom_error();
+    else if (!stop_process) {
+        snprintf(buf, sizeof(buf), _("Track %d is frozen"), ch + 1);
+        gui_statusbar_update_message(buf, FALSE);
+    }
+}
+
+void
+gui_unfreeze_all_tracks(void)
+{
+    channel_unfreeze(0xffffffff);
+}
+
 typedef struct {
     gint len, channels, pat, patpos;
     /* Manual 2D indexing is supposed */
@@ -926,12 +954,14 @@ gui_pattern_undo(const gint ins, const gint smp, const gboolean redo,
     /* Current pattern is already set by undo routines */
     tmp_length = pa->len;
     pa->len = pattern->length;
+    pattern_sync_edit_begin(pattern, TRUE);
     st_set_pattern_length(pattern, tmp_length);
     for (i = 0, src_chaddr = 0, dst_chaddr = 0; i < pa->channels;
         i++, dst_chaddr += pa->len, src_chaddr += tmp_length) {
         memcpy(&tmp_notes[dst_chaddr], pattern->channels[i], pa->len * sizeof(XMNote));
         memcpy(pattern->channels[i], &pa->notes[src_chaddr], tmp_length * sizeof(XMNote));
     }
+    pattern_sync_edit_end(pattern);
     memcpy(pa->notes, tmp_notes, pa->len * pa->channels * sizeof(XMNote));
 
     if (pa->pat >= 0 && redo)
@@ -969,6 +999,7 @@ gui_log_pattern_full(XMPattern* pattern, const gchar* title, const gint pat,
     arg->channels = xm->num_channels;
     for (i = 0, chaddr = 0; i < xm->num_channels; i++, chaddr += len)
         memcpy(&arg->notes[chaddr], pattern->channels[i], chansize);
+    pattern_sync_notes_changing(pattern);
 
     history_log_action(HISTORY_ACTION_POINTER, _(title),
         HISTORY_FLAG_LOG_POS | HISTORY_FLAG_LOG_PAT |
@@ -1003,11 +1034,13 @@ song_undo(const gint ins, const gint smp, const gboolean redo,
             alloc_len = len;
             tmp_notes = g_new(XMNote, alloc_len);
         }
+        pattern_sync_edit_begin(&mod->patterns[i], TRUE);
         for (j = 0; j < mod->num_channels; j++, addr += len) {
             memcpy(tmp_notes, mod->patterns[i].channels[j], chansize);
             memcpy(mod->patterns[i].channels[j], &sa->notes[addr], chansize);
             memcpy(&sa->notes[addr], tmp_notes, chansize);
         }
+        pattern_sync_edit_end(&mod->patterns[i]);
     }
 
     g_free(tmp_notes);
@@ -1032,6 +1065,7 @@ gui_log_song(const gchar* title, XM* mod)
         for (j = 0; j < mod->num_channels; j++, addr += len) {
             memcpy(&arg->notes[addr], mod->patterns[i].channels[j], chansize);
         }
+        pattern_sync_notes_changing(&mod->patterns[i]);
     }
 
     history_log_action(HISTORY_ACTION_POINTER, _(title),
@@ -1232,9 +1266,11 @@ load_pat(const gchar* fn, const gchar* localname)
 static void
 current_instrument_changed(GtkSpinButton* spin)
 {
-    STInstrument* i = &xm->instruments[curinst = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(curins_spin)) - 1];
+    const gint n = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(curins_spin)) - 1;
+    STInstrument* i = &xm->instruments[n];
     STSample* s = &i->samples[gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(cursmpl_spin))];
 
+    g_atomic_int_set(&curinst, n);
     instrument_editor_set_instrument(i, curinst);
     sample_editor_set_sample(s);
     modinfo_set_current_instrument(curinst);
@@ -2128,35 +2164,32 @@ ch_status_foreach_func(gpointer data,
         scope_group_update_channel_status(scopegroup, p->channel, newinst, newsmpl);
 }
 
-static gboolean
-channel_status_timeout(gpointer data)
+static void
+channel_status_timeout(const gdouble time1,
+    gpointer data)
 {
-    gdouble time1 = current_driver->get_play_time(current_driver_object);
-
     time_buffer_foreach(audio_channels_status_tb, time1, ch_status_foreach_func, NULL);
     scope_group_timeout(scopegroup, time1);
-
-    return TRUE;
 }
 
 static void
 channel_status_start_updating(void)
 {
-    if (chan_status_timer != -1)
+    if (chan_status_tick)
         return;
 
-    chan_status_timer = g_timeout_add(1000 / gui_settings.scopes_update_freq,
+    chan_status_tick = display_tick_add(gui_settings.scopes_update_freq,
         channel_status_timeout, NULL);
 }
 
 static void
 channel_status_stop_updating(void)
 {
-    if (chan_status_timer == -1)
+    if (!chan_status_tick)
         return;
 
-    g_source_remove(chan_status_timer);
-    chan_status_timer = -1;
+    display_tick_remove(chan_status_tick);
+    chan_status_tick = 0;
     scope_group_stop_updating(scopegroup);
 }
 
@@ -2165,10 +2198,8 @@ gui_set_channel_status_update_freq(const gint freq)
 {
     scope_group_set_update_freq(scopegroup, freq);
 
-    if (chan_status_timer != -1) {
-        channel_status_stop_updating();
-        channel_status_start_updating();
-    }
+    if (chan_status_tick)
+        display_tick_set_freq(chan_status_tick, freq);
 }
 
 static gboolean
@@ -2302,6 +2333,10 @@ static void play_song(gpointer data)
     g_assert(xm != NULL);
 
     gui_play_stop();
+    /* Not every change is logged to the history */
+    channel_freeze_validate(xm);
+    if (gui_settings.permanent_channels)
+        audio_validate_trace_cache();
     playlist_enable(playlist, FALSE);
     audio_ctlpipe_write(AUDIO_CTLPIPE_PLAY_SONG, sp, pp, (gint)gui_settings.looped);
     wait_for_player();
@@ -2376,7 +2411,12 @@ void gui_free_xm(void)
     instrument_editor_set_instrument(NULL, 0);
     sample_editor_set_sample(NULL);
     tracker_set_pattern(tracker, NULL);
-    XM_Free(xm);
+    channel_unfreeze(0xffffffff);
+#if USE_SNDFILE || AUDIOFILE_VERSION
+    /* A module still being rendered is freed by the render queue later */
+    if (!render_queue_take_module(xm))
+#endif
+        XM_Free(xm);
     xm = NULL;
 }
 
@@ -2700,6 +2740,11 @@ int gui_get_current_instrument(void)
     return gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(curins_spin));
 }
 
+int gui_peek_current_instrument(void)
+{
+    return g_atomic_int_get(&curinst) + 1;
+}
+
 void gui_offset_current_instrument(int offset)
 {
     int nv, v;
@@ -2915,6 +2960,14 @@ int gui_splash(void)
 gboolean
 quit_requested(void)
 {
+#if USE_SNDFILE || AUDIOFILE_VERSION
+    if (render_queue_timer) {
+        if (!gui_ok_cancel_modal(mainwindow,
+                _("Rendering into file is in progress.\nAre you sure you want to stop it and quit?")))
+            return TRUE;
+        render_queue_cancel_all();
+    }
+#endif
     if (history_get_modified()) {
         if (gui_ok_cancel_modal(mainwindow,
                 _("Are you sure you want to quit?\nAll changes will be lost!")))
@@ -2995,64 +3048,43 @@ void gui_amp_estimate(void)
         gint rate = audio_get_playback_rate();
 
         if (rate != -1) {
-#define EST_BUFSIZE 65536
+#define EST_CHUNK 16384
 #ifdef WORDS_BIGENDIAN
             const gint format = ST_MIXER_FORMAT_S16_BE | ST_MIXER_FORMAT_STEREO;
 #else
             const gint format = ST_MIXER_FORMAT_S16_LE | ST_MIXER_FORMAT_STEREO;
 #endif
-            const guint32 num_samples =
-                (EST_BUFSIZE / mixer_get_resolution(format)) >> mixer_is_format_stereo(format);
+            /* The song is rendered once by a renderer of its own, so the playback
+               and the current amplification are not affected */
+            audio_renderer* r = audio_renderer_new(xm, mixer, rate, format);
             guint32 num_rendered;
-            gint16* est_buf = malloc(EST_BUFSIZE);
-            gboolean clipping;
-            gint16 min_val, max_val;
-            gfloat amp = 1.0;
+            float sample_peak = 0.0, true_peak = 0.0;
             GtkWidget* pw;
 
+            if (!r)
+                return;
+
             pw = show_process_window(N_("Estimating..."));
-            gui_play_stop();
+            audio_renderer_start(r, 0, -1);
             do {
-                /* We start estimation from the normal amplification level */
-                audio_set_amplification(amp);
-                audio_prepare_for_rendering(AUDIO_RENDER_SONG, 0, 0, 0, 0, 0);
-
-                min_val = max_val = 0;
-                clipping = FALSE;
-                do {
-                    guint i;
-
-                    num_rendered = audio_mix(est_buf, num_samples, rate, format, FALSE, &clipping);
-                    for(i = 0; i < EST_BUFSIZE / sizeof(gint16); i++) {
-                        if (est_buf[i] > max_val)
-                            max_val = est_buf[i];
-                        if (est_buf[i] < min_val)
-                            min_val = est_buf[i];
-                    }
-                    while (gtk_events_pending())
-                        gtk_main_iteration();
-                } while (num_rendered == num_samples && !clipping && !stop_process);
-
-                audio_cleanup_after_rendering();
-                /* Clipping occured, decrease amplification and make the next attempt */
-                if (clipping)
-                    amp /= 2.0;
-            } while (clipping && !stop_process);
+                num_rendered = audio_renderer_measure(r, EST_CHUNK, &sample_peak, &true_peak);
+                while (gtk_events_pending())
+                    gtk_main_iteration();
+            } while (num_rendered == EST_CHUNK && !stop_process);
             gtk_widget_hide(pw);
-
-            if (stop_process) /* restoring the old value on explicit stop */
-                audio_set_amplification(powf(10.0, (20.0 - gtk_adjustment_get_value(adj_amplification)) / 20.0));
-            else {
-                max_val = MAX(abs(min_val), abs(max_val));
-                if (max_val == 0) /* Nothing to do for a silent module, restoring the old value */
-                    audio_set_amplification(powf(10.0, (20.0 - gtk_adjustment_get_value(adj_amplification)) / 20.0));
-                else {
-                    /* 0.9 to be at the safe side */
-                    amp = CLAMP(amp * 0.9 * 32768.0 / max_val, 0.01, 10.0);
-                    gtk_adjustment_set_value(adj_amplification, 20.0 * (1.0 - log10f(amp)));
-                }
+            audio_renderer_destroy(r);
+
+            /* Nothing to do on explicit stop or for a silent module */
+            if (!stop_process && true_peak > 0.0) {
+                static gchar buf[128];
+                /* -1 dBTP to be at the safe side */
+                const gfloat amp = CLAMP(32767.0 * 0.891 / true_peak, 0.01, 10.0);
+
+                gtk_adjustment_set_value(adj_amplification, 20.0 * (1.0 - log10f(amp)));
+                snprintf(buf, sizeof(buf), _("Peak: %.1f dBFS, true peak: %.1f dBTP (without amplification)"),
+                    20.0 * log10f(sample_peak / 32768.0), 20.0 * log10f(true_peak / 32768.0));
+                gui_statusbar_update_message(buf, FALSE);
             }
-            g_free(est_buf);
         }
     }
 }
@@ -3176,7 +3208,13 @@ int gui_final(int argc, char* argv[])
     static const gchar** save_mod_formats[] = { save_mod_f, NULL };
 #if USE_SNDFILE || AUDIOFILE_VERSION
     static const gchar* wav_f[] = { N_("Microsoft RIFF (*.wav)"), "*.[wW][aA][vV]", NULL };
+#if USE_SNDFILE
+    static const gchar* flac_f[] = { N_("FLAC (*.flac)"), "*.[fF][lL][aA][cC]", NULL };
+    static const gchar* ogg_f[] = { N_("Ogg Vorbis (*.ogg)"), "*.[oO][gG][gG]", NULL };
+    static const gchar** wav_formats[] = { wav_f, flac_f, ogg_f, NULL };
+#else
     static const gchar** wav_formats[] = { wav_f, NULL };
+#endif
 #endif
     static const gchar* xp_f[] = { N_("Extended pattern (*.xp)"), "*.[xX][pP]", NULL };
     static const gchar** xp_formats[] = { xp_f, NULL };
@@ -3681,6 +3719,21 @@ int gui_final(int argc, char* argv[])
     gtk_widget_show(status_bar);
     gtk_container_add(GTK_CONTAINER(thing), status_bar);
 
+#if USE_SNDFILE || AUDIOFILE_VERSION
+    /* Shown only while rendering in background */
+    render_cancel_button = gtk_button_new();
+    gtk_button_set_relief(GTK_BUTTON(render_cancel_button), GTK_RELIEF_NONE);
+    gtk_container_add(GTK_CONTAINER(render_cancel_button),
+        gtk_image_new_from_stock(GTK_STOCK_CANCEL, GTK_ICON_SIZE_MENU));
+    gtk_widget_show_all(render_cancel_button);
+    gtk_widget_set_no_show_all(render_cancel_button, TRUE);
+    gtk_widget_hide(render_cancel_button);
+    gtk_widget_set_tooltip_text(render_cancel_button, _("Stop rendering the current file"));
+    gtk_box_pack_start(GTK_BOX(hbox), render_cancel_button, FALSE, FALSE, 0);
+    g_signal_connect(render_cancel_button, "clicked",
+        G_CALLBACK(render_cancel_clicked), NULL);
+#endif
+
     thing = gtk_frame_new(NULL);
     gtk_widget_show(thing);
     gtk_box_pack_start(GTK_BOX(hbox), thing, FALSE, FALSE, 0);
@@ -125,6 +125,8 @@ void gui_set_current_position(int n);
 void gui_update_pattern_data(void);
 
 int gui_get_current_instrument(void);
+/* The same, but can be called by any thread */
+int gui_peek_current_instrument(void);
 int gui_get_current_sample(void);
 int gui_get_current_pattern(void);
 int gui_get_current_position(void);
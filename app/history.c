@@ -23,6 +23,7 @@
 
 #include <glib/gi18n.h>
 
+#include "channel-freeze.h"
 #include "gui-settings.h"
 #include "gui.h"
 #include "history.h"
@@ -162,6 +163,7 @@ undo_redo_common(Action* element, const gboolean redo)
     }
     update_menus();
     gui_update_title(NULL);
+    channel_freeze_schedule_validate();
 
     in_history = FALSE;
 }
@@ -323,6 +325,8 @@ history_log_action_full(HistoryActionType type,
 
     /* Sanity check to make debugging easier */
     g_assert(history_check_size(arg_size));
+    /* The action is logged before the change is made */
+    channel_freeze_schedule_validate();
 
     if (history_skip || in_history)
         return HISTORY_STATUS_OK;
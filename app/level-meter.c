@@ -0,0 +1,391 @@
+/*
+ * The Real SoundTracker - signal level measurement
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "level-meter.h"
+
+/* The signal is processed in blocks of this size per channel */
+#define METER_BLOCK 256
+
+/* Maxima and sums are accumulated in this many independent lanes, each
+   lane loop has a fixed trip count and is vectorized by the compiler */
+#define METER_LANES 8
+
+/* True peak interpolator: 48-tap windowed sinc split into 4 phases */
+#define TP_PHASES 4
+#define TP_TAPS 12
+
+static float tp_coefs[TP_PHASES][TP_TAPS];
+
+struct peak_meter {
+    gint num_channels;
+    float sample_peak, true_peak;
+    /* Last TP_TAPS - 1 samples of the previous block followed by the current one */
+    float x[2][TP_TAPS - 1 + METER_BLOCK];
+};
+
+static void
+tp_init_coefs(void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        const gint n = TP_PHASES * TP_TAPS;
+        gint i, p;
+
+        for (i = 0; i < n; i++) {
+            const double t = (i - (n - 1) / 2.0) / TP_PHASES;
+            const double w = 0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / n);
+
+            tp_coefs[i % TP_PHASES][i / TP_PHASES] = (t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t)) * w;
+        }
+        /* Unity gain for every phase */
+        for (p = 0; p < TP_PHASES; p++) {
+            double sum = 0.0;
+
+            for (i = 0; i < TP_TAPS; i++)
+                sum += tp_coefs[p][i];
+            for (i = 0; i < TP_TAPS; i++)
+                tp_coefs[p][i] /= sum;
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+peak_meter*
+peak_meter_new(const gint num_channels)
+{
+    peak_meter* m;
+
+    g_assert(num_channels == 1 || num_channels == 2);
+
+    tp_init_coefs();
+    m = g_new0(peak_meter, 1);
+    m->num_channels = num_channels;
+
+    return m;
+}
+
+void
+peak_meter_destroy(peak_meter* m)
+{
+    g_free(m);
+}
+
+void
+peak_meter_reset(peak_meter* m)
+{
+    m->sample_peak = m->true_peak = 0.0;
+    memset(m->x, 0, sizeof(m->x));
+}
+
+void
+peak_meter_process(peak_meter* m,
+    const float* data,
+    guint32 count)
+{
+    const gint nch = m->num_channels;
+
+    while (count) {
+        const guint32 n = MIN(count, METER_BLOCK);
+        gint c;
+
+        for (c = 0; c < nch; c++) {
+            float* restrict x = m->x[c];
+            float sp[METER_LANES] = { 0.0 }, tp[METER_LANES] = { 0.0 };
+            guint32 i, j;
+            gint p, k;
+
+            for (i = 0; i < n; i++)
+                x[TP_TAPS - 1 + i] = data[i * nch + c];
+
+            for (i = 0; i + METER_LANES <= n; i += METER_LANES)
+                for (j = 0; j < METER_LANES; j++)
+                    sp[j] = MAX(sp[j], fabsf(x[TP_TAPS - 1 + i + j]));
+            for (j = 0; i < n; i++, j++)
+                sp[j] = MAX(sp[j], fabsf(x[TP_TAPS - 1 + i]));
+
+            /* The outputs of a phase are computed METER_LANES at a time */
+            for (p = 0; p < TP_PHASES; p++) {
+                const float* restrict h = tp_coefs[p];
+
+                for (i = 0; i + METER_LANES <= n; i += METER_LANES) {
+                    float acc[METER_LANES] = { 0.0 };
+
+                    for (k = 0; k < TP_TAPS; k++)
+                        for (j = 0; j < METER_LANES; j++)
+                            acc[j] += h[k] * x[TP_TAPS - 1 + i + j - k];
+                    for (j = 0; j < METER_LANES; j++)
+                        tp[j] = MAX(tp[j], fabsf(acc[j]));
+                }
+                for (j = 0; i < n; i++, j++) {
+                    float acc = 0.0;
+
+                    for (k = 0; k < TP_TAPS; k++)
+                        acc += h[k] * x[TP_TAPS - 1 + i - k];
+                    tp[j] = MAX(tp[j], fabsf(acc));
+                }
+            }
+
+            for (j = 0; j < METER_LANES; j++) {
+                m->sample_peak = MAX(m->sample_peak, sp[j]);
+                m->true_peak = MAX(m->true_peak, tp[j]);
+            }
+            /* The interpolated signal can't peak lower than the original one */
+            m->true_peak = MAX(m->true_peak, m->sample_peak);
+            memmove(x, x + n, (TP_TAPS - 1) * sizeof(x[0]));
+        }
+
+        data += n * nch;
+        count -= n;
+    }
+}
+
+void
+peak_meter_get(const peak_meter* m,
+    float* sample_peak,
+    float* true_peak)
+{
+    if (sample_peak)
+        *sample_peak = m->sample_peak;
+    if (true_peak)
+        *true_peak = m->true_peak;
+}
+
+/* K-weighting is a high shelf followed by a high pass, both are computed
+   for the actual rate from their analog prototypes */
+#define KW_SHELF_F0 1681.974450955533
+#define KW_SHELF_GAIN 3.999843853973347
+#define KW_SHELF_Q 0.7071752369554196
+#define KW_HP_F0 38.13547087602444
+#define KW_HP_Q 0.5003270373238773
+
+/* Gating blocks of 100 ms */
+#define LM_MOMENTARY_BLOCKS 4
+#define LM_SHORT_TERM_BLOCKS 30
+
+typedef struct {
+    double b0, b1, b2, a1, a2;
+} biquad;
+
+struct loudness_meter {
+    gint num_channels;
+    guint32 block_len, block_pos;
+    biquad stage[2];
+    /* Filter states; both channels are always filtered side by side, the
+       second one is ignored for mono */
+    double z1[2][2], z2[2][2];
+    double block_sum;
+    float blocks[LM_SHORT_TERM_BLOCKS];
+    gint block_idx, num_blocks;
+    float momentary, short_term;
+};
+
+loudness_meter*
+loudness_meter_new(void)
+{
+    loudness_meter* m = g_new0(loudness_meter, 1);
+
+    m->num_channels = 1;
+    m->block_len = 4800;
+    m->stage[0].b0 = m->stage[1].b0 = 1.0;
+    loudness_meter_reset(m);
+
+    return m;
+}
+
+void
+loudness_meter_destroy(loudness_meter* m)
+{
+    g_free(m);
+}
+
+void
+loudness_meter_configure(loudness_meter* m,
+    const gint num_channels,
+    const gint rate)
+{
+    double k, vh, vb, a0;
+
+    g_assert(num_channels == 1 || num_channels == 2);
+    g_assert(rate > 0);
+
+    m->num_channels = num_channels;
+    m->block_len = MAX(rate / 10, 1);
+
+    k = tan(M_PI * KW_SHELF_F0 / rate);
+    vh = pow(10.0, KW_SHELF_GAIN / 20.0);
+    vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / KW_SHELF_Q + k * k;
+    m->stage[0].b0 = (vh + vb * k / KW_SHELF_Q + k * k) / a0;
+    m->stage[0].b1 = 2.0 * (k * k - vh) / a0;
+    m->stage[0].b2 = (vh - vb * k / KW_SHELF_Q + k * k) / a0;
+    m->stage[0].a1 = 2.0 * (k * k - 1.0) / a0;
+    m->stage[0].a2 = (1.0 - k / KW_SHELF_Q + k * k) / a0;
+
+    k = tan(M_PI * KW_HP_F0 / rate);
+    a0 = 1.0 + k / KW_HP_Q + k * k;
+    m->stage[1].b0 = 1.0;
+    m->stage[1].b1 = -2.0;
+    m->stage[1].b2 = 1.0;
+    m->stage[1].a1 = 2.0 * (k * k - 1.0) / a0;
+    m->stage[1].a2 = (1.0 - k / KW_HP_Q + k * k) / a0;
+
+    loudness_meter_reset(m);
+}
+
+void
+loudness_meter_reset(loudness_meter* m)
+{
+    memset(m->z1, 0, sizeof(m->z1));
+    memset(m->z2, 0, sizeof(m->z2));
+    m->block_pos = 0;
+    m->block_sum = 0.0;
+    m->block_idx = m->num_blocks = 0;
+    m->momentary = m->short_term = LOUDNESS_METER_FLOOR;
+}
+
+static inline float
+lm_loudness(const double mean_sq)
+{
+    return mean_sq > 0.0 ? MAX(-0.691 + 10.0 * log10(mean_sq), LOUDNESS_METER_FLOOR) : LOUDNESS_METER_FLOOR;
+}
+
+static void
+lm_finish_block(loudness_meter* m)
+{
+    double sum = 0.0;
+    gint i;
+
+    m->blocks[m->block_idx] = m->block_sum / m->block_len;
+    m->block_idx = (m->block_idx + 1) % LM_SHORT_TERM_BLOCKS;
+    if (m->num_blocks < LM_SHORT_TERM_BLOCKS)
+        m->num_blocks++;
+    m->block_sum = 0.0;
+    m->block_pos = 0;
+
+    /* The blocks not measured yet are treated as silence */
+    for (i = 1; i <= LM_SHORT_TERM_BLOCKS; i++) {
+        if (i <= m->num_blocks)
+            sum += m->blocks[(m->block_idx + LM_SHORT_TERM_BLOCKS - i) % LM_SHORT_TERM_BLOCKS];
+        if (i == LM_MOMENTARY_BLOCKS)
+            m->momentary = lm_loudness(sum / LM_MOMENTARY_BLOCKS);
+    }
+    m->short_term = lm_loudness(sum / LM_SHORT_TERM_BLOCKS);
+}
+
+void
+loudness_meter_process(loudness_meter* m,
+    const float* data,
+    guint32 count)
+{
+    /* Mono is read as both channels, the second one with zero weight */
+    const guint32 nch = m->num_channels, cmask = nch - 1;
+    const double weight[2] = { 1.0, nch == 2 ? 1.0 : 0.0 };
+
+    while (count) {
+        const guint32 n = MIN(count, m->block_len - m->block_pos);
+        double sum[2] = { 0.0, 0.0 };
+        guint32 i;
+
+        /* The filters are recursive, so the only independent work is the
+           channels; each of them has its own state and sum */
+        for (i = 0; i < n; i++) {
+            gint c, s;
+
+            for (c = 0; c < 2; c++) {
+                double x = data[i * nch + (c & cmask)];
+
+                for (s = 0; s < 2; s++) {
+                    const biquad* f = &m->stage[s];
+                    const double y = f->b0 * x + m->z1[s][c];
+
+                    m->z1[s][c] = f->b1 * x - f->a1 * y + m->z2[s][c];
+                    m->z2[s][c] = f->b2 * x - f->a2 * y;
+                    x = y;
+                }
+                sum[c] += weight[c] * x * x;
+            }
+        }
+
+        m->block_sum += sum[0] + sum[1];
+        m->block_pos += n;
+        if (m->block_pos == m->block_len)
+            lm_finish_block(m);
+        data += n * nch;
+        count -= n;
+    }
+}
+
+void
+loudness_meter_get(const loudness_meter* m,
+    float* momentary,
+    float* short_term)
+{
+    if (momentary)
+        *momentary = m->momentary;
+    if (short_term)
+        *short_term = m->short_term;
+}
+
+#define LEVEL_ACCUMULATE(data, count, scale, sum_sq, peak) { \
+        float sq[METER_LANES] = { 0.0 }, pk[METER_LANES] = { 0.0 }; \
+        guint32 i, j; \
+\
+        for (i = 0; i + METER_LANES <= count; i += METER_LANES) \
+            for (j = 0; j < METER_LANES; j++) { \
+                const float v = data[i + j] * scale; \
+\
+                sq[j] += v * v; \
+                pk[j] = MAX(pk[j], fabsf(v)); \
+            } \
+        for (j = 0; i < count; i++, j++) { \
+            const float v = data[i] * scale; \
+\
+            sq[j] += v * v; \
+            pk[j] = MAX(pk[j], fabsf(v)); \
+        } \
+        for (j = 0; j < METER_LANES; j++) { \
+            *sum_sq += sq[j]; \
+            *peak = MAX(*peak, pk[j]); \
+        } \
+    }
+
+void
+level_accumulate_int(const gint* restrict data,
+    const guint32 count,
+    const float scale,
+    float* sum_sq,
+    float* peak)
+{
+    LEVEL_ACCUMULATE(data, count, scale, sum_sq, peak);
+}
+
+void
+level_accumulate_float(const float* restrict data,
+    const guint32 count,
+    const float scale,
+    float* sum_sq,
+    float* peak)
+{
+    LEVEL_ACCUMULATE(data, count, scale, sum_sq, peak);
+}
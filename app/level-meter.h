@@ -0,0 +1,76 @@
+/*
+ * The Real SoundTracker - signal level measurement (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _LEVEL_METER_H
+#define _LEVEL_METER_H
+
+#include <glib.h>
+
+/* The meters take interleaved float samples of any scale, the results are
+   in the same scale. They don't allocate memory after creation, so they
+   can be used in the audio thread. */
+
+/* Sample peak and true peak, the latter is measured on the signal
+   oversampled 4 times as recommended by ITU-R BS.1770 */
+typedef struct peak_meter peak_meter;
+
+peak_meter* peak_meter_new(const gint num_channels);
+void peak_meter_destroy(peak_meter* m);
+void peak_meter_reset(peak_meter* m);
+void peak_meter_process(peak_meter* m,
+    const float* data,
+    guint32 count);
+void peak_meter_get(const peak_meter* m,
+    float* sample_peak,
+    float* true_peak);
+
+/* Momentary (400 ms) and short-term (3 s) loudness of K-weighted signal
+   according to ITU-R BS.1770 in LUFS. The samples are expected to be
+   in the range -1.0...1.0. The meter has to be configured before use. */
+#define LOUDNESS_METER_FLOOR -70.0
+
+typedef struct loudness_meter loudness_meter;
+
+loudness_meter* loudness_meter_new(void);
+void loudness_meter_destroy(loudness_meter* m);
+/* Also resets the meter */
+void loudness_meter_configure(loudness_meter* m,
+    const gint num_channels,
+    const gint rate);
+void loudness_meter_reset(loudness_meter* m);
+void loudness_meter_process(loudness_meter* m,
+    const float* data,
+    guint32 count);
+void loudness_meter_get(const loudness_meter* m,
+    float* momentary,
+    float* short_term);
+
+/* Accumulate the sum of squares and the absolute peak of count scaled
+   samples into sum_sq and peak */
+void level_accumulate_int(const gint* data,
+    const guint32 count,
+    const float scale,
+    float* sum_sq,
+    float* peak);
+void level_accumulate_float(const float* data,
+    const guint32 count,
+    const float scale,
+    float* sum_sq,
+    float* peak);
+
+#endif /* _LEVEL_METER_H */
@@ -30,6 +30,7 @@
 #include "gui-settings.h"
 #include "history.h"
 #include "sample-editor.h"
+#include "sample-sync.h"
 
 enum {
     WINDOW_TRIANGLE = 0,
@@ -382,6 +383,7 @@ loop_factory_xfade_loop_point(LoopFactoryPanel* panel)
         break;
     }
 
+    sample_sync_edit_begin(si, TRUE);
     for (i = irange_start; i < irange_end; i++) {
         mul2 = (gfloat)i / range;
 
@@ -412,6 +414,7 @@ loop_factory_xfade_loop_point(LoopFactoryPanel* panel)
                     (gfloat)si->data[si->loopstart - i] * (1.0 - mul));
         }
     }
+    sample_sync_edit_end(si);
     sample_editor_update();
 }
 
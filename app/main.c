@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <glib/gi18n.h>
 #include <signal.h>
@@ -31,6 +32,8 @@
 
 #include "audio.h"
 #include "audioconfig.h"
+#include "batch-render.h"
+#include "epoch.h"
 #include "file-operations.h"
 #include "gui-settings.h"
 #include "gui.h"
@@ -68,6 +71,7 @@ int main(int argc,
     extern st_driver
         driver_out_dummy,
         driver_in_dummy,
+        driver_out_benchmark,
 #ifdef DRIVER_OSS
         driver_out_oss, driver_in_oss,
 #endif
@@ -128,6 +132,17 @@ int main(int argc,
     textdomain(PACKAGE);
 #endif
 
+    mixers = g_list_append(mixers,
+        &mixer_kbfloat);
+    mixers = g_list_append(mixers,
+        &mixer_integer32);
+
+    /* Headless rendering, GTK+ is not initialized at all */
+    if (argc >= 2 && !strcmp(argv[1], "--render")) {
+        argv[1] = argv[0];
+        return batch_render_main(argc - 1, argv + 1);
+    }
+
     gtk_init(&argc, &argv);
     prefs_init();
     tips_dialog_load_settings();
@@ -144,11 +159,6 @@ int main(int argc,
                         "style \"list\" {GtkComboBox::appears-as-list = 1}\n"
                         "widget \"*.keyconfig_combo\" style \"list\"");
 
-    mixers = g_list_append(mixers,
-        &mixer_kbfloat);
-    mixers = g_list_append(mixers,
-        &mixer_integer32);
-
 #if 0
     drivers[DRIVER_OUTPUT] = g_list_append(drivers[DRIVER_OUTPUT],
 					   &driver_out_test);
@@ -215,6 +225,8 @@ int main(int argc,
         drivers[DRIVER_INPUT] = g_list_append(drivers[DRIVER_INPUT],
             &driver_in_dummy);
     }
+    drivers[DRIVER_OUTPUT] = g_list_append(drivers[DRIVER_OUTPUT],
+        &driver_out_benchmark);
 
     g_assert(g_list_length(mixers) >= 1);
 
@@ -254,6 +266,7 @@ int main(int argc,
 
         fileops_tmpclean();
         audioconfig_shutdown(); /* Closing all opened drivers */
+        epoch_shutdown();
         return 0;
     } else {
         fprintf(stderr, "GUI Initialization failed.\n");
@@ -45,6 +45,7 @@
 #include "module-info.h"
 #include "preferences.h"
 #include "sample-editor.h"
+#include "sample-sync.h"
 #include "scope-group.h"
 #include "st-subs.h"
 #include "tips-dialog.h"
@@ -696,14 +697,13 @@ void menubar_optimize_module(void)
                     if (IS_SAMPLE_LOOPED(s->sample) &&
                         s->sample.length > s->sample.loopend) {
                         gint16* newdata = g_new(gint16, s->sample.loopend);
-                        gint16* olddata = s->sample.data;
 
                         memcpy(newdata, s->sample.data, sizeof(gint16) * s->sample.loopend);
-                        g_mutex_lock(&s->sample.lock);
+                        /* The old data are reclaimed when no longer played */
+                        sample_sync_edit_begin(&s->sample, FALSE);
                         s->sample.data = newdata;
                         s->sample.length = s->sample.loopend;
-                        g_mutex_unlock(&s->sample.lock);
-                        g_free(olddata);
+                        sample_sync_edit_end(&s->sample);
 
                         done = TRUE;
                         seu = TRUE;
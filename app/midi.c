@@ -26,8 +26,11 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "audio.h"
 #include "gui-settings.h"
 #include "gui.h"
 #include "history.h"
@@ -67,36 +70,58 @@ extern Tracker* tracker; /* from track-editor.c */
 /* Handle to sequencer device. */
 
 static snd_seq_t* midi_handle = NULL;
-static gint midi_file_tag = -1;
-static GIOChannel* midi_channel;
+static int midi_queue = -1;
 
-/* Count the number of notes on to later turn them off gracefully...*/
+/* Output handle, its port and queue. The handle is used by the audio
+   thread, which doesn't wait for the lock. */
+
+static snd_seq_t* midi_out_handle = NULL;
+static int midi_out_port = -1, midi_out_queue = -1;
+static GMutex midi_out_mutex;
+
+/* The input thread and the pipe used to stop it */
+
+static GThread* midi_thread = NULL;
+static int midi_stop_pipe[2] = { -1, -1 };
+
+/* Count the number of notes on to later turn them off gracefully...
+   Used only by the input thread. */
 
 static int nb_notes_on = 0;
 
+/* An event passed from the input thread to the main loop. The notes are
+   resolved to the tracker channel and note by the input thread, which plays
+   them through the audio thread if it's running (played is set then). */
+
+typedef enum {
+    MIDI_SOUND_NONE,
+    MIDI_SOUND_NOTE,
+    MIDI_SOUND_KEYOFF
+} midi_sound;
+
+typedef struct {
+    snd_seq_event_type_t type;
+    union {
+        struct {
+            gint channel, note, velocity;
+            midi_sound sound;
+            gboolean played;
+        } note;
+        snd_seq_ev_ctrl_t control;
+    } data;
+} midi_input_event;
+
 /* Local functions prototypes */
 
 static void close_handle(snd_seq_t* handle);
-static void midi_process_note_on(snd_seq_ev_note_t* pnote);
-static void midi_process_controller(snd_seq_ev_ctrl_t* pcontrol);
-static void midi_process_program_change(snd_seq_ev_ctrl_t* pcontrol);
+static void midi_input_note(snd_seq_ev_note_t* pnote, double time);
+static void midi_input_controller(snd_seq_ev_ctrl_t* pcontrol, double time);
+static gboolean midi_process_event(gpointer data);
 static gint midi_get_fd(snd_seq_t* handle);
-static gint midi_add_to_main_loop(snd_seq_t* handle);
-
-gboolean midi_channel_ready(GIOChannel* src, GIOCondition cond, gpointer data);
-void midi_channel_destroy(gpointer data);
-
-/*******************************************************************
- * Called when the IO channel associated with 
- * the MIDI handle is destroyed.
- */
-
-void midi_channel_destroy(gpointer data)
-{
-    if (IS_MIDI_DEBUG_ON) {
-        g_print("MIDI IO channel destroyed...\n");
-    }
-}
+static gboolean midi_start_thread(snd_seq_t* handle);
+static void midi_stop_thread(void);
+static void midi_output_init(void);
+static void midi_output_fini(void);
 
 /*******************************************************************
  * Get file descriptor of MIDI seq. handle.
@@ -133,49 +158,179 @@ midi_get_fd(snd_seq_t* seq_handle)
 }
 
 /****************************************************
- * Hook up the MIDI sequencer to GTK main loop.
+ * Convert the sequencer time stamp of the event into
+ * the monotonic time (s). The port stamps the events
+ * with the real time of our queue when they arrive,
+ * so the delay of the input thread doesn't count.
  */
 
-static gint midi_add_to_main_loop(snd_seq_t* handle)
+static double
+midi_event_time(snd_seq_event_t* ev,
+    const snd_seq_real_time_t* queue_now,
+    const gint64 now)
 {
-    gint fd, rc, retcode;
+    gint64 delay = 0;
 
-    /* Get the file descriptor associated with the seq.
-   * Will be used to let GDK monitor MIDI input.
-   */
+    if (queue_now && (ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL) {
+        delay = ((gint64)queue_now->tv_sec - ev->time.time.tv_sec) * G_USEC_PER_SEC
+            + ((gint64)queue_now->tv_nsec - ev->time.time.tv_nsec) / 1000;
+        delay = CLAMP(delay, 0, G_USEC_PER_SEC);
+    }
 
-    fd = midi_get_fd(midi_handle);
-    if (IS_MIDI_DEBUG_ON) {
-        g_print("FD = %d\n", fd);
+    return (double)(now - delay) / G_USEC_PER_SEC;
+}
+
+/**************************************************
+ * Read the events pending on the sequencer handle.
+ * Called from the input thread.
+ */
+
+static void
+midi_read_events(snd_seq_t* handle)
+{
+    snd_seq_queue_status_t* status;
+    const snd_seq_real_time_t* queue_now = NULL;
+    snd_seq_event_t* ev;
+    gint64 now;
+
+    snd_seq_queue_status_alloca(&status);
+    if (midi_queue >= 0 && snd_seq_get_queue_status(handle, midi_queue, status) >= 0)
+        queue_now = snd_seq_queue_status_get_real_time(status);
+    now = g_get_monotonic_time();
+
+    while (snd_seq_event_input(handle, &ev) >= 0) {
+        const double time = midi_event_time(ev, queue_now, now);
+        midi_input_event* e;
+
+        /* Process MIDI event.  The event is owned by the handle. */
+
+        if (IS_MIDI_DEBUG_ON) {
+            /* Some events (like SND_SEQ_EVENT_SENSING) are not printed
+               by the print_event routine. */
+            midi_print_event(ev);
+        }
+
+        switch (ev->type) {
+        case SND_SEQ_EVENT_NOTEOFF:
+            /* Simulate a note on event. */
+            ev->data.note.velocity = 0;
+            /* no break here. Go to next case...*/
+        case SND_SEQ_EVENT_NOTE:
+        case SND_SEQ_EVENT_NOTEON:
+            midi_input_note(&(ev->data.note), time);
+            break;
+
+        case SND_SEQ_EVENT_CONTROLLER:
+            midi_input_controller(&(ev->data.control), time);
+            break;
+
+        case SND_SEQ_EVENT_PGMCHANGE:
+            e = g_new(midi_input_event, 1);
+            e->type = ev->type;
+            e->data.control = ev->data.control;
+            g_idle_add_full(G_PRIORITY_HIGH, midi_process_event, e, g_free);
+            break;
+
+        default:
+            break;
+        }
+
+        if (snd_seq_event_input_pending(handle, 0) <= 0)
+            break;
+    }
+}
+
+/**************************************************
+ * MIDI input thread.
+ *
+ * Waits for the events on the sequencer handle until
+ * something is written to the stop pipe.
+ */
+
+static gpointer
+midi_input_thread(gpointer data)
+{
+    snd_seq_t* handle = (snd_seq_t*)data;
+    struct pollfd pfd[2];
+
+    audio_realtime_raise_thread();
+
+    pfd[0].fd = midi_stop_pipe[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = midi_get_fd(handle);
+    pfd[1].events = POLLIN;
+
+    while (1) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            g_warning("MIDI input thread: poll failed (%s)", g_strerror(errno));
+            break;
+        }
+        if (pfd[0].revents)
+            break;
+        if (pfd[1].revents & (POLLERR | POLLHUP)) {
+            g_print("MIDI input stream condition not POLLIN.\n");
+            break;
+        }
+        if (pfd[1].revents & POLLIN)
+            midi_read_events(handle);
     }
 
-    /* Install callback to process MIDI input. */
+    return NULL;
+}
 
-    midi_channel = g_io_channel_unix_new(fd);
+/****************************************************
+ * Start the input thread for the sequencer handle.
+ */
 
-    retcode = g_io_add_watch_full(midi_channel,
-        G_PRIORITY_HIGH,
-        G_IO_IN | G_IO_ERR | G_IO_HUP,
-        midi_channel_ready,
-        midi_handle, /*user data */
-        midi_channel_destroy);
+static gboolean
+midi_start_thread(snd_seq_t* handle)
+{
+    int rc;
 
     /* Filter some MIDI events...
    * Let pass only interessting events...
    */
 
     rc = 0;
-    rc = rc + snd_seq_set_client_event_filter(midi_handle, SND_SEQ_EVENT_NOTE);
-    rc = rc + snd_seq_set_client_event_filter(midi_handle, SND_SEQ_EVENT_NOTEON);
-    rc = rc + snd_seq_set_client_event_filter(midi_handle, SND_SEQ_EVENT_NOTEOFF);
-    rc = rc + snd_seq_set_client_event_filter(midi_handle, SND_SEQ_EVENT_CONTROLLER);
-    rc = rc + snd_seq_set_client_event_filter(midi_handle, SND_SEQ_EVENT_PGMCHANGE);
+    rc = rc + snd_seq_set_client_event_filter(handle, SND_SEQ_EVENT_NOTE);
+    rc = rc + snd_seq_set_client_event_filter(handle, SND_SEQ_EVENT_NOTEON);
+    rc = rc + snd_seq_set_client_event_filter(handle, SND_SEQ_EVENT_NOTEOFF);
+    rc = rc + snd_seq_set_client_event_filter(handle, SND_SEQ_EVENT_CONTROLLER);
+    rc = rc + snd_seq_set_client_event_filter(handle, SND_SEQ_EVENT_PGMCHANGE);
 
     if (rc != 0) {
         g_print("Unable to set event filter(s) on MIDI input stream...\n");
     }
 
-    return retcode;
+    if (midi_get_fd(handle) < 0 || pipe(midi_stop_pipe) != 0)
+        return FALSE;
+
+    /* The thread reads all the pending events at once */
+    snd_seq_nonblock(handle, 1);
+    nb_notes_on = 0;
+    midi_thread = g_thread_new("MIDI input", midi_input_thread, handle);
+
+    return TRUE;
+}
+
+static void
+midi_stop_thread(void)
+{
+    if (midi_thread) {
+        const char c = 0;
+
+        if (write(midi_stop_pipe[1], &c, 1) != 1)
+            g_warning("Unable to stop the MIDI input thread (%s)", g_strerror(errno));
+        g_thread_join(midi_thread);
+        midi_thread = NULL;
+    }
+    if (midi_stop_pipe[0] >= 0) {
+        close(midi_stop_pipe[0]);
+        close(midi_stop_pipe[1]);
+        midi_stop_pipe[0] = midi_stop_pipe[1] = -1;
+    }
 }
 
 /***********************************************
@@ -200,6 +355,7 @@ void midi_init()
 {
     int rc;
     snd_seq_port_subscribe_t* port_sub = NULL;
+    snd_seq_port_info_t* port_info;
     int client;
     int port;
     char* str = NULL;
@@ -213,18 +369,17 @@ void midi_init()
             g_print("Reinitializing MIDI input\n");
         }
 
-        if (midi_file_tag >= 0) {
-            g_source_remove(midi_file_tag);
-            midi_file_tag = -1;
-        }
-
+        midi_stop_thread();
         close_handle(midi_handle);
         midi_handle = NULL;
     }
 
-    /* Open the sequencer device, in non-block mode. */
+    midi_output_init();
 
-    rc = snd_seq_open(&midi_handle, "default", SND_SEQ_OPEN_INPUT, 0);
+    /* Open the sequencer device. The output direction is needed
+       to control our queue. */
+
+    rc = snd_seq_open(&midi_handle, "default", SND_SEQ_OPEN_DUPLEX, 0);
 
     if (rc < 0) {
         midi_warning(N_("error opening ALSA MIDI input stream (%s)\n"), rc);
@@ -259,16 +414,38 @@ void midi_init()
         return;
     }
 
+    /* Allocate a queue. It only runs to stamp the incoming events
+     * with the time they arrived at, so the input thread can place
+     * them in the audio output regardless of its own delay.
+     */
+
+    midi_queue = snd_seq_alloc_named_queue(midi_handle, PACKAGE_NAME);
+    if (midi_queue >= 0) {
+        snd_seq_start_queue(midi_handle, midi_queue, NULL);
+        snd_seq_drain_output(midi_handle);
+    } else if (IS_MIDI_DEBUG_ON) {
+        g_print("Unable to allocate a queue, MIDI events are not timestamped\n");
+    }
+
     /* Create a port for our user-level client.
      * The port number will be the destination port
      * when we subscribe to the ALSA seq.
      */
 
+    snd_seq_port_info_alloca(&port_info);
     str = g_strdup_printf("%s-%d-%d", PACKAGE_NAME, getpid(), 0 /* port number */);
-    port = snd_seq_create_simple_port(midi_handle, str,
-        SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-        SND_SEQ_PORT_TYPE_APPLICATION);
+    snd_seq_port_info_set_name(port_info, str);
     g_free(str);
+    snd_seq_port_info_set_capability(port_info,
+        SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+    snd_seq_port_info_set_type(port_info, SND_SEQ_PORT_TYPE_APPLICATION);
+    if (midi_queue >= 0) {
+        snd_seq_port_info_set_timestamping(port_info, 1);
+        snd_seq_port_info_set_timestamp_real(port_info, 1);
+        snd_seq_port_info_set_timestamp_queue(port_info, midi_queue);
+    }
+    rc = snd_seq_create_port(midi_handle, port_info);
+    port = rc < 0 ? rc : snd_seq_port_info_get_port(port_info);
 
     if (port < 0) {
         close_handle(midi_handle);
@@ -322,14 +499,12 @@ void midi_init()
         }
     }
 
-    midi_file_tag = midi_add_to_main_loop(midi_handle);
-
-    if (midi_file_tag < 0) {
+    if (!midi_start_thread(midi_handle)) {
+        midi_stop_thread();
         close_handle(midi_handle);
         midi_handle = NULL;
 
-        g_warning("error installing MIDI input callback (%s)\n",
-            g_strerror(midi_file_tag));
+        g_warning("error starting MIDI input thread\n");
         return;
     }
 
@@ -344,80 +519,193 @@ void midi_init()
 /* It's better to close handle, as Valgring advices */
 void midi_fini(void)
 {
-    close_handle(midi_handle);
+    midi_output_fini();
+    midi_stop_thread();
+    if (midi_handle != NULL) {
+        close_handle(midi_handle);
+        midi_handle = NULL;
+    }
 }
 
-/**************************************************
- * Callback for MIDI input events.
+/***********************************************
+ * Create the MIDI output.
  *
- * NOTE:
- *	before leaving, "data" must be freed.
- *	It was created in snd_seq_event_input().
+ * A separate client is used, so the audio thread
+ * doesn't share the handle with the input thread.
+ * Its port is connected to the client and port
+ * from the configuration, if any; otherwise it has
+ * to be connected by another mean, e.g. aconnect.
  */
 
-gboolean midi_channel_ready(GIOChannel* channel, GIOCondition cond, gpointer data)
+static void
+midi_output_init(void)
 {
-    snd_seq_t* handle = (snd_seq_t*)data;
-    snd_seq_event_t* ev;
+    snd_seq_t* handle;
+    char* str;
     int rc;
 
-    if (cond != G_IO_IN) {
-        g_print("MIDI IO channel condition not G_IO_IN.\n");
-        return FALSE;
+    midi_output_fini();
+
+    rc = snd_seq_open(&handle, "default", SND_SEQ_OPEN_OUTPUT, SND_SEQ_NONBLOCK);
+    if (rc < 0) {
+        if (IS_MIDI_DEBUG_ON) {
+            g_print("Unable to open MIDI output (%s)\n", snd_strerror(rc));
+        }
+        return;
     }
 
-    g_return_val_if_fail(handle != NULL, FALSE);
+    str = g_strdup_printf("%s-%d-out", PACKAGE_NAME, getpid());
+    snd_seq_set_client_name(handle, str);
+    g_free(str);
 
-    do {
-        /* Process MIDI event.  Don't forget to free the event after usage. */
+    str = g_strdup_printf("%s-%d-%d", PACKAGE_NAME, getpid(), 1 /* port number */);
+    midi_out_port = snd_seq_create_simple_port(handle, str,
+        SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+        SND_SEQ_PORT_TYPE_APPLICATION | SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+    g_free(str);
 
-        rc = snd_seq_event_input(handle, &ev);
-        if (rc < 0) {
-            g_print("unable to get event");
-            return TRUE;
+    midi_out_queue = snd_seq_alloc_named_queue(handle, PACKAGE_NAME);
+
+    if (midi_out_port < 0 || midi_out_queue < 0) {
+        if (IS_MIDI_DEBUG_ON) {
+            g_print("Unable to create MIDI output port or queue\n");
         }
+        snd_seq_close(handle);
+        return;
+    }
 
-        switch (ev->type) {
-        case SND_SEQ_EVENT_NOTEOFF:
-            /* Simulate a note on event. */
-            ev->data.note.velocity = 0;
-            /* no break here. Go to next case...*/
-        case SND_SEQ_EVENT_NOTE:
-        case SND_SEQ_EVENT_NOTEON:
-            if (IS_MIDI_DEBUG_ON) {
-                midi_print_event(ev);
-            }
-            midi_process_note_on(&(ev->data.note));
-            break;
+    snd_seq_start_queue(handle, midi_out_queue, NULL);
+    snd_seq_drain_output(handle);
 
-        case SND_SEQ_EVENT_CONTROLLER:
-            if (IS_MIDI_DEBUG_ON) {
-                midi_print_event(ev);
-            }
-            midi_process_controller(&(ev->data.control));
-            break;
+    if (midi_settings.output.client > 0) {
+        rc = snd_seq_connect_to(handle, midi_out_port,
+            midi_settings.output.client, midi_settings.output.port);
+        if (rc < 0 && IS_MIDI_DEBUG_ON) {
+            g_print("Unable to connect MIDI output to %d:%d (%s)\n",
+                midi_settings.output.client, midi_settings.output.port, snd_strerror(rc));
+        }
+    }
 
-        case SND_SEQ_EVENT_PGMCHANGE:
-            if (IS_MIDI_DEBUG_ON) {
-                midi_print_event(ev);
-            }
-            midi_process_program_change(&(ev->data.control));
-            break;
+    g_mutex_lock(&midi_out_mutex);
+    midi_out_handle = handle;
+    g_mutex_unlock(&midi_out_mutex);
 
-        default:
-            if (IS_MIDI_DEBUG_ON) {
-                /* Some events (like SND_SEQ_EVENT_SENSING) are not printed
-	     by the print_event routine. */
-                midi_print_event(ev);
-            }
-            break;
-        }
+    if (IS_MIDI_DEBUG_ON) {
+        g_print("MIDI output initialized\n");
+    }
+}
 
-        snd_seq_free_event(ev);
+static void
+midi_output_fini(void)
+{
+    snd_seq_t* handle;
 
-    } while (snd_seq_event_input_pending(handle, 0) > 0);
+    g_mutex_lock(&midi_out_mutex);
+    handle = midi_out_handle;
+    midi_out_handle = NULL;
+    g_mutex_unlock(&midi_out_mutex);
 
-    return TRUE;
+    if (handle != NULL)
+        snd_seq_close(handle);
+}
+
+/**************************************************
+ * Schedule an event on the MIDI output.
+ * Called from the audio thread.
+ */
+
+static void
+midi_output_event(snd_seq_event_t* ev, double delay)
+{
+    snd_seq_real_time_t rt;
+
+    if (!g_mutex_trylock(&midi_out_mutex))
+        return;
+
+    if (midi_out_handle != NULL) {
+        delay = MAX(delay, 0.0);
+        rt.tv_sec = (unsigned int)delay;
+        rt.tv_nsec = (unsigned int)((delay - rt.tv_sec) * 1.0e9);
+
+        snd_seq_ev_set_source(ev, midi_out_port);
+        snd_seq_ev_set_subs(ev);
+        snd_seq_ev_schedule_real(ev, midi_out_queue, 1 /* relative */, &rt);
+        snd_seq_event_output_direct(midi_out_handle, ev);
+    }
+
+    g_mutex_unlock(&midi_out_mutex);
+}
+
+void midi_output_note_on(double delay, int channel, int note, int velocity)
+{
+    snd_seq_event_t ev;
+
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_noteon(&ev, channel, note, velocity);
+    midi_output_event(&ev, delay);
+}
+
+void midi_output_note_off(double delay, int channel, int note)
+{
+    snd_seq_event_t ev;
+
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_noteoff(&ev, channel, note, 0);
+    midi_output_event(&ev, delay);
+}
+
+void midi_output_program(double delay, int channel, int program)
+{
+    snd_seq_event_t ev;
+
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_pgmchange(&ev, channel, program);
+    midi_output_event(&ev, delay);
+}
+
+void midi_output_bend(double delay, int channel, int value)
+{
+    snd_seq_event_t ev;
+
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_pitchbend(&ev, channel, value);
+    midi_output_event(&ev, delay);
+}
+
+void midi_output_reset(void)
+{
+    snd_seq_remove_events_t* rm;
+    int i;
+
+    if (!g_mutex_trylock(&midi_out_mutex))
+        return;
+
+    if (midi_out_handle != NULL) {
+        snd_seq_remove_events_alloca(&rm);
+        snd_seq_remove_events_set_queue(rm, midi_out_queue);
+        snd_seq_remove_events_set_condition(rm, SND_SEQ_REMOVE_OUTPUT);
+        snd_seq_remove_events(midi_out_handle, rm);
+
+        /* These are sent immediately */
+        for (i = 0; i < 16; i++) {
+            snd_seq_event_t ev[2];
+            int j;
+
+            snd_seq_ev_clear(&ev[0]);
+            snd_seq_ev_set_controller(&ev[0], i, MIDI_CTL_ALL_NOTES_OFF, 0);
+            snd_seq_ev_clear(&ev[1]);
+            snd_seq_ev_set_pitchbend(&ev[1], i, 0);
+
+            for (j = 0; j < 2; j++) {
+                snd_seq_ev_set_source(&ev[j], midi_out_port);
+                snd_seq_ev_set_subs(&ev[j]);
+                snd_seq_ev_set_direct(&ev[j]);
+                snd_seq_event_output_direct(midi_out_handle, &ev[j]);
+            }
+        }
+    }
+
+    g_mutex_unlock(&midi_out_mutex);
 }
 
 /**********************************
@@ -429,6 +717,7 @@ static void close_handle(snd_seq_t* handle)
     int rc;
 
     rc = snd_seq_close(handle);
+    midi_queue = -1;
     if (rc < 0) {
         midi_warning(N_("error closing handle (%s)\n"), rc);
     }
@@ -439,7 +728,7 @@ static void close_handle(snd_seq_t* handle)
 
 /*******************************************************
  * Process MIDI program change event.
- * Called from the MIDI input callback.
+ * Called from the main loop.
  *
  * Change the XM instrument.
  */
@@ -464,12 +753,12 @@ static void midi_process_program_change(snd_seq_ev_ctrl_t* pcontrol)
 
 /*******************************************************
  * Process MIDI controller event.
- * Called from the MIDI input callback.
+ * Called from the input thread.
  *
  * If we receive Sustain event, transform it into a XM note off.
  */
 
-static void midi_process_controller(snd_seq_ev_ctrl_t* pcontrol)
+static void midi_input_controller(snd_seq_ev_ctrl_t* pcontrol, double time)
 {
     snd_seq_ev_note_t note;
 
@@ -491,7 +780,7 @@ static void midi_process_controller(snd_seq_ev_ctrl_t* pcontrol)
         } else {
             note.velocity = MIDI_VELOCITY_MAX;
         }
-        midi_process_note_on(&note);
+        midi_input_note(&note, time);
         break;
 
     default:
@@ -503,11 +792,11 @@ static void midi_process_controller(snd_seq_ev_ctrl_t* pcontrol)
 
     return;
 
-} /* midi_process_controller() */
+} /* midi_input_controller() */
 
 /*******************************************************
  * Process MIDI note ON.
- * Called from the MIDI input callback (most of the time).
+ * Called from the input thread.
  *
  * If the note velocity is 0, just turn off the sound. Don't
  * see it as a XM note off event.
@@ -519,37 +808,24 @@ static void midi_process_controller(snd_seq_ev_ctrl_t* pcontrol)
  * the first key), we would turn off the sound of the second
  * note.  With the counter, the note off is done at the right time,
  * when the last key is released...
+ *
+ * The sound is sent to the audio thread directly if it's running,
+ * the rest (and the sound otherwise) is done in the main loop.
  */
 
-static void midi_process_note_on(snd_seq_ev_note_t* pnote)
+static void midi_input_note(snd_seq_ev_note_t* pnote, double time)
 {
+    midi_input_event* e;
     gint note;
-    int channel;
-    int volume;
-    gboolean note_on = pnote->velocity > 0 ? 1 : 0;
+    int channel, num_channels;
+    midi_sound sound;
 
-    /* Set local value for channel. */
+    /* Set local value for channel. The tracker fields belong to the main
+       thread, so only its published snapshot can be read here. */
 
-    if (midi_settings.input.channel_enabled) {
+    channel = tracker_peek_cursor_channel(tracker, &num_channels);
+    if (midi_settings.input.channel_enabled)
         channel = (int)pnote->channel;
-    } else {
-        channel = tracker->cursor_ch;
-    }
-
-    /* Set local value for volume. */
-    /* The value -1 means don't change the volume in the pattern. */
-
-    if (midi_settings.input.volume_enabled) {
-        volume = (int)pnote->velocity;
-        /* Since XM volume range is limited, adjust it here. */
-        if (volume < XM_NOTE_VOLUME_MIN) {
-            volume = XM_NOTE_VOLUME_MIN;
-        } else if (volume > XM_NOTE_VOLUME_MAX) {
-            volume = XM_NOTE_VOLUME_MAX;
-        }
-    } else {
-        volume = -1;
-    }
 
     /* Perform some validation on the event.
        - is the note a valid XM note ?
@@ -563,7 +839,7 @@ static void midi_process_note_on(snd_seq_ev_note_t* pnote)
         return;
     }
 
-    if (channel > tracker->num_channels) {
+    if (channel >= num_channels) {
         g_warning("Channel out of range");
         return;
     }
@@ -575,6 +851,76 @@ static void midi_process_note_on(snd_seq_ev_note_t* pnote)
             note);
     }
 
+    if (pnote->velocity > 0) {
+        /* Increment the number of notes on. */
+
+        nb_notes_on++;
+        sound = MIDI_SOUND_NOTE;
+    } else {
+        /* Decrement the number of note on.
+	   If it is 0, then turn the note off in the track (channel). */
+
+        nb_notes_on--;
+        sound = MIDI_SOUND_NONE;
+
+        if (nb_notes_on <= 0) {
+            sound = MIDI_SOUND_KEYOFF;
+            nb_notes_on = 0;
+        }
+    }
+
+    e = g_new(midi_input_event, 1);
+    e->type = SND_SEQ_EVENT_NOTEON;
+    e->data.note.channel = channel;
+    e->data.note.note = note;
+    e->data.note.velocity = pnote->velocity;
+    e->data.note.sound = sound;
+    e->data.note.played = FALSE;
+
+    if (sound != MIDI_SOUND_NONE && audio_midi_accepting()) {
+        audio_midi_event a;
+
+        a.type = sound == MIDI_SOUND_NOTE ? AUDIO_MIDI_NOTE : AUDIO_MIDI_KEYOFF;
+        a.channel = channel;
+        a.note = note;
+        a.instrument = gui_peek_current_instrument();
+        e->data.note.played = time_buffer_add(audio_midi_tb, &a, time);
+    }
+
+    g_idle_add_full(G_PRIORITY_HIGH, midi_process_event, e, g_free);
+
+} /* midi_input_note() */
+
+/*******************************************************
+ * Process MIDI note ON.
+ * Called from the main loop with the note resolved by
+ * the input thread.
+ *
+ * Play the note unless it's been played already and
+ * record it if we're in the track editor.
+ */
+
+static void midi_process_note_on(const midi_input_event* e)
+{
+    const int channel = e->data.note.channel;
+    const gint note = e->data.note.note;
+    int volume;
+
+    /* Set local value for volume. */
+    /* The value -1 means don't change the volume in the pattern. */
+
+    if (midi_settings.input.volume_enabled) {
+        volume = e->data.note.velocity;
+        /* Since XM volume range is limited, adjust it here. */
+        if (volume < XM_NOTE_VOLUME_MIN) {
+            volume = XM_NOTE_VOLUME_MIN;
+        } else if (volume > XM_NOTE_VOLUME_MAX) {
+            volume = XM_NOTE_VOLUME_MAX;
+        }
+    } else {
+        volume = -1;
+    }
+
     /* If necessary, jump to channel */
 
     if (tracker->cursor_ch != channel)
@@ -582,17 +928,17 @@ static void midi_process_note_on(snd_seq_ev_note_t* pnote)
 
     /* Play the note. Record it if we're in the track editor. */
 
-    if (note_on) {
+    if (e->data.note.sound == MIDI_SOUND_KEYOFF && !e->data.note.played)
+        gui_play_note_keyoff(channel);
+
+    if (e->data.note.velocity > 0) {
         gint row, jump;
         XMNote* xmnote;
 
-        /* Increment the number of notes on. */
-
-        nb_notes_on++;
-
         /* Play the note in the channel specified by the MIDI channel. */
 
-        gui_play_note(channel, note, FALSE);
+        if (!e->data.note.played)
+            gui_play_note(channel, note, FALSE);
 
         /* Give warning when MIDI channel and cursor channel are different. */
 
@@ -633,18 +979,31 @@ static void midi_process_note_on(snd_seq_ev_note_t* pnote)
             tracker_step_cursor_row(tracker, jump);
         else
             tracker_redraw_current_row(tracker);
-    } else {
-        /* Decrement the number of note on.
-	   If it is 0, then turn the note off in the track (channel). */
-
-        nb_notes_on--;
-
-        if (nb_notes_on <= 0) {
-            gui_play_note_keyoff(channel);
-            nb_notes_on = 0;
-        }
     }
 
     return;
 
 } /* midi_process_note_on() */
+
+/*******************************************************
+ * Process an event passed by the input thread.
+ * Called from the main loop.
+ */
+
+static gboolean midi_process_event(gpointer data)
+{
+    const midi_input_event* e = data;
+
+    switch (e->type) {
+    case SND_SEQ_EVENT_NOTEON:
+        midi_process_note_on(e);
+        break;
+    case SND_SEQ_EVENT_PGMCHANGE:
+        midi_process_program_change((snd_seq_ev_ctrl_t*)&e->data.control);
+        break;
+    default:
+        break;
+    }
+
+    return FALSE;
+}
@@ -25,4 +25,15 @@
 void midi_init(void);
 void midi_fini(void);
 
+/* MIDI output. The events are scheduled through our queue to be sent delay
+   seconds later. Must be called by the audio thread only; the events are
+   dropped while the output is being reinitialized. */
+
+void midi_output_note_on(double delay, int channel, int note, int velocity);
+void midi_output_note_off(double delay, int channel, int note);
+void midi_output_program(double delay, int channel, int program);
+void midi_output_bend(double delay, int channel, int value);
+/* Drops the events not sent yet and turns all the notes off */
+void midi_output_reset(void);
+
 #endif /* _MIDI_H */
@@ -35,15 +35,35 @@ typedef enum {
     ST_SAMPLE_STEREO = 1 << 5
 } STSampleFlags;
 
+/* See sample-sync.h */
+typedef struct st_mixer_sample_sync {
+    GRecMutex lock; /* serializes the editors, the mixers don't take it */
+    gint generation; /* odd while the sample is being edited */
+    guint depth; /* of the nested edits */
+    gint16* published; /* the data as of the beginning of the edit */
+    gsize published_size; /* its size in bytes */
+} st_mixer_sample_sync;
+
 typedef struct st_mixer_sample_info {
     STSampleFlags flags;
     guint32 length; /* length in samples, not in bytes */
     guint32 loopstart; /* offset in samples, not in bytes */
     guint32 loopend; /* offset to first sample not being played */
     gint16* data; /* pointer to sample data */
-    GMutex lock;
+    st_mixer_sample_sync sync;
 } st_mixer_sample_info;
 
+/* The mixer's own copy of the sample parameters, taken with
+   sample_sync_snapshot() */
+typedef struct st_mixer_sample_state {
+    STSampleFlags flags;
+    guint32 length;
+    guint32 loopstart;
+    guint32 loopend;
+    gint16* data;
+    gint generation; /* of the sample when copied, -1 if none */
+} st_mixer_sample_state;
+
 #define IS_SAMPLE_LOOPED(s) (s.flags & ST_SAMPLE_LOOP_MASK)
 #define IS_SAMPLE_FORWARD(s) (s.flags & ST_SAMPLE_LOOPTYPE_AMIGA)
 #define IS_SAMPLE_PINGPONG(s) (s.flags & ST_SAMPLE_LOOPTYPE_PINGPONG)
@@ -68,66 +88,76 @@ typedef struct st_mixer {
     const char* id;
     const char* description;
 
+    /* create new instance of this mixer; all the other functions operate
+       on an instance, different instances can be used concurrently */
+    void* (*new)(void);
+
+    /* destroy instance of this mixer */
+    void (*destroy)(void* m);
+
     /* set number of channels to be mixed */
-    void (*setnumch)(int numchannels);
+    void (*setnumch)(void* m, int numchannels);
 
     /* set channel buffers */
-    void (*setbuffers)(st_mixer_buffer buffers[]);
-
-    /* notify sample update (sample must be locked by caller!) */
-    void (*updatesample)(st_mixer_sample_info* si);
+    void (*setbuffers)(void* m, st_mixer_buffer buffers[]);
 
     /* set mixer output format -- signed 16 or 8 (in machine endianness) */
-    gboolean (*setmixformat)(int format);
+    gboolean (*setmixformat)(void* m, int format);
 
     /* toggle stereo mixing -- interleaved left / right samples */
-    gboolean (*setstereo)(int on);
+    gboolean (*setstereo)(void* m, int on);
 
     /* set mixing frequency */
-    void (*setmixfreq)(guint32 frequency);
+    void (*setmixfreq)(void* m, guint32 frequency);
 
     /* reset internal playing state */
-    void (*reset)(void);
+    void (*reset)(void* m);
 
     /* play sample from the beginning, initialize nothing else */
-    void (*startnote)(int channel, st_mixer_sample_info* si);
+    void (*startnote)(void* m, int channel, st_mixer_sample_info* si);
 
     /* stop note */
-    void (*stopnote)(int channel);
+    void (*stopnote)(void* m, int channel);
 
     /* set curent sample play position */
-    void (*setsmplpos)(int channel, guint32 offset);
+    void (*setsmplpos)(void* m, int channel, guint32 offset);
 
     /* set curent sample play end position */
-    void (*setsmplend)(int channel, guint32 playend);
+    void (*setsmplend)(void* m, int channel, guint32 playend);
 
     /* set replay frequency (Hz) */
-    void (*setfreq)(int channel, float frequency);
+    void (*setfreq)(void* m, int channel, float frequency);
 
     /* set sample volume (0.0 ... 1.0) */
-    void (*setvolume)(int channel, float volume);
+    void (*setvolume)(void* m, int channel, float volume);
 
     /* set sample panning (-1.0 ... +1.0) */
-    void (*setpanning)(int channel, float panning);
+    void (*setpanning)(void* m, int channel, float panning);
 
     /* set channel filter cutoff frequency (-1.0 for off, or 0.0 ... +1.0) */
-    void (*setchcutoff)(int channel, float freq);
+    void (*setchcutoff)(void* m, int channel, float freq);
 
     /* set channel filter resonance (0.0 ... +1.0) */
-    void (*setchreso)(int channel, float reso);
+    void (*setchreso)(void* m, int channel, float reso);
 
-    /* do the rendering */
-    void (*render)(guint32 count,
+    /* do the rendering; the changes of the samples are picked up by the
+       mixer itself without waiting for the editors, see sample-sync.h */
+    void (*render)(void* m,
+        guint32 count,
         gint16* scopebufs[],
         int scopebuf_offset,
         time_buffer* channels_status_tb,
         gdouble time);
 
+    /* render a single channel without scopes and status reports into its
+       buffer; different channels can be rendered concurrently (may be NULL) */
+    void (*renderchannel)(void* m, int channel, guint32 count);
+
     /* get status information */
-    void (*dumpstatus)(st_mixer_channel_status array[]);
+    void (*dumpstatus)(void* m, st_mixer_channel_status array[]);
 
-    /* load channel settings from tracer */
-    void (*loadchsettings)(int channel);
+    /* load channel settings from a tracer instance */
+    void (*loadchsettings)(void* m, int channel, void* tracer);
 
     const guint32 max_sample_length;
 
@@ -27,18 +27,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "epoch.h"
 #include "mixer.h"
+#include "sample-sync.h"
 #include "tracer.h"
 
-static int num_channels, mixfreq;
-static int stereo;
-
 typedef struct integer32_channel {
     st_mixer_sample_info* sample;
     st_mixer_buffer* mixbuf;
 
-    void* data; /* copy of sample->data */
+    gint16* data; /* copy of sample->data */
     guint32 length; /* length of sample (converted) */
+    gint generation; /* of the sample when copied, -1 if none */
     guint32 playend; /* for a forced premature end of the sample */
 
     int running; /* this channel is active */
@@ -54,62 +54,110 @@ typedef struct integer32_channel {
     float panning; /* -1.0 .. +1.0 */
 } integer32_channel;
 
-static integer32_channel channels[32];
+typedef struct integer32_mixer {
+    int num_channels, mixfreq;
+    int stereo;
+
+    integer32_channel channels[32];
+} integer32_mixer;
 
 #define ACCURACY 12 /* accuracy of the fixed point stuff, ALSO HARDCODED in the assembly routines!! */
 
 #define MAX_SAMPLE_LENGTH ((1 << (32 - ACCURACY)) - 1)
 
+static void*
+integer32_new(void)
+{
+    return g_new0(integer32_mixer, 1);
+}
+
 static void
-integer32_setnumch(int n)
+integer32_destroy(void* mp)
 {
+    g_free(mp);
+}
+
+static void
+integer32_setnumch(void* mp, int n)
+{
+    integer32_mixer* const mx = mp;
+
     g_assert(n >= 1 && n <= 32);
 
-    num_channels = n;
+    mx->num_channels = n;
 }
 
 static void
-integer32_setbuffers(st_mixer_buffer buffers[])
+integer32_setbuffers(void* mp, st_mixer_buffer buffers[])
 {
+    integer32_mixer* const mx = mp;
     int i;
 
     for (i = 0; i < 32; i++)
-        channels[i].mixbuf = &buffers[i];
+        mx->channels[i].mixbuf = &buffers[i];
 }
 
 static void
-integer32_updatesample(st_mixer_sample_info* si)
+integer32_set_sample(integer32_channel* c,
+    const st_mixer_sample_state* st)
 {
-    int i;
-    integer32_channel* c;
+    c->data = st->data;
+    c->length = MIN(st->length, MAX_SAMPLE_LENGTH) << ACCURACY;
+    c->loopstart = MIN(st->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
+    c->loopend = MIN(st->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
+    c->loopflags = st->flags & ST_SAMPLE_LOOP_MASK;
+    c->generation = st->generation;
+}
 
-    for (i = 0; i < 32; i++) {
-        c = &channels[i];
-        if (c->sample != si || !c->running) {
-            continue;
-        }
+/* Picks up the changes made by the editors. Returns FALSE if the channel
+   can't be rendered this time. */
+static gboolean
+integer32_sync_sample(integer32_channel* c)
+{
+    st_mixer_sample_state st;
+    guint32 length;
+
+    if (c->generation >= 0) {
+        const gint generation = g_atomic_int_get(&c->sample->sync.generation);
+
+        /* Our data are valid until the end of the current edit */
+        if (generation == c->generation || generation == c->generation + 1)
+            return TRUE;
+    }
+    if (!sample_sync_snapshot(c->sample, &st))
+        return FALSE;
 
-        if (c->data != si->data
-            || c->length != MIN(si->length, MAX_SAMPLE_LENGTH) << ACCURACY
-            || c->loopflags != (si->flags & ST_SAMPLE_LOOP_MASK)) {
+    if (c->generation < 0) {
+        /* Started while the sample was being edited */
+        integer32_set_sample(c, &st);
+        if (c->current >= c->length) {
             c->running = 0;
+            return FALSE;
         }
+        return TRUE;
+    }
 
-        /* No relevant data has changed. Don't stop the sample, but update
-	   our local loop data instead. */
-        c->loopstart = MIN(si->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
-        c->loopend = MIN(si->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
-        c->loopflags = si->flags & ST_SAMPLE_LOOP_MASK;
-        if (c->loopflags != ST_SAMPLE_LOOPTYPE_NONE) {
-            // we can be more clever here...
-            c->current = c->loopstart;
-            c->direction = 1;
-        }
+    length = MIN(st.length, MAX_SAMPLE_LENGTH) << ACCURACY;
+    if (c->length != length || c->loopflags != (st.flags & ST_SAMPLE_LOOP_MASK)) {
+        integer32_set_sample(c, &st);
+        c->running = 0;
+        return FALSE;
     }
+
+    /* Only the data or the loop points have changed. Don't stop the sample,
+       but update our local copy instead. */
+    integer32_set_sample(c, &st);
+    if (c->loopflags != ST_SAMPLE_LOOPTYPE_NONE) {
+        // we can be more clever here...
+        c->current = c->loopstart;
+        c->direction = 1;
+    }
+
+    return TRUE;
 }
 
 static gboolean
-integer32_setmixformat(int format)
+integer32_setmixformat(void* mp, int format)
 {
     if (format != 16)
         return FALSE;
@@ -118,65 +166,72 @@ integer32_setmixformat(int format)
 }
 
 static gboolean
-integer32_setstereo(int on)
+integer32_setstereo(void* mp, int on)
 {
-    stereo = on;
+    integer32_mixer* const mx = mp;
+
+    mx->stereo = on;
     return TRUE;
 }
 
 static void
-integer32_setmixfreq(guint32 frequency)
+integer32_setmixfreq(void* mp, guint32 frequency)
 {
-    mixfreq = frequency;
+    integer32_mixer* const mx = mp;
+
+    mx->mixfreq = frequency;
 }
 
 static void
-integer32_reset(void)
+integer32_reset(void* mp)
 {
+    integer32_mixer* const mx = mp;
     guint i;
     st_mixer_buffer* tmp[32];
 
     for (i = 0; i < 32; i++)
-        tmp[i] = channels[i].mixbuf;
-    memset(channels, 0, sizeof(channels));
+        tmp[i] = mx->channels[i].mixbuf;
+    memset(mx->channels, 0, sizeof(mx->channels));
     for (i = 0; i < 32; i++)
-        channels[i].mixbuf = tmp[i];
+        mx->channels[i].mixbuf = tmp[i];
 }
 
 static void
-integer32_startnote(int channel,
+integer32_startnote(void* mp, int channel,
     st_mixer_sample_info* s)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
     c->sample = s;
-    c->data = s->data;
-    c->length = MIN(s->length, MAX_SAMPLE_LENGTH) << ACCURACY;
+    c->generation = -1;
+    c->length = 0;
     c->playend = 0;
     c->running = 1;
     c->speed = 1;
     c->current = 0;
-    c->loopstart = MIN(s->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
-    c->loopend = MIN(s->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
-    c->loopflags = s->flags & ST_SAMPLE_LOOP_MASK;
     c->direction = 1;
+    /* If the sample is being edited, the next render will try again */
+    integer32_sync_sample(c);
 }
 
 static void
-integer32_stopnote(int channel)
+integer32_stopnote(void* mp, int channel)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
     c->running = 0;
 }
 
 static void
-integer32_setsmplpos(int channel,
+integer32_setsmplpos(void* mp, int channel,
     guint32 offset)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
-    if (offset<c->length>> ACCURACY) {
+    if (c->generation < 0 || offset < c->length >> ACCURACY) {
         c->current = offset << ACCURACY;
         c->direction = 1;
     } else {
@@ -185,10 +240,11 @@ integer32_setsmplpos(int channel,
 }
 
 static void
-integer32_setsmplend(int channel,
+integer32_setsmplend(void* mp, int channel,
     guint32 playend)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
     if ((c->current != 0 || playend<c->length>> ACCURACY) && playend > 0) {
         c->playend = MIN(playend, MAX_SAMPLE_LENGTH) << ACCURACY;
@@ -196,48 +252,52 @@ integer32_setsmplend(int channel,
 }
 
 static void
-integer32_setfreq(int channel,
+integer32_setfreq(void* mp, int channel,
     float frequency)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
     if (frequency > (0x7fffffff >> ACCURACY)) {
         frequency = (0x7fffffff >> ACCURACY);
     }
 
-    c->speed = frequency * (1 << ACCURACY) / mixfreq;
+    c->speed = frequency * (1 << ACCURACY) / mx->mixfreq;
     if (c->speed == 0) {
         c->speed = 1;
     }
 }
 
 static void
-integer32_setvolume(int channel,
+integer32_setvolume(void* mp, int channel,
     float volume)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
     c->volume = 64 * volume;
 }
 
 static void
-integer32_setpanning(int channel,
+integer32_setpanning(void* mp, int channel,
     float panning)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const mx = mp;
+    integer32_channel* c = &mx->channels[channel];
 
     c->panning = panning;
 }
 
+/* Channels don't share any data, so different channels can be rendered
+   concurrently */
 static void
-integer32_render(guint32 count,
+integer32_render_channel(integer32_mixer* mx, int i,
+    guint32 count,
     gint16* scopebufs[],
-    int scopebuf_offset,
-    time_buffer* channels_status_tb,
-    gdouble time)
+    int scopebuf_offset)
 {
     guint32 t;
-    int i, j, *m, v;
+    int j, *m, v;
     integer32_channel* c;
     int done;
     int offs2end, oflcnt, looplen;
@@ -247,132 +307,162 @@ integer32_render(guint32 count,
     gint16* data;
     int s, val;
 
-    for (i = 0; i < num_channels; i++) {
-        c = &channels[i];
-        t = count;
-        m = c->mixbuf->buffer;
-        v = c->volume;
+    c = &mx->channels[i];
+    t = count;
+    m = c->mixbuf->buffer;
+    v = c->volume;
 
-        if (scopebufs)
-            scopedata = scopebufs[i] + scopebuf_offset;
+    if (scopebufs)
+        scopedata = scopebufs[i] + scopebuf_offset;
 
-        if (!c->running) {
-            c->mixbuf->num_processed = 0;
-            if (scopebufs)
-                memset(scopedata, 0, 2 * count);
-            continue;
-        }
+    if (!c->running) {
+        c->mixbuf->num_processed = 0;
+        if (scopebufs)
+            memset(scopedata, 0, 2 * count);
+        return;
+    }
 
-        g_mutex_lock(&c->sample->lock);
+    if (!integer32_sync_sample(c)) {
+        c->mixbuf->num_processed = 0;
+        if (scopebufs)
+            memset(scopedata, 0, 2 * count);
+        return;
+    }
 
-        while (t) {
-            /* Check how much of the sample we can fill in one run */
-            if (c->loopflags && c->playend == 0) {
-                looplen = c->loopend - c->loopstart;
-                g_assert(looplen > 0);
-                if (c->loopflags == ST_SAMPLE_LOOPTYPE_AMIGA) {
+    while (t) {
+        /* Check how much of the sample we can fill in one run */
+        if (c->loopflags && c->playend == 0) {
+            looplen = c->loopend - c->loopstart;
+            g_assert(looplen > 0);
+            if (c->loopflags == ST_SAMPLE_LOOPTYPE_AMIGA) {
+                offs2end = c->loopend - c->current;
+                if (offs2end <= 0) {
+                    oflcnt = -offs2end / looplen;
+                    offs2end += oflcnt * looplen;
+                    c->current = c->loopstart - offs2end;
+                    offs2end = c->loopend - c->current;
+                }
+            } else /* if(c->loopflags == ST_SAMPLE_LOOPTYPE_PINGPONG) */ {
+                if (c->direction == 1)
                     offs2end = c->loopend - c->current;
-                    if (offs2end <= 0) {
-                        oflcnt = -offs2end / looplen;
-                        offs2end += oflcnt * looplen;
+                else
+                    offs2end = c->current - c->loopstart;
+
+                if (offs2end <= 0) {
+                    oflcnt = -offs2end / looplen;
+                    offs2end += oflcnt * looplen;
+                    if ((oflcnt && 1) ^ (c->direction == -1)) {
                         c->current = c->loopstart - offs2end;
                         offs2end = c->loopend - c->current;
-                    }
-                } else /* if(c->loopflags == ST_SAMPLE_LOOPTYPE_PINGPONG) */ {
-                    if (c->direction == 1)
-                        offs2end = c->loopend - c->current;
-                    else
+                        c->direction = 1;
+                    } else {
+                        c->current = c->loopend + offs2end;
+                        if (c->current == c->loopend)
+                            c->current--;
                         offs2end = c->current - c->loopstart;
-
-                    if (offs2end <= 0) {
-                        oflcnt = -offs2end / looplen;
-                        offs2end += oflcnt * looplen;
-                        if ((oflcnt && 1) ^ (c->direction == -1)) {
-                            c->current = c->loopstart - offs2end;
-                            offs2end = c->loopend - c->current;
-                            c->direction = 1;
-                        } else {
-                            c->current = c->loopend + offs2end;
-                            if (c->current == c->loopend)
-                                c->current--;
-                            offs2end = c->current - c->loopstart;
-                            c->direction = -1;
-                        }
+                        c->direction = -1;
                     }
                 }
-                g_assert(offs2end >= 0);
-                done = offs2end / c->speed + 1;
-            } else /* if(c->loopflags == LOOP_NO) */ {
-                done = ((c->playend ? c->playend : c->length) - c->current) / c->speed;
-                if (!done) {
-                    c->running = 0;
-                    break;
-                }
             }
+            g_assert(offs2end >= 0);
+            done = offs2end / c->speed + 1;
+        } else /* if(c->loopflags == LOOP_NO) */ {
+            done = ((c->playend ? c->playend : c->length) - c->current) / c->speed;
+            if (!done) {
+                c->running = 0;
+                break;
+            }
+        }
 
-            g_assert(done > 0);
+        g_assert(done > 0);
 
-            if (done > t)
-                done = t;
-            t -= done;
+        if (done > t)
+            done = t;
+        t -= done;
 
-            g_assert(c->current >= 0 && (c->current >> ACCURACY) < c->length);
+        g_assert(c->current >= 0 && (c->current >> ACCURACY) < c->length);
 
-            if (stereo) {
-                vl = 64 - ((c->panning + 1.0) * 32);
-                vr = (c->panning + 1.0) * 32;
-            }
+        if (mx->stereo) {
+            vl = 64 - ((c->panning + 1.0) * 32);
+            vr = (c->panning + 1.0) * 32;
+        }
 
-            /* This one does the actual mixing */
-            data = c->data;
-            if (scopebufs) {
-                if (stereo) {
-                    for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
-                        val = v * data[j >> ACCURACY];
-                        *m++ = vl * val >> 6;
-                        *m++ = vr * val >> 6;
-                        *scopedata++ = val >> 6;
-                    }
-                } else {
-                    for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
-                        val = v * data[j >> ACCURACY];
-                        *m++ = val;
-                        *scopedata++ = val >> 6;
-                    }
+        /* This one does the actual mixing */
+        data = c->data;
+        if (scopebufs) {
+            if (mx->stereo) {
+                for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
+                    val = v * data[j >> ACCURACY];
+                    *m++ = vl * val >> 6;
+                    *m++ = vr * val >> 6;
+                    *scopedata++ = val >> 6;
                 }
             } else {
-                if (stereo) {
-                    vl *= v;
-                    vr *= v;
-                    for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
-                        val = data[j >> ACCURACY];
-                        *m++ = vl * val >> 6;
-                        *m++ = vr * val >> 6;
-                    }
-                } else {
-                    for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
-                        val = v * data[j >> ACCURACY];
-                        *m++ = val;
-                    }
+                for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
+                    val = v * data[j >> ACCURACY];
+                    *m++ = val;
+                    *scopedata++ = val >> 6;
+                }
+            }
+        } else {
+            if (mx->stereo) {
+                vl *= v;
+                vr *= v;
+                for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
+                    val = data[j >> ACCURACY];
+                    *m++ = vl * val >> 6;
+                    *m++ = vr * val >> 6;
+                }
+            } else {
+                for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
+                    val = v * data[j >> ACCURACY];
+                    *m++ = val;
                 }
             }
-
-            c->current = j;
         }
 
-        g_mutex_unlock(&c->sample->lock);
-        c->mixbuf->num_processed = count - t;
+        c->current = j;
     }
+
+    c->mixbuf->num_processed = count - t;
+}
+
+static void
+integer32_render(void* mp, guint32 count,
+    gint16* scopebufs[],
+    int scopebuf_offset,
+    time_buffer* channels_status_tb,
+    gdouble time)
+{
+    integer32_mixer* const mx = mp;
+    int i;
+
+    epoch_enter();
+    for (i = 0; i < mx->num_channels; i++)
+        integer32_render_channel(mx, i, count, scopebufs, scopebuf_offset);
+    epoch_leave();
+}
+
+static void
+integer32_renderchannel(void* mp, int channel,
+    guint32 count)
+{
+    integer32_mixer* const mx = mp;
+
+    epoch_enter();
+    integer32_render_channel(mx, channel, count, NULL, 0);
+    epoch_leave();
 }
 
-void integer32_dumpstatus(st_mixer_channel_status array[])
+void integer32_dumpstatus(void* mp, st_mixer_channel_status array[])
 {
+    integer32_mixer* const mx = mp;
     int i;
 
     for (i = 0; i < 32; i++) {
-        if (channels[i].running) {
-            array[i].current_sample = channels[i].sample;
-            array[i].current_position = channels[i].current >> ACCURACY;
+        if (mx->channels[i].running) {
+            array[i].current_sample = mx->channels[i].sample;
+            array[i].current_position = mx->channels[i].current >> ACCURACY;
         } else {
             array[i].current_sample = NULL;
         }
@@ -380,26 +470,20 @@ void integer32_dumpstatus(st_mixer_channel_status array[])
 }
 
 static void
-integer32_loadchsettings(int ch)
+integer32_loadchsettings(void* mp, int ch, void* tracer)
 {
+    integer32_mixer* const mx = mp;
     tracer_channel* tch;
     integer32_channel* c;
     guint64 tmp64;
 
-    g_assert(ch < num_channels);
+    g_assert(ch < mx->num_channels);
 
-    tch = tracer_return_channel(ch);
-    c = &channels[ch];
+    tch = tracer_return_channel(tracer, ch);
+    c = &mx->channels[ch];
 
     c->sample = tch->sample;
-    c->data = tch->data;
-
-    if (tch->sample) {
-        c->loopflags = tch->looptype;
-        c->loopstart = MIN(tch->sample->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
-        c->loopend = MIN(tch->sample->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
-    }
-    c->length = MIN(tch->length, MAX_SAMPLE_LENGTH) << ACCURACY;
+    integer32_set_sample(c, &tch->smp);
     c->volume = tch->volume * 64;
     c->panning = tch->panning;
     c->direction = tch->direction;
@@ -416,9 +500,10 @@ st_mixer mixer_integer32 = {
     "integer32",
     N_("Integers mixer, no interpolation, no filters, maximum sample length 1M"),
 
+    integer32_new,
+    integer32_destroy,
     integer32_setnumch,
     integer32_setbuffers,
-    integer32_updatesample,
     integer32_setmixformat,
     integer32_setstereo,
     integer32_setmixfreq,
@@ -433,6 +518,7 @@ st_mixer mixer_integer32 = {
     NULL,
     NULL,
     integer32_render,
+    integer32_renderchannel,
     integer32_dumpstatus,
     integer32_loadchsettings,
 
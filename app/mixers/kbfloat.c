@@ -32,14 +32,13 @@
 #include <string.h>
 
 #include "audio.h"
+#include "epoch.h"
 #include "kbfloat-core.h"
 #include "mixer.h"
+#include "sample-sync.h"
 #include "tracer.h"
 #include "st-subs.h"
 
-static int num_channels, mixfreq;
-static float fmixfreq;
-
 float kb_x86_ct0[256];
 float kb_x86_ct1[256];
 float kb_x86_ct2[256];
@@ -49,9 +48,7 @@ typedef struct kb_x86_channel {
     st_mixer_sample_info* sample;
     st_mixer_buffer* kb_x86_tempbuf;
 
-    void* data; // for updatesample() to see if sample has changed
-    int looptype;
-    guint32 length;
+    st_mixer_sample_state smp; // what is being played, see sample-sync.h
 
     guint32 flags; // see below
     float volume; // 0.0 ... 1.0
@@ -91,8 +88,13 @@ enum {
     KB_FLAG_JUST_STOPPED = 2 << 7
 };
 
-// This is an artificial limit. The code can do more channels.
-static kb_x86_channel channels[2 * 32];
+typedef struct kb_x86_mixer {
+    int num_channels, mixfreq;
+    float fmixfreq;
+
+    // This is an artificial limit. The code can do more channels.
+    kb_x86_channel channels[2 * 32];
+} kb_x86_mixer;
 
 // Number of samples the mixer needs in advance
 #define KB_X86_SAMPLE_PADDING 3
@@ -100,25 +102,64 @@ static kb_x86_channel channels[2 * 32];
 // A ramp from 32768 to 0 should take RAMP_MAX_DURATION seconds
 #define RAMP_MAX_DURATION 0.001
 
-#define NUM_CHANNELS (sizeof(channels) / sizeof(kb_x86_channel))
+#define NUM_CHANNELS (2 * 32)
+
+static void
+kb_x86_init_tables(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        float x1 = i / 256.0;
+        float x2 = x1 * x1;
+        float x3 = x1 * x1 * x1;
+        kb_x86_ct0[i] = -0.5 * x3 + x2 - 0.5 * x1;
+        kb_x86_ct1[i] = 1.5 * x3 - 2.5 * x2 + 1;
+        kb_x86_ct2[i] = -1.5 * x3 + 2 * x2 + 0.5 * x1;
+        kb_x86_ct3[i] = 0.5 * x3 - 0.5 * x2;
+    }
+}
+
+static void*
+kb_x86_new(void)
+{
+    static gsize tables_initialized = 0;
+
+    /* The interpolation tables are shared by all the instances */
+    if (g_once_init_enter(&tables_initialized)) {
+        kb_x86_init_tables();
+        g_once_init_leave(&tables_initialized, 1);
+    }
+
+    return g_new0(kb_x86_mixer, 1);
+}
+
+static void
+kb_x86_destroy(void* mp)
+{
+    g_free(mp);
+}
 
 static void
-kb_x86_setnumch(int n)
+kb_x86_setnumch(void* mp, int n)
 {
+    kb_x86_mixer* const mx = mp;
+
     g_assert(n >= 1 && n <= 32);
 
-    num_channels = n;
+    mx->num_channels = n;
 }
 
 static void
-kb_x86_setbuffers(st_mixer_buffer buffers[])
+kb_x86_setbuffers(void* mp, st_mixer_buffer buffers[])
 {
+    kb_x86_mixer* const mx = mp;
     gint i;
 
     for (i = 0; i < 32; i++) {
-        channels[i].kb_x86_tempbuf = &buffers[i];
+        mx->channels[i].kb_x86_tempbuf = &buffers[i];
         /* Virtual channels shares the same buffer */
-        channels[i + 32].kb_x86_tempbuf = &buffers[i];
+        mx->channels[i + 32].kb_x86_tempbuf = &buffers[i];
     }
 }
 
@@ -142,54 +183,78 @@ kb_x86_setbuffers(st_mixer_buffer buffers[])
    virtual-channel support will make this superfluous.
 */
 static kb_x86_channel*
-kb_x86_get_channel_struct(int channel)
+kb_x86_get_channel_struct(kb_x86_mixer* mx, int channel)
 {
-    kb_x86_channel* c = &channels[channel];
+    kb_x86_channel* c = &mx->channels[channel];
 
     if (c->flags & KB_FLAG_UPPER_ACTIVE) {
-        c = &channels[channel + 32];
+        c = &mx->channels[channel + 32];
     }
 
     return c;
 }
 
 static void
-kb_x86_updatesample(st_mixer_sample_info* si)
+kb_x86_set_loop_flags(kb_x86_channel* c)
 {
-    int i;
-    kb_x86_channel* c;
+    c->flags &= ~(KB_FLAG_LOOP_UNIDIRECTIONAL | KB_FLAG_LOOP_BIDIRECTIONAL);
+    if (c->smp.flags & ST_SAMPLE_LOOPTYPE_AMIGA) {
+        c->flags |= KB_FLAG_LOOP_UNIDIRECTIONAL;
+    } else if (c->smp.flags & ST_SAMPLE_LOOPTYPE_PINGPONG) {
+        c->flags |= KB_FLAG_LOOP_BIDIRECTIONAL;
+    }
+}
 
-    for (i = 0; i < NUM_CHANNELS; i++) {
-        c = &channels[i];
+/* Picks up the changes made by the editors. Returns FALSE if the channel
+   can't be rendered this time. */
+static gboolean
+kb_x86_sync_sample(kb_x86_channel* c)
+{
+    st_mixer_sample_state st;
 
-        if (c->sample != si || !(c->flags & KB_FLAG_SAMPLE_RUNNING)) {
-            continue;
-        }
+    if (sample_sync_check(c->sample, &c->smp) != SAMPLE_SYNC_STALE)
+        return TRUE;
+    if (!sample_sync_snapshot(c->sample, &st))
+        /* Being edited again, our data may be gone already */
+        return FALSE;
 
-        if (c->data != si->data
-            || c->length != si->length
-            || c->looptype != (si->flags & ST_SAMPLE_LOOP_MASK)) {
-            c->flags &= ~KB_FLAG_SAMPLE_RUNNING;
-            continue;
+    if (c->smp.generation < 0) {
+        /* Started while the sample was being edited */
+        c->smp = st;
+        kb_x86_set_loop_flags(c);
+        if (c->positionw >= st.length) {
+            c->flags &= KB_FLAG_UPPER_ACTIVE;
+            return FALSE;
         }
+        return TRUE;
+    }
 
-        /* No relevant data has changed. Don't stop the sample, but update
-	   our local loop data instead. */
-        c->looptype = si->flags & ST_SAMPLE_LOOP_MASK;
-        if (c->looptype != ST_SAMPLE_LOOPTYPE_NONE) {
-            if (c->positionw < si->loopstart) {
-                c->positionw = si->loopstart;
-                c->positionf = 0x7fffffff;
-            } else if (c->positionw >= si->loopend) {
-                c->positionw = si->loopend - 1;
-                c->positionf = 0x7fffffff;
-            }
+    if (c->smp.length != st.length
+        || (c->smp.flags & (ST_SAMPLE_LOOP_MASK | ST_SAMPLE_STEREO))
+            != (st.flags & (ST_SAMPLE_LOOP_MASK | ST_SAMPLE_STEREO))) {
+        c->smp = st;
+        c->flags &= ~KB_FLAG_SAMPLE_RUNNING;
+        return FALSE;
+    }
+
+    /* Only the data or the loop points have changed. Don't stop the sample,
+       but update our local copy instead. */
+    c->smp = st;
+    if (st.flags & ST_SAMPLE_LOOP_MASK) {
+        if (c->positionw < st.loopstart) {
+            c->positionw = st.loopstart;
+            c->positionf = 0x7fffffff;
+        } else if (c->positionw >= st.loopend) {
+            c->positionw = st.loopend - 1;
+            c->positionf = 0x7fffffff;
         }
     }
+
+    return TRUE;
 }
 
 static gboolean
-kb_x86_setmixformat(int format)
+kb_x86_setmixformat(void* mp, int format)
 {
     if (format != 16)
         return FALSE;
@@ -198,7 +263,7 @@ kb_x86_setmixformat(int format)
 }
 
 static gboolean
-kb_x86_setstereo(int on)
+kb_x86_setstereo(void* mp, int on)
 {
     if (!on)
         return FALSE;
@@ -207,73 +272,62 @@ kb_x86_setstereo(int on)
 }
 
 static void
-kb_x86_setmixfreq(guint32 frequency)
+kb_x86_setmixfreq(void* mp, guint32 frequency)
 {
-    mixfreq = frequency;
-    fmixfreq = 48000.0 / (float)mixfreq;
+    kb_x86_mixer* const mx = mp;
+
+    mx->mixfreq = frequency;
+    mx->fmixfreq = 48000.0 / (float)mx->mixfreq;
 }
 
 static void
-kb_x86_reset(void)
+kb_x86_reset(void* mp)
 {
+    kb_x86_mixer* const mx = mp;
     int i;
     st_mixer_buffer* tmp[NUM_CHANNELS];
 
     for (i = 0; i < NUM_CHANNELS; i++)
-        tmp[i] = channels[i].kb_x86_tempbuf;
-    memset(channels, 0, sizeof(channels));
+        tmp[i] = mx->channels[i].kb_x86_tempbuf;
+    memset(mx->channels, 0, sizeof(mx->channels));
     for (i = 0; i < NUM_CHANNELS; i++)
-        channels[i].kb_x86_tempbuf= tmp[i];
-
-    for (i = 0; i < 256; i++) {
-        float x1 = i / 256.0;
-        float x2 = x1 * x1;
-        float x3 = x1 * x1 * x1;
-        kb_x86_ct0[i] = -0.5 * x3 + x2 - 0.5 * x1;
-        kb_x86_ct1[i] = 1.5 * x3 - 2.5 * x2 + 1;
-        kb_x86_ct2[i] = -1.5 * x3 + 2 * x2 + 0.5 * x1;
-        kb_x86_ct3[i] = 0.5 * x3 - 0.5 * x2;
-    }
+        mx->channels[i].kb_x86_tempbuf= tmp[i];
 }
 
 static void
-kb_x86_startnote(int channel,
+kb_x86_startnote(void* mp, int channel,
     st_mixer_sample_info* s)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     c->flags &= KB_FLAG_UPPER_ACTIVE;
 
     c->sample = s;
-
-    // The following three for update_sample()
-    c->data = s->data;
-    c->length = s->length;
-    c->looptype = s->flags & ST_SAMPLE_LOOP_MASK;
+    memset(&c->smp, 0, sizeof(c->smp));
+    c->smp.generation = -1;
 
     c->positionw = 0;
     c->positionf = 0;
     c->playend = 0;
-    if (s->flags & ST_SAMPLE_LOOPTYPE_AMIGA) {
-        c->flags |= KB_FLAG_LOOP_UNIDIRECTIONAL;
-    } else if (s->flags & ST_SAMPLE_LOOPTYPE_PINGPONG) {
-        c->flags |= KB_FLAG_LOOP_BIDIRECTIONAL;
-    }
     c->direction = 1;
     c->ramp_num_samples = 0;
     c->freso = 0.0;
-    c->ffreq = fmixfreq;
+    c->ffreq = mx->fmixfreq;
     c->filter_on = FALSE;
     c->fl1 = 0.0;
     c->fb1 = 0.0;
     c->flags |= KB_FLAG_SAMPLE_RUNNING | KB_FLAG_JUST_STARTED;
+    /* If the sample is being edited, the next render will try again */
+    kb_x86_sync_sample(c);
 }
 
 static void
-kb_x86_stopnote(int channel)
+kb_x86_stopnote(void* mp, int channel)
 {
-    kb_x86_channel* c = &channels[channel];
-    kb_x86_channel* current_used_chan = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = &mx->channels[channel];
+    kb_x86_channel* current_used_chan = kb_x86_get_channel_struct(mx, channel);
 
     if (current_used_chan->flags & KB_FLAG_SAMPLE_RUNNING) {
         if (current_used_chan != c) {
@@ -286,7 +340,7 @@ kb_x86_stopnote(int channel)
 
         c->flags |= KB_FLAG_STOP_AFTER_VOLRAMP;
 
-        c->ramp_num_samples = RAMP_MAX_DURATION * mixfreq;
+        c->ramp_num_samples = RAMP_MAX_DURATION * mx->mixfreq;
         if (c->ramp_num_samples == 0) {
             c->ramp_num_samples = 1;
         }
@@ -298,13 +352,14 @@ kb_x86_stopnote(int channel)
 }
 
 static void
-kb_x86_setsmplpos(int channel,
+kb_x86_setsmplpos(void* mp, int channel,
     guint32 offset)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     if (c->sample && c->flags != 0) {
-        if (offset < c->sample->length) {
+        if (c->smp.generation < 0 || offset < c->smp.length) {
             c->positionw = offset;
             c->positionf = 0;
             c->direction = 1;
@@ -320,13 +375,14 @@ kb_x86_setsmplpos(int channel,
 }
 
 static void
-kb_x86_setsmplend(int channel,
+kb_x86_setsmplend(void* mp, int channel,
     guint32 playend)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     if (c->sample && c->flags != 0 && playend > 0) {
-        if (c->positionw != 0 || playend < c->sample->length) {
+        if (c->positionw != 0 || playend < c->smp.length) {
             // only end if the selection is not the whole sample
             c->playend = playend;
         }
@@ -334,19 +390,20 @@ kb_x86_setsmplend(int channel,
 }
 
 static void
-kb_x86_setfreq(int channel,
+kb_x86_setfreq(void* mp, int channel,
     float frequency)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
-    frequency /= mixfreq;
+    frequency /= mx->mixfreq;
 
     c->freqw = (guint32)floor(frequency);
     c->freqf = (guint32)((frequency - c->freqw) * 4294967296.0 /* this is pow(2,32) */);
 }
 
 static void
-kb_x86_redo_vol_fields(kb_x86_channel* c)
+kb_x86_redo_vol_fields(kb_x86_mixer* mx, kb_x86_channel* c)
 {
     c->rampdestleft = c->volume * (1.0 - c->panning);
     c->rampdestright = c->volume * c->panning;
@@ -357,7 +414,7 @@ kb_x86_redo_vol_fields(kb_x86_channel* c)
         c->volleft = c->rampdestleft;
         c->volright = c->rampdestright;
     } else {
-        c->ramp_num_samples = RAMP_MAX_DURATION * mixfreq;
+        c->ramp_num_samples = RAMP_MAX_DURATION * mx->mixfreq;
         if (c->ramp_num_samples == 0) {
             c->ramp_num_samples = 1;
         }
@@ -367,48 +424,52 @@ kb_x86_redo_vol_fields(kb_x86_channel* c)
 }
 
 static void
-kb_x86_setvolume(int channel,
+kb_x86_setvolume(void* mp, int channel,
     float volume)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     c->volume = volume;
-    kb_x86_redo_vol_fields(c);
+    kb_x86_redo_vol_fields(mx, c);
 }
 
 static void
-kb_x86_setpanning(int channel,
+kb_x86_setpanning(void* mp, int channel,
     float panning)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     c->panning = 0.5 * (panning + 1.0);
-    kb_x86_redo_vol_fields(c);
+    kb_x86_redo_vol_fields(mx, c);
 }
 
 static void
-kb_x86_setchcutoff(int channel,
+kb_x86_setchcutoff(void* mp, int channel,
     float freq)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     if (freq < 0.0) {
-        c->ffreq = fmixfreq;
+        c->ffreq = mx->fmixfreq;
         c->freso = 0.0;
         c->filter_on = FALSE;
     } else {
         g_assert(0.0 <= freq);
         g_assert(freq <= 1.0);
-        c->ffreq = freq * fmixfreq;
+        c->ffreq = freq * mx->fmixfreq;
         c->filter_on = TRUE;
     }
 }
 
 static void
-kb_x86_setchreso(int channel,
+kb_x86_setchreso(void* mp, int channel,
     float reso)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const mx = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(mx, channel);
 
     g_assert(0.0 <= reso);
     g_assert(reso <= 1.0);
@@ -459,11 +520,11 @@ kb_x86_mix_sub(kb_x86_channel* ch,
     const gboolean loopit = (ch->playend == 0) && (ch->flags & (KB_FLAG_LOOP_UNIDIRECTIONAL | KB_FLAG_LOOP_BIDIRECTIONAL));
     const gboolean gonnapingpong = loopit && (ch->flags & KB_FLAG_LOOP_BIDIRECTIONAL);
 
-    const gint64 lstart64 = ((guint64)ch->sample->loopstart) << 32;
+    const gint64 lstart64 = ((guint64)ch->smp.loopstart) << 32;
     const gint32 pos = ch->positionw;
     const gint64 freq64 = (((guint64)ch->freqw) << 32) + (guint64)ch->freqf;
     const gint64 pos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
-    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->sample->loopend : ch->length);
+    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->smp.loopend : ch->smp.length);
     const gint64 ende64 = (guint64)ende << 32;
 
     int num_samples;
@@ -504,12 +565,12 @@ kb_x86_mix_sub(kb_x86_channel* ch,
     if (virtual) {
         md.flags |= KB_X86_MIXER_FLAGS_VIRTUAL;
     }
-    if (ch->sample->flags & ST_SAMPLE_STEREO) {
+    if (ch->smp.flags & ST_SAMPLE_STEREO) {
         md.flags |= KB_X86_MIXER_FLAGS_STEREO;
     }
 
     if ((ch->direction == 1 && pos >= ende - KB_X86_SAMPLE_PADDING)
-        || (ch->direction == -1 && pos < (gint32)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING))) {
+        || (ch->direction == -1 && pos < (gint32)(ch->smp.loopstart + KB_X86_SAMPLE_PADDING))) {
         /* This is the dangerous case. We are near one of the ends of
 	   a loop or sample (we might even have crossed it
 	   already!). We have to take care of handling the looping and
@@ -532,7 +593,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
 	       frequencies. */
             gboolean touched = FALSE;
             gint64 mypos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
-            gint64 lend64 = (((guint64)ch->sample->loopend) << 32) - 1;
+            gint64 lend64 = (((guint64)ch->smp.loopend) << 32) - 1;
 
             while (1) {
                 if (ch->direction == 1 && mypos64 >= lend64) {
@@ -561,9 +622,9 @@ kb_x86_mix_sub(kb_x86_channel* ch,
         } else if (loopit) {
             /* The unidirectional ("Amiga") loop case. */
             gboolean touched = FALSE;
-            guint32 looplen = ch->sample->loopend - ch->sample->loopstart;
+            guint32 looplen = ch->smp.loopend - ch->smp.loopstart;
 
-            while (ch->positionw >= ch->sample->loopend) {
+            while (ch->positionw >= ch->smp.loopend) {
                 ch->positionw -= looplen;
                 touched = TRUE;
             }
@@ -584,7 +645,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
         /* The following code is concerned with doing the fake sample
 	   stuff for correct handling of the loop incontinuities. */
         if (loopit || gonnapingpong) {
-            g_assert(pos < ch->sample->loopend);
+            g_assert(pos < ch->smp.loopend);
         }
 
         if (gonnapingpong) {
@@ -596,16 +657,16 @@ kb_x86_mix_sub(kb_x86_channel* ch,
                 bufferpt += bufsize - 1;
             }
             for (i = 0, j = pos; i < bufsize; i++) {
-                *bufferpt = ((gint16*)ch->sample->data)[j];
+                *bufferpt = ((gint16*)ch->smp.data)[j];
                 if (md.flags & KB_X86_MIXER_FLAGS_STEREO)
-                    bufferpt[bufsize] = ((gint16*)ch->sample->data)[j + ch->sample->length];
+                    bufferpt[bufsize] = ((gint16*)ch->smp.data)[j + ch->smp.length];
                 if (dir == +1) {
-                    if (++j >= ch->sample->loopend) {
+                    if (++j >= ch->smp.loopend) {
                         dir = -1;
                         j--;
                     }
                 } else {
-                    if (--j < (gint32)ch->sample->loopstart) {
+                    if (--j < (gint32)ch->smp.loopstart) {
                         j++;
                         dir = +1;
                     }
@@ -614,12 +675,12 @@ kb_x86_mix_sub(kb_x86_channel* ch,
             }
         } else {
             for (i = 0, j = pos; i < bufsize; i++) {
-                buffer[i] = ((gint16*)ch->sample->data)[j];
+                buffer[i] = ((gint16*)ch->smp.data)[j];
                 if (md.flags & KB_X86_MIXER_FLAGS_STEREO)
-                    buffer[i + bufsize] = ((gint16*)ch->sample->data)[j + ch->sample->length];
+                    buffer[i + bufsize] = ((gint16*)ch->smp.data)[j + ch->smp.length];
                 if (++j >= ende) {
                     if (loopit) {
-                        j -= (ch->sample->loopend - ch->sample->loopstart);
+                        j -= (ch->smp.loopend - ch->smp.loopstart);
                     } else {
                         j--;
                     }
@@ -656,7 +717,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
 
 	   Now calculate how far we can go on like this until we hit a
 	   dangerous area.  */
-        md.stereo_off = ch->sample->length;
+        md.stereo_off = ch->smp.length;
         if (ch->direction == 1) {
             const guint64 wieweit64 = pos64 + freq64 * num_samples_left;
             const guint32 wieweit = wieweit64 >> 32;
@@ -677,7 +738,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
                 num_samples = num_samples_left;
             }
 
-            md.positioni = (gint16*)ch->sample->data + pos;
+            md.positioni = (gint16*)ch->smp.data + pos;
             md.numsamples = num_samples;
             kb_x86_call_mixer(ch, &md, TRUE);
         } else {
@@ -685,22 +746,22 @@ kb_x86_mix_sub(kb_x86_channel* ch,
             const gint64 wieweit64 = pos64 - freq64 * num_samples_left;
             const gint32 wieweit = wieweit64 >> 32;
 
-            if (wieweit < (gint32)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING)) {
-                num_samples = 1 + (pos64 - (((guint64)KB_X86_SAMPLE_PADDING + ch->sample->loopstart) << 32)) / freq64;
+            if (wieweit < (gint32)(ch->smp.loopstart + KB_X86_SAMPLE_PADDING)) {
+                num_samples = 1 + (pos64 - (((guint64)KB_X86_SAMPLE_PADDING + ch->smp.loopstart) << 32)) / freq64;
                 g_assert(num_samples > 0);
-                g_assert(pos64 - freq64 * (gint64)(num_samples) < ((gint64)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING) << 32));
-                g_assert(pos64 - freq64 * (gint64)(num_samples - 1) >= ((gint64)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING) << 32));
+                g_assert(pos64 - freq64 * (gint64)(num_samples) < ((gint64)(ch->smp.loopstart + KB_X86_SAMPLE_PADDING) << 32));
+                g_assert(pos64 - freq64 * (gint64)(num_samples - 1) >= ((gint64)(ch->smp.loopstart + KB_X86_SAMPLE_PADDING) << 32));
                 num_samples = MIN(num_samples_left, num_samples);
             } else {
                 num_samples = num_samples_left;
             }
 
-            md.positioni = (gint16*)ch->sample->data + pos;
+            md.positioni = (gint16*)ch->smp.data + pos;
             md.numsamples = num_samples;
             kb_x86_call_mixer(ch, &md, FALSE);
         }
 
-        ch->positionw = md.positioni - (gint16*)ch->sample->data;
+        ch->positionw = md.positioni - (gint16*)ch->smp.data;
         ch->positionf = md.positionf;
         ch->volleft = md.volleft;
         ch->volright = md.volright;
@@ -711,131 +772,163 @@ kb_x86_mix_sub(kb_x86_channel* ch,
     }
 }
 
+/* The upper (virtual) channel shares the output buffer with the lower one
+   and must be rendered after it; otherwise the channels are independent and
+   can be rendered concurrently */
 static void
-kb_x86_render(guint32 count,
+kb_x86_render_channel(kb_x86_mixer* mx, int chnr,
+    guint32 count,
     gint16* scopebufs[],
     int scopebuf_offset,
     time_buffer* c_s_tb,
     gdouble time)
 {
-    int chnr;
-
-    for (chnr = 0; chnr < NUM_CHANNELS; chnr++) {
-        kb_x86_channel* ch = channels + chnr;
-        guint32 num_samples_left = count, already_processed = 0, num_processed;
-        gint16* scopedata = NULL;
-        float* tempbuf = ch->kb_x86_tempbuf->buffer;
-
-        if ((chnr & 31) >= num_channels)
-            continue;
+    kb_x86_channel* ch = mx->channels + chnr;
+    guint32 num_samples_left = count, already_processed = 0, num_processed;
+    gint16* scopedata = NULL;
+    float* tempbuf = ch->kb_x86_tempbuf->buffer;
+
+    if ((chnr & 31) >= mx->num_channels)
+        return;
+
+    if (chnr < 32)
+        ch->kb_x86_tempbuf->num_processed = 0;
+    num_processed = ch->kb_x86_tempbuf->num_processed;
+    if (scopebufs && (chnr < 32 || (mx->channels[chnr - 32].flags & KB_FLAG_UPPER_ACTIVE))) {
+        scopedata = scopebufs[chnr & 31] + scopebuf_offset;
+    }
 
-        if (chnr < 32)
-            ch->kb_x86_tempbuf->num_processed = 0;
-        num_processed = ch->kb_x86_tempbuf->num_processed;
-        if (scopebufs && (chnr < 32 || (channels[chnr - 32].flags & KB_FLAG_UPPER_ACTIVE))) {
-            scopedata = scopebufs[chnr & 31] + scopebuf_offset;
+    if (!(ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
+        if (scopedata) {
+            memset(scopedata, 0, 2 * num_samples_left);
         }
+        return;
+    }
 
-        if (!(ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
-            if (scopedata) {
-                memset(scopedata, 0, 2 * num_samples_left);
+    if (ch->flags & KB_FLAG_JUST_STARTED) {
+        if (ch->flags & KB_FLAG_DO_SAMPLE_START_DECLICK) {
+            ch->ramp_num_samples = RAMP_MAX_DURATION * mx->mixfreq;
+            if (ch->ramp_num_samples == 0) {
+                ch->ramp_num_samples = 1;
             }
-            continue;
+            ch->volleft = 0.0;
+            ch->volright = 0.0;
+            ch->rampleft = (ch->rampdestleft - ch->volleft) / ch->ramp_num_samples;
+            ch->rampright = (ch->rampdestright - ch->volright) / ch->ramp_num_samples;
         }
 
-        if (ch->flags & KB_FLAG_JUST_STARTED) {
-            if (ch->flags & KB_FLAG_DO_SAMPLE_START_DECLICK) {
-                ch->ramp_num_samples = RAMP_MAX_DURATION * mixfreq;
-                if (ch->ramp_num_samples == 0) {
-                    ch->ramp_num_samples = 1;
-                }
-                ch->volleft = 0.0;
-                ch->volright = 0.0;
-                ch->rampleft = (ch->rampdestleft - ch->volleft) / ch->ramp_num_samples;
-                ch->rampright = (ch->rampdestright - ch->volright) / ch->ramp_num_samples;
-            }
+        ch->flags &= ~KB_FLAG_JUST_STARTED;
+    }
 
-            ch->flags &= ~KB_FLAG_JUST_STARTED;
+    if (!kb_x86_sync_sample(ch)) {
+        if (scopedata) {
+            memset(scopedata, 0, 2 * num_samples_left);
         }
+        return;
+    }
 
-        g_mutex_lock(&ch->sample->lock);
-
-        while (num_samples_left && (ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
-            int num_samples;
-            gboolean vol_ramping = (ch->ramp_num_samples != 0);
-            int max_samples_this_time = vol_ramping ? MIN(ch->ramp_num_samples, num_samples_left) : num_samples_left;
-
-            ch->flags &= ~KB_FLAG_JUST_STOPPED;
-            if (already_processed < num_processed)
-                /* The channes is partly filled, we shoud add new data to it */
-                num_samples = kb_x86_mix_sub(ch,
-                    MIN(max_samples_this_time, num_processed - already_processed), vol_ramping,
-                    tempbuf, scopedata, TRUE);
-            else
-                /* Free part, just render as is */
-                num_samples = kb_x86_mix_sub(ch,
-                    max_samples_this_time, vol_ramping,
-                    tempbuf, scopedata, FALSE);
-
-            if (vol_ramping) {
-                ch->ramp_num_samples -= num_samples;
-                if (ch->ramp_num_samples == 0) {
-                    /* Volume ramping finished. */
-                    ch->volleft = ch->rampdestleft;
-                    ch->volright = ch->rampdestright;
-                    if (ch->flags & KB_FLAG_STOP_AFTER_VOLRAMP) {
-                        /* This was only a declicking channel. Stop sample. */
-                        ch->flags &= KB_FLAG_UPPER_ACTIVE;
-                    }
-                }
-            }
-
-            num_samples_left -= num_samples;
-            already_processed += num_samples;
-            /* Reporting sample end */
-            if (ch->flags & KB_FLAG_JUST_STOPPED && c_s_tb) {
-                /* We concern only about lower 32 channels */
-                gint chnr_stopped = chnr < 32 ? chnr : chnr - 32;
-
-                /* Making sure that the playback on the current channel is do stopped */
-                if (!(channels[chnr_stopped].flags & KB_FLAG_SAMPLE_RUNNING)) {
-                    audio_channel_status* p;
-
-                    p = g_new(audio_channel_status, 1);
-                    p->command = AUDIO_COMMAND_STOP_PLAYING;
-                    p->channel = chnr_stopped;
-                    time_buffer_add(c_s_tb, p,
-                        time + (gdouble)(count - num_samples_left) / (gdouble)mixfreq);
+    while (num_samples_left && (ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
+        int num_samples;
+        gboolean vol_ramping = (ch->ramp_num_samples != 0);
+        int max_samples_this_time = vol_ramping ? MIN(ch->ramp_num_samples, num_samples_left) : num_samples_left;
+
+        ch->flags &= ~KB_FLAG_JUST_STOPPED;
+        if (already_processed < num_processed)
+            /* The channes is partly filled, we shoud add new data to it */
+            num_samples = kb_x86_mix_sub(ch,
+                MIN(max_samples_this_time, num_processed - already_processed), vol_ramping,
+                tempbuf, scopedata, TRUE);
+        else
+            /* Free part, just render as is */
+            num_samples = kb_x86_mix_sub(ch,
+                max_samples_this_time, vol_ramping,
+                tempbuf, scopedata, FALSE);
+
+        if (vol_ramping) {
+            ch->ramp_num_samples -= num_samples;
+            if (ch->ramp_num_samples == 0) {
+                /* Volume ramping finished. */
+                ch->volleft = ch->rampdestleft;
+                ch->volright = ch->rampdestright;
+                if (ch->flags & KB_FLAG_STOP_AFTER_VOLRAMP) {
+                    /* This was only a declicking channel. Stop sample. */
+                    ch->flags &= KB_FLAG_UPPER_ACTIVE;
                 }
             }
+        }
 
-            tempbuf += (num_samples * 2);
-            if (scopedata) {
-                scopedata += num_samples;
+        num_samples_left -= num_samples;
+        already_processed += num_samples;
+        /* Reporting sample end */
+        if (ch->flags & KB_FLAG_JUST_STOPPED && c_s_tb) {
+            /* We concern only about lower 32 channels */
+            gint chnr_stopped = chnr < 32 ? chnr : chnr - 32;
+
+            /* Making sure that the playback on the current channel is do stopped */
+            if (!(mx->channels[chnr_stopped].flags & KB_FLAG_SAMPLE_RUNNING)) {
+                audio_channel_status p;
+
+                p.command = AUDIO_COMMAND_STOP_PLAYING;
+                p.channel = chnr_stopped;
+                time_buffer_add(c_s_tb, &p,
+                    time + (gdouble)(count - num_samples_left) / (gdouble)mx->mixfreq);
             }
         }
 
-        g_mutex_unlock(&ch->sample->lock);
-        if (already_processed > num_processed)
-            ch->kb_x86_tempbuf->num_processed = already_processed;
+        tempbuf += (num_samples * 2);
+        if (scopedata) {
+            scopedata += num_samples;
+        }
     }
+
+    if (already_processed > num_processed)
+        ch->kb_x86_tempbuf->num_processed = already_processed;
+}
+
+static void
+kb_x86_render(void* mp, guint32 count,
+    gint16* scopebufs[],
+    int scopebuf_offset,
+    time_buffer* c_s_tb,
+    gdouble time)
+{
+    kb_x86_mixer* const mx = mp;
+    int chnr;
+
+    epoch_enter();
+    for (chnr = 0; chnr < NUM_CHANNELS; chnr++)
+        kb_x86_render_channel(mx, chnr, count, scopebufs, scopebuf_offset, c_s_tb, time);
+    epoch_leave();
+}
+
+static void
+kb_x86_renderchannel(void* mp, int channel,
+    guint32 count)
+{
+    kb_x86_mixer* const mx = mp;
+
+    epoch_enter();
+    kb_x86_render_channel(mx, channel, count, NULL, 0, NULL, 0.0);
+    kb_x86_render_channel(mx, channel + 32, count, NULL, 0, NULL, 0.0);
+    epoch_leave();
 }
 
-void kb_x86_dumpstatus(st_mixer_channel_status array[])
+void kb_x86_dumpstatus(void* mp, st_mixer_channel_status array[])
 {
+    kb_x86_mixer* const mx = mp;
     int i;
     gint32 pos;
 
     for (i = 0; i < 32; i++) {
-        kb_x86_channel* c = kb_x86_get_channel_struct(i);
+        kb_x86_channel* c = kb_x86_get_channel_struct(mx, i);
 
         if (c->flags & KB_FLAG_SAMPLE_RUNNING) {
             array[i].current_sample = c->sample;
             pos = c->positionw;
             if (pos < 0) {
                 pos = 0;
-            } else if (pos >= c->sample->length) {
-                pos = c->sample->length - 1;
+            } else if (pos >= c->smp.length) {
+                pos = c->smp.length ? c->smp.length - 1 : 0;
             }
             array[i].current_position = pos;
         } else {
@@ -845,20 +938,19 @@ void kb_x86_dumpstatus(st_mixer_channel_status array[])
 }
 
 static void
-kb_x86_loadchsettings(int ch)
+kb_x86_loadchsettings(void* mp, int ch, void* tracer)
 {
+    kb_x86_mixer* const mx = mp;
     tracer_channel* tch;
     kb_x86_channel* kbch;
 
-    g_assert(ch < num_channels);
+    g_assert(ch < mx->num_channels);
 
-    tch = tracer_return_channel(ch);
-    kbch = kb_x86_get_channel_struct(ch);
+    tch = tracer_return_channel(tracer, ch);
+    kbch = kb_x86_get_channel_struct(mx, ch);
 
     kbch->sample = tch->sample;
-    kbch->data = tch->data;
-    kbch->looptype = tch->looptype;
-    kbch->length = tch->length;
+    kbch->smp = tch->smp;
     kbch->volume = tch->volume;
     kbch->panning = tch->panning;
     kbch->direction = tch->direction;
@@ -873,16 +965,17 @@ kb_x86_loadchsettings(int ch)
 
     kbch->flags = (kbch->flags & KB_FLAG_UPPER_ACTIVE) | KB_FLAG_JUST_STARTED | ((tch->flags & TR_FLAG_LOOP_UNIDIRECTIONAL) ? KB_FLAG_LOOP_UNIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_LOOP_BIDIRECTIONAL) ? KB_FLAG_LOOP_BIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_SAMPLE_RUNNING) ? KB_FLAG_SAMPLE_RUNNING : 0);
 
-    kb_x86_redo_vol_fields(kbch);
+    kb_x86_redo_vol_fields(mx, kbch);
 }
 
 st_mixer mixer_kbfloat = {
     "kbfloat",
     N_("High-quality FPU mixer, cubic interpolation, IT filters, unlimited length samples"),
 
+    kb_x86_new,
+    kb_x86_destroy,
     kb_x86_setnumch,
     kb_x86_setbuffers,
-    kb_x86_updatesample,
     kb_x86_setmixformat,
     kb_x86_setstereo,
     kb_x86_setmixfreq,
@@ -897,6 +990,7 @@ st_mixer mixer_kbfloat = {
     kb_x86_setchcutoff,
     kb_x86_setchreso,
     kb_x86_render,
+    kb_x86_renderchannel,
     kb_x86_dumpstatus,
     kb_x86_loadchsettings,
 
@@ -38,6 +38,7 @@
 #include "main.h"
 #include "module-info.h"
 #include "sample-editor.h"
+#include "sample-sync.h"
 #include "st-subs.h"
 #include "track-editor.h"
 #include "xm.h"
@@ -334,7 +335,7 @@ static void sample_copy_undo(const gint ins, const gint smp, const gboolean redo
     const gsize data_length = dst_smp->sample.length * sizeof(dst_smp->sample.data[0]);
     gint16* tmp_data = NULL;
     STSample tmp_smp;
-    GMutex tmp_lock;
+    st_mixer_sample_sync tmp_sync;
 
     if (data_length) {
         tmp_data = g_malloc(data_length);
@@ -347,10 +348,9 @@ static void sample_copy_undo(const gint ins, const gint smp, const gboolean redo
     tmp_smp = *dst_smp;
     memcpy(tmp_smap, dst_ins->samplemap, sizeof(dst_ins->samplemap));
 
-    g_mutex_lock(&dst_smp->sample.lock);
-    tmp_lock = dst_smp->sample.lock;
-    if (dst_smp->sample.length && dst_smp->sample.data)
-        g_free(dst_smp->sample.data);
+    sample_sync_edit_begin(&dst_smp->sample, FALSE);
+    sample_sync_free_data(&dst_smp->sample);
+    tmp_sync = dst_smp->sample.sync;
     memcpy(dst_ins->samplemap, bup->samplemap, sizeof(dst_ins->samplemap));
     *dst_smp = bup->sample;
     if (dst_smp->sample.length) {
@@ -358,8 +358,8 @@ static void sample_copy_undo(const gint ins, const gint smp, const gboolean redo
         memcpy(dst_smp->sample.data, bup->data, dst_smp->sample.length * sizeof(bup->data[0]));
     } else
         dst_smp->sample.data = NULL;
-    dst_smp->sample.lock = tmp_lock;
-    g_mutex_unlock(&dst_smp->sample.lock);
+    dst_smp->sample.sync = tmp_sync;
+    sample_sync_edit_end(&dst_smp->sample);
 
     bup->sample = tmp_smp;
     if (tmp_data) {
@@ -753,7 +753,7 @@ mix_clicked(void)
                 HISTORY_SET_PAGE(NOTEBOOK_PAGE_SAMPLE_EDITOR), loglen))
         return;
 
-    g_mutex_lock(&sample->sample.lock);
+    sample_sync_edit_begin(&sample->sample, TRUE);
     if (length1 < length2) {
         gsize alloc_len = length2 * sizeof(sample->sample.data[0]);
 
@@ -767,7 +767,7 @@ mix_clicked(void)
     }
     mix_samples(sample, sample, sample1, length1, length2, mixlevel);
 
-    g_mutex_unlock(&sample->sample.lock);
+    sample_sync_edit_end(&sample->sample);
     sample_editor_update();
 }
 
@@ -0,0 +1,174 @@
+/*
+ * The Real SoundTracker - lock-free publication of the patterns and
+ * the order list
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "epoch.h"
+#include "pattern-sync.h"
+
+/* The patterns are changed only by the GUI thread, so no locking here.
+   The removed tracks are kept until all the edits in progress are over,
+   since a player still using the previous state of a pattern may need
+   them till the end of its edit. */
+static GSList* removed_tracks = NULL;
+/* The patterns having private tracks in the current edit */
+static GSList* private_patterns = NULL;
+static guint num_edits = 0;
+/* The patterns whose notes are being changed in place */
+static GSList* changing_patterns = NULL;
+static guint changing_tag = 0;
+
+void
+pattern_sync_edit_begin(XMPattern* pat,
+    const gboolean private_tracks)
+{
+    if (!pat->sync.depth++) {
+        num_edits++;
+        g_atomic_int_inc(&pat->sync.generation);
+    }
+
+    if (private_tracks && !g_slist_find(private_patterns, pat)) {
+        int i;
+
+        for (i = 0; i < 32; i++)
+            if (pat->channels[i]) {
+                XMNote* n = g_malloc(pat->alloc_length * sizeof(XMNote));
+
+                memcpy(n, pat->channels[i], pat->alloc_length * sizeof(XMNote));
+                removed_tracks = g_slist_prepend(removed_tracks, pat->channels[i]);
+                pat->channels[i] = n;
+            }
+        private_patterns = g_slist_prepend(private_patterns, pat);
+    }
+}
+
+void
+pattern_sync_edit_end(XMPattern* pat)
+{
+    g_assert(pat->sync.depth > 0);
+
+    if (!--pat->sync.depth) {
+        private_patterns = g_slist_remove(private_patterns, pat);
+        g_atomic_int_inc(&pat->sync.generation);
+
+        if (!--num_edits) {
+            GSList* l;
+
+            for (l = removed_tracks; l; l = l->next)
+                epoch_retire(l->data);
+            g_slist_free(removed_tracks);
+            removed_tracks = NULL;
+        }
+    }
+}
+
+void
+pattern_sync_free_track(XMNote* track)
+{
+    g_assert(num_edits > 0);
+
+    if (track)
+        removed_tracks = g_slist_prepend(removed_tracks, track);
+}
+
+static gboolean
+pattern_sync_notes_changed(gpointer data)
+{
+    GSList* l;
+
+    for (l = changing_patterns; l; l = l->next) {
+        XMPattern* pat = l->data;
+
+        g_atomic_int_inc(&pat->sync.notes);
+    }
+    g_slist_free(changing_patterns);
+    changing_patterns = NULL;
+    changing_tag = 0;
+
+    return FALSE;
+}
+
+void
+pattern_sync_notes_changing(XMPattern* pat)
+{
+    if (g_slist_find(changing_patterns, pat))
+        return;
+
+    changing_patterns = g_slist_prepend(changing_patterns, pat);
+    /* Before anything else can happen, like freeing the module */
+    if (!changing_tag)
+        changing_tag = g_idle_add_full(G_PRIORITY_HIGH, pattern_sync_notes_changed, NULL, NULL);
+}
+
+void
+pattern_sync_order_begin(XM* xm)
+{
+    if (!xm->order_sync.depth++)
+        g_atomic_int_inc(&xm->order_sync.generation);
+}
+
+void
+pattern_sync_order_end(XM* xm)
+{
+    g_assert(xm->order_sync.depth > 0);
+
+    if (!--xm->order_sync.depth)
+        g_atomic_int_inc(&xm->order_sync.generation);
+}
+
+gboolean
+pattern_sync_snapshot(const XMPattern* pat,
+    pattern_sync_state* st)
+{
+    const gint generation = g_atomic_int_get(&pat->sync.generation);
+
+    if (generation & 1)
+        return FALSE;
+
+    st->length = pat->length;
+    memcpy(st->channels, pat->channels, sizeof(st->channels));
+
+    /* g_atomic_int_get() is a full barrier, so the fields have been read
+       before the generation is checked again */
+    if (g_atomic_int_get(&pat->sync.generation) != generation)
+        return FALSE;
+    st->generation = generation;
+
+    return TRUE;
+}
+
+gboolean
+pattern_sync_order_snapshot(const XM* xm,
+    guint8 order[],
+    gint* generation)
+{
+    const gint g = g_atomic_int_get(&xm->order_sync.generation);
+    guint8 tmp[sizeof(xm->pattern_order_table)];
+
+    if (g & 1)
+        return FALSE;
+
+    memcpy(tmp, xm->pattern_order_table, sizeof(tmp));
+    if (g_atomic_int_get(&xm->order_sync.generation) != g)
+        return FALSE;
+    memcpy(order, tmp, sizeof(tmp));
+    *generation = g;
+
+    return TRUE;
+}
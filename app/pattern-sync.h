@@ -0,0 +1,106 @@
+/*
+ * The Real SoundTracker - lock-free publication of the patterns and
+ * the order list (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _PATTERN_SYNC_H
+#define _PATTERN_SYNC_H
+
+#include <glib.h>
+
+#include "xm.h"
+
+/* The players never wait for the editors.
+
+   The structure of a pattern (its length and track arrays) is changed
+   between pattern_sync_edit_begin() and pattern_sync_edit_end(), its
+   generation is odd in between. A player reads the notes through its own
+   copy of the structure (pattern_sync_state) taken with
+   pattern_sync_snapshot(). The track arrays are copied on write: they are
+   never reallocated or freed in place, the replaced ones are reclaimed
+   after the end of the edit once no player can be reading them (see
+   epoch.h). Single notes are still written in place; the players which
+   keep something derived from the notes learn about such changes from the
+   pattern's notes counter.
+
+   The order list is changed between pattern_sync_order_begin() and
+   pattern_sync_order_end(); the players keep their own copy of it. */
+
+/* Starts a change of the pattern structure; the changes can be nested.
+   With private_tracks the track arrays are replaced with private copies,
+   so a whole block of notes can be changed at once. */
+void pattern_sync_edit_begin(XMPattern* pat,
+    const gboolean private_tracks);
+/* Publishes the changes; the replaced tracks are reclaimed later */
+void pattern_sync_edit_end(XMPattern* pat);
+/* Frees the track array within an edit after it's been removed from the
+   pattern */
+void pattern_sync_free_track(XMNote* track);
+
+/* Announces that the notes of the pattern are going to be changed in
+   place. The notes counter is incremented when the control returns to the
+   main loop, that is after the change. The undo logging functions call
+   this, so the editors needn't. */
+void pattern_sync_notes_changing(XMPattern* pat);
+
+static inline gint
+pattern_sync_notes_counter(const XMPattern* pat)
+{
+    return g_atomic_int_get(&pat->sync.notes);
+}
+
+void pattern_sync_order_begin(XM* xm);
+void pattern_sync_order_end(XM* xm);
+
+typedef struct pattern_sync_state {
+    int length;
+    XMNote* channels[32];
+    gint generation; /* of the pattern when copied, -1 if none */
+} pattern_sync_state;
+
+/* Takes a consistent copy of the pattern structure, fails if the pattern
+   is being changed */
+gboolean pattern_sync_snapshot(const XMPattern* pat,
+    pattern_sync_state* st);
+/* Copies the order list if it's not being changed */
+gboolean pattern_sync_order_snapshot(const XM* xm,
+    guint8 order[],
+    gint* generation);
+
+typedef enum {
+    PATTERN_SYNC_CURRENT, /* The state is up to date */
+    PATTERN_SYNC_EDITED, /* The pattern is being changed, the state is still valid */
+    PATTERN_SYNC_STALE /* The state must be updated before the tracks can be used */
+} pattern_sync_status;
+
+static inline pattern_sync_status
+pattern_sync_check(const XMPattern* pat,
+    const pattern_sync_state* st)
+{
+    const gint generation = g_atomic_int_get(&pat->sync.generation);
+
+    if (st->generation < 0)
+        return PATTERN_SYNC_STALE;
+    if (generation == st->generation)
+        return PATTERN_SYNC_CURRENT;
+    /* The tracks are reclaimed only after the end of the edit */
+    if (generation == st->generation + 1)
+        return PATTERN_SYNC_EDITED;
+    return PATTERN_SYNC_STALE;
+}
+
+#endif /* _PATTERN_SYNC_H */
@@ -30,6 +30,7 @@
 #include "gui-subs.h"
 #include "history.h"
 #include "marshal.h"
+#include "pattern-sync.h"
 #include "playlist.h"
 #include "st-subs.h"
 
@@ -232,7 +233,9 @@ playlist_undo(const gint smp, const gint ins, const gboolean redo,
     state->length = tmp_value;
     playlist_set_restartpos(p, state->restartpos);
     state->restartpos = old_restartpos;
+    pattern_sync_order_begin(p->xm);
     memcpy(p->xm->pattern_order_table, state->pot, sizeof(p->xm->pattern_order_table));
+    pattern_sync_order_end(p->xm);
     memcpy(state->pot, pot, sizeof(state->pot));
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(p->spin_songpat),
         p->xm->pattern_order_table[p->current_position]);
@@ -302,9 +305,11 @@ _playlist_insert_pattern(Playlist* p,
     p->skip_logging--;
     playlist_thaw_signals(p);
 
+    pattern_sync_order_begin(p->xm);
     memmove(&p->xm->pattern_order_table[pos + 1], &p->xm->pattern_order_table[pos],
         sizeof(p->xm->pattern_order_table) - (1 + pos) * sizeof(p->xm->pattern_order_table[0]));
     p->xm->pattern_order_table[pos] = pat;
+    pattern_sync_order_end(p->xm);
     if (pos == current_songpos) {
         gtk_spin_button_set_value(GTK_SPIN_BUTTON(p->spin_songpat),
             p->xm->pattern_order_table[pos]);
@@ -347,7 +352,9 @@ pot_undo(const gint smp, const gint ins, const gboolean redo,
     guint8 *pot = arg, *tmp = alloca(sizeof(p->xm->pattern_order_table));
 
     memcpy(tmp, p->xm->pattern_order_table, sizeof(p->xm->pattern_order_table));
+    pattern_sync_order_begin(p->xm);
     memcpy(p->xm->pattern_order_table, pot, sizeof(p->xm->pattern_order_table));
+    pattern_sync_order_end(p->xm);
     memcpy(pot, tmp, sizeof(p->xm->pattern_order_table));
     playlist_draw_contents(p, TRUE, TRUE);
     editor_select_current_row(p);
@@ -382,10 +389,12 @@ editor_row_deleted(GtkTreeView* tv, GtkTreePath* path, Playlist* p)
     if (row_ins < row_del - 1) {
         playlist_log_pot(p);
         tmp = p->xm->pattern_order_table[row_del - 1];
+        pattern_sync_order_begin(p->xm);
         memmove(&p->xm->pattern_order_table[row_ins + 1],
                 &p->xm->pattern_order_table[row_ins],
                 row_del - row_ins - 1);
         p->xm->pattern_order_table[row_ins] = tmp;
+        pattern_sync_order_end(p->xm);
         if (p->current_position != row_ins) {
             playlist_set_position(p, row_ins);
             playlist_draw_contents(p, FALSE, TRUE);
@@ -397,10 +406,12 @@ editor_row_deleted(GtkTreeView* tv, GtkTreePath* path, Playlist* p)
     } else if (row_ins > row_del + 1) {
         playlist_log_pot(p);
         tmp = p->xm->pattern_order_table[row_del];
+        pattern_sync_order_begin(p->xm);
         memmove(&p->xm->pattern_order_table[row_del],
                 &p->xm->pattern_order_table[row_del + 1],
                 row_ins - row_del - 1);
         p->xm->pattern_order_table[row_ins - 1] = tmp;
+        pattern_sync_order_end(p->xm);
         if (p->current_position != row_ins - 1) {
             playlist_set_position(p, row_ins - 1);
             playlist_draw_contents(p, FALSE, TRUE);
@@ -442,8 +453,10 @@ playlist_delete_clicked(Playlist* p)
 
     pos = lrint(gtk_adjustment_get_value(p->adj_songpos));
     playlist_log(p, N_("Pattern removal"), -1, -1);
+    pattern_sync_order_begin(p->xm);
     memmove(&p->xm->pattern_order_table[pos], &p->xm->pattern_order_table[pos + 1],
         sizeof(p->xm->pattern_order_table) - (1 + pos) * sizeof(p->xm->pattern_order_table[0]));
+    pattern_sync_order_end(p->xm);
 
     /* Length change is already logged */
     p->skip_logging++;
@@ -735,7 +748,9 @@ playlist_songpat_changed(GtkSpinButton* spin,
 
     history_log_spin_button(spin, _("Pattern number changing"),
         HISTORY_FLAG_LOG_POS, p->xm->pattern_order_table[p->current_position]);
+    pattern_sync_order_begin(p->xm);
     p->xm->pattern_order_table[p->current_position] = n;
+    pattern_sync_order_end(p->xm);
 
     /* Check whether the pattern becomes unused */
     if (p->dialog && gtk_widget_get_visible(p->dialog)) {
@@ -0,0 +1,533 @@
+/*
+ * The Real SoundTracker - background rendering into files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#if USE_SNDFILE
+#include <sndfile.h>
+#elif AUDIOFILE_VERSION
+#include <audiofile.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "audio.h"
+#include "render-queue.h"
+#include "song-timeline.h"
+
+#if USE_SNDFILE || AUDIOFILE_VERSION
+
+/* Frames per audio_renderer_mix_stems() call */
+#define RENDER_QUEUE_CHUNK 16384
+
+/* One output file of a job, either the whole mix or a group of channels */
+typedef struct {
+    gchar* path;
+#if USE_SNDFILE
+    SNDFILE* outfile;
+#else
+    AFfilehandle outfile;
+#endif
+    gint first, num;
+    gboolean audible; /* Updated by the encoder */
+} render_stem;
+
+typedef struct {
+    XM* xm;
+    gchar* path;
+    audio_renderer* renderer;
+    gint start, stop;
+    gdouble duration; /* Expected, s, 0.0 if unknown */
+    guint num_stems;
+    gboolean skip_silent;
+    render_stem stems[32];
+    gint cancelled; /* atomic */
+    gint error; /* atomic, set by the encoder */
+} render_job;
+
+/* Rendering and encoding overlap: while the worker renders one chunk, the
+   encoder thread writes the other one. The chunks circulate between the
+   two threads through the queues, so there is no other synchronization. */
+typedef struct {
+    render_job* job;
+    gint16* data[32]; /* Per stem, allocated on demand */
+    guint32 num_frames;
+    guint32 audible; /* Bit mask of the stems */
+} render_chunk;
+
+#define RENDER_QUEUE_NUM_CHUNKS 2
+
+/* Protected by the mutex */
+static GMutex rq_mutex;
+static GCond rq_cond;
+static GQueue rq_waiting = G_QUEUE_INIT;
+static render_job* rq_current = NULL;
+
+static GThread* rq_thread = NULL;
+static GAsyncQueue* rq_finished = NULL;
+static gint rq_progress = 0; /* atomic, 0...1000 */
+static GSList* rq_orphans = NULL; /* Modules to be freed after rendering */
+static guint rq_num_jobs = 0; /* Added, but not cleaned up yet */
+
+static GAsyncQueue* rq_free_chunks = NULL;
+static GAsyncQueue* rq_full_chunks = NULL;
+
+/* Silent stems are removed if requested */
+static void
+render_queue_close(render_job* job)
+{
+    guint i;
+
+    for (i = 0; i < job->num_stems; i++) {
+        render_stem* st = &job->stems[i];
+
+#if USE_SNDFILE
+        sf_close(st->outfile);
+#else
+        afCloseFile(st->outfile);
+#endif
+        if (job->skip_silent && !st->audible)
+            g_unlink(st->path);
+        g_free(st->path);
+    }
+    job->num_stems = 0;
+
+    if (job->renderer)
+        audio_renderer_destroy(job->renderer);
+    job->renderer = NULL;
+}
+
+static gpointer
+render_queue_encoder_thread(gpointer data)
+{
+    audio_realtime_pin_worker();
+
+    for (;;) {
+        render_chunk* c = g_async_queue_pop(rq_full_chunks);
+        render_job* job = c->job;
+        guint i;
+
+        /* After a failure the rest of the job is just skipped */
+        for (i = 0; i < job->num_stems && !g_atomic_int_get(&job->error); i++) {
+            render_stem* st = &job->stems[i];
+            gint num_written;
+
+            errno = 0;
+#if USE_SNDFILE
+            num_written = sf_writef_short(st->outfile, c->data[i], c->num_frames);
+#else
+            num_written = afWriteFrames(st->outfile, AF_DEFAULT_TRACK, c->data[i], c->num_frames);
+#endif
+            if (num_written != c->num_frames)
+                g_atomic_int_set(&job->error, errno ? errno : EIO);
+            if (c->audible & (1u << i))
+                st->audible = TRUE;
+        }
+        g_async_queue_push(rq_free_chunks, c);
+    }
+
+    return NULL;
+}
+
+/* Exact for the whole song; a part of it is played from its start without
+   the preceding speed changes, so it's just an estimate then */
+static gdouble
+render_queue_estimate_duration(const XM* xm,
+    const gint start,
+    const gint stop)
+{
+    song_timeline* tl = song_timeline_new(xm);
+    gdouble from, to;
+
+    from = song_timeline_row_to_time(tl, start, 0);
+    to = stop + 1 < xm->song_length ? song_timeline_row_to_time(tl, stop + 1, 0)
+                                    : song_timeline_get_length(tl);
+    song_timeline_destroy(tl);
+
+    return (from >= 0.0 && to > from) ? to - from : 0.0;
+}
+
+static void
+render_queue_render(render_job* job)
+{
+    render_chunk* chunks[RENDER_QUEUE_NUM_CHUNKS];
+    audio_renderer_stem stems[32];
+    guint32 num_rendered;
+    guint i;
+    const gint num_pos = job->stop - job->start + 1;
+
+    for (i = 0; i < job->num_stems; i++) {
+        stems[i].first = job->stems[i].first;
+        stems[i].num = job->stems[i].num;
+    }
+
+    audio_renderer_start(job->renderer, job->start, job->stop);
+    do {
+        render_chunk* c = g_async_queue_pop(rq_free_chunks);
+        gint pos;
+
+        if (g_atomic_int_get(&job->error)) {
+            g_async_queue_push(rq_free_chunks, c);
+            break;
+        }
+        for (i = 0; i < job->num_stems; i++) {
+            if (!c->data[i])
+                c->data[i] = g_new(gint16, RENDER_QUEUE_CHUNK * 2);
+            stems[i].dest = c->data[i];
+        }
+        c->job = job;
+        c->num_frames = num_rendered = audio_renderer_mix_stems(job->renderer, stems, job->num_stems, RENDER_QUEUE_CHUNK);
+        for (c->audible = 0, i = 0; i < job->num_stems; i++)
+            if (stems[i].audible)
+                c->audible |= 1u << i;
+        g_async_queue_push(rq_full_chunks, c);
+
+        if (job->duration > 0.0)
+            pos = audio_renderer_get_time(job->renderer) / job->duration * 1000.0;
+        else
+            pos = (audio_renderer_get_songpos(job->renderer) - job->start) * 1000 / num_pos;
+        g_atomic_int_set(&rq_progress, CLAMP(pos, 0, 1000));
+    } while (num_rendered == RENDER_QUEUE_CHUNK && !g_atomic_int_get(&job->cancelled));
+
+    /* Wait until the encoder has written everything before the file is closed */
+    for (i = 0; i < RENDER_QUEUE_NUM_CHUNKS; i++)
+        chunks[i] = g_async_queue_pop(rq_free_chunks);
+    for (i = 0; i < RENDER_QUEUE_NUM_CHUNKS; i++)
+        g_async_queue_push(rq_free_chunks, chunks[i]);
+}
+
+static gpointer
+render_queue_thread(gpointer data)
+{
+    for (;;) {
+        render_job* job;
+
+        g_mutex_lock(&rq_mutex);
+        while (!(job = g_queue_pop_head(&rq_waiting)))
+            g_cond_wait(&rq_cond, &rq_mutex);
+        rq_current = job;
+        g_mutex_unlock(&rq_mutex);
+
+        audio_realtime_pin_worker();
+
+        g_atomic_int_set(&rq_progress, 0);
+        if (!g_atomic_int_get(&job->cancelled))
+            render_queue_render(job);
+        render_queue_close(job);
+
+        g_mutex_lock(&rq_mutex);
+        rq_current = NULL;
+        g_cond_broadcast(&rq_cond);
+        g_mutex_unlock(&rq_mutex);
+        g_async_queue_push(rq_finished, job);
+    }
+
+    return NULL;
+}
+
+/* Appends the numbers of the channels to the name, before the extension */
+static gchar*
+render_queue_stem_name(const gchar* path,
+    const gint first,
+    const gint num)
+{
+    const gchar* base = strrchr(path, G_DIR_SEPARATOR);
+    const gchar* ext = strrchr(base ? base : path, '.');
+    gchar *stem, *name;
+
+    if (!ext || ext == base + 1 || ext == path)
+        ext = path + strlen(path);
+    stem = g_strndup(path, ext - path);
+    name = num > 1 ? g_strdup_printf("%s-%02d-%02d%s", stem, first + 1, first + num, ext)
+                   : g_strdup_printf("%s-%02d%s", stem, first + 1, ext);
+    g_free(stem);
+
+    return name;
+}
+
+render_queue_format
+render_queue_format_from_name(const gchar* path)
+{
+    const gchar* ext = strrchr(path, '.');
+
+    if (ext && !g_ascii_strcasecmp(ext, ".flac"))
+        return RENDER_QUEUE_FORMAT_FLAC;
+    if (ext && (!g_ascii_strcasecmp(ext, ".ogg") || !g_ascii_strcasecmp(ext, ".oga")))
+        return RENDER_QUEUE_FORMAT_OGG;
+
+    return RENDER_QUEUE_FORMAT_WAV;
+}
+
+gboolean
+render_queue_add(XM* xm,
+    const gchar* path,
+    const render_queue_format file_format,
+    const gint channels,
+    const gint resolution,
+    const gint mixfreq,
+    const gint start,
+    const gint stop,
+    const gint group_size)
+{
+    render_job* job;
+    STMixerFormat format;
+    guint i;
+#if USE_SNDFILE
+    SF_INFO sfinfo;
+#else
+    AFfilesetup outfilesetup;
+#endif
+
+    g_assert(xm != NULL);
+    g_assert(start >= 0 && start < xm->song_length);
+
+    if (!rq_thread) {
+        rq_finished = g_async_queue_new();
+        rq_free_chunks = g_async_queue_new();
+        rq_full_chunks = g_async_queue_new();
+        for (i = 0; i < RENDER_QUEUE_NUM_CHUNKS; i++)
+            g_async_queue_push(rq_free_chunks, g_new0(render_chunk, 1));
+        g_thread_unref(g_thread_new("render-encoder", render_queue_encoder_thread, NULL));
+        rq_thread = g_thread_new("render-queue", render_queue_thread, NULL);
+    }
+
+    /* libsndfile can handle only 16-bit samples, even when it saves a 8-bit wav */
+#if !USE_SNDFILE
+    if (resolution == 16) {
+#endif
+#ifdef WORDS_BIGENDIAN
+        format = ST_MIXER_FORMAT_S16_BE;
+#else
+        format = ST_MIXER_FORMAT_S16_LE;
+#endif
+#if !USE_SNDFILE
+    } else
+        format = ST_MIXER_FORMAT_U8;
+#endif
+    format |= (channels == 2 ? ST_MIXER_FORMAT_STEREO : 0);
+
+#if USE_SNDFILE
+    sfinfo.channels = channels;
+    sfinfo.samplerate = mixfreq;
+    switch (file_format) {
+    case RENDER_QUEUE_FORMAT_FLAC:
+        sfinfo.format = SF_FORMAT_FLAC | (resolution == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_S8);
+        break;
+    case RENDER_QUEUE_FORMAT_OGG:
+        sfinfo.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
+        break;
+    default:
+        sfinfo.format = SF_FORMAT_WAV | (resolution == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_U8);
+        break;
+    }
+    /* libsndfile can be built without the external encoders */
+    if (!sf_format_check(&sfinfo)) {
+        errno = ENOTSUP;
+        return FALSE;
+    }
+
+#else
+    if (file_format != RENDER_QUEUE_FORMAT_WAV) {
+        errno = ENOTSUP;
+        return FALSE;
+    }
+
+    outfilesetup = afNewFileSetup();
+    afInitFileFormat(outfilesetup, AF_FILE_WAVE);
+    afInitChannels(outfilesetup, AF_DEFAULT_TRACK, channels);
+    afInitRate(outfilesetup, AF_DEFAULT_TRACK, mixfreq);
+    afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK,
+        resolution == 16 ? AF_SAMPFMT_TWOSCOMP : AF_SAMPFMT_UNSIGNED, resolution);
+#endif
+
+    job = g_new0(render_job, 1);
+    if (group_size > 0) {
+        job->skip_silent = TRUE;
+        for (i = 0; i * group_size < xm->num_channels; i++) {
+            job->stems[i].first = i * group_size;
+            job->stems[i].num = MIN(group_size, xm->num_channels - job->stems[i].first);
+            job->stems[i].path = render_queue_stem_name(path, job->stems[i].first, job->stems[i].num);
+        }
+        job->num_stems = i;
+    } else {
+        job->stems[0].num = 32;
+        job->stems[0].path = g_strdup(path);
+        job->num_stems = 1;
+    }
+
+    /* All the files are opened at once, so that errors are reported right away */
+    for (i = 0; i < job->num_stems; i++) {
+        render_stem* st = &job->stems[i];
+
+        errno = 0;
+#if USE_SNDFILE
+        st->outfile = sf_open(st->path, SFM_WRITE, &sfinfo);
+#else
+        st->outfile = afOpenFile(st->path, "w", outfilesetup);
+#endif
+        if (!st->outfile) {
+            gint err = errno;
+
+            g_free(st->path);
+            job->num_stems = i;
+            render_queue_close(job);
+            g_free(job);
+#if !USE_SNDFILE
+            afFreeFileSetup(outfilesetup);
+#endif
+            errno = err;
+            return FALSE;
+        }
+    }
+#if !USE_SNDFILE
+    afFreeFileSetup(outfilesetup);
+#endif
+
+    job->renderer = audio_renderer_new(xm, mixer, mixfreq, format);
+    if (!job->renderer) {
+        render_queue_close(job);
+        g_free(job);
+        errno = ENOTSUP;
+        return FALSE;
+    }
+
+    job->xm = xm;
+    job->path = g_strdup(path);
+    job->start = start;
+    job->stop = (stop < 0 || stop >= xm->song_length) ? xm->song_length - 1 : stop;
+    job->duration = render_queue_estimate_duration(xm, job->start, job->stop);
+
+    rq_num_jobs++;
+    g_mutex_lock(&rq_mutex);
+    g_queue_push_tail(&rq_waiting, job);
+    g_cond_broadcast(&rq_cond);
+    g_mutex_unlock(&rq_mutex);
+
+    return TRUE;
+}
+
+/* Must be called with the mutex locked */
+static gboolean
+render_queue_uses_module(XM* xm)
+{
+    GList* l;
+
+    if (rq_current && rq_current->xm == xm)
+        return TRUE;
+    for (l = rq_waiting.head; l; l = l->next)
+        if (((render_job*)l->data)->xm == xm)
+            return TRUE;
+
+    return FALSE;
+}
+
+static void
+render_queue_free_job(render_job* job)
+{
+    GSList* l;
+
+    /* The jobs still using the module are either waiting or being rendered */
+    g_mutex_lock(&rq_mutex);
+    l = g_slist_find(rq_orphans, job->xm);
+    if (l && !render_queue_uses_module(job->xm)) {
+        rq_orphans = g_slist_delete_link(rq_orphans, l);
+        XM_Free(job->xm);
+    }
+    g_mutex_unlock(&rq_mutex);
+
+    g_free(job->path);
+    g_free(job);
+    rq_num_jobs--;
+}
+
+gboolean
+render_queue_poll(render_queue_status* status,
+    render_queue_finished_func func,
+    gpointer data)
+{
+    render_job* job;
+
+    if (!rq_thread)
+        return FALSE;
+
+    while ((job = g_async_queue_try_pop(rq_finished))) {
+        if (func)
+            func(job->path, g_atomic_int_get(&job->error), g_atomic_int_get(&job->cancelled), data);
+        render_queue_free_job(job);
+    }
+
+    if (status) {
+        g_mutex_lock(&rq_mutex);
+        /* The current job is freed only by this function, so its path
+           remains valid until the next call */
+        status->path = rq_current ? rq_current->path : NULL;
+        status->num_waiting = rq_waiting.length;
+        g_mutex_unlock(&rq_mutex);
+        status->progress = g_atomic_int_get(&rq_progress);
+    }
+
+    return rq_num_jobs != 0;
+}
+
+void
+render_queue_cancel(void)
+{
+    g_mutex_lock(&rq_mutex);
+    if (rq_current)
+        g_atomic_int_set(&rq_current->cancelled, TRUE);
+    g_mutex_unlock(&rq_mutex);
+}
+
+void
+render_queue_cancel_all(void)
+{
+    GList* l;
+
+    g_mutex_lock(&rq_mutex);
+    for (l = rq_waiting.head; l; l = l->next)
+        g_atomic_int_set(&((render_job*)l->data)->cancelled, TRUE);
+    if (rq_current)
+        g_atomic_int_set(&rq_current->cancelled, TRUE);
+    /* Wait until the worker has closed all the files */
+    while (rq_current || rq_waiting.length)
+        g_cond_wait(&rq_cond, &rq_mutex);
+    g_mutex_unlock(&rq_mutex);
+}
+
+gboolean
+render_queue_take_module(XM* xm)
+{
+    gboolean used;
+
+    if (!rq_thread)
+        return FALSE;
+
+    g_mutex_lock(&rq_mutex);
+    used = render_queue_uses_module(xm);
+    if (used)
+        rq_orphans = g_slist_prepend(rq_orphans, xm);
+    g_mutex_unlock(&rq_mutex);
+
+    return used;
+}
+
+#endif /* USE_SNDFILE || AUDIOFILE_VERSION */
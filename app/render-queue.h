@@ -0,0 +1,85 @@
+/*
+ * The Real SoundTracker - background rendering into files (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _RENDER_QUEUE_H
+#define _RENDER_QUEUE_H
+
+#include <glib.h>
+
+#include "xm.h"
+
+/* The jobs are rendered one after another by a worker thread, each one with
+   its own player and mixer instance (see audio_renderer_new()), so playing
+   and editing can go on meanwhile. All the functions are to be called from
+   the main thread only. */
+
+typedef enum {
+    RENDER_QUEUE_FORMAT_WAV = 0,
+    RENDER_QUEUE_FORMAT_FLAC, /* libsndfile only */
+    RENDER_QUEUE_FORMAT_OGG /* Vorbis, libsndfile only */
+} render_queue_format;
+
+typedef struct {
+    const gchar* path; /* The file being rendered, NULL if the queue is idle */
+    gint progress; /* 0...1000 */
+    guint num_waiting;
+} render_queue_status;
+
+/* Called for every finished job, error is errno of a write failure or 0 */
+typedef void (*render_queue_finished_func)(const gchar* path,
+    const gint error,
+    const gboolean cancelled,
+    gpointer data);
+
+/* Guesses the format by the file name extension, WAV by default */
+render_queue_format render_queue_format_from_name(const gchar* path);
+
+/* Opens the file and appends the job rendering song positions start...stop
+   (stop < 0 means the end of the song) to the queue. Returns FALSE with errno
+   set if the file can't be opened or the format is not supported. The
+   resolution is ignored for Ogg Vorbis.
+
+   If group_size > 0, every group_size channels are rendered into a separate
+   file named like path with the numbers of the channels appended, all in one
+   pass; the files which turn out to be silent are removed. */
+gboolean render_queue_add(XM* xm,
+    const gchar* path,
+    const render_queue_format file_format,
+    const gint channels,
+    const gint resolution,
+    const gint mixfreq,
+    const gint start,
+    const gint stop,
+    const gint group_size);
+
+/* Cleans up the finished jobs calling func for each of them and fills the
+   status; returns FALSE if there are no more jobs */
+gboolean render_queue_poll(render_queue_status* status,
+    render_queue_finished_func func,
+    gpointer data);
+
+/* The current job is stopped as soon as possible, the file rendered so far
+   is kept */
+void render_queue_cancel(void);
+void render_queue_cancel_all(void);
+
+/* If the module is referenced by the jobs, the queue takes it over and frees
+   it after rendering; returns FALSE if the module is not used by the queue */
+gboolean render_queue_take_module(XM* xm);
+
+#endif /* _RENDER_QUEUE_H */
@@ -34,6 +34,7 @@
 #include "history.h"
 #include "poll.h"
 #include "sample-editor.h"
+#include "sample-sync.h"
 #include "st-subs.h"
 
 static gboolean show_error = TRUE;
@@ -700,7 +701,8 @@ ext_dialog_run(ExtDialog* d)
                         g_free(new_sdata);
                         goto end;
                     }
-                    g_mutex_lock(&s->sample.lock);
+                    /* Everything except the whole mono sample is written in place */
+                    sample_sync_edit_begin(&s->sample, !whole || stereo);
 
                     if (whole) {
                         if (stereo) {
@@ -709,7 +711,7 @@ ext_dialog_run(ExtDialog* d)
                             /* We can obtain less data from an extension than has been sent */
                             s->sample.length = (rlen / sizeof(s->sample.data[0])) >> 1;
                         } else {
-                            g_free(s->sample.data);
+                            sample_sync_free_data(&s->sample);
                             s->sample.data = new_sdata;
                             s->sample.length = rlen / sizeof(s->sample.data[0]);
                         }
@@ -723,7 +725,7 @@ ext_dialog_run(ExtDialog* d)
                         g_free(new_sdata);
                     }
 
-                    g_mutex_unlock(&s->sample.lock);
+                    sample_sync_edit_end(&s->sample);
                     sample_editor_update();
                     if (!whole)
                         sample_editor_set_selection(ss, se);
@@ -45,6 +45,7 @@
 #include "audio.h"
 #include "clock.h"
 #include "colors.h"
+#include "display-tick.h"
 #include "draw-interlayer.h"
 #include "endian-conv.h"
 #include "errors.h"
@@ -61,6 +62,7 @@
 #include "sample-display.h"
 #include "sample-editor.h"
 #include "sample-editor-extensions.h"
+#include "sample-sync.h"
 #include "st-subs.h"
 #include "time-buffer.h"
 #include "track-editor.h"
@@ -170,7 +172,7 @@ static STSample copybuffer_sampleinfo;
 
 // = Realtime stuff
 
-static int gtktimer = -1;
+static guint tick_id = 0;
 
 static void sample_editor_ok_clicked(void);
 
@@ -197,19 +199,25 @@ static void sample_editor_save_region_wav(const gchar* name, const gchar* localn
 static void sample_editor_trim(gboolean beg, gboolean end, gfloat threshold);
 static void sample_editor_delete(STSample* sample, int start, int end);
 
+/* For the changes of the parameters or the replacement of the data */
 static void
 sample_editor_lock_sample(void)
 {
-    g_mutex_lock(&sed->sample->sample.lock);
+    sample_sync_edit_begin(&sed->sample->sample, FALSE);
+}
+
+/* For the modification of the data in place; the mixers keep playing the
+   old data until the changes are published */
+static void
+sample_editor_lock_sample_data(void)
+{
+    sample_sync_edit_begin(&sed->sample->sample, TRUE);
 }
 
 static void
 sample_editor_unlock_sample(void)
 {
-    if (gui_playing_mode) {
-        mixer->updatesample(&sed->sample->sample);
-    }
-    g_mutex_unlock(&sed->sample->sample.lock);
+    sample_sync_edit_end(&sed->sample->sample);
 }
 
 gint sample_editor_display_print_status(SampleEditorDisplay* s,
@@ -1442,52 +1450,43 @@ sample_editor_display_set_mixer_position(SampleEditorDisplay* s,
 static void
 sample_editor_update_mixer_position(const double songtime)
 {
-    audio_mixer_position* p;
+    audio_mixer_position p;
     int i;
 
-    if (songtime >= 0.0 && sed->sample && (p = time_buffer_get(audio_mixer_position_tb, songtime))) {
-        for (i = 0; i < ARRAY_SIZE(p->dump); i++) {
-            if (p->dump[i].current_sample == &sed->sample->sample) {
-                sample_editor_display_set_mixer_position(sed, p->dump[i].current_position);
-                g_free(p);
+    if (songtime >= 0.0 && sed->sample && time_buffer_get(audio_mixer_position_tb, songtime, &p)) {
+        for (i = 0; i < ARRAY_SIZE(p.dump); i++) {
+            if (p.dump[i].current_sample == &sed->sample->sample) {
+                sample_editor_display_set_mixer_position(sed, p.dump[i].current_position);
                 return;
             }
         }
-        g_free(p);
     }
 
     sample_editor_display_set_mixer_position(sed, -1);
 }
 
-static gint
-sample_editor_update_timeout(gpointer data)
+static void
+sample_editor_update_timeout(const gdouble display_songtime,
+    gpointer data)
 {
-    double display_songtime;
-
-    if (current_driver == NULL)
-        return FALSE;
-
-    display_songtime = current_driver->get_play_time(current_driver_object);
     sample_editor_update_mixer_position(display_songtime);
-
-    return TRUE;
 }
 
 void sample_editor_start_updating(void)
 {
-    if (gtktimer != -1)
+    if (tick_id)
         return;
 
-    gtktimer = g_timeout_add(1000 / gui_settings.scopes_update_freq, sample_editor_update_timeout, NULL);
+    tick_id = display_tick_add(gui_settings.scopes_update_freq, sample_editor_update_timeout, NULL);
 }
 
 void sample_editor_stop_updating(void)
 {
-    if (gtktimer == -1)
+    if (!tick_id)
         return;
 
-    g_source_remove(gtktimer);
-    gtktimer = -1;
+    display_tick_remove(tick_id);
+    tick_id = 0;
     sample_editor_update_mixer_position(-1.0);
 }
 
@@ -1714,7 +1713,7 @@ sample_total_undo(const gint ins, const gint smp, const gboolean redo,
     gint16* tmp_data = NULL;
     STSample tmp_smp;
     gchar tmp_name[24];
-    GMutex tmp_lock;
+    st_mixer_sample_sync tmp_sync;
 
     if (data_length) {
         if (sample->sample.flags & ST_SAMPLE_STEREO)
@@ -1728,10 +1727,9 @@ sample_total_undo(const gint ins, const gint smp, const gboolean redo,
     }
     tmp_smp = *sample;
 
-    g_mutex_lock(&sample->sample.lock);
-    tmp_lock = sample->sample.lock;
-    if (sample->sample.length && sample->sample.data)
-        g_free(sample->sample.data);
+    sample_sync_edit_begin(&sample->sample, FALSE);
+    sample_sync_free_data(&sample->sample);
+    tmp_sync = sample->sample.sync;
     *sample = sb->sample;
     if (sample->sample.length) {
         gsize len = (sample->sample.flags & ST_SAMPLE_STEREO ?
@@ -1740,8 +1738,8 @@ sample_total_undo(const gint ins, const gint smp, const gboolean redo,
         memcpy(sample->sample.data, sb->data, len);
     } else
         sample->sample.data = NULL;
-    sample->sample.lock = tmp_lock;
-    g_mutex_unlock(&sample->sample.lock);
+    sample->sample.sync = tmp_sync;
+    sample_sync_edit_end(&sample->sample);
 
     sb->sample = tmp_smp;
     if (tmp_data) {
@@ -1823,11 +1821,11 @@ sample_range_undo(const gint ins, const gint smp, const gboolean redo,
     memcpy(tmp_data, &sample->sample.data[rb->start], data_length);
     if (sample->sample.flags & ST_SAMPLE_STEREO)
         memcpy(&tmp_data[offset], &sample->sample.data[rb->start + sample->sample.length], data_length);
-    g_mutex_lock(&sample->sample.lock);
+    sample_sync_edit_begin(&sample->sample, TRUE);
     memcpy(&sample->sample.data[rb->start], rb->data, data_length);
     if (sample->sample.flags & ST_SAMPLE_STEREO)
         memcpy(&sample->sample.data[rb->start + sample->sample.length], &rb->data[offset], data_length);
-    g_mutex_unlock(&sample->sample.lock);
+    sample_sync_edit_end(&sample->sample);
     memcpy(rb->data, tmp_data,
         sample->sample.flags & ST_SAMPLE_STEREO ? data_length << 1 : data_length);
 
@@ -1887,8 +1885,6 @@ sample_editor_do_clear(const gchar* title)
     STInstrument* instr;
     gint nsam;
 
-    sample_editor_lock_sample();
-
     instr = instrument_editor_get_instrument();
     nsam = st_instrument_num_samples(instr);
     if (!nsam) /* All samples are empty, nothing to do */
@@ -1903,6 +1899,8 @@ sample_editor_do_clear(const gchar* title)
             title, HISTORY_FLAG_LOG_ALL, 0))
             return;
     }
+
+    sample_editor_lock_sample();
     st_clean_sample_full(sed->sample, NULL, NULL, FALSE);
 
     if (nsam == 1) /* Was 1 _before_ cleaning */
@@ -2021,14 +2019,9 @@ sample_editor_xcopy_samples(STSample* src_smp,
         /* We need a place to store one of the samples during the exchange */
         copy_smp_to_tmp(dest_smp);
     }
-    g_mutex_lock(&dest_smp->sample.lock);
     st_copy_sample(src_smp, dest_smp);
-    g_mutex_unlock(&dest_smp->sample.lock);
-    if (xchg) {
-        g_mutex_lock(&src_smp->sample.lock);
+    if (xchg)
         st_copy_sample(tmp_sample, src_smp);
-        g_mutex_unlock(&src_smp->sample.lock);
-    }
 }
 
 void sample_editor_copy_cut_common(gboolean copy,
@@ -2116,7 +2109,7 @@ void sample_editor_copy_cut_common(gboolean copy,
             (oldsample->sample.length - se) * sizeof(oldsample->sample.data[0]));
     }
 
-    free(oldsample->sample.data);
+    sample_sync_free_data(&oldsample->sample);
 
     oldsample->sample.data = newsample;
     oldsample->sample.length = newlen;
@@ -2479,7 +2472,7 @@ void sample_editor_paste_clicked(void)
             }
         }
 
-        free(oldsample->sample.data);
+        sample_sync_free_data(&oldsample->sample);
 
         oldsample->sample.data = newsample;
         oldsample->sample.length = newlen;
@@ -2514,7 +2507,7 @@ sample_editor_reverse_clicked(void)
         return;
     sample_editor_log_action(sample_editor_reverse_clicked);
 
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
 
     p = q = s->sample.data;
     p += ss;
@@ -2577,7 +2570,7 @@ sample_editor_to_mono(void)
     STSample *s, *next;
     gint response, cursam, mode;
     gsize i;
-    GMutex lock;
+    st_mixer_sample_sync sync;
 
     s = sed->sample;
     g_assert(s != NULL);
@@ -2627,7 +2620,7 @@ sample_editor_to_mono(void)
         return;
     sample_editor_log_action(sample_editor_to_mono);
 
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
     s->sample.flags &= ~ST_SAMPLE_STEREO;
     switch (mode) {
     case MODE_STEREO_LEFT:
@@ -2644,25 +2637,19 @@ sample_editor_to_mono(void)
         }
         break;
     case MODE_STEREO_2:
-        g_mutex_lock(&next->sample.lock);
-
-        if (next->sample.data)
-            g_free(next->sample.data);
-        lock = next->sample.lock;
+        sample_sync_edit_begin(&next->sample, FALSE);
+        sample_sync_free_data(&next->sample);
+        sync = next->sample.sync;
         next->sample = s->sample;
         next->volume = s->volume;
         next->finetune = s->finetune;
         next->panning = s->panning;
         next->relnote = s->relnote;
-        next->sample.lock = lock;
+        next->sample.sync = sync;
         next->sample.data = g_new(gint16, s->sample.length);
         memcpy(next->sample.data, &s->sample.data[s->sample.length],
             s->sample.length * sizeof(s->sample.data[0]));
-
-        if (gui_playing_mode) {
-            mixer->updatesample(&next->sample);
-        }
-        g_mutex_unlock(&next->sample.lock);
+        sample_sync_edit_end(&next->sample);
         break;
     default:
         g_assert_not_reached();
@@ -2738,7 +2725,7 @@ sample_editor_to_stereo(void)
         return;
     sample_editor_log_action(sample_editor_to_stereo);
 
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
     s->sample.flags |= ST_SAMPLE_STEREO;
     s->sample.data = realloc(s->sample.data, (newlen * sizeof(s->sample.data)) << 1);
     switch (mode) {
@@ -2780,7 +2767,7 @@ sample_editor_swop_channels(void)
         return;
     sample_editor_log_action(sample_editor_swop_channels);
 
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
     for (i = 0; i < l; i++) {
         gint16 tmp = s->sample.data[i];
 
@@ -2845,7 +2832,7 @@ sample_editor_stereo_separation(void)
     sample_editor_log_action(sample_editor_stereo_separation);
 
     sep = gtk_adjustment_get_value(adj) * 0.5;
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
     for (i = 0; i < l; i++) {
         gdouble vl = s->sample.data[i], vr = s->sample.data[i + l];
 
@@ -2911,7 +2898,7 @@ sample_editor_stereo_balance(void)
     sample_editor_log_action(sample_editor_stereo_balance);
 
     bal = gtk_adjustment_get_value(adj);
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
     for (i = 0; i < l; i++) {
         gdouble vl = s->sample.data[i], vr = s->sample.data[i + l];
 
@@ -4098,7 +4085,7 @@ sample_editor_perform_ramp(const gint action,
     }
 
     // Now perform the actual operation
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
 
     p = s->sample.data;
     p += ss;
@@ -4368,7 +4355,8 @@ sample_editor_perform_agc(const gint response,
         }
 
     /* Now perform the actual operation */
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
+    sdata = s->data;
 
     for (i = ss; i < se; i++) {
         gdouble tmp = tmp_data[i - ss] * ((keep_cons) ? data0 : (32767.0 / maxamp));
@@ -4508,7 +4496,7 @@ sample_editor_insert_silence(void)
         return;
     sample_editor_log_action(sample_editor_insert_silence);
 
-    sample_editor_lock_sample();
+    sample_editor_lock_sample_data();
     at_beg = (find_current_toggle(position, 2) == 0);
     start =  at_beg ? ss : se;
     tail = smp->length - start;
@@ -4749,7 +4737,7 @@ static void sample_editor_delete(STSample* sample, int start, int end)
             (sample->sample.length - end) * sizeof(sample->sample.data[0]));
     }
 
-    free(sample->sample.data);
+    sample_sync_free_data(&sample->sample);
 
     sample->sample.data = newdata;
     sample->sample.length = newlen;
@@ -0,0 +1,91 @@
+/*
+ * The Real SoundTracker - lock-free publication of the sample data
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "epoch.h"
+#include "sample-sync.h"
+
+gboolean
+sample_sync_snapshot(const st_mixer_sample_info* si,
+    st_mixer_sample_state* st)
+{
+    const gint generation = g_atomic_int_get(&si->sync.generation);
+
+    if (generation & 1)
+        return FALSE;
+
+    st->flags = si->flags;
+    st->length = si->length;
+    st->loopstart = si->loopstart;
+    st->loopend = si->loopend;
+    st->data = si->data;
+
+    /* g_atomic_int_get() is a full barrier, so the fields have been read
+       before the generation is checked again */
+    if (g_atomic_int_get(&si->sync.generation) != generation)
+        return FALSE;
+    st->generation = generation;
+
+    return TRUE;
+}
+
+void
+sample_sync_edit_begin(st_mixer_sample_info* si,
+    const gboolean private_data)
+{
+    g_rec_mutex_lock(&si->sync.lock);
+    if (!si->sync.depth++) {
+        si->sync.published = si->data;
+        si->sync.published_size = si->length * sizeof(si->data[0]);
+        if (si->flags & ST_SAMPLE_STEREO)
+            si->sync.published_size <<= 1;
+        g_atomic_int_inc(&si->sync.generation);
+    }
+
+    if (private_data && si->data && si->data == si->sync.published) {
+        si->data = g_malloc(si->sync.published_size);
+        memcpy(si->data, si->sync.published, si->sync.published_size);
+    }
+}
+
+void
+sample_sync_edit_end(st_mixer_sample_info* si)
+{
+    g_assert(si->sync.depth > 0);
+
+    if (!--si->sync.depth) {
+        gint16* published = si->sync.published;
+
+        si->sync.published = NULL;
+        g_atomic_int_inc(&si->sync.generation);
+        if (published && published != si->data)
+            epoch_retire_sized(published, si->sync.published_size);
+    }
+    g_rec_mutex_unlock(&si->sync.lock);
+}
+
+void
+sample_sync_free_data(st_mixer_sample_info* si)
+{
+    g_assert(si->sync.depth > 0);
+
+    if (si->data != si->sync.published)
+        g_free(si->data);
+    si->data = NULL;
+}
@@ -0,0 +1,77 @@
+/*
+ * The Real SoundTracker - lock-free publication of the sample data (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _SAMPLE_SYNC_H
+#define _SAMPLE_SYNC_H
+
+#include <glib.h>
+
+#include "mixer.h"
+
+/* The mixers never wait for the editors.
+
+   A sample is modified between sample_sync_edit_begin() and
+   sample_sync_edit_end(); its generation is odd in between. A mixer channel
+   plays its own copy of the sample parameters (st_mixer_sample_state) taken
+   with sample_sync_snapshot(), and keeps playing it while the sample is
+   being edited. The data buffer the mixers may be playing is never
+   modified or freed by the editors: they either work on a private copy of
+   it or replace it, and the published buffer is reclaimed only after every
+   thread which could have been reading it has left its critical section
+   (see epoch.h). */
+
+/* Starts an edit of the sample; the edits can be nested. With private_data
+   the sample data are replaced with a private copy which can be modified
+   in place or reallocated. */
+void sample_sync_edit_begin(st_mixer_sample_info* si,
+    const gboolean private_data);
+/* Publishes the changes; the previous data buffer is reclaimed later if it
+   has been replaced */
+void sample_sync_edit_end(st_mixer_sample_info* si);
+/* Releases the sample data within an edit, frees them immediately if they
+   are private and sets the data pointer to NULL */
+void sample_sync_free_data(st_mixer_sample_info* si);
+
+/* Takes a consistent copy of the sample parameters, fails if the sample is
+   being edited */
+gboolean sample_sync_snapshot(const st_mixer_sample_info* si,
+    st_mixer_sample_state* st);
+
+typedef enum {
+    SAMPLE_SYNC_CURRENT, /* The state is up to date */
+    SAMPLE_SYNC_EDITED, /* The sample is being edited, the state is still valid */
+    SAMPLE_SYNC_STALE /* The state must be updated before the data can be used */
+} sample_sync_status;
+
+static inline sample_sync_status
+sample_sync_check(const st_mixer_sample_info* si,
+    const st_mixer_sample_state* st)
+{
+    const gint generation = g_atomic_int_get(&si->sync.generation);
+
+    if (st->generation < 0)
+        return SAMPLE_SYNC_STALE;
+    if (generation == st->generation)
+        return SAMPLE_SYNC_CURRENT;
+    /* The buffer is reclaimed only after the end of the edit */
+    if (generation == st->generation + 1)
+        return SAMPLE_SYNC_EDITED;
+    return SAMPLE_SYNC_STALE;
+}
+
+#endif /* _SAMPLE_SYNC_H */
@@ -22,11 +22,13 @@
 
 #include <config.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
+#include <glib/gi18n.h>
 #include <glib/gprintf.h>
 
 #include "audio.h"
@@ -34,6 +36,7 @@
 #include "draw-interlayer.h"
 #include "gui-settings.h"
 #include "gui-subs.h"
+#include "level-meter.h"
 #include "sample-display.h"
 #include "scalablepic.h"
 #include "scope-group.h"
@@ -81,6 +84,9 @@ struct _ScopeGroupPriv {
     int update_freq;
     gint32 on_mask;
 
+    GtkWidget* meter;
+    audio_levels levels;
+
     DIGC bg_gc;
 };
 
@@ -90,6 +96,103 @@ G_DEFINE_TYPE(ScopeGroup, scope_group, GTK_TYPE_HBOX)
    x_displ = XDISP + width / FRACTION, the same is for y coordinate */
 static guint XDISP = 1, YDISP = 1, FRACTION = 200;
 
+/* Level meters: two bars for the momentary and short-term loudness of the
+   output followed by a thin bar per channel showing RMS with a peak mark.
+   The scale is the same for all of them, 0 dB is at the top. */
+#define METER_RANGE 60.0
+#define METER_MASTER_WIDTH 6
+#define METER_CH_WIDTH 2
+#define METER_CH_STEP 3
+#define METER_CH_OFFSET (2 * (METER_MASTER_WIDTH + 1) + 3)
+
+static inline gdouble
+meter_db(const gfloat level)
+{
+    return level > 0.0 ? 20.0 * log10(level) : -METER_RANGE;
+}
+
+static inline gint
+meter_height(const gdouble db, const gint height)
+{
+    return CLAMP((db + METER_RANGE) / METER_RANGE, 0.0, 1.0) * height;
+}
+
+static void
+meter_reset(ScopeGroupPriv* s)
+{
+    memset(&s->levels, 0, sizeof(s->levels));
+    s->levels.momentary = s->levels.short_term = LOUDNESS_METER_FLOOR;
+    gtk_widget_queue_draw(s->meter);
+}
+
+static gboolean
+meter_expose(GtkWidget* widget,
+    GdkEventExpose* event,
+    gpointer data)
+{
+    ScopeGroupPriv* s = data;
+    const gint height = widget->allocation.height;
+    cairo_t* cr = gdk_cairo_create(widget->window);
+    gint i, h;
+
+    gdk_cairo_rectangle(cr, &event->area);
+    cairo_clip(cr);
+    gdk_cairo_set_source_color(cr, colors_get_color(COLOR_UNMUTED_BG));
+    cairo_paint(cr);
+
+    gdk_cairo_set_source_color(cr, colors_get_color(COLOR_CHANNUMS));
+    for (i = 0; i < 2; i++) {
+        h = meter_height(i ? s->levels.short_term : s->levels.momentary, height);
+        cairo_rectangle(cr, i * (METER_MASTER_WIDTH + 1), height - h, METER_MASTER_WIDTH, h);
+    }
+    for (i = 0; i < s->numchan; i++) {
+        h = meter_height(meter_db(s->levels.rms[i]), height);
+        cairo_rectangle(cr, METER_CH_OFFSET + i * METER_CH_STEP, height - h, METER_CH_WIDTH, h);
+    }
+    cairo_fill(cr);
+
+    for (i = 0; i < s->numchan; i++) {
+        if (s->levels.peak[i] == 0.0)
+            continue;
+        h = MAX(meter_height(meter_db(s->levels.peak[i]), height), 1);
+        /* The channel alone exceeds the full scale */
+        gdk_cairo_set_source_color(cr, colors_get_color(s->levels.peak[i] >= 1.0 ? COLOR_RED : COLOR_CHANNUMS));
+        cairo_rectangle(cr, METER_CH_OFFSET + i * METER_CH_STEP, height - h, METER_CH_WIDTH, 1);
+        cairo_fill(cr);
+    }
+
+    cairo_destroy(cr);
+    return TRUE;
+}
+
+static gboolean
+meter_query_tooltip(GtkWidget* widget,
+    gint x,
+    gint y,
+    gboolean keyboard_mode,
+    GtkTooltip* tooltip,
+    gpointer data)
+{
+    ScopeGroupPriv* s = data;
+    gchar* text;
+
+    if (x < METER_CH_OFFSET)
+        text = g_strdup_printf(_("Loudness: momentary %.1f LUFS, short-term %.1f LUFS"),
+            s->levels.momentary, s->levels.short_term);
+    else {
+        const gint ch = (x - METER_CH_OFFSET) / METER_CH_STEP;
+
+        if (ch >= s->numchan)
+            return FALSE;
+        text = g_strdup_printf(_("Channel %d: RMS %.1f dBFS, peak %.1f dBFS"),
+            ch + 1, meter_db(s->levels.rms[ch]), meter_db(s->levels.peak[ch]));
+    }
+    gtk_tooltip_set_text(tooltip, text);
+    g_free(text);
+
+    return TRUE;
+}
+
 static void
 scope_group_set_channel_state(ScopeGroupPriv *s,
     const guint n,
@@ -200,6 +303,8 @@ void scope_group_set_num_channels(ScopeGroup* sg,
     }
 
     s->numchan = num_channels;
+    gtk_widget_set_size_request(s->meter, METER_CH_OFFSET + num_channels * METER_CH_STEP, -1);
+    meter_reset(s);
     s->on_mask = 0xFFFFFFFF; /* all channels are on */
     memset(player_mute_channels, 0, sizeof(player_mute_channels));
 
@@ -253,6 +358,10 @@ scope_group_timeout(ScopeGroup* sg, gdouble time1)
     static int bufsize = 0;
     int o1, o2;
 
+    /* The meters work regardless of the scopes */
+    if (current_driver && time_buffer_get(audio_levels_tb, time1, &s->levels))
+        gtk_widget_queue_draw(s->meter);
+
     if (!s->scopes_on || !scopebuf_ready || !current_driver)
         return;
 
@@ -316,6 +425,7 @@ void scope_group_stop_updating(ScopeGroup* sg)
     int i;
     ScopeGroupPriv *s = sg->priv;
 
+    meter_reset(s);
     if (!s->scopes_on)
         return;
 
@@ -549,6 +659,18 @@ scope_group_new(GdkPixbuf* mutedpic, GdkPixbuf* unmutedpic)
     gtk_widget_show(s->table);
     gtk_box_pack_start(GTK_BOX(sg), s->table, TRUE, TRUE, 0);
 
+    s->meter = gtk_drawing_area_new();
+    gtk_widget_set_size_request(s->meter, METER_CH_OFFSET + s->numchan * METER_CH_STEP, -1);
+    gtk_widget_set_has_tooltip(s->meter, TRUE);
+    g_signal_connect(s->meter, "expose-event",
+        G_CALLBACK(meter_expose), s);
+    g_signal_connect(s->meter, "query-tooltip",
+        G_CALLBACK(meter_query_tooltip), s);
+    colors_add_widget(COLOR_CHANNUMS, s->meter);
+    gtk_widget_show(s->meter);
+    gtk_box_pack_start(GTK_BOX(sg), s->meter, FALSE, FALSE, 0);
+    meter_reset(s);
+
     for (i = 0; i < XM_NUM_CHAN; i++) {
         GtkWidget *box, *thing;
 
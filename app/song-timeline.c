@@ -0,0 +1,270 @@
+/*
+ * The Real SoundTracker - song timeline index
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "song-timeline.h"
+#include "xm-player.h"
+
+/* Songs playing longer than that without looping are given up */
+#define TIMELINE_MAX_ROWS (1 << 20)
+#define TIMELINE_MAX_ENTRIES 4096
+
+/* The part of xmplayer controlling the song position, as it is between
+   two rows. The structure is compared as a whole, so it has no padding. */
+typedef struct timeline_state {
+    gint curord, currow, patlen;
+    gint jumptoord, jumptorow;
+    gint tempo, bpm, patdelay;
+    gboolean will_loop;
+    guint8 loop_count[32], loop_start[32];
+} timeline_state;
+
+struct song_timeline {
+    gdouble* row_time[256]; /* Per order position, the time each row is first played at */
+    GArray* entries; /* timeline_state before each change of the order position */
+    guint num_rows;
+    timeline_state st;
+    gdouble time;
+};
+
+/* Returns TRUE if the player would set its looped flag */
+static gboolean
+timeline_jump(const XM* xm,
+    timeline_state* st)
+{
+    gboolean looped = FALSE;
+
+    if (st->jumptoord != st->curord) {
+        memset(st->loop_count, 0, sizeof(st->loop_count));
+        memset(st->loop_start, 0, sizeof(st->loop_start));
+    }
+    if (st->jumptoord >= xm->song_length) {
+        st->jumptoord = xm->restart_position;
+        looped = TRUE;
+    }
+
+    st->curord = st->jumptoord;
+    st->patlen = xm->patterns[xm->pattern_order_table[st->curord]].length;
+    st->currow = st->jumptorow;
+    st->jumptoord = -1;
+
+    return looped;
+}
+
+static void
+timeline_process_row(const XM* xm,
+    timeline_state* st)
+{
+    const XMPattern* pat = &xm->patterns[xm->pattern_order_table[st->curord]];
+    gint i;
+
+    if (st->currow >= pat->length)
+        return;
+
+    for (i = 0; i < xm->num_channels; i++) {
+        const XMNote* note;
+        gint cmd, param;
+
+        if (!pat->channels[i])
+            continue;
+        note = &pat->channels[i][st->currow];
+        cmd = note->fxtype;
+        param = note->fxparam;
+        if (cmd == xmpCmdExtended) {
+            cmd = 36 + (param >> 4);
+            param &= 0xF;
+        }
+
+        switch (cmd) {
+        case xmpCmdJump:
+            if (!st->patdelay) {
+                st->jumptoord = param;
+                st->jumptorow = 0;
+                if (st->jumptoord <= st->curord)
+                    st->will_loop = TRUE;
+            }
+            break;
+        case xmpCmdBreak:
+            if (!st->patdelay) {
+                if (st->jumptoord == -1)
+                    st->jumptoord = st->curord + 1;
+                st->jumptorow = (param & 0xF) + (param >> 4) * 10;
+            }
+            break;
+        case xmpCmdSpeed:
+            if (!param) {
+                st->jumptoord = 0;
+                st->jumptorow = 0;
+                st->will_loop = TRUE;
+            } else if (param >= 0x20)
+                st->bpm = param;
+            else
+                st->tempo = param;
+            break;
+        case xmpCmdMODtTempo:
+            if (!param) {
+                st->jumptoord = 0;
+                st->jumptorow = 0;
+            } else
+                st->tempo = param;
+            break;
+        case xmpCmdPatLoop:
+            if (!param)
+                st->loop_start[i] = st->currow;
+            else {
+                st->loop_count[i]++;
+                if (st->loop_count[i] <= param) {
+                    st->jumptorow = st->loop_start[i];
+                    st->jumptoord = st->curord;
+                } else {
+                    st->loop_count[i] = 0;
+                    st->loop_start[i] = st->currow + 1;
+                }
+            }
+            break;
+        case xmpCmdPatDelay:
+            if (!st->patdelay)
+                st->patdelay = param + 1;
+            break;
+        }
+    }
+}
+
+/* Returns TRUE if the state repeats a previous one, so the song would be
+   played from there on forever */
+static gboolean
+timeline_find_repetition(const song_timeline* tl,
+    const timeline_state* st)
+{
+    guint i;
+
+    for (i = 0; i < tl->entries->len; i++) {
+        const timeline_state* e = &g_array_index(tl->entries, timeline_state, i);
+
+        if (e->curord == st->curord && !memcmp(e, st, sizeof(*st)))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Does what xmpPlayTick() does on the first tick of each row */
+static void
+timeline_follow(song_timeline* tl,
+    const XM* xm)
+{
+    timeline_state* st = &tl->st;
+
+    while (tl->num_rows < TIMELINE_MAX_ROWS && tl->entries->len < TIMELINE_MAX_ENTRIES) {
+        const timeline_state before = *st;
+        gboolean looped = st->will_loop, row_started = FALSE;
+
+        st->will_loop = FALSE;
+        if (st->patdelay && st->jumptoord != -1)
+            looped |= timeline_jump(xm, st);
+        if (!st->patdelay || (xm->flags & XM_FLAGS_IS_MOD)) {
+            if (!st->patdelay) {
+                st->currow++;
+                if (st->jumptoord == -1 && st->currow >= st->patlen) {
+                    st->jumptoord = st->curord + 1;
+                    st->jumptorow = 0;
+                }
+                if (st->jumptoord != -1)
+                    looped |= timeline_jump(xm, st);
+                row_started = TRUE;
+            }
+        }
+
+        /* The player stops here if it doesn't loop, the song would be
+           played from the start or the restart position again otherwise */
+        if (looped)
+            break;
+
+        if (st->curord != before.curord || !tl->entries->len) {
+            if (timeline_find_repetition(tl, &before))
+                break;
+            g_array_append_val(tl->entries, before);
+            if (!tl->row_time[st->curord]) {
+                gint i;
+
+                tl->row_time[st->curord] = g_new(gdouble, 256);
+                for (i = 0; i < 256; i++)
+                    tl->row_time[st->curord][i] = -1.0;
+            }
+        }
+
+        if (row_started) {
+            if (st->currow < 256 && tl->row_time[st->curord][st->currow] < 0.0)
+                tl->row_time[st->curord][st->currow] = tl->time;
+            tl->num_rows++;
+        }
+
+        if (!st->patdelay || (xm->flags & XM_FLAGS_IS_MOD))
+            timeline_process_row(xm, st);
+        if (st->patdelay)
+            st->patdelay--;
+
+        /* Each tick lasts 2.5 / BPM seconds */
+        tl->time += st->tempo * 125.0 / (st->bpm * 50);
+    }
+}
+
+song_timeline*
+song_timeline_new(const XM* xm)
+{
+    song_timeline* tl = g_new0(song_timeline, 1);
+
+    tl->entries = g_array_new(FALSE, FALSE, sizeof(timeline_state));
+    /* As after xmplayer_init_play_song(p, 0, 0, TRUE), the jump to the
+       first row is pending */
+    tl->st.tempo = xm->tempo;
+    tl->st.bpm = xm->bpm;
+    timeline_follow(tl, xm);
+    /* Only needed to detect the endless loops */
+    g_array_free(tl->entries, TRUE);
+    tl->entries = NULL;
+
+    return tl;
+}
+
+void
+song_timeline_destroy(song_timeline* tl)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(tl->row_time); i++)
+        g_free(tl->row_time[i]);
+    g_free(tl);
+}
+
+gdouble
+song_timeline_get_length(const song_timeline* tl)
+{
+    return tl->time;
+}
+
+gdouble
+song_timeline_row_to_time(const song_timeline* tl,
+    const gint songpos,
+    const gint patpos)
+{
+    g_return_val_if_fail(songpos >= 0 && songpos < 256 && patpos >= 0 && patpos < 256, -1.0);
+
+    return tl->row_time[songpos] ? tl->row_time[songpos][patpos] : -1.0;
+}
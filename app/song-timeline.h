@@ -0,0 +1,48 @@
+/*
+ * The Real SoundTracker - song timeline index (header)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_SONG_TIMELINE_H
+#define _ST_SONG_TIMELINE_H
+
+#include <glib.h>
+
+#include "xm.h"
+
+/* The times the rows of the song are played at, found by following only
+   what the player does with the song position: speed and tempo changes,
+   position jumps, pattern breaks, pattern loops and pattern delays, the
+   same way as xmpPlayTick() does. The song is followed from the beginning
+   until the player would loop (or be caught in an endless loop). The
+   timeline is a snapshot, it isn't updated when the module is edited. */
+
+typedef struct song_timeline song_timeline;
+
+/* Must be called by the thread which edits the module */
+song_timeline* song_timeline_new(const XM* xm);
+void song_timeline_destroy(song_timeline* tl);
+
+/* The time the song ends or loops at, s. If the song couldn't be followed
+   to its end, the time it's been followed for. */
+gdouble song_timeline_get_length(const song_timeline* tl);
+
+/* Returns the time the row is first played at, -1.0 if it's never played */
+gdouble song_timeline_row_to_time(const song_timeline* tl,
+    const gint songpos,
+    const gint patpos);
+
+#endif /* _ST_SONG_TIMELINE_H */
@@ -27,6 +27,8 @@
 
 #include <glib.h>
 
+#include "pattern-sync.h"
+#include "sample-sync.h"
 #include "st-subs.h"
 #include "xm.h"
 
@@ -34,27 +36,32 @@ int st_init_pattern_channels(XMPattern* p,
     unsigned length,
     int num_channels)
 {
-    int i;
+    int i, ret = 1;
 
+    pattern_sync_edit_begin(p, FALSE);
     p->length = p->alloc_length = length;
     for (i = 0; i < num_channels; i++) {
         if (!(p->channels[i] = calloc(1, length * sizeof(XMNote)))) {
             st_free_pattern_channels(p);
-            return 0;
+            ret = 0;
+            break;
         }
     }
+    pattern_sync_edit_end(p);
 
-    return 1;
+    return ret;
 }
 
 void st_free_pattern_channels(XMPattern* pat)
 {
     int i;
 
+    pattern_sync_edit_begin(pat, FALSE);
     for (i = 0; i < 32; i++) {
-        free(pat->channels[i]);
+        pattern_sync_free_track(pat->channels[i]);
         pat->channels[i] = NULL;
     }
+    pattern_sync_edit_end(pat);
 }
 
 void st_free_all_pattern_channels(XM* xm)
@@ -88,6 +95,7 @@ int st_copy_pattern(XMPattern* dst,
     XMNote* oldchans[32];
     int i;
 
+    pattern_sync_edit_begin(dst, FALSE);
     for (i = 0; i < 32; i++) {
         oldchans[i] = dst->channels[i];
         if (src->channels[i]) {
@@ -97,6 +105,7 @@ int st_copy_pattern(XMPattern* dst,
                     free(dst->channels[i]);
                     dst->channels[i] = oldchans[i];
                 }
+                pattern_sync_edit_end(dst);
                 return 0;
             }
         } else {
@@ -105,9 +114,10 @@ int st_copy_pattern(XMPattern* dst,
     }
 
     for (i = 0; i < 32; i++)
-        free(oldchans[i]);
+        pattern_sync_free_track(oldchans[i]);
 
     dst->length = dst->alloc_length = src->length;
+    pattern_sync_edit_end(dst);
 
     return 1;
 }
@@ -125,9 +135,11 @@ void st_clear_pattern(XMPattern* p)
 {
     int i;
 
+    pattern_sync_edit_begin(p, TRUE);
     for (i = 0; i < 32; i++) {
         st_clear_track(p->channels[i], p->alloc_length);
     }
+    pattern_sync_edit_end(p);
 }
 
 void st_pattern_delete_track(XMPattern* p,
@@ -136,6 +148,7 @@ void st_pattern_delete_track(XMPattern* p,
     int i;
     XMNote* a;
 
+    pattern_sync_edit_begin(p, TRUE);
     a = p->channels[t];
     g_assert(a != NULL);
 
@@ -145,6 +158,7 @@ void st_pattern_delete_track(XMPattern* p,
 
     p->channels[i] = a;
     st_clear_track(a, p->alloc_length);
+    pattern_sync_edit_end(p);
 }
 
 void st_pattern_insert_track(XMPattern* p,
@@ -153,6 +167,7 @@ void st_pattern_insert_track(XMPattern* p,
     int i;
     XMNote* a;
 
+    pattern_sync_edit_begin(p, TRUE);
     a = p->channels[31];
 
     for (i = 31; i > t; i--) {
@@ -167,6 +182,7 @@ void st_pattern_insert_track(XMPattern* p,
 
     p->channels[t] = a;
     st_clear_track(a, p->alloc_length);
+    pattern_sync_edit_end(p);
 }
 
 gboolean
@@ -314,12 +330,13 @@ void st_clean_sample_full(STSample* s,
     const char* utf_name, const char* name,
     const gboolean clear_name)
 {
-    free(s->sample.data);
-    s->sample.data = NULL;
+    sample_sync_edit_begin(&s->sample, FALSE);
+    sample_sync_free_data(&s->sample);
     s->sample.flags = ST_SAMPLE_16_BIT;
     s->sample.length = 0;
     s->sample.loopend = 1;
     s->sample.loopstart = 0;
+    sample_sync_edit_end(&s->sample);
     s->volume = 0;
     s->finetune = 0;
     s->panning = 0;
@@ -345,10 +362,11 @@ void st_clean_sample_full(STSample* s,
 void st_copy_sample_full(STSample* src_smp, STSample* dest_smp, const gboolean name_overwrite)
 {
     guint32 length;
-    GMutex lock = dest_smp->sample.lock;
+    st_mixer_sample_sync sync;
 
-    if (dest_smp->sample.data)
-        g_free(dest_smp->sample.data);
+    sample_sync_edit_begin(&dest_smp->sample, FALSE);
+    sample_sync_free_data(&dest_smp->sample);
+    sync = dest_smp->sample.sync;
     if (name_overwrite)
         memcpy(dest_smp, src_smp, sizeof(STSample));
     else {
@@ -358,13 +376,14 @@ void st_copy_sample_full(STSample* src_smp, STSample* dest_smp, const gboolean n
         dest_smp->panning = src_smp->panning;
         dest_smp->relnote = src_smp->relnote;
     }
-    dest_smp->sample.lock = lock;
+    dest_smp->sample.sync = sync;
     if ((length = sizeof(dest_smp->sample.data[0]) * dest_smp->sample.length)) {
         if (dest_smp->sample.flags & ST_SAMPLE_STEREO)
             length <<= 1;
         dest_smp->sample.data = malloc(length);
         memcpy(dest_smp->sample.data, src_smp->sample.data, length);
     }
+    sample_sync_edit_end(&dest_smp->sample);
 }
 
 void st_clean_song(XM* xm)
@@ -379,7 +398,9 @@ void st_clean_song(XM* xm)
     xm->tempo = 6;
     xm->bpm = 125;
     xm->flags = 0;
+    pattern_sync_order_begin(xm);
     memset(xm->pattern_order_table, 0, sizeof(xm->pattern_order_table));
+    pattern_sync_order_end(xm);
 
     for (i = 0; i < 256; i++)
         st_init_pattern_channels(&xm->patterns[i], 64, xm->num_channels);
@@ -393,11 +414,13 @@ void st_set_num_channels(XM* xm,
 
     for (i = 0; i < XM_NUM_PATTERNS; i++) {
         pat = &xm->patterns[i];
+        pattern_sync_edit_begin(pat, FALSE);
         for (j = 0; j < n; j++) {
             if (!pat->channels[j]) {
                 pat->channels[j] = calloc(1, sizeof(XMNote) * pat->alloc_length);
             }
         }
+        pattern_sync_edit_end(pat);
     }
 
     xm->num_channels = n;
@@ -411,17 +434,29 @@ void st_set_alloc_length(XMPattern* pat,
         int i;
         XMNote* n;
 
+        pattern_sync_edit_begin(pat, FALSE);
         for (i = 0; i < 32 && pat->channels[i] != NULL; i++) {
             n = calloc(l, sizeof(XMNote));
             if (need_copy)
                 memcpy(n, pat->channels[i], sizeof(XMNote) * pat->alloc_length);
-            free(pat->channels[i]);
+            pattern_sync_free_track(pat->channels[i]);
             pat->channels[i] = n;
         }
         pat->alloc_length = l;
+        pattern_sync_edit_end(pat);
     }
 }
 
+void st_set_pattern_length(XMPattern* pat,
+    int l)
+{
+    pattern_sync_edit_begin(pat, FALSE);
+    if (pat->alloc_length < l)
+        st_set_alloc_length(pat, l, TRUE);
+    pat->length = l;
+    pattern_sync_edit_end(pat);
+}
+
 void st_sample_fix_loop(STSample* sts)
 {
     st_mixer_sample_info* s = &sts->sample;
@@ -497,16 +532,23 @@ void st_exchange_patterns(XM* xm,
     XMPattern tmp;
     int i;
 
-    memcpy(&tmp, &xm->patterns[p1], sizeof(XMPattern));
-    memcpy(&xm->patterns[p1], &xm->patterns[p2], sizeof(XMPattern));
-    memcpy(&xm->patterns[p2], &tmp, sizeof(XMPattern));
+    pattern_sync_edit_begin(&xm->patterns[p1], FALSE);
+    pattern_sync_edit_begin(&xm->patterns[p2], FALSE);
+    /* The sync data belong to the place, not to the content */
+    memcpy(&tmp, &xm->patterns[p1], offsetof(XMPattern, sync));
+    memcpy(&xm->patterns[p1], &xm->patterns[p2], offsetof(XMPattern, sync));
+    memcpy(&xm->patterns[p2], &tmp, offsetof(XMPattern, sync));
+    pattern_sync_edit_end(&xm->patterns[p2]);
+    pattern_sync_edit_end(&xm->patterns[p1]);
 
+    pattern_sync_order_begin(xm);
     for (i = 0; i < xm->song_length; i++) {
         if (xm->pattern_order_table[i] == p1)
             xm->pattern_order_table[i] = p2;
         else if (xm->pattern_order_table[i] == p2)
             xm->pattern_order_table[i] = p1;
     }
+    pattern_sync_order_end(xm);
 }
 
 void
@@ -516,11 +558,13 @@ st_pattern_delete_line(XMPattern* p, int l)
 
     if (l == p->length - 1) /* Don't remove the last line */
         return;
+    pattern_sync_edit_begin(p, TRUE);
     for (i = 0; i < 32 && p->channels[i]; i++) {
         for (j = l; j < p->alloc_length - 1; j++)
             p->channels[i][j] = p->channels[i][j + 1];
         memset(&p->channels[i][p->alloc_length - 1], 0, sizeof(XMNote));
     }
+    pattern_sync_edit_end(p);
 }
 
 void
@@ -528,6 +572,7 @@ st_pattern_insert_line(XMPattern* p, int l)
 {
     int i, j;
 
+    pattern_sync_edit_begin(p, TRUE);
     if (p->alloc_length < 256)
         st_set_alloc_length(p, p->alloc_length + 1, TRUE);
     if (l < 255) { /* 255 -- last line, do nothing */
@@ -537,6 +582,7 @@ st_pattern_insert_line(XMPattern* p, int l)
             memset(&p->channels[i][l], 0, sizeof(XMNote));
         }
     }
+    pattern_sync_edit_end(p);
 }
 
 gboolean
@@ -556,6 +602,7 @@ void st_shrink_pattern(XMPattern* p)
 {
     int i, j, length = p->length;
 
+    pattern_sync_edit_begin(p, TRUE);
     for (i = 0; i < 32 && p->channels[i]; i++) {
         for (j = 1; j <= (length - 1) / 2; j++)
             memcpy(&p->channels[i][j], &p->channels[i][2 * j], sizeof(XMNote));
@@ -569,12 +616,14 @@ void st_shrink_pattern(XMPattern* p)
     }
 
     st_set_pattern_length(p, (length - 1) / 2 + 1);
+    pattern_sync_edit_end(p);
 }
 
 void st_expand_pattern(XMPattern* p)
 {
     int i, j, length = MIN(p->length * 2, 256);
 
+    pattern_sync_edit_begin(p, TRUE);
     st_set_pattern_length(p, length);
 
     for (i = 0; i < 32 && p->channels[i]; i++) {
@@ -588,6 +637,7 @@ void st_expand_pattern(XMPattern* p)
             p->channels[i][2 * j + 1].fxparam = 0;
         }
     }
+    pattern_sync_edit_end(p);
 }
 
 void st_convert_sample(const void* src,
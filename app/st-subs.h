@@ -65,14 +65,8 @@ int st_find_first_unused_and_empty_pattern(XM* xm);
 gboolean st_is_pattern_used_in_song(XM* xm,
     int patnum);
 void st_set_alloc_length(XMPattern*, const gint, const gboolean);
-
-static inline void st_set_pattern_length(XMPattern* pat,
-    int l)
-{
-    if (pat->alloc_length < l)
-        st_set_alloc_length(pat, l, TRUE);
-    pat->length = l;
-}
+void st_set_pattern_length(XMPattern* pat,
+    int l);
 
 void st_exchange_patterns(XM* xm,
     int p1,
@@ -0,0 +1,306 @@
+/*
+ * The Real SoundTracker - audio performance telemetry dialog
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <glib/gi18n.h>
+#include <gtk/gtk.h>
+
+#include "audio-telemetry.h"
+#include "file-operations.h"
+#include "gui-settings.h"
+#include "gui-subs.h"
+#include "gui.h"
+#include "telemetry-dialog.h"
+
+#define TELEMETRY_UPDATE_INTERVAL 500 /* ms */
+
+enum {
+    RESPONSE_RESET = 1,
+    RESPONSE_SAVE
+};
+
+enum {
+    STAT_BLOCKS = 0,
+    STAT_AVERAGE,
+    STAT_MAXIMUM,
+    STAT_LAST,
+    STAT_OVERRUNS,
+    STAT_XRUNS,
+    STAT_LAST_ITEM
+};
+
+static const gchar* stat_titles[] = {
+    N_("Blocks rendered:"),
+    N_("Average load:"),
+    N_("Maximum load:"),
+    N_("Last block:"),
+    N_("Overruns:"),
+    N_("Driver xruns:")
+};
+
+static GtkWidget *telemetry_window = NULL, *stat_labels[STAT_LAST_ITEM], *hist_list, *events_list;
+static guint update_tag = 0;
+static guint num_events_shown = 0;
+static gint64 last_event_shown = 0;
+static file_op* savetelemetry = NULL;
+
+static void
+set_load_label(GtkWidget* label,
+    const guint32 render_us,
+    const guint32 deadline_us)
+{
+    gchar* buf = g_strdup_printf(_("%.1f%% (%u of %u \302\265s)"),
+        deadline_us ? 100.0 * render_us / deadline_us : 0.0, render_us, deadline_us);
+
+    gtk_label_set_text(GTK_LABEL(label), buf);
+    g_free(buf);
+}
+
+static void
+set_number_label(GtkWidget* label,
+    const guint64 value)
+{
+    gchar* buf = g_strdup_printf("%" G_GUINT64_FORMAT, value);
+
+    gtk_label_set_text(GTK_LABEL(label), buf);
+    g_free(buf);
+}
+
+static void
+update_histogram(const telemetry_stats* s)
+{
+    GtkListStore* list_store = GUI_GET_LIST_STORE(hist_list);
+    GtkTreeModel* model = gui_list_freeze(hist_list);
+    GtkTreeIter iter;
+    guint i;
+
+    gui_list_clear_with_model(model);
+    for (i = 0; i < TELEMETRY_NUM_BUCKETS; i++) {
+        const gint from = 100.0 * i * TELEMETRY_BUCKET_WIDTH + 0.5;
+        gchar *range, *count, *share;
+
+        if (i < TELEMETRY_NUM_BUCKETS - 1)
+            range = g_strdup_printf("%d\342\200\223%d%%", from, (gint)(100.0 * (i + 1) * TELEMETRY_BUCKET_WIDTH + 0.5));
+        else
+            range = g_strdup_printf("\342\211\245 %d%%", from);
+        count = g_strdup_printf("%u", s->histogram[i]);
+        share = g_strdup_printf("%.2f%%", s->num_blocks ? 100.0 * s->histogram[i] / s->num_blocks : 0.0);
+
+        gtk_list_store_append(list_store, &iter);
+        gtk_list_store_set(list_store, &iter, 0, range, 1, count, 2, share, -1);
+        g_free(range);
+        g_free(count);
+        g_free(share);
+    }
+    gui_list_thaw(hist_list, model);
+}
+
+static void
+update_events(const telemetry_event* events,
+    const guint num_events)
+{
+    GtkListStore* list_store;
+    GtkTreeModel* model;
+    GtkTreeIter iter;
+    gint i;
+
+    /* Rebuilding the list resets its scrolling, so only if there are new events */
+    if (num_events == num_events_shown
+        && (!num_events || events[num_events - 1].time == last_event_shown))
+        return;
+    num_events_shown = num_events;
+    last_event_shown = num_events ? events[num_events - 1].time : 0;
+
+    list_store = GUI_GET_LIST_STORE(events_list);
+    model = gui_list_freeze(events_list);
+    gui_list_clear_with_model(model);
+    /* The most recent first */
+    for (i = num_events - 1; i >= 0; i--) {
+        const telemetry_event* e = &events[i];
+        const time_t t = e->time / G_USEC_PER_SEC;
+        struct tm tm;
+        gchar time_buf[16], *pos, *row, *render;
+
+        strftime(time_buf, sizeof(time_buf), "%H:%M:%S", localtime_r(&t, &tm));
+        if (e->songpos >= 0) {
+            pos = g_strdup_printf("%d / %d", e->songpos, e->patno);
+            row = g_strdup_printf("%d.%d", e->patpos, e->tick);
+        } else {
+            pos = g_strdup("\342\200\224");
+            row = g_strdup("\342\200\224");
+        }
+        render = g_strdup_printf("%u / %u", e->render_us, e->deadline_us);
+
+        gtk_list_store_append(list_store, &iter);
+        gtk_list_store_set(list_store, &iter, 0, time_buf,
+            1, e->type == TELEMETRY_EVENT_OVERRUN ? _("Overrun") : _("Xrun"),
+            2, pos, 3, row, 4, render, -1);
+        g_free(pos);
+        g_free(row);
+        g_free(render);
+    }
+    gui_list_thaw(events_list, model);
+}
+
+static gboolean
+telemetry_update(gpointer data)
+{
+    telemetry_stats s;
+    telemetry_event* events = g_new(telemetry_event, TELEMETRY_LOG_SIZE);
+    const guint num_events = audio_telemetry_get(&s, events);
+    gchar* buf;
+
+    set_number_label(stat_labels[STAT_BLOCKS], s.num_blocks);
+    buf = g_strdup_printf("%.1f%%", s.deadline_us_total ? 100.0 * s.render_us_total / s.deadline_us_total : 0.0);
+    gtk_label_set_text(GTK_LABEL(stat_labels[STAT_AVERAGE]), buf);
+    g_free(buf);
+    set_load_label(stat_labels[STAT_MAXIMUM], s.max_render_us, s.max_deadline_us);
+    set_load_label(stat_labels[STAT_LAST], s.last_render_us, s.last_deadline_us);
+    set_number_label(stat_labels[STAT_OVERRUNS], s.num_overruns);
+    set_number_label(stat_labels[STAT_XRUNS], s.num_xruns);
+    update_histogram(&s);
+    update_events(events, num_events);
+    g_free(events);
+
+    return TRUE;
+}
+
+static void
+telemetry_hidden(void)
+{
+    if (update_tag) {
+        g_source_remove(update_tag);
+        update_tag = 0;
+    }
+}
+
+static void
+save_telemetry(const gchar* fn,
+    const gchar* localname)
+{
+    FILE* f = gui_fopen(localname, fn, "w");
+    gboolean ok;
+
+    if (!f)
+        return;
+
+    errno = 0;
+    ok = audio_telemetry_dump(f);
+    if (fclose(f) || !ok) {
+        gchar* buf = g_strdup_printf(_("Error while writing file %s"), fn);
+
+        gui_errno_dialog(telemetry_window, buf, errno);
+        g_free(buf);
+    }
+}
+
+static void
+telemetry_response(GtkWidget* dialog,
+    gint response)
+{
+    switch (response) {
+    case RESPONSE_RESET:
+        audio_telemetry_reset();
+        telemetry_update(NULL);
+        break;
+    case RESPONSE_SAVE:
+        if (!savetelemetry)
+            savetelemetry = fileops_dialog_create(DIALOG_SAVE_TELEMETRY, _("Save telemetry..."),
+                &gui_settings.savetelemetry_path, save_telemetry, FALSE, TRUE, NULL, NULL, "txt");
+        fileops_open_dialog(savetelemetry);
+        break;
+    default:
+        gtk_widget_hide(dialog);
+        break;
+    }
+}
+
+void telemetry_dialog(void)
+{
+    GtkWidget *mainbox, *hbox, *vbox, *table, *frame, *thing;
+    static const gchar* hist_titles[] = { N_("Load"), N_("Blocks"), N_("Share") };
+    static const gchar* events_titles[] = { N_("Time"), N_("Event"), N_("Order / Pattern"),
+        N_("Row.Tick"), N_("Render / Deadline, \302\265s") };
+    guint i;
+
+    if (telemetry_window != NULL) {
+        if (!update_tag)
+            update_tag = g_timeout_add(TELEMETRY_UPDATE_INTERVAL, telemetry_update, NULL);
+        telemetry_update(NULL);
+        gtk_window_present(GTK_WINDOW(telemetry_window));
+        return;
+    }
+
+    telemetry_window = gtk_dialog_new_with_buttons(_("Audio Performance"), GTK_WINDOW(mainwindow), 0,
+        GTK_STOCK_CLEAR, RESPONSE_RESET, GTK_STOCK_SAVE_AS, RESPONSE_SAVE,
+        GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE, NULL);
+    gui_dialog_connect(telemetry_window, G_CALLBACK(telemetry_response));
+    g_signal_connect(telemetry_window, "hide", G_CALLBACK(telemetry_hidden), NULL);
+    gui_dialog_adjust(telemetry_window, GTK_RESPONSE_CLOSE);
+    mainbox = gtk_dialog_get_content_area(GTK_DIALOG(telemetry_window));
+
+    hbox = gtk_hbox_new(FALSE, 4);
+    gtk_box_pack_start(GTK_BOX(mainbox), hbox, FALSE, TRUE, 0);
+
+    /* Summary */
+    frame = gtk_frame_new(_("Audio thread"));
+    gtk_box_pack_start(GTK_BOX(hbox), frame, FALSE, TRUE, 0);
+    table = gtk_table_new(STAT_LAST_ITEM, 2, FALSE);
+    gtk_container_set_border_width(GTK_CONTAINER(table), 4);
+    gtk_table_set_col_spacings(GTK_TABLE(table), 8);
+    gtk_table_set_row_spacings(GTK_TABLE(table), 2);
+    gtk_container_add(GTK_CONTAINER(frame), table);
+    for (i = 0; i < STAT_LAST_ITEM; i++) {
+        thing = gtk_label_new(_(stat_titles[i]));
+        gtk_misc_set_alignment(GTK_MISC(thing), 0.0, 0.5);
+        gtk_table_attach(GTK_TABLE(table), thing, 0, 1, i, i + 1, GTK_FILL, 0, 0, 0);
+        stat_labels[i] = gtk_label_new(NULL);
+        gtk_misc_set_alignment(GTK_MISC(stat_labels[i]), 1.0, 0.5);
+        gtk_table_attach(GTK_TABLE(table), stat_labels[i], 1, 2, i, i + 1, GTK_EXPAND | GTK_FILL, 0, 0, 0);
+    }
+
+    /* Histogram of render time relative to the deadline */
+    frame = gtk_frame_new(_("Load histogram"));
+    gtk_box_pack_start(GTK_BOX(hbox), frame, TRUE, TRUE, 0);
+    vbox = gtk_vbox_new(FALSE, 0);
+    gtk_container_set_border_width(GTK_CONTAINER(vbox), 4);
+    gtk_container_add(GTK_CONTAINER(frame), vbox);
+    hist_list = gui_stringlist_in_scrolled_window(3, hist_titles, vbox, TRUE);
+    gui_set_list_size(hist_list, 24, 8);
+
+    /* Overruns and xruns */
+    frame = gtk_frame_new(_("Overruns and xruns"));
+    gtk_box_pack_start(GTK_BOX(mainbox), frame, TRUE, TRUE, 0);
+    vbox = gtk_vbox_new(FALSE, 0);
+    gtk_container_set_border_width(GTK_CONTAINER(vbox), 4);
+    gtk_container_add(GTK_CONTAINER(frame), vbox);
+    events_list = gui_stringlist_in_scrolled_window(5, events_titles, vbox, TRUE);
+    gui_set_list_size(events_list, 60, 10);
+
+    num_events_shown = 0;
+    last_event_shown = 0;
+    telemetry_update(NULL);
+    update_tag = g_timeout_add(TELEMETRY_UPDATE_INTERVAL, telemetry_update, NULL);
+
+    gtk_widget_show_all(telemetry_window);
+}
@@ -1,4 +1,3 @@
-
 /*
  * The Real SoundTracker - time buffer
  *
@@ -20,6 +19,8 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <string.h>
+
 #include "time-buffer.h"
 
 #include <glib.h>
@@ -29,31 +30,57 @@ typedef struct time_buffer_item {
     /* then user data follows */
 } time_buffer_item;
 
+/* head and tail are free-running counters of added and consumed items,
+   only their difference matters, so wrapping around is harmless. head is
+   written only by the producer, tail only by the consumer. discard is the
+   head value at the moment of the last clearing; the consumer skips
+   everything before it. */
 struct time_buffer {
-    GMutex mutex;
-    GQueue buffer;
+    gint head;
+    gint tail;
+    gint discard;
+    guint mask;
+    gsize item_size;
+    double last_time;
+    guint8* slots;
 };
 
+#define TB_SLOT(t, n) ((time_buffer_item*)((t)->slots + ((n) & (t)->mask) * (t)->item_size))
+
 time_buffer*
-time_buffer_new(void)
+time_buffer_new(gsize item_size, guint capacity)
 {
-    time_buffer* t = g_new(time_buffer, 1);
+    time_buffer* t;
+    guint c = 1;
+
+    g_assert(item_size >= sizeof(time_buffer_item));
+
+    while (c < capacity)
+        c <<= 1;
 
+    t = g_new(time_buffer, 1);
     if (t) {
-        g_mutex_init(&t->mutex);
-        g_queue_init(&t->buffer);
+        t->head = t->tail = t->discard = 0;
+        t->mask = c - 1;
+        t->item_size = item_size;
+        t->last_time = 0.0;
+        /* Zeroed allocation also makes the pages resident before the audio
+           thread touches them */
+        t->slots = g_malloc0(item_size * c);
+        if (!t->slots) {
+            g_free(t);
+            return NULL;
+        }
     }
 
     return t;
 }
 
 /* Take care on whether we need to free the buffer contents first
-or just use g_list_free_full()
 void time_buffer_destroy(time_buffer* t)
 {
     if (t) {
-        g_list_free(t->list);
-        g_mutex_clear(&t->mutex);
+        g_free(t->slots);
         g_free(t);
     }
 }
@@ -61,48 +88,59 @@ void time_buffer_destroy(time_buffer* t)
 
 void time_buffer_clear(time_buffer* t)
 {
-    GList* l;
-
-    for (l = t->buffer.head; l; l = l->next)
-        g_free(l->data);
-    g_queue_clear(&t->buffer);
+    g_atomic_int_set(&t->discard, t->head);
+    t->last_time = 0.0;
 }
 
-void
+gboolean
 time_buffer_add(time_buffer* t,
-    void* item,
+    const void* item,
     double time)
 {
-    time_buffer_item* a = item;
-    GList *h;
-
-    g_mutex_lock(&t->mutex);
-    h = t->buffer.head;
-    a->time = time;
-
-    if (h) {
-        /* A special case sometimes emerging when samples stop on their own.
-           During one time chunk the sample in one channel can finish earlier
-           than the sample in one of the previously rendered channels. So a
-           kind of sorting is needed */
-        if (((time_buffer_item *)h->data)->time > time) {
-            while ((h = h->next)) {
-                if (((time_buffer_item *)h->data)->time < time) {
-                    g_queue_insert_before(&t->buffer, h, item);
-                    break;
-                }
-            }
-            if (!h)
-                g_queue_push_tail(&t->buffer, item);
-
-            g_mutex_unlock(&t->mutex);
-            return;
-        }
+    const guint head = t->head;
+    time_buffer_item* slot;
+
+    /* Only the real consumer position is taken into account here, the slots
+       between it and the discard mark can still be being read */
+    if (head - (guint)g_atomic_int_get(&t->tail) > t->mask)
+        return FALSE;
+
+    /* A special case sometimes emerging when samples stop on their own.
+       During one time chunk the sample in one channel can finish earlier
+       than the sample in one of the previously rendered channels. Such an
+       item is delivered together with the previous one, that is at most one
+       rendering chunk later than requested. */
+    if (time < t->last_time)
+        time = t->last_time;
+    else
+        t->last_time = time;
+
+    slot = TB_SLOT(t, head);
+    memcpy(slot, item, t->item_size);
+    slot->time = time;
+    g_atomic_int_set(&t->head, head + 1);
+
+    return TRUE;
+}
+
+/* Returns the first position to read; *end is set to the position following
+   the last item available */
+static inline guint
+time_buffer_consumer_begin(time_buffer* t,
+    guint* end)
+{
+    guint tail = t->tail;
+    const guint discard = g_atomic_int_get(&t->discard);
+    const guint head = g_atomic_int_get(&t->head);
+
+    if (discard - tail <= head - tail) {
+        /* The buffer has been cleared since the last reading */
+        tail = discard;
+        g_atomic_int_set(&t->tail, tail);
     }
-    g_queue_push_head(&t->buffer, item);
-    g_mutex_unlock(&t->mutex);
+    *end = head;
 
-    return;
+    return tail;
 }
 
 gboolean time_buffer_foreach(time_buffer* t,
@@ -110,44 +148,43 @@ gboolean time_buffer_foreach(time_buffer* t,
     void (*foreach_func)(gpointer data, gpointer user_data),
     gpointer user_data)
 {
-    GList* l;
+    guint head, tail = time_buffer_consumer_begin(t, &head);
     gboolean retval = FALSE;
 
-    g_mutex_lock(&t->mutex);
-    while ((l = t->buffer.tail)) {
-        gpointer data;
+    for (; tail != head; tail++) {
+        time_buffer_item* slot = TB_SLOT(t, tail);
 
-        if (((time_buffer_item*)l->data)->time > time)
+        if (slot->time > time)
             break;
-        data = g_queue_pop_tail(&t->buffer);
-        foreach_func(data, user_data);
-        g_free(data);
+        foreach_func(slot, user_data);
+        g_atomic_int_set(&t->tail, tail + 1);
         retval = TRUE;
     }
-    g_mutex_unlock(&t->mutex);
 
     return retval;
 }
 
-gpointer time_buffer_get(time_buffer* t,
-    double time)
+gboolean time_buffer_get(time_buffer* t,
+    double time,
+    void* dest)
 {
-    gpointer result = NULL;
-    GList* l;
-
-    g_mutex_lock(&t->mutex);
-    l = t->buffer.tail;
-
-    if (l)
-        if (((time_buffer_item*)l->data)->time <= time) {
-            for (; l->prev; l = t->buffer.tail) {
-                if (((time_buffer_item*)l->prev->data)->time > time)
-                    break;
-                g_free(g_queue_pop_tail(&t->buffer));
-            }
-            result = g_queue_pop_tail(&t->buffer);
-        }
+    guint head, tail = time_buffer_consumer_begin(t, &head);
+    time_buffer_item* found = NULL;
+
+    for (; tail != head; tail++) {
+        time_buffer_item* slot = TB_SLOT(t, tail);
+
+        if (slot->time > time)
+            break;
+        found = slot;
+    }
+
+    if (!found)
+        return FALSE;
+
+    /* The slot must be copied before it's given back to the producer */
+    memcpy(dest, found, t->item_size);
+    g_atomic_int_set(&t->tail, tail);
 
-    g_mutex_unlock(&t->mutex);
-    return result;
+    return TRUE;
 }
@@ -1,4 +1,3 @@
-
 /*
  * The Real SoundTracker - time buffer (header)
  *
@@ -30,17 +29,35 @@
    info must be delayed to coincide with the audio output in the
    speakers.
 
-   The _add, _get and _foreach functions are thread-safe. */
+   The buffer is a fixed-size ring of preallocated slots of the same
+   size. Each item must start with a `double time' field. Every buffer
+   must have only one producer thread and one consumer thread at a time:
+   player buffers are filled by the audio thread (or by the main thread
+   when it renders offline with the audio thread stopped) and read by the
+   main thread, while the MIDI note buffer is filled by the MIDI input
+   thread and read by the audio thread. _add and _clear are producer-side,
+   _get and _foreach are consumer-side. None of them blocks or allocates
+   memory.
+
+   Items are delivered in the order they are added. Time stamps are kept
+   non-decreasing: an item whose time is earlier than the one of the
+   previously added item gets the time of the latter. If the buffer is
+   full, the new item is dropped. */
 
 typedef struct time_buffer time_buffer;
 
-time_buffer* time_buffer_new(void);
+/* item_size includes the leading `double time' field, capacity is rounded
+   up to a power of two */
+time_buffer* time_buffer_new(gsize item_size, guint capacity);
 //void time_buffer_destroy(time_buffer* t);
 
-void time_buffer_add(time_buffer* t, void* item, double time);
+/* The item is copied into the buffer, so it can reside on the stack */
+gboolean time_buffer_add(time_buffer* t, const void* item, double time);
 void time_buffer_clear(time_buffer* t);
-/* time_buffer_get requires explicit freeing of the result */
-gpointer time_buffer_get(time_buffer* t, double time);
+/* Copies the latest item not later than time into dest and drops it and all
+   the preceding ones. Returns FALSE if there's no such item. */
+gboolean time_buffer_get(time_buffer* t, double time, void* dest);
+/* The data pointer passed to foreach_func is valid only during the call */
 gboolean time_buffer_foreach(time_buffer* t,
     double time,
     void (*foreach_func)(gpointer data, gpointer user_data),
@@ -26,119 +26,194 @@
 #include <string.h>
 
 #include "audio.h"
+#include "epoch.h"
 #include "gui-settings.h"
 #include "main.h"
 #include "mixer.h"
+#include "pattern-sync.h"
+#include "sample-sync.h"
 #include "tracer.h"
 #include "xm-player.h"
 
-static int num_channels, mixfreq;
-static float fmixfreq;
-
-// This is an artificial limit. The code can do more channels.
-static tracer_channel channels[32];
+/* A keyframe is taken at the start of every order position and every
+   TRACER_KEYFRAME_ROWS rows within it */
+#define TRACER_KEYFRAME_ROWS 32
+#define TRACER_MAX_KEYFRAMES 1024
+#define TRACER_HASH_INIT 2166136261U
+
+typedef struct tracer_mixer {
+    int num_channels, mixfreq;
+    float fmixfreq;
+
+    // This is an artificial limit. The code can do more channels.
+    tracer_channel channels[32];
+} tracer_mixer;
+
+/* The state of the tracing right after the first tick of a row */
+typedef struct tracer_keyframe {
+    int songpos, patpos;
+    xmplayer player;
+    tracer_mixer mixer;
+    double rest, previous;
+} tracer_keyframe;
+
+/* Keyframes are taken only at the rows which are further in the song than
+   everything traced before, so a keyframe can be used for any position not
+   before it: the tracing from the beginning would pass it without having
+   reached that position. They are appended in the order of tracing, so
+   dropping the ones depending on a changed object is a truncation. */
+struct tracer_cache {
+    GPtrArray* keyframes;
+
+    /* The conditions the keyframes have been taken under */
+    XM* xm;
+    int mixfreq, num_channels;
+    guint32 permanent_channels;
+    int flags, xm_channels, tempo, bpm, song_length;
+
+    /* The number of keyframes taken before the object has been used first,
+       -1 if it hasn't been used yet, and the object's hash at that moment */
+    gint pattern_use[XM_NUM_PATTERNS];
+    guint32 pattern_hash[XM_NUM_PATTERNS];
+    gint instrument_use[XM_NUM_INSTRUMENTS];
+    guint32 instrument_hash[XM_NUM_INSTRUMENTS];
+    gint order_use[256];
+    guint8 order[256];
+
+    /* The furthest row reached by the tracing */
+    int max_songpos, max_patpos;
+};
 
-void tracer_setnumch(int n)
+void*
+tracer_new(void)
 {
-    g_assert(n >= 1 && n <= 32);
+    return g_new0(tracer_mixer, 1);
+}
 
-    num_channels = n;
+void tracer_destroy(void* mp)
+{
+    g_free(mp);
 }
 
-static void
-tracer_updatesample(st_mixer_sample_info* si)
+void tracer_setnumch(void* mp, int n)
 {
-    int i;
-    tracer_channel* c;
+    tracer_mixer* const mx = mp;
 
-    for (i = 0; i < 32; i++) {
-        c = &channels[i];
+    g_assert(n >= 1 && n <= 32);
 
-        if (c->sample != si || !(c->flags & TR_FLAG_SAMPLE_RUNNING)) {
-            continue;
-        }
+    mx->num_channels = n;
+}
 
-        if (c->data != si->data
-            || c->length != si->length
-            || c->looptype != (si->flags & ST_SAMPLE_LOOP_MASK)) {
-            c->flags &= ~TR_FLAG_SAMPLE_RUNNING;
-            continue;
+/* Picks up the changes made by the editors. Tracing is done only when the
+   playback is being started, so unlike the real mixers the tracer can wait
+   until the current edit is finished. Returns FALSE if the channel has been
+   stopped. */
+static gboolean
+tracer_sync_sample(tracer_channel* c)
+{
+    st_mixer_sample_state st;
+
+    if (sample_sync_check(c->sample, &c->smp) != SAMPLE_SYNC_STALE)
+        return TRUE;
+    if (!sample_sync_snapshot(c->sample, &st)) {
+        gboolean ok;
+
+        g_rec_mutex_lock(&c->sample->sync.lock);
+        ok = sample_sync_snapshot(c->sample, &st);
+        g_rec_mutex_unlock(&c->sample->sync.lock);
+        if (!ok) {
+            /* Only if called from within an edit by the same thread */
+            c->flags = 0;
+            return FALSE;
         }
+    }
 
-        /* No relevant data has changed. Don't stop the sample, but update
-	   our local loop data instead. */
-        c->looptype = si->flags & ST_SAMPLE_LOOP_MASK;
-        if (c->looptype != ST_SAMPLE_LOOPTYPE_NONE) {
-            if (c->positionw < si->loopstart) {
-                c->positionw = si->loopstart;
-                c->positionf = 0x7fffffff;
-            } else if (c->positionw >= si->loopend) {
-                c->positionw = si->loopend - 1;
-                c->positionf = 0x7fffffff;
-            }
+    if (c->smp.generation >= 0
+        && (c->smp.length != st.length
+            || (c->smp.flags & ST_SAMPLE_LOOP_MASK) != (st.flags & ST_SAMPLE_LOOP_MASK))) {
+        c->smp = st;
+        c->flags &= ~TR_FLAG_SAMPLE_RUNNING;
+        return FALSE;
+    }
+
+    c->smp = st;
+    if (st.flags & ST_SAMPLE_LOOP_MASK) {
+        if (c->positionw < st.loopstart) {
+            c->positionw = st.loopstart;
+            c->positionf = 0x7fffffff;
+        } else if (c->positionw >= st.loopend) {
+            c->positionw = st.loopend - 1;
+            c->positionf = 0x7fffffff;
         }
     }
+
+    return TRUE;
 }
 
 static void
-tracer_setmixfreq(guint32 frequency)
+tracer_setmixfreq(void* mp, guint32 frequency)
 {
-    mixfreq = frequency;
-    fmixfreq = 48000.0 / (float)mixfreq;
+    tracer_mixer* const mx = mp;
+
+    mx->mixfreq = frequency;
+    mx->fmixfreq = 48000.0 / (float)mx->mixfreq;
 }
 
 static void
-tracer_reset(void)
+tracer_reset(void* mp)
 {
-    memset(channels, 0, sizeof(channels));
+    tracer_mixer* const mx = mp;
+
+    memset(mx->channels, 0, sizeof(mx->channels));
 }
 
 static void
-tracer_startnote(int channel,
+tracer_startnote(void* mp, int channel,
     st_mixer_sample_info* s)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     c->flags = 0;
 
     c->sample = s;
-
-    // The following three for update_sample()
-    c->data = s->data;
-    c->length = s->length;
-    c->looptype = s->flags & ST_SAMPLE_LOOP_MASK;
+    c->smp.generation = -1;
+    if (!tracer_sync_sample(c))
+        return;
 
     c->positionw = 0;
     c->positionf = 0;
     c->playend = 0;
-    if (s->flags & ST_SAMPLE_LOOPTYPE_AMIGA) {
+    if (c->smp.flags & ST_SAMPLE_LOOPTYPE_AMIGA) {
         c->flags |= TR_FLAG_LOOP_UNIDIRECTIONAL;
-    } else if (s->flags & ST_SAMPLE_LOOPTYPE_PINGPONG) {
+    } else if (c->smp.flags & ST_SAMPLE_LOOPTYPE_PINGPONG) {
         c->flags |= TR_FLAG_LOOP_BIDIRECTIONAL;
     }
     c->direction = 1;
     c->freso = 0.0;
-    c->ffreq = fmixfreq;
+    c->ffreq = mx->fmixfreq;
     c->filter_on = FALSE;
     c->flags |= TR_FLAG_SAMPLE_RUNNING;
 }
 
 static void
-tracer_stopnote(int channel)
+tracer_stopnote(void* mp, int channel)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     c->flags = 0; /* Just stop the note without reverances */
 }
 
 static void
-tracer_setsmplpos(int channel,
+tracer_setsmplpos(void* mp, int channel,
     guint32 offset)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     if (c->sample && c->flags != 0) {
-        if (offset < c->sample->length) {
+        if (offset < c->smp.length) {
             c->positionw = offset;
             c->positionf = 0;
             c->direction = 1;
@@ -149,13 +224,14 @@ tracer_setsmplpos(int channel,
 }
 
 static void
-tracer_setsmplend(int channel,
+tracer_setsmplend(void* mp, int channel,
     guint32 playend)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     if (c->sample && c->flags != 0 && playend > 0) {
-        if (c->positionw != 0 || playend < c->sample->length) {
+        if (c->positionw != 0 || playend < c->smp.length) {
             // only end if the selection is not the whole sample
             c->playend = playend;
         }
@@ -163,167 +239,154 @@ tracer_setsmplend(int channel,
 }
 
 static void
-tracer_setfreq(int channel,
+tracer_setfreq(void* mp, int channel,
     float frequency)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
-    frequency /= mixfreq;
+    frequency /= mx->mixfreq;
 
     c->freqw = (guint32)floor(frequency);
     c->freqf = (guint32)((frequency - c->freqw) * 4294967296.0);
 }
 
 static void
-tracer_setvolume(int channel,
+tracer_setvolume(void* mp, int channel,
     float volume)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     c->volume = volume;
 }
 
 static void
-tracer_setpanning(int channel,
+tracer_setpanning(void* mp, int channel,
     float panning)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     c->panning = 0.5 * (panning + 1.0);
 }
 
 static void
-tracer_setchcutoff(int channel,
+tracer_setchcutoff(void* mp, int channel,
     float freq)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     if (freq < 0.0) {
-        c->ffreq = fmixfreq;
+        c->ffreq = mx->fmixfreq;
         c->freso = 0.0;
         c->filter_on = FALSE;
     } else {
         g_assert(0.0 <= freq);
         g_assert(freq <= 1.0);
-        c->ffreq = freq * fmixfreq;
+        c->ffreq = freq * mx->fmixfreq;
         c->filter_on = TRUE;
     }
 }
 
 static void
-tracer_setchreso(int channel,
+tracer_setchreso(void* mp, int channel,
     float reso)
 {
-    tracer_channel* c = &channels[channel];
+    tracer_mixer* const mx = mp;
+    tracer_channel* c = &mx->channels[channel];
 
     g_assert(0.0 <= reso);
     g_assert(reso <= 1.0);
     c->freso = reso;
 }
 
-static guint32
-tracer_mix_sub(tracer_channel* ch,
-    guint32 num_samples_left)
+/* Moves the sample pointer as far as the mixer would get after count
+   output samples. The position is found in closed form rather than by
+   stepping through the loop cycles: inside a loop it's the distance
+   travelled reduced modulo the loop length (or twice the length for the
+   pingpong loop, the second half being the backward run). */
+static void
+tracer_advance(tracer_channel* ch,
+    guint32 count)
 {
     const gboolean loopit = (ch->playend == 0) && (ch->flags & (TR_FLAG_LOOP_UNIDIRECTIONAL | TR_FLAG_LOOP_BIDIRECTIONAL));
-    const gboolean gonnapingpong = loopit && (ch->flags & TR_FLAG_LOOP_BIDIRECTIONAL);
-
-    const gint64 lstart64 = ((guint64)ch->sample->loopstart) << 32;
-    const gint64 freq64 = (((guint64)ch->freqw) << 32) + (guint64)ch->freqf;
-    gint64 pos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
-    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->sample->loopend : ch->length);
-    const gint64 ende64 = (guint64)ende << 32;
 
-    gint64 vieweit64;
-    guint32 num_samples;
+    const guint64 lstart64 = ((guint64)ch->smp.loopstart) << 32;
+    const guint64 freq64 = (((guint64)ch->freqw) << 32) + (guint64)ch->freqf;
+    const guint64 pos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
+    const guint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->smp.loopend : ch->smp.length);
+    const guint64 ende64 = (guint64)ende << 32;
+    const guint64 dist64 = freq64 * count;
 
-    if (ch->direction == 1)
-        vieweit64 = pos64 + freq64 * num_samples_left;
-    else
-        vieweit64 = pos64 - freq64 * num_samples_left;
+    guint64 looplen64, phase64;
 
-    if ((ch->direction == 1 && vieweit64 < ende64) || (ch->direction == -1 && vieweit64 > lstart64)) {
+    if (ch->direction == 1 ? pos64 + dist64 < ende64 : pos64 > lstart64 + dist64) {
         /* Normal conditions; we are far from loop boundaries and sample end */
+        const guint64 vieweit64 = ch->direction == 1 ? pos64 + dist64 : pos64 - dist64;
+
         ch->positionw = vieweit64 >> 32;
         ch->positionf = vieweit64 & 0xffffffff;
-
-        return num_samples_left;
+        return;
     }
 
-    /* If we've reached this point, this means we are close to any `critical point' of the sample */
-    if (!loopit) {
-        /* Sample without loop just stopped; we don't care about it more */
+    /* Sample without loop just stopped; we don't care about it more */
+    if (!loopit || ende64 <= lstart64) {
         ch->flags = 0;
-
-        return 0;
+        return;
     }
 
-    if (!gonnapingpong) {
-        /* End of Amiga-type loop */
-        num_samples = (ende64 - pos64) / freq64 + 1; /* plus one sample from the next loop cycle */
-        pos64 += num_samples * freq64 - ende64 + lstart64;
-
-        ch->positionw = pos64 >> 32;
-        ch->positionf = pos64 & 0xffffffff;
+    looplen64 = ende64 - lstart64;
 
-        g_assert(num_samples <= num_samples_left);
-        return num_samples;
+    if (!(ch->flags & TR_FLAG_LOOP_BIDIRECTIONAL)) {
+        /* Amiga-type loop, the end has been passed at least once */
+        phase64 = (pos64 + dist64 - lstart64) % looplen64;
+        ch->positionw = (lstart64 + phase64) >> 32;
+        ch->positionf = (lstart64 + phase64) & 0xffffffff;
+        return;
     }
 
-    if (ch->direction == 1) {
-        /* Reflection at the end of pingpong loop */
-        num_samples = (ende64 - pos64) / freq64 + 1; /* plus one sample from the next loop cycle */
-        pos64 += num_samples * freq64;
-        pos64 = ende64 - (pos64 - ende64);
+    /* Pingpong loop: the phase runs forward from the loop start in the
+       first half of the period and backward from the loop end in the
+       second one */
+    if (ch->direction == 1)
+        phase64 = pos64 + dist64 - lstart64;
+    else
+        phase64 = looplen64 + (ende64 - pos64) + dist64;
+    phase64 %= looplen64 << 1;
 
-        ch->positionw = pos64 >> 32;
-        ch->positionf = pos64 & 0xffffffff;
+    if (phase64 < looplen64) {
+        ch->positionw = (lstart64 + phase64) >> 32;
+        ch->positionf = (lstart64 + phase64) & 0xffffffff;
+        ch->direction = 1;
+    } else {
+        ch->positionw = (ende64 - (phase64 - looplen64)) >> 32;
+        ch->positionf = (ende64 - (phase64 - looplen64)) & 0xffffffff;
         ch->direction = -1;
-
-        g_assert(num_samples <= num_samples_left);
-        return num_samples;
     }
-
-    /* The same but at the start... */
-    num_samples = (pos64 - lstart64) / freq64 + 1; /* plus one sample from the next loop cycle */
-    pos64 -= num_samples * freq64;
-    pos64 = lstart64 - (pos64 - lstart64);
-
-    ch->positionw = pos64 >> 32;
-    ch->positionf = pos64 & 0xffffffff;
-    ch->direction = 1;
-
-    g_assert(num_samples <= num_samples_left);
-    return num_samples;
 }
 
+/* The tracer doesn't produce anything, it only follows the sample
+   pointers, so the cost of a tick doesn't depend on its length */
 static void
-tracer_render(guint32 count,
+tracer_render(void* mp, guint32 count,
     gint16* scopebufs[],
     int scopebufs_offset,
     time_buffer* channels_status_tb,
     gdouble time)
 {
+    tracer_mixer* const mx = mp;
     int chnr;
 
-    for (chnr = 0; chnr < num_channels; chnr++) {
-        tracer_channel* ch = channels + chnr;
-        int num_samples_left = count;
+    for (chnr = 0; chnr < mx->num_channels; chnr++) {
+        tracer_channel* ch = mx->channels + chnr;
 
         if (!((ch->flags & TR_FLAG_SAMPLE_RUNNING) && (gui_settings.permanent_channels & (1 << chnr))))
             continue;
 
-        g_mutex_lock(&ch->sample->lock);
-
-        while (num_samples_left && (ch->flags & TR_FLAG_SAMPLE_RUNNING)) {
-            int num_samples = 0;
-
-            num_samples = tracer_mix_sub(ch, num_samples_left);
-
-            num_samples_left -= num_samples;
-        }
-
-        g_mutex_unlock(&ch->sample->lock);
+        if (tracer_sync_sample(ch) && count)
+            tracer_advance(ch, count);
     }
 }
 
@@ -331,9 +394,10 @@ static st_mixer mixer_tracer = {
     "tracer",
     "Pseudo-mixer for channel settings tracing", /* It will NEVER be used and hence translated */
 
+    tracer_new,
+    tracer_destroy,
     tracer_setnumch,
     NULL,
-    tracer_updatesample,
     NULL,
     NULL,
     tracer_setmixfreq,
@@ -350,6 +414,7 @@ static st_mixer mixer_tracer = {
     tracer_render,
     NULL,
     NULL,
+    NULL,
 
     0x7fffffff,
     ST_MIXER_BUFFER_FORMAT_FLOAT,
@@ -357,48 +422,407 @@ static st_mixer mixer_tracer = {
     NULL
 };
 
-void tracer_trace(int mixfreq, int songpos, int patpos)
+static inline guint32
+tracer_hash(guint32 h,
+    const void* data,
+    const gsize len)
+{
+    const guint8* b = data;
+    gsize i;
+
+    /* FNV-1a */
+    for (i = 0; i < len; i++)
+        h = (h ^ b[i]) * 16777619U;
+
+    return h;
+}
+
+/* The generations are hashed as well, so an object which is being changed
+   never matches, and neither does one with the structure changed back */
+static guint32
+tracer_hash_instrument(const STInstrument* ins)
+{
+    const STEnvelope* envs[] = { &ins->vol_env, &ins->pan_env };
+    guint32 h = TRACER_HASH_INIT;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(envs); i++) {
+        const STEnvelope* env = envs[i];
+        const guint8 params[] = { env->num_points, env->sustain_point,
+            env->loop_start, env->loop_end, env->flags };
+
+        h = tracer_hash(h, params, sizeof(params));
+        h = tracer_hash(h, env->points, MIN(env->num_points, ST_MAX_ENVELOPE_POINTS) * sizeof(env->points[0]));
+    }
+    {
+        const guint8 params[] = { ins->vibtype, ins->vibrate, ins->vibdepth, ins->vibsweep };
+
+        h = tracer_hash(h, params, sizeof(params));
+        h = tracer_hash(h, &ins->volfade, sizeof(ins->volfade));
+        h = tracer_hash(h, ins->samplemap, sizeof(ins->samplemap));
+    }
+
+    for (i = 0; i < XM_NUM_SAMPLES; i++) {
+        const STSample* smp = &ins->samples[i];
+        const gint8 params[] = { smp->volume, smp->finetune, smp->panning, smp->relnote };
+        st_mixer_sample_state st;
+
+        h = tracer_hash(h, params, sizeof(params));
+        if (sample_sync_snapshot(&smp->sample, &st)) {
+            h = tracer_hash(h, &st.length, sizeof(st.length));
+            h = tracer_hash(h, &st.loopstart, sizeof(st.loopstart));
+            h = tracer_hash(h, &st.loopend, sizeof(st.loopend));
+            h = tracer_hash(h, &st.flags, sizeof(st.flags));
+            h = tracer_hash(h, &st.generation, sizeof(st.generation));
+        } else {
+            const gint generation = g_atomic_int_get(&smp->sample.sync.generation);
+
+            h = tracer_hash(h, &generation, sizeof(generation));
+        }
+    }
+
+    return h;
+}
+
+/* With count >= 0 also marks the instruments used by the pattern */
+static guint32
+tracer_cache_hash_pattern(tracer_cache* c,
+    const XM* xm,
+    const int n,
+    const gint count)
+{
+    pattern_sync_state st;
+    guint32 h = TRACER_HASH_INIT;
+    int i, j;
+
+    epoch_enter();
+    if (pattern_sync_snapshot(&xm->patterns[n], &st)) {
+        h = tracer_hash(h, &st.length, sizeof(st.length));
+        h = tracer_hash(h, &st.generation, sizeof(st.generation));
+        for (i = 0; i < xm->num_channels; i++) {
+            if (!st.channels[i])
+                continue;
+            h = tracer_hash(h, st.channels[i], st.length * sizeof(XMNote));
+            if (count < 0)
+                continue;
+            for (j = 0; j < st.length; j++) {
+                const int ins = st.channels[i][j].instrument - 1;
+
+                if (ins >= 0 && ins < XM_NUM_INSTRUMENTS && c->instrument_use[ins] < 0) {
+                    c->instrument_use[ins] = count;
+                    c->instrument_hash[ins] = tracer_hash_instrument(&xm->instruments[ins]);
+                }
+            }
+        }
+    } else {
+        const gint generation = g_atomic_int_get(&xm->patterns[n].sync.generation);
+
+        h = tracer_hash(h, &generation, sizeof(generation));
+    }
+    epoch_leave();
+
+    return h;
+}
+
+static void
+tracer_cache_truncate(tracer_cache* c,
+    const gint count)
+{
+    gint i;
+
+    if (count >= c->keyframes->len)
+        return;
+
+    g_ptr_array_set_size(c->keyframes, count);
+    for (i = 0; i < XM_NUM_PATTERNS; i++)
+        if (c->pattern_use[i] >= count)
+            c->pattern_use[i] = -1;
+    for (i = 0; i < XM_NUM_INSTRUMENTS; i++)
+        if (c->instrument_use[i] >= count)
+            c->instrument_use[i] = -1;
+    for (i = 0; i < G_N_ELEMENTS(c->order_use); i++)
+        if (c->order_use[i] >= count)
+            c->order_use[i] = -1;
+
+    if (count) {
+        const tracer_keyframe* k = g_ptr_array_index(c->keyframes, count - 1);
+
+        c->max_songpos = k->songpos;
+        c->max_patpos = k->patpos;
+    } else
+        c->max_songpos = c->max_patpos = -1;
+}
+
+tracer_cache*
+tracer_cache_new(void)
+{
+    tracer_cache* c = g_new0(tracer_cache, 1);
+
+    c->keyframes = g_ptr_array_new_with_free_func(g_free);
+    tracer_cache_clear(c);
+
+    return c;
+}
+
+void
+tracer_cache_destroy(tracer_cache* c)
+{
+    g_ptr_array_free(c->keyframes, TRUE);
+    g_free(c);
+}
+
+void
+tracer_cache_clear(tracer_cache* c)
+{
+    tracer_cache_truncate(c, 0);
+    c->xm = NULL;
+    memset(c->pattern_use, -1, sizeof(c->pattern_use));
+    memset(c->instrument_use, -1, sizeof(c->instrument_use));
+    memset(c->order_use, -1, sizeof(c->order_use));
+    c->max_songpos = c->max_patpos = -1;
+}
+
+/* Drops all the keyframes if they have been taken under other conditions.
+   Cheap, called by the audio thread at every trace. */
+static void
+tracer_cache_check_conditions(tracer_cache* c,
+    XM* xm,
+    const int mixfreq,
+    const int num_channels)
+{
+    if (c->xm != xm || c->mixfreq != mixfreq || c->num_channels != num_channels
+        || c->permanent_channels != gui_settings.permanent_channels
+        || c->flags != xm->flags || c->xm_channels != xm->num_channels
+        || c->tempo != xm->tempo || c->bpm != xm->bpm) {
+        tracer_cache_clear(c);
+        c->xm = xm;
+        c->mixfreq = mixfreq;
+        c->num_channels = num_channels;
+        c->permanent_channels = gui_settings.permanent_channels;
+        c->flags = xm->flags;
+        c->xm_channels = xm->num_channels;
+        c->tempo = xm->tempo;
+        c->bpm = xm->bpm;
+        c->song_length = xm->song_length;
+    }
+}
+
+void
+tracer_cache_validate(tracer_cache* c,
+    XM* xm)
+{
+    guint8 order[256];
+    gint order_generation, valid = c->keyframes->len;
+    int i;
+
+    /* Cleared anyway at the next trace */
+    if (c->xm != xm)
+        return;
+
+    for (i = 0; i < XM_NUM_PATTERNS; i++)
+        if (c->pattern_use[i] >= 0 && c->pattern_use[i] < valid
+            && tracer_cache_hash_pattern(c, xm, i, -1) != c->pattern_hash[i])
+            valid = c->pattern_use[i];
+    for (i = 0; i < XM_NUM_INSTRUMENTS; i++)
+        if (c->instrument_use[i] >= 0 && c->instrument_use[i] < valid
+            && tracer_hash_instrument(&xm->instruments[i]) != c->instrument_hash[i])
+            valid = c->instrument_use[i];
+
+    order_generation = -1;
+    if (pattern_sync_order_snapshot(xm, order, &order_generation)) {
+        for (i = 0; i < G_N_ELEMENTS(order); i++)
+            if (c->order_use[i] >= 0 && c->order_use[i] < valid && c->order[i] != order[i])
+                valid = c->order_use[i];
+    } else
+        valid = 0;
+
+    /* The song length changes what follows the last position */
+    if (c->song_length != xm->song_length) {
+        for (i = MAX(MIN(c->song_length, xm->song_length) - 1, 0); i < G_N_ELEMENTS(c->order_use); i++)
+            if (c->order_use[i] >= 0)
+                valid = MIN(valid, c->order_use[i]);
+        c->song_length = xm->song_length;
+    }
+
+    tracer_cache_truncate(c, valid);
+}
+
+/* Restores the last keyframe not after the given row, returns its index or
+   -1 if there's none */
+static gint
+tracer_cache_restore(tracer_cache* c,
+    xmplayer* p,
+    tracer_mixer* mx,
+    const int songpos,
+    const int patpos,
+    double* rest,
+    double* previous)
+{
+    gint i;
+
+    for (i = c->keyframes->len - 1; i >= 0; i--) {
+        const tracer_keyframe* k = g_ptr_array_index(c->keyframes, i);
+        st_mixer* const mixer = p->mixer;
+        void* const mixer_object = p->mixer_object;
+        xmplayer_events* const events = p->events;
+        gint midi_program[16], midi_bend[16], midi_note[32], midi_ch[32];
+        double midi_freq[32];
+        int j;
+
+        if (k->songpos > songpos || (k->songpos == songpos && k->patpos > patpos))
+            continue;
+
+        /* The MIDI output state isn't a part of the snapshot: it tells what
+           has been sent to the device, which the keyframe doesn't change */
+        memcpy(midi_program, p->midi_program, sizeof(midi_program));
+        memcpy(midi_bend, p->midi_bend, sizeof(midi_bend));
+        for (j = 0; j < 32; j++) {
+            midi_note[j] = p->channels[j].midi_note;
+            midi_ch[j] = p->channels[j].midi_ch;
+            midi_freq[j] = p->channels[j].midi_freq;
+        }
+
+        *p = k->player;
+        p->mixer = mixer;
+        p->mixer_object = mixer_object;
+        p->events = events;
+        memcpy(p->midi_program, midi_program, sizeof(midi_program));
+        memcpy(p->midi_bend, midi_bend, sizeof(midi_bend));
+        for (j = 0; j < 32; j++) {
+            p->channels[j].midi_note = midi_note[j];
+            p->channels[j].midi_ch = midi_ch[j];
+            p->channels[j].midi_freq = midi_freq[j];
+        }
+        /* The tracks and the sample data copied could be reclaimed since */
+        p->pat.generation = -1;
+        p->order_generation = -1;
+        *mx = k->mixer;
+        for (j = 0; j < mx->num_channels; j++) {
+            tracer_channel* ch = &mx->channels[j];
+
+            ch->smp.generation = -1;
+            if (ch->flags & TR_FLAG_SAMPLE_RUNNING)
+                tracer_sync_sample(ch);
+        }
+        *rest = k->rest;
+        *previous = k->previous;
+
+        return i;
+    }
+
+    return -1;
+}
+
+/* Called after every tick while tracing beyond the last keyframe */
+static void
+tracer_cache_record(tracer_cache* c,
+    const xmplayer* p,
+    const tracer_mixer* mx,
+    const double rest,
+    const double previous)
+{
+    const gint count = c->keyframes->len;
+    gboolean key;
+
+    if (c->order_use[p->songpos] < 0) {
+        c->order_use[p->songpos] = count;
+        c->order[p->songpos] = p->patno;
+    }
+    if (c->pattern_use[p->patno] < 0) {
+        c->pattern_use[p->patno] = count;
+        c->pattern_hash[p->patno] = tracer_cache_hash_pattern(c, p->xm, p->patno, count);
+    }
+
+    if (p->songpos < c->max_songpos || (p->songpos == c->max_songpos && p->patpos <= c->max_patpos))
+        return;
+    key = p->songpos != c->max_songpos || !(p->patpos % TRACER_KEYFRAME_ROWS);
+    c->max_songpos = p->songpos;
+    c->max_patpos = p->patpos;
+
+    if (key && !p->curtick && count < TRACER_MAX_KEYFRAMES) {
+        tracer_keyframe* k = g_new(tracer_keyframe, 1);
+
+        k->songpos = p->songpos;
+        k->patpos = p->patpos;
+        k->player = *p;
+        k->mixer = *mx;
+        k->rest = rest;
+        k->previous = previous;
+        g_ptr_array_add(c->keyframes, k);
+    }
+}
+
+static inline gboolean
+tracer_reached(const xmplayer* p,
+    const int stopsongpos,
+    const int stoppatpos)
+{
+    return p->songpos > stopsongpos || (p->songpos == stopsongpos && p->patpos > stoppatpos)
+        || (p->songpos == stopsongpos && p->patpos == stoppatpos && p->curtick >= p->tempo - 1);
+}
+
+void tracer_trace(xmplayer* p, void* t, tracer_cache* cache, int mixfreq, int songpos, int patpos)
 {
     /* Attemp to take pitchband into account */
     /* Test if tempo and BPM are traced */
-    st_mixer* real_mixer = mixer;
-    mixer = &mixer_tracer;
+    st_mixer* real_mixer = p->mixer;
+    void* real_mixer_object = p->mixer_object;
+    tracer_mixer* const mx = t;
 
     int stopsongpos = songpos;
     int stoppatpos = patpos;
 
     double rest = 0, previous = 0; /* Fractional part of the samples */
+    gboolean extending = TRUE, done = FALSE;
+
+    p->mixer = &mixer_tracer;
+    p->mixer_object = t;
 
     if ((stoppatpos -= 1) < 0) {
         stopsongpos -= 1;
-        stoppatpos = xm->patterns[xm->pattern_order_table[stopsongpos]].length - 1;
+        stoppatpos = p->xm->patterns[p->xm->pattern_order_table[stopsongpos]].length - 1;
     }
 
-    tracer_setmixfreq(mixfreq);
-    tracer_reset();
+    tracer_setmixfreq(t, mixfreq);
+    tracer_reset(t);
 
-    while (1) {
-        double t;
+    if (cache) {
+        gint k;
 
-        double current = xmplayer_play(TRUE);
-        t = current - previous + rest;
+        tracer_cache_check_conditions(cache, p->xm, mixfreq, mx->num_channels);
+        k = tracer_cache_restore(cache, p, mx, stopsongpos, stoppatpos, &rest, &previous);
+        /* Only the tracing beyond the last keyframe can take new ones */
+        extending = k == (gint)cache->keyframes->len - 1;
+        if (k >= 0)
+            done = tracer_reached(p, stopsongpos, stoppatpos);
+    }
+
+    while (!done) {
+        double dt;
+
+        double current = xmplayer_play(p, TRUE);
+        dt = current - previous + rest;
         previous = current;
 
-        guint32 samples = t * mixfreq;
-        rest = t - (double)samples / (double)mixfreq;
+        guint32 samples = dt * mixfreq;
+        rest = dt - (double)samples / (double)mixfreq;
 
-        tracer_render(samples, NULL, 0, NULL, 0.0);
-        if (player_songpos > stopsongpos || (player_songpos == stopsongpos && player_patpos > stoppatpos) || (player_songpos == stopsongpos && player_patpos == stoppatpos && curtick >= player_tempo - 1))
-            break; //? maybe player_patpos - 1
+        tracer_render(t, samples, NULL, 0, NULL, 0.0);
+        if (cache && extending)
+            tracer_cache_record(cache, p, mx, rest, previous);
+        done = tracer_reached(p, stopsongpos, stoppatpos); //? maybe patpos - 1
     }
 
-    mixer = real_mixer;
+    p->mixer = real_mixer;
+    p->mixer_object = real_mixer_object;
 }
 
 tracer_channel*
-tracer_return_channel(int n)
+tracer_return_channel(void* mp, int n)
 {
-    g_assert(n < num_channels);
+    tracer_mixer* const mx = mp;
+
+    g_assert(n < mx->num_channels);
 
-    return &channels[n];
+    return &mx->channels[n];
 }
@@ -24,13 +24,12 @@
 #define _TRACER_H
 
 #include "mixer.h"
+#include "xm-player.h"
 
 typedef struct tracer_channel {
     st_mixer_sample_info* sample;
 
-    void* data; // for updatesample() to see if sample has changed
-    int looptype;
-    guint32 length;
+    st_mixer_sample_state smp; // handed over to the mixer, see sample-sync.h
 
     guint32 flags; // see below
     float volume; // 0.0 ... 1.0
@@ -52,7 +51,31 @@ typedef struct tracer_channel {
 #define TR_FLAG_LOOP_BIDIRECTIONAL 2
 #define TR_FLAG_SAMPLE_RUNNING 4
 
-void tracer_trace(int mixfreq, int songpos, int patpos);
-tracer_channel* tracer_return_channel(int number);
-void tracer_setnumch(int n);
+/* The tracer is a mixer on its own; its objects are created by tracer_new()
+   and passed as the `tracer' argument of st_mixer->loadchsettings() */
+void* tracer_new(void);
+void tracer_destroy(void* t);
+
+/* The states of the player and the tracer taken while tracing, so the next
+   trace can start from the nearest one instead of the beginning of the
+   song. A keyframe is dropped when a pattern, an instrument or an order
+   list entry used before it is changed. */
+typedef struct tracer_cache tracer_cache;
+
+tracer_cache* tracer_cache_new(void);
+void tracer_cache_destroy(tracer_cache* c);
+/* Must be called when another module is loaded */
+void tracer_cache_clear(tracer_cache* c);
+/* Drops the keyframes depending on what has been changed in the module
+   since they have been taken. Hashes the patterns and instruments used, so
+   it's called by the GUI thread before the playback is started, while the
+   audio thread doesn't use the cache. */
+void tracer_cache_validate(tracer_cache* c,
+    XM* xm);
+
+/* Runs the player p from the beginning of the song up to the given position
+   with the tracer t temporarily set as p's mixer. The cache c can be NULL. */
+void tracer_trace(xmplayer* p, void* t, tracer_cache* c, int mixfreq, int songpos, int patpos);
+tracer_channel* tracer_return_channel(void* t, int number);
+void tracer_setnumch(void* t, int n);
 #endif
@@ -31,6 +31,7 @@
 #include <glib/gi18n.h>
 
 #include "audio.h"
+#include "display-tick.h"
 #include "gui-settings.h"
 #include "gui-subs.h"
 #include "gui.h"
@@ -38,6 +39,7 @@
 #include "keys.h"
 #include "main.h"
 #include "menubar.h"
+#include "pattern-sync.h"
 #include "preferences.h"
 #include "st-subs.h"
 #include "track-editor.h"
@@ -107,7 +109,7 @@ static guint hscroll_tag, vscroll_tag;
 static int note_running[32] = {-1};
 
 static int update_freq = 30;
-static int gtktimer = -1;
+static guint tick_id = 0;
 
 static guint track_editor_editmode_status_idle_handler = 0;
 static gchar track_editor_editmode_status_ed_buf[512];
@@ -464,6 +466,7 @@ note_undo(const gint ins, const gint smp, const gboolean redo,
 
     g_assert(IS_TRACKER(data));
     t = TRACKER(data);
+    pattern_sync_notes_changing(t->curpattern);
     tmp_value = t->curpattern->channels[na->channel][na->row];
     t->curpattern->channels[na->channel][na->row] = na->note;
     na->note = tmp_value;
@@ -479,10 +482,12 @@ track_editor_log_note(Tracker* t,
     const gint flags)
 {
     struct NoteArg* arg = g_new(struct NoteArg, 1);
+    XMPattern* pat = pattern == -1 ? t->curpattern : &xm->patterns[pattern];
 
     arg->channel = channel;
     arg->row = row;
-    arg->note = (pattern == -1 ? t->curpattern : &xm->patterns[pattern])->channels[channel][row];
+    arg->note = pat->channels[channel][row];
+    pattern_sync_notes_changing(pat);
     history_log_action(HISTORY_ACTION_POINTER, _(title), flags | HISTORY_FLAG_LOG_POS |
         (pattern == -1 ? HISTORY_FLAG_LOG_PAT : HISTORY_SET_PAT(pattern)), note_undo,
         t, sizeof(struct NoteArg), arg);
@@ -509,6 +514,7 @@ static void track_editor_block_undo(const gint ins, const gint smp, const gboole
     t = TRACKER(data);
 
     /* Current pattern is already set by undo routines */
+    pattern_sync_notes_changing(t->curpattern);
     for (i = 0, chaddr = 0; i < ba->width; i++, chaddr += ba->length) {
         memcpy(&tmp_notes[chaddr],
             &t->curpattern->channels[ba->channel + i][ba->pos], chansize);
@@ -536,6 +542,7 @@ void track_editor_log_block(Tracker* t, const gchar* title,
     arg->pos = pos;
     for (i = 0, chaddr = 0; i < width; i++, chaddr += length)
         memcpy(&arg->notes[chaddr], &t->curpattern->channels[channel + i][pos], chansize);
+    pattern_sync_notes_changing(t->curpattern);
 
     history_log_action(HISTORY_ACTION_POINTER, _(title),
         HISTORY_FLAG_LOG_POS | HISTORY_FLAG_LOG_PAT | HISTORY_FLAG_LOG_PAGE,
@@ -1409,11 +1416,16 @@ void track_editor_delete_line(GtkWidget* w, Tracker* t)
 {
     if (GUI_EDITING && notebook_current_page == NOTEBOOK_PAGE_TRACKER) {
         XMPattern* pat = t->curpattern;
+        const gboolean change_len = gui_settings.change_patlen && pat->length > 1;
 
         gui_log_pattern_full(pat, N_("Pattern line removing"), -1, -1, -1, t->patpos);
+        /* The player gets the shifted rows and the new length together */
+        pattern_sync_edit_begin(pat, FALSE);
         st_pattern_delete_line(pat, t->patpos);
-        if (gui_settings.change_patlen && pat->length > 1) {
+        if (change_len)
             st_set_pattern_length(pat, pat->length - 1);
+        pattern_sync_edit_end(pat);
+        if (change_len) {
             gui_update_pattern_data();
             tracker_set_pattern(tracker, NULL);
             tracker_set_pattern(tracker, pat);
@@ -1433,12 +1445,16 @@ void track_editor_insert_line(GtkWidget* w, Tracker* t)
 
     if (GUI_EDITING && notebook_current_page == NOTEBOOK_PAGE_TRACKER) {
         XMPattern* pat = t->curpattern;
+        const gboolean change_len = gui_settings.change_patlen && pat->length < 256;
 
         gui_log_pattern_full(pat, N_("Pattern line insertion"), -1, -1,
             gui_settings.change_patlen ? MIN(pat->length + 1, 256) : -1, t->patpos);
+        pattern_sync_edit_begin(pat, FALSE);
         st_pattern_insert_line(pat, t->patpos);
-        if (gui_settings.change_patlen && pat->length < 256) {
+        if (change_len)
             st_set_pattern_length(pat, pat->length + 1);
+        pattern_sync_edit_end(pat);
+        if (change_len) {
             gui_update_pattern_data();
             tracker_set_pattern(tracker, NULL);
             tracker_set_pattern(tracker, pat);
@@ -1570,6 +1586,8 @@ paste_notes(XMPattern* dst,
     gint newlength = MIN(src->length, length - start_row);
     gint newnum_ch = MIN(srcb->num_chans, num_ch - start_ch);
 
+    /* The block appears in the played pattern at once */
+    pattern_sync_edit_begin(dst, TRUE);
     _paste_notes(dst, src, start_row, 0, newlength, start_ch, 0, newnum_ch);
     if (wrap) {
         gint newnum_ch1 = srcb->num_chans - num_ch + start_ch;
@@ -1589,6 +1607,7 @@ paste_notes(XMPattern* dst,
             }
         }
     }
+    pattern_sync_edit_end(dst);
 }
 
 void _copy_pattern(GtkWidget* w,
@@ -1624,6 +1643,7 @@ clear_notes(XMPattern* src,
 
     g_assert(start_row + length <= 256 && start_ch + numch <= 32);
 
+    pattern_sync_edit_begin(src, TRUE);
     for (i = 0; i < length; i++)
         for (j = 0; j < numch && src->channels[j + start_ch]; j++) {
             XMNote* source = &src->channels[j + start_ch][i + start_row];
@@ -1639,6 +1659,7 @@ clear_notes(XMPattern* src,
             if (mask & cpt_masks[MASK_CUT + MASK_FXPARAM])
                 source->fxparam = 0;
         }
+    pattern_sync_edit_end(src);
 }
 
 void track_editor_cut_pattern(GtkWidget* w, Tracker* t)
@@ -1668,6 +1689,7 @@ void track_editor_paste_pattern(GtkWidget* w, Tracker* t)
         gui_log_pattern(p, N_("Pattern paste"), -1, -1,
             MAX(p->length, len));
 
+        pattern_sync_edit_begin(p, FALSE);
         if (p->length != len) {
             if (p->alloc_length < len)
                 st_set_alloc_length(p, len, FALSE);
@@ -1679,6 +1701,7 @@ void track_editor_paste_pattern(GtkWidget* w, Tracker* t)
         }
 
         paste_notes(p, &pattern_buffer, 0, 0, 32, FALSE);
+        pattern_sync_edit_end(p);
 
         if (full_update) {
             gui_update_pattern_data();
@@ -2434,70 +2457,54 @@ tracker_timeout_foreach(gpointer data,
     }
 }
 
-static gint
-tracker_timeout(gpointer data)
+static void
+tracker_timeout(const gdouble display_songtime,
+    gpointer data)
 {
-    g_debug("tracker_timeout()");
-
-    double display_songtime;
     gboolean new_event = TRUE;
 
-    if (current_driver_object == NULL) {
-        /* Can happen when audio thread stops on its own. Note that
-	 * tracker_stop_updating() is called in
-	 * gui.c::read_mixer_pipe(). */
-        return TRUE;
-    }
-
-    display_songtime = current_driver->get_play_time(current_driver_object);
     g_debug("tracker_timeout() songtime=%lf", display_songtime);
 
     if (display_songtime < 0.0) {
         gui_clipping_indicator_update(FALSE);
     } else {
-        audio_clipping_indicator* c =
-            time_buffer_get(audio_clipping_indicator_tb, display_songtime);
-        if (c) {
-            gui_clipping_indicator_update(c->clipping);
-            g_free(c);
-        }
+        audio_clipping_indicator c;
+
+        if (time_buffer_get(audio_clipping_indicator_tb, display_songtime, &c))
+            gui_clipping_indicator_update(c.clipping);
     }
 
     time_buffer_foreach(audio_playerpos_tb, display_songtime, tracker_timeout_foreach, &new_event);
     if (new_event)
         gui_update_player_pos(curtime, cur_pat, patno, cur_pos, cur_tempo, bpm);
-
-    return TRUE;
 }
 
 void tracker_start_updating(void)
 {
     g_debug("tracker_start_updating()");
 
-    if (gtktimer != -1)
+    if (tick_id)
         return;
 
-    gtktimer = g_timeout_add(1000 / update_freq, tracker_timeout, NULL);
+    tick_id = display_tick_add(update_freq, tracker_timeout, NULL);
 }
 
 void tracker_stop_updating(void)
 {
     g_debug("tracker_stop_updating()");
 
-    if (gtktimer == -1)
+    if (!tick_id)
         return;
 
-    g_source_remove(gtktimer);
-    gtktimer = -1;
+    display_tick_remove(tick_id);
+    tick_id = 0;
 }
 
 void tracker_set_update_freq(int freq)
 {
     update_freq = freq;
-    if (gtktimer != -1) {
-        tracker_stop_updating();
-        tracker_start_updating();
-    }
+    if (tick_id)
+        display_tick_set_freq(tick_id, freq);
 }
 
 void track_editor_load_config(void)
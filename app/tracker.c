@@ -111,12 +111,28 @@ tracker_get_note_name(const guint key)
     return notenames[index][key];
 }
 
+static inline void
+tracker_publish_cursor(Tracker* t)
+{
+    g_atomic_int_set(&t->cursor_snapshot, (t->num_channels << 8) | t->cursor_ch);
+}
+
+int tracker_peek_cursor_channel(Tracker* t,
+    int* num_channels)
+{
+    gint snapshot = g_atomic_int_get(&t->cursor_snapshot);
+
+    *num_channels = snapshot >> 8;
+    return snapshot & 0xff;
+}
+
 void tracker_set_num_channels(Tracker* t,
     int n)
 {
     GtkWidget* widget = GTK_WIDGET(t);
 
     t->num_channels = n;
+    tracker_publish_cursor(t);
     if (gtk_widget_get_realized(widget)) {
         init_display(t, widget->allocation.width, widget->allocation.height, FALSE);
         gtk_widget_queue_draw(widget);
@@ -259,6 +275,7 @@ static void tracker_set_xpanning_full(Tracker* t,
                 t->cursor_ch = t->leftchan;
             else if (t->cursor_ch >= t->leftchan + t->disp_numchans)
                 t->cursor_ch = t->leftchan + t->disp_numchans - 1;
+            tracker_publish_cursor(t);
         }
         if (signal)
             g_signal_emit(G_OBJECT(t), tracker_signals[SIG_XPANNING], 0, t->leftchan);
@@ -314,6 +331,7 @@ void tracker_step_cursor_channel(Tracker* t,
         t->cursor_ch = t->num_channels - 1;
     else if (t->cursor_ch >= t->num_channels)
         t->cursor_ch = 0;
+    tracker_publish_cursor(t);
 
     adjust_xpanning(t, TRUE);
 
@@ -334,6 +352,7 @@ void tracker_set_cursor_channel(Tracker* t,
         t->cursor_ch = 0;
     else if (t->cursor_ch >= t->num_channels)
         t->cursor_ch = t->num_channels - 1;
+    tracker_publish_cursor(t);
 
     adjust_xpanning(t, TRUE);
 
@@ -1061,6 +1080,7 @@ void tracker_reset(Tracker* t)
         t->cursor_ch = 0;
         t->cursor_item = 0;
         t->leftchan = 0;
+        tracker_publish_cursor(t);
         init_display(t, widget->allocation.width, widget->allocation.height, TRUE);
         gtk_widget_queue_draw(GTK_WIDGET(t));
     }
@@ -1442,6 +1462,7 @@ tracker_button_press(GtkWidget* widget,
             if (cursor_ch != t->cursor_ch || cursor_item != t->cursor_item) {
                 t->cursor_ch = cursor_ch;
                 t->cursor_item = cursor_item;
+                tracker_publish_cursor(t);
                 adjust_xpanning(t, TRUE);
                 redraw = 1;
             }
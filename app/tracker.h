@@ -58,6 +58,9 @@ struct _Tracker {
     int num_channels;
 
     int cursor_ch, cursor_item;
+    /* Cursor channel and channel count packed together for the MIDI input
+       thread, see tracker_peek_cursor_channel() */
+    gint cursor_snapshot;
     gboolean editing, print_numbers, print_cursor, selectable;
     int leftchan;
 
@@ -107,6 +110,9 @@ void tracker_step_cursor_item(Tracker* t, int direction);
 void tracker_step_cursor_channel(Tracker* t, int direction);
 void tracker_set_cursor_channel(Tracker* t, int channel);
 void tracker_set_cursor_item(Tracker* t, int item);
+/* Can be called from any thread; returns the cursor channel and stores
+   the number of channels into *num_channels */
+int tracker_peek_cursor_channel(Tracker* t, int* num_channels);
 void tracker_set_patpos(Tracker* t, int row);
 void tracker_step_cursor_row(Tracker* t, int direction);
 
@@ -33,19 +33,14 @@
 #include <string.h>
 
 #include "audio.h"
+#include "epoch.h"
+#include "freq-tables.h"
 #include "gui.h"
 #include "gui-settings.h"
 #include "main.h"
 #include "xm-player.h"
 #include "xm.h"
 
-int player_songpos, player_patpos, player_patno;
-int player_tempo, player_bpm;
-guint8 curtick;
-gboolean player_looped;
-static double current_time;
-static int xmplayer_playmode;
-
 static inline int
 env_length(STEnvelope* env)
 {
@@ -96,12 +91,6 @@ env_handle(STEnvelope* env, guint32* p, guint8 sustain)
     return 4 * v;
 }
 
-static inline double
-pitch_to_freq(int pitch)
-{
-    return 8363 * pow(2, ((float)(-pitch) / (float)PITCH_OCTAVE));
-}
-
 static inline guint32
 umulshr16(guint32 a,
     guint32 b)
@@ -121,112 +110,6 @@ umuldiv(guint32 a,
     return d / c;
 }
 
-typedef struct channel {
-    int chVol;
-    int chFinalVol;
-    int chPan;
-    int chFinalPan;
-    gint32 chPitch; /* Pitch really means 'period' in nonlinear and module frequencies */
-    gint32 chFinalPitch;
-    gint32 chOldPitch;
-    int curnote; /* -1 indicates that the channel is not playing */
-    gint lastnote;
-    long chCutoff;
-    long chReso;
-
-    gint chCurIns;
-    gint chCurSamp;
-    gint chLastIns;
-    int chCurNormNote;
-    guint8 chSustain;
-    guint16 chFadeVol;
-    guint16 chAVibPos;
-    guint32 chAVibSwpPos;
-    guint32 chVolEnvPos;
-    guint32 chPanEnvPos;
-
-    guint8 chDefVol;
-    int chDefPan;
-    guint8 chCommand;
-    guint8 chVCommand;
-    gint32 chPortaToPitch;
-    gint32 chPortaToVal;
-    guint8 chVolSlideVal;
-    guint8 chGVolSlideVal;
-    guint8 chVVolPanSlideVal;
-    guint8 chPanSlideVal;
-    guint8 chFineVolSlideUVal;
-    guint8 chFineVolSlideDVal;
-    gint32 chPortaUVal;
-    gint32 chPortaDVal;
-    guint8 chFinePortaUVal;
-    guint8 chFinePortaDVal;
-    guint8 chXFinePortaUVal;
-    guint8 chXFinePortaDVal;
-    guint8 chVibRate;
-    guint8 chVibPos;
-    guint8 chVibType;
-    guint8 chVibDep;
-    guint8 chTremRate;
-    guint8 chTremPos;
-    guint8 chTremType;
-    guint8 chTremDep;
-    guint8 chPatLoopCount;
-    guint8 chPatLoopStart;
-    guint8 chArpPos;
-    guint8 chArpOffsets[3];
-    guint8 chActionTick;
-    guint8 chMRetrigAct;
-    guint8 chDelayNote;
-    guint8 chDelayIns;
-    guint8 chDelayVol;
-    guint8 chOffset;
-    guint8 chGlissando;
-    guint8 chTremorPos;
-    guint8 chTremorLen;
-    guint8 chTremorOff;
-
-    int nextstop;
-    STSample* nextsamp;
-    int nextpos;
-    int sampleplayend; /* don't play all of the sample, but stop at (here) */
-    STSample* cursamp;
-    STInstrument* curins;
-    int hacksample; /* if 1, then simply play the sample pointed to by cursamp */
-} channel;
-
-static channel channels[32];
-
-static guint8 globalvol;
-
-static guint8 tick0;
-
-static int currow, play_only_row, startrow, stoprow;
-static int ch_start, ch_num;
-static XMPattern* curpattern;
-static int patlen;
-static int curord;
-
-static int nord;
-static int ninst;
-static int nsamp;
-static int linearfreq;
-static int nchan;
-static int loopord;
-static int ismod;
-
-static int jumptoord;
-static int jumptorow;
-static int patdelay;
-static gboolean player_will_loop;
-
-static guint8 procnot;
-static guint8 procins;
-static guint8 procvol;
-static guint8 proccmd;
-static guint8 procdat;
-
-static int realgvol;
 
 static guint32 hnotetab6848[16] = { 11131415, 4417505, 1753088, 695713, 276094, 109568, 43482, 17256, 6848, 2718, 1078, 428, 170, 67, 27, 11 };
 static guint32 hnotetab8363[16] = { 13594045, 5394801, 2140928, 849628, 337175, 133808, 53102, 21073, 8363, 3319, 1317, 523, 207, 82, 33, 13 };
@@ -918,13 +801,13 @@ int mcpGetNote8363(int frq)
     return -x - i;
 }
 
-static int freqrange(int x)
+static int freqrange(xmplayer* p, int x)
 {
-    if (ismod) {
+    if (p->ismod) {
         /* Values from ProTracker 2.2a documentation */
         return CLAMP(x, 113 << 4, 856 << 4);
     } else {
-        if (linearfreq)
+        if (p->linearfreq)
             return (x < -72 * 256) ? -72 * 256 : (x > 96 * 256) ? 96 * 256 : x;
         else
             return (x < 107) ? 107 : (x > 438272) ? 438272 : x;
@@ -942,12 +825,13 @@ static int panrange(int x)
 }
 
 static int
-xm_player_start_note(channel* ch,
+xm_player_start_note(xmplayer* p,
+    xmplayer_channel* ch,
     int note)
 {
-    STInstrument* ins = &xm->instruments[ch->chCurIns - 1];
+    STInstrument* ins = &p->xm->instruments[ch->chCurIns - 1];
     note--;
-    if (ins->samplemap[note] > nsamp)
+    if (ins->samplemap[note] > p->nsamp)
         return 0;
     ch->curins = ins;
     ch->chCurSamp = ins->samplemap[note];
@@ -958,13 +842,14 @@ xm_player_start_note(channel* ch,
 }
 
 static gint32
-xm_player_get_note_pitch(channel* ch,
+xm_player_get_note_pitch(xmplayer* p,
+    xmplayer_channel* ch,
     gint note)
 {
-    if (!ismod) {
+    if (!p->ismod) {
         gint32 pitch = 48 * 256 - (((note - 1) << 8) - ch->chCurNormNote);
 
-        if (linearfreq)
+        if (p->linearfreq)
             return pitch;
         else
             return mcpGetFreq6848(pitch);
@@ -981,37 +866,37 @@ xm_player_get_note_pitch(channel* ch,
 }
 
 static void
-xm_player_playnote_protracker(channel* ch)
+xm_player_playnote_protracker(xmplayer* p, xmplayer_channel* ch)
 {
     int portatmp = 0;
     int delaytmp;
 
-    if (proccmd == xmpCmdPortaNote)
+    if (p->proccmd == xmpCmdPortaNote)
         portatmp = 1;
-    if (proccmd == xmpCmdPortaVol)
+    if (p->proccmd == xmpCmdPortaVol)
         portatmp = 1;
 
-    delaytmp = (proccmd == xmpCmdDelayNote) && procdat;
+    delaytmp = (p->proccmd == xmpCmdDelayNote) && p->procdat;
 
     if (!ch->chCurIns)
         return;
 
     /* This needs to be fixed! */
-    if (!procnot && procins && ch->chCurIns != ch->chLastIns)
-        procnot = ch->curnote;
+    if (!p->procnot && p->procins && ch->chCurIns != ch->chLastIns)
+        p->procnot = ch->curnote;
 
-    if (procnot && !delaytmp)
-        ch->curnote = procnot;
+    if (p->procnot && !delaytmp)
+        ch->curnote = p->procnot;
 
-    if (procins) {
+    if (p->procins) {
         gint32 checknote = ch->curnote;
         if (!checknote)
             checknote = 49;
-        if (!xm_player_start_note(ch, checknote))
+        if (!xm_player_start_note(p, ch, checknote))
             return;
     }
 
-    if (procnot && !delaytmp) {
+    if (p->procnot && !delaytmp) {
         if (!portatmp) {
             gint32 nn;
             ch->nextstop = 1;
@@ -1023,18 +908,18 @@ xm_player_playnote_protracker(channel* ch)
 
             /* CurNormNote is only relevant in FastTracker mode */
             nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
-            if (proccmd == xmpCmdSFinetune)
-                nn = -ch->cursamp->relnote * 256 - (gint16)(procdat << 4) + 0x80;
+            if (p->proccmd == xmpCmdSFinetune)
+                nn = -ch->cursamp->relnote * 256 - (gint16)(p->procdat << 4) + 0x80;
             ch->chCurNormNote = nn;
 
-            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(ch, procnot);
+            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(p, ch, p->procnot);
 
             ch->nextpos = 0;
             ch->sampleplayend = -1;
 
-            if (proccmd == xmpCmdOffset) {
-                if (procdat != 0)
-                    ch->chOffset = procdat;
+            if (p->proccmd == xmpCmdOffset) {
+                if (p->procdat != 0)
+                    ch->chOffset = p->procdat;
                 ch->nextpos = ch->chOffset << 8;
                 if (1 && ch->nextpos > ch->nextsamp->sample.length)
                     ch->nextpos = ch->nextsamp->sample.length - 16;
@@ -1047,11 +932,11 @@ xm_player_playnote_protracker(channel* ch)
             ch->chArpPos = 0;
             ch->chTremorPos = 0;
         } else {
-            ch->chPortaToPitch = xm_player_get_note_pitch(ch, procnot);
+            ch->chPortaToPitch = xm_player_get_note_pitch(p, ch, p->procnot);
         }
     }
 
-    if (procins) {
+    if (p->procins) {
         ch->chVol = ch->chDefVol;
         ch->chFinalVol = ch->chDefVol;
         ch->chPan = ch->chDefPan;
@@ -1065,55 +950,55 @@ xm_player_playnote_protracker(channel* ch)
 }
 
 static void
-xm_player_playnote_fasttracker(channel* ch)
+xm_player_playnote_fasttracker(xmplayer* p, xmplayer_channel* ch)
 {
     int portatmp = 0;
     int delaytmp;
     int keyoff = 0;
 
-    if (proccmd == xmpCmdPortaNote)
+    if (p->proccmd == xmpCmdPortaNote)
         portatmp = 1;
-    if (proccmd == xmpCmdPortaVol)
+    if (p->proccmd == xmpCmdPortaVol)
         portatmp = 1;
-    if ((procvol >> 4) == xmpVCmdPortaNote)
+    if ((p->procvol >> 4) == xmpVCmdPortaNote)
         portatmp = 1;
 
-    delaytmp = (proccmd == xmpCmdDelayNote) && procdat;
+    delaytmp = (p->proccmd == xmpCmdDelayNote) && p->procdat;
 
-    if (procnot == XM_PATTERN_NOTE_OFF) {
-        procnot = 0;
+    if (p->procnot == XM_PATTERN_NOTE_OFF) {
+        p->procnot = 0;
         keyoff = 1;
     }
 
-    if ((proccmd == xmpCmdKeyOff) && !procdat)
+    if ((p->proccmd == xmpCmdKeyOff) && !p->procdat)
         keyoff = 1;
 
     if (!ch->chCurIns)
         return;
 
-    if (procins && !keyoff && !delaytmp)
+    if (p->procins && !keyoff && !delaytmp)
         ch->chSustain = 1;
 
-    if (procnot && !delaytmp) {
-        ch->curnote = procnot;
-        ch->lastnote = procnot;
+    if (p->procnot && !delaytmp) {
+        ch->curnote = p->procnot;
+        ch->lastnote = p->procnot;
     }
 
-    if (procins && !delaytmp) {
+    if (p->procins && !delaytmp) {
         gint32 checknote = ch->curnote;
         if (!checknote)
             checknote = 49;
-        if (!xm_player_start_note(ch, checknote))
+        if (!xm_player_start_note(p, ch, checknote))
             return;
     }
 
-    if (procnot && !delaytmp) {
+    if (p->procnot && !delaytmp) {
         if (!portatmp) {
             gint32 nn;
             ch->nextstop = 1;
 
-            if (procins) {
-                if (!xm_player_start_note(ch, ch->curnote))
+            if (p->procins) {
+                if (!xm_player_start_note(p, ch, ch->curnote))
                     return;
             }
 
@@ -1124,18 +1009,18 @@ xm_player_playnote_fasttracker(channel* ch)
 
             /* CurNormNote is only relevant in FastTracker mode */
             nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
-            if (proccmd == xmpCmdSFinetune)
-                nn = -ch->cursamp->relnote * 256 - (gint16)(procdat << 4) + 0x80;
+            if (p->proccmd == xmpCmdSFinetune)
+                nn = -ch->cursamp->relnote * 256 - (gint16)(p->procdat << 4) + 0x80;
             ch->chCurNormNote = nn;
 
-            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(ch, procnot);
+            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(p, ch, p->procnot);
 
             ch->nextpos = 0;
             ch->sampleplayend = -1;
 
-            if (proccmd == xmpCmdOffset) {
-                if (procdat != 0)
-                    ch->chOffset = procdat;
+            if (p->proccmd == xmpCmdOffset) {
+                if (p->procdat != 0)
+                    ch->chOffset = p->procdat;
                 ch->nextpos = ch->chOffset << 8;
             }
 
@@ -1146,20 +1031,20 @@ xm_player_playnote_fasttracker(channel* ch)
             ch->chArpPos = 0;
             ch->chTremorPos = 0;
         } else {
-            ch->chPortaToPitch = xm_player_get_note_pitch(ch, procnot);
+            ch->chPortaToPitch = xm_player_get_note_pitch(p, ch, p->procnot);
         }
     }
 
-    if (procnot && delaytmp)
+    if (p->procnot && delaytmp)
         return;
 
     if (keyoff && ch->cursamp) {
         ch->chSustain = 0;
-        if (!(ch->curins->vol_env.flags & EF_ON) && !procins)
+        if (!(ch->curins->vol_env.flags & EF_ON) && !p->procins)
             ch->chFadeVol = 0;
     }
 
-    if (procins && ch->chSustain) {
+    if (p->procins && ch->chSustain) {
         ch->chVol = ch->chDefVol;
         ch->chFinalVol = ch->chDefVol;
         ch->chPan = ch->chDefPan;
@@ -1173,31 +1058,91 @@ xm_player_playnote_fasttracker(channel* ch)
 }
 
 static void
-PlayNote(int chnr)
+PlayNote(xmplayer* p, int chnr)
 {
-    channel* ch = &channels[chnr];
+    xmplayer_channel* ch = &p->channels[chnr];
 
-    if (ismod)
-        xm_player_playnote_protracker(ch);
+    if (p->ismod)
+        xm_player_playnote_protracker(p, ch);
     else
-        xm_player_playnote_fasttracker(ch);
+        xm_player_playnote_fasttracker(p, ch);
+}
+
+static void
+xmplayer_midi_note_off(xmplayer* p,
+    xmplayer_channel* ch)
+{
+    if (ch->midi_note) {
+        driver_midi_note_off(p, ch->midi_ch, ch->midi_note - 1);
+        ch->midi_note = 0;
+    }
+}
+
+/* Follows the sample of an instrument with MIDI output enabled on the MIDI
+   channel of the instrument. The frequency changes (freq is 0.0 if it
+   hasn't been changed on this tick) are sent as the pitch bend relative to
+   the frequency the note has been started with. */
+static void
+xmplayer_midi_channel_ops(xmplayer* p,
+    xmplayer_channel* ch,
+    const gboolean started,
+    const double freq)
+{
+    const STInstrument* ins = ch->curins;
+    const gint midich = ins->midi_channel & 15;
+
+    if (!driver_midi_enabled(p))
+        return;
+
+    if (started || ch->curnote < 0 || !ch->chSustain)
+        xmplayer_midi_note_off(p, ch);
+
+    if (started && ch->curnote >= XM_PATTERN_NOTE_MIN && ch->curnote <= XM_PATTERN_NOTE_MAX) {
+        const gint velocity = MIN(ch->chVol * 2, 127);
+
+        if (p->midi_program[midich] != ins->midi_program) {
+            driver_midi_program(p, midich, ins->midi_program);
+            p->midi_program[midich] = ins->midi_program;
+        }
+        if (p->midi_bend[midich] != 0) {
+            driver_midi_bend(p, midich, 0);
+            p->midi_bend[midich] = 0;
+        }
+        if (velocity > 0) {
+            /* XM C-0 is MIDI note 12 */
+            ch->midi_note = ch->curnote - 1 + 12 + 1;
+            ch->midi_ch = midich;
+            ch->midi_freq = freq;
+            driver_midi_note_on(p, midich, ch->midi_note - 1, velocity);
+        }
+    } else if (ch->midi_note && freq > 0.0 && ch->midi_freq > 0.0 && ins->midi_bend_range) {
+        gint bend = lrint(8192.0 * 12.0 * log2(freq / ch->midi_freq) / ins->midi_bend_range);
+
+        bend = CLAMP(bend, -8192, 8191);
+        if (bend != p->midi_bend[ch->midi_ch]) {
+            driver_midi_bend(p, ch->midi_ch, bend);
+            p->midi_bend[ch->midi_ch] = bend;
+        }
+    }
 }
 
 static void
-xmplayer_final_channel_ops(int chnr)
+xmplayer_final_channel_ops(xmplayer* p, int chnr)
 {
     gint vol, pan, note;
-    channel* ch = &channels[chnr];
+    double freq = 0.0;
+    xmplayer_channel* ch = &p->channels[chnr];
 
-    if (player_mute_channels[chnr] && (xmplayer_playmode == PLAYING_SONG || xmplayer_playmode == PLAYING_PATTERN)) {
-        driver_setvolume(chnr, 0);
+    if (p->live && player_mute_channels[chnr] && (p->playmode == PLAYING_SONG || p->playmode == PLAYING_PATTERN)) {
+        driver_setvolume(p, chnr, 0);
+        xmplayer_midi_note_off(p, ch);
         return;
     }
 
-    vol = (ch->chFinalVol * globalvol) >> 4;
+    vol = (ch->chFinalVol * p->globalvol) >> 4;
     pan = ch->chFinalPan;
 
-    if (!ismod && !ch->hacksample) {
+    if (!p->ismod && !ch->hacksample) {
         if (!ch->chSustain) {
             vol = (vol * ch->chFadeVol) >> 15;
             if (ch->chFadeVol >= ch->curins->volfade)
@@ -1218,7 +1163,7 @@ xmplayer_final_channel_ops(int chnr)
             int dep = 0;
             switch (ch->curins->vibtype) {
             case 0:
-                dep = sin(2 * M_PI * (double)ch->chAVibPos / 256 / 256) * (double)(ch->curins->vibdepth << 2);
+                dep = freq_tables_sine[ch->chAVibPos >> 8] * (double)(ch->curins->vibdepth << 2);
                 break;
             case 1:
                 dep = (ch->chAVibPos & 0x8000) ? -(ch->curins->vibdepth << 2) : (ch->curins->vibdepth << 2);
@@ -1240,66 +1185,76 @@ xmplayer_final_channel_ops(int chnr)
 
             ch->chAVibPos += ch->curins->vibrate << 8;
         }
+
+        if (ch->curins->midi_on && ch->curins->mute_computer)
+            vol = 0;
     }
 
     note = ch->curnote;
     if (ch->nextstop) {
-        driver_stopnote(chnr);
+        driver_stopnote(p, chnr);
         ch->curnote = -1;
     }
     if (ch->nextsamp != NULL) {
-        driver_startnote(chnr, &ch->nextsamp->sample, ch->chCurIns, ch->chCurSamp, note);
+        driver_startnote(p, chnr, &ch->nextsamp->sample, ch->chCurIns, ch->chCurSamp, note);
     }
     if (ch->nextpos != -1) {
-        driver_setsmplpos(chnr, ch->nextpos);
+        driver_setsmplpos(p, chnr, ch->nextpos);
         if (ch->sampleplayend != -1) {
-            driver_setsmplend(chnr, ch->sampleplayend);
+            driver_setsmplend(p, chnr, ch->sampleplayend);
         }
     }
     if (ch->chFinalPitch != ch->chOldPitch || ch->nextsamp != NULL) {
         ch->chOldPitch = ch->chFinalPitch;
-        if (ismod) {
+        if (p->ismod) {
             if (ch->chFinalPitch != 0) { /* == 0 happens on tru_funk.mod */
                 /* PAL clock constant is 3546895, NTSC clock constant is 3579545 */
                 /* Taken from "Amiga Hardware Reference Manual, revised & updated", September 1989 printing */
-                driver_setfreq(chnr, (double)(3546895 * 16) / ch->chFinalPitch);
+                freq = (double)(3546895 * 16) / ch->chFinalPitch;
             }
         } else {
-            if (linearfreq) {
-                driver_setfreq(chnr, pitch_to_freq(ch->chFinalPitch));
+            if (p->linearfreq) {
+                freq = pitch_to_freq(ch->chFinalPitch);
             } else {
                 if (ch->chFinalPitch != 0) { /* == 0 happens on tru_funk.mod */
-                    driver_setfreq(chnr, pitch_to_freq(-mcpGetNote8363(8363 * 6848 / ch->chFinalPitch)));
+                    freq = pitch_to_freq(-mcpGetNote8363(8363 * 6848 / ch->chFinalPitch));
                 }
             }
         }
+        if (freq != 0.0)
+            driver_setfreq(p, chnr, freq);
     }
 
-    driver_setvolume(chnr, (double)vol / 4 / 64);
+    if (!p->ismod && !ch->hacksample && ch->curins && ch->curins->midi_on)
+        xmplayer_midi_channel_ops(p, ch, ch->nextsamp != NULL, freq);
+    else
+        xmplayer_midi_note_off(p, ch);
+
+    driver_setvolume(p, chnr, (double)vol / 4 / 64);
 
-    if (ismod) {
-        driver_setpanning(chnr, (chnr & 3) == 0 || (chnr & 3) == 3 ? -1.0 : +1.0);
+    if (p->ismod) {
+        driver_setpanning(p, chnr, (chnr & 3) == 0 || (chnr & 3) == 3 ? -1.0 : +1.0);
     } else {
-        driver_setpanning(chnr, (double)pan / 128.0);
+        driver_setpanning(p, chnr, (double)pan / 128.0);
     }
 
     if ((ch->chCutoff == 0xff && ch->chReso == 0) || !gui_settings.use_filter) {
-        driver_set_ch_filter_freq(chnr, -1.0);
+        driver_set_ch_filter_freq(p, chnr, -1.0);
     } else {
-        driver_set_ch_filter_freq(chnr, 0.5 * pow(2, (float)(ch->chCutoff - 255) / 32.0));
-        driver_set_ch_filter_reso(chnr, (float)ch->chReso / 255);
+        driver_set_ch_filter_freq(p, chnr, cutoff_to_freq(ch->chCutoff));
+        driver_set_ch_filter_reso(p, chnr, (float)ch->chReso / 255);
     }
 }
 
 static gint32
-xm_player_handle_glissando(channel* ch)
+xm_player_handle_glissando(xmplayer* p, xmplayer_channel* ch)
 {
     if (ch->chGlissando) {
-        if (ismod) {
-            fprintf(stderr, "Glissando (E31) for ProTracker modules not supported yet (in module '%s').\n", xm->utf_name);
+        if (p->ismod) {
+            fprintf(stderr, "Glissando (E31) for ProTracker modules not supported yet (in module '%s').\n", p->xm->utf_name);
             return ch->chPitch;
         } else {
-            if (linearfreq)
+            if (p->linearfreq)
                 return ((ch->chPitch + ch->chCurNormNote + 0x80) & ~0xFF) - ch->chCurNormNote;
             else
                 return mcpGetFreq6848(((mcpGetNote6848(ch->chPitch) + ch->chCurNormNote + 0x80) & ~0xFF) - ch->chCurNormNote);
@@ -1308,24 +1263,129 @@ xm_player_handle_glissando(channel* ch)
         return ch->chPitch;
 }
 
-static void xmpPlayTick(const gboolean simulation)
+static inline gint
+xmplayer_order_entry(xmplayer* p,
+    const gint ord)
+{
+    if (g_atomic_int_get(&p->xm->order_sync.generation) != p->order_generation)
+        /* Keeps the previous copy if the list is being changed */
+        pattern_sync_order_snapshot(p->xm, p->order, &p->order_generation);
+
+    /* Nothing to keep yet, the entries are valid pattern numbers anyway */
+    return p->order_generation >= 0 ? p->order[ord] : p->xm->pattern_order_table[ord];
+}
+
+static void
+xmplayer_sync_pattern(xmplayer* p)
+{
+    if (pattern_sync_check(p->curpattern, &p->pat) != PATTERN_SYNC_STALE)
+        return;
+
+    if (pattern_sync_snapshot(p->curpattern, &p->pat))
+        p->patlen = p->pat.length;
+    else {
+        /* The previous tracks can be already reclaimed, so the rows are
+           skipped until the changes are published */
+        p->pat.generation = -1;
+        p->pat.length = 0;
+    }
+}
+
+static void
+xmplayer_set_curpattern(xmplayer* p,
+    const gint pattern)
+{
+    p->curpattern = &p->xm->patterns[p->patno = pattern];
+    p->patlen = p->curpattern->length;
+    p->pat.generation = -1;
+    xmplayer_sync_pattern(p);
+}
+
+/* A non-empty cell of a pattern with the extended effect decoded */
+typedef struct xmplayer_event {
+    guint8 channel;
+    guint8 note, instrument, volume;
+    guint8 cmd, param;
+} xmplayer_event;
+
+/* The cells of the current pattern as lists of the non-empty ones for each
+   row, ordered by channel. Most of the cells are empty in real songs, and
+   the rows are processed without looking at them. */
+struct xmplayer_events {
+    const XMPattern* pattern;
+    gint generation, notes; /* of the pattern when compiled */
+    int nchan;
+    guint16 rows[257]; /* The first event of each row, the end of the last one */
+    xmplayer_event events[256 * 32];
+};
+
+/* The pattern is compiled anew only after its structure or notes have
+   changed. The notes counter is read before the notes, so a change made
+   meanwhile is caught on the next row. */
+static void
+xmplayer_compile_pattern(xmplayer* p)
+{
+    xmplayer_events* e = p->events;
+    const gint notes = pattern_sync_notes_counter(p->curpattern);
+    int row, i, n = 0;
+
+    if (e->pattern == p->curpattern && e->generation == p->pat.generation
+        && e->notes == notes && e->nchan == p->nchan)
+        return;
+
+    e->pattern = p->curpattern;
+    e->generation = p->pat.generation;
+    e->notes = notes;
+    e->nchan = p->nchan;
+
+    for (row = 0; row < p->pat.length; row++) {
+        e->rows[row] = n;
+        for (i = 0; i < p->nchan; i++) {
+            const XMNote* c;
+            xmplayer_event* ev;
+
+            if (!p->pat.channels[i])
+                continue;
+            c = &p->pat.channels[i][row];
+            if (!(c->note | c->instrument | c->volume | c->fxtype | c->fxparam))
+                continue;
+
+            ev = &e->events[n++];
+            ev->channel = i;
+            ev->note = c->note;
+            ev->instrument = c->instrument;
+            ev->volume = c->volume;
+            if (c->fxtype == xmpCmdExtended) {
+                ev->cmd = 36 + (c->fxparam >> 4);
+                ev->param = c->fxparam & 0xF;
+            } else {
+                ev->cmd = c->fxtype;
+                ev->param = c->fxparam;
+            }
+        }
+    }
+    e->rows[row] = n;
+}
+
+static void xmpPlayTick(xmplayer* p, const gboolean simulation)
 {
     int i, fromch, toch;
+    const xmplayer_event *ev, *ev_end;
 
-    tick0 = 0;
+    p->tick0 = 0;
 
-    if (xmplayer_playmode == PLAYING_PATTERN && ch_start >= 0 && ch_num >= 0) {
-        fromch = ch_start;
-        toch = ch_start + ch_num;
-        if (toch > nchan)
-            toch = nchan;
+    if (p->playmode == PLAYING_PATTERN && p->ch_start >= 0 && p->ch_num >= 0) {
+        fromch = p->ch_start;
+        toch = p->ch_start + p->ch_num;
+        if (toch > p->nchan)
+            toch = p->nchan;
     } else {
         fromch = 0;
-        toch = nchan;
+        toch = p->nchan;
     }
 
     for (i = fromch; i < toch; i++) {
-        channel* ch = &channels[i];
+        xmplayer_channel* ch = &p->channels[i];
         ch->chFinalVol = ch->chVol;
         ch->chFinalPan = ch->chPan;
         ch->chFinalPitch = ch->chPitch;
@@ -1334,220 +1394,232 @@ static void xmpPlayTick(const gboolean simulation)
         ch->nextpos = -1;
     }
 
-    if (xmplayer_playmode == PLAYING_NOTE) {
-        for (i = 0; i < nchan; i++) {
-            channel* ch = &channels[i];
+    if (p->playmode == PLAYING_NOTE) {
+        for (i = 0; i < p->nchan; i++) {
+            xmplayer_channel* ch = &p->channels[i];
             if (!ch->cursamp) {
+                xmplayer_midi_note_off(p, ch);
                 if (ch->curnote >= 0) {
-                    driver_stopnote(i);
+                    driver_stopnote(p, i);
                     ch->curnote = -1;
                 }
             } else {
-                xmplayer_final_channel_ops(i);
+                xmplayer_final_channel_ops(p, i);
             }
         }
         return;
     }
 
-    curtick++;
-    if (curtick >= player_tempo)
-        curtick = 0;
+    p->curtick++;
+    if (p->curtick >= p->tempo)
+        p->curtick = 0;
 
-    if (player_will_loop) {
-        player_looped = TRUE;
-        player_will_loop = FALSE;
+    if (p->will_loop) {
+        p->looped = TRUE;
+        p->will_loop = FALSE;
     }
 
-    if (!curtick && patdelay) {
-        if (jumptoord != -1) {
-            if (jumptoord != curord)
-                for (i = 0; i < nchan; i++) {
-                    channel* ch = &channels[i];
+    if (!p->curtick && p->patdelay) {
+        if (p->jumptoord != -1) {
+            if (p->jumptoord != p->curord)
+                for (i = 0; i < p->nchan; i++) {
+                    xmplayer_channel* ch = &p->channels[i];
                     ch->chPatLoopCount = 0;
                     ch->chPatLoopStart = 0;
                 }
 
-            if (jumptoord >= nord) {
-                jumptoord = loopord;
-                player_looped = TRUE;
+            if (p->jumptoord >= p->nord) {
+                p->jumptoord = p->loopord;
+                p->looped = TRUE;
             }
 
-            if (xmplayer_playmode == PLAYING_SONG) {
-                curord = jumptoord;
-                patlen = xm->patterns[xm->pattern_order_table[curord]].length;
-                curpattern = &xm->patterns[player_patno = xm->pattern_order_table[curord]];
+            if (p->playmode == PLAYING_SONG) {
+                p->curord = p->jumptoord;
+                xmplayer_set_curpattern(p, xmplayer_order_entry(p, p->curord));
             }
-            currow = jumptorow;
-            jumptoord = -1;
+            p->currow = p->jumptorow;
+            p->jumptoord = -1;
         }
     }
 
-    if (!curtick && (!patdelay || ismod)) {
-        tick0 = 1;
+    if (!p->curtick && (!p->patdelay || p->ismod)) {
+        p->tick0 = 1;
 
-        if (!patdelay) {
-            currow++;
-            if (xmplayer_playmode == PLAYING_PATTERN && jumptoord == -1 &&
-                stoprow >= 0 && currow >= stoprow) {
-                jumptoord = curord;
-                jumptorow = startrow;
-                player_looped = TRUE;
+        if (!p->patdelay) {
+            p->currow++;
+            if (p->playmode == PLAYING_PATTERN && p->jumptoord == -1 &&
+                p->stoprow >= 0 && p->currow >= p->stoprow) {
+                p->jumptoord = p->curord;
+                p->jumptorow = p->startrow;
+                p->looped = TRUE;
             }
-            if ((jumptoord == -1) && (currow >= patlen)) {
-                jumptoord = curord + 1;
-                jumptorow = 0;
-                if (xmplayer_playmode == PLAYING_PATTERN) {
-                    player_looped = TRUE;
-                    if (stoprow >= 0)
-                        jumptorow = startrow;
+            if ((p->jumptoord == -1) && (p->currow >= p->patlen)) {
+                p->jumptoord = p->curord + 1;
+                p->jumptorow = 0;
+                if (p->playmode == PLAYING_PATTERN) {
+                    p->looped = TRUE;
+                    if (p->stoprow >= 0)
+                        p->jumptorow = p->startrow;
                 }
             }
-            if (jumptoord != -1) {
-                if (jumptoord != curord)
-                    for (i = 0; i < nchan; i++) {
-                        channel* ch = &channels[i];
+            if (p->jumptoord != -1) {
+                if (p->jumptoord != p->curord)
+                    for (i = 0; i < p->nchan; i++) {
+                        xmplayer_channel* ch = &p->channels[i];
                         ch->chPatLoopCount = 0;
                         ch->chPatLoopStart = 0;
                     }
 
-                if (jumptoord >= nord) {
-                    jumptoord = loopord;
-                    player_looped = TRUE;
+                if (p->jumptoord >= p->nord) {
+                    p->jumptoord = p->loopord;
+                    p->looped = TRUE;
                 }
 
-                if (xmplayer_playmode == PLAYING_SONG) {
-                    curord = jumptoord;
-                    patlen = xm->patterns[xm->pattern_order_table[curord]].length;
-                    curpattern = &xm->patterns[player_patno = xm->pattern_order_table[curord]];
+                if (p->playmode == PLAYING_SONG) {
+                    p->curord = p->jumptoord;
+                    xmplayer_set_curpattern(p, xmplayer_order_entry(p, p->curord));
                 }
-                currow = jumptorow;
-                jumptoord = -1;
+                p->currow = p->jumptorow;
+                p->jumptoord = -1;
             }
         }
 
-        if (play_only_row != -1 && currow != play_only_row) {
-            currow = play_only_row;
-            xmplayer_playmode = PLAYING_NOTE;
+        if (p->play_only_row != -1 && p->currow != p->play_only_row) {
+            p->currow = p->play_only_row;
+            p->playmode = PLAYING_NOTE;
             return;
         }
 
-        for (i = fromch; i < toch; i++) {
-            channel* ch = &channels[i];
-
-            procnot = curpattern->channels[i][currow].note;
-            procins = curpattern->channels[i][currow].instrument;
-            procvol = curpattern->channels[i][currow].volume;
-            proccmd = curpattern->channels[i][currow].fxtype;
-            procdat = curpattern->channels[i][currow].fxparam;
+        xmplayer_sync_pattern(p);
+        xmplayer_compile_pattern(p);
+        if (p->currow < p->pat.length) {
+            ev = &p->events->events[p->events->rows[p->currow]];
+            ev_end = &p->events->events[p->events->rows[p->currow + 1]];
+        } else
+            ev = ev_end = NULL;
 
-            if (proccmd == xmpCmdExtended) {
-                proccmd = 36 + (procdat >> 4);
-                procdat &= 0xF;
+        for (i = fromch; i < toch; i++) {
+            xmplayer_channel* ch = &p->channels[i];
+
+            while (ev < ev_end && ev->channel < i)
+                ev++;
+            if (ev == ev_end || ev->channel != i) {
+                /* All that the code below does for an empty cell */
+                ch->chVCommand = 0;
+                ch->chCommand = 0xFF;
+                memset(ch->chArpOffsets, 0, sizeof(ch->chArpOffsets));
+                continue;
             }
 
-            if (!patdelay) {
-                if (procins && procins <= ninst) {
+            p->procnot = ev->note;
+            p->procins = ev->instrument;
+            p->procvol = ev->volume;
+            p->proccmd = ev->cmd;
+            p->procdat = ev->param;
+
+            if (!p->patdelay) {
+                if (p->procins && p->procins <= p->ninst) {
                     ch->chLastIns = ch->chCurIns;
-                    ch->chCurIns = procins;
+                    ch->chCurIns = p->procins;
                 }
-                if (procins <= ninst)
-                    PlayNote(i);
+                if (p->procins <= p->ninst)
+                    PlayNote(p, i);
             }
 
-            ch->chVCommand = procvol >> 4;
+            ch->chVCommand = p->procvol >> 4;
 
             switch (ch->chVCommand) {
             case xmpVCmdVol0x:
             case xmpVCmdVol1x:
             case xmpVCmdVol2x:
             case xmpVCmdVol3x:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalVol = ch->chVol = procvol - 0x10;
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalVol = ch->chVol = p->procvol - 0x10;
                 break;
             case xmpVCmdVol40:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
                     ch->chFinalVol = ch->chVol = 0x40;
                 break;
             case xmpVCmdVolSlideD:
             case xmpVCmdVolSlideU:
             case xmpVCmdPanSlideL:
             case xmpVCmdPanSlideR:
-                ch->chVVolPanSlideVal = procvol & 0xF;
+                ch->chVVolPanSlideVal = p->procvol & 0xF;
                 break;
             case xmpVCmdFVolSlideD:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalVol = ch->chVol = volrange(ch->chVol - (procvol & 0xF));
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalVol = ch->chVol = volrange(ch->chVol - (p->procvol & 0xF));
                 break;
             case xmpVCmdFVolSlideU:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalVol = ch->chVol = volrange(ch->chVol + (procvol & 0xF));
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalVol = ch->chVol = volrange(ch->chVol + (p->procvol & 0xF));
                 break;
             case xmpVCmdVibRate:
-                if (procvol & 0xF)
-                    ch->chVibRate = ((procvol & 0xF) << 2);
+                if (p->procvol & 0xF)
+                    ch->chVibRate = ((p->procvol & 0xF) << 2);
                 break;
             case xmpVCmdVibDep:
-                if (procvol & 0xF)
-                    ch->chVibDep = ((procvol & 0xF) << (1 + (!linearfreq && !ismod)));
+                if (p->procvol & 0xF)
+                    ch->chVibDep = ((p->procvol & 0xF) << (1 + (!p->linearfreq && !p->ismod)));
                 break;
             case xmpVCmdPanning:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalPan = ch->chPan = (procvol & 0xF) * 0x11 - 128;
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalPan = ch->chPan = (p->procvol & 0xF) * 0x11 - 128;
                 break;
             case xmpVCmdPortaNote:
-                if (procvol & 0xF)
-                    ch->chPortaToVal = (procvol & 0xF) << 8;
+                if (p->procvol & 0xF)
+                    ch->chPortaToVal = (p->procvol & 0xF) << 8;
                 break;
             }
 
-            ch->chCommand = proccmd;
+            ch->chCommand = p->proccmd;
 
             switch (ch->chCommand) {
             case xmpCmdArpeggio:
-                if (!procdat)
+                if (!p->procdat)
                     ch->chCommand = 0xFF;
                 ch->chArpOffsets[0] = 0;
-                ch->chArpOffsets[1] = procdat >> 4;
-                ch->chArpOffsets[2] = procdat & 0xF;
+                ch->chArpOffsets[1] = p->procdat >> 4;
+                ch->chArpOffsets[2] = p->procdat & 0xF;
                 break;
             case xmpCmdPortaU:
-                if (procdat)
-                    ch->chPortaUVal = procdat << 4;
+                if (p->procdat)
+                    ch->chPortaUVal = p->procdat << 4;
                 break;
             case xmpCmdPortaD:
-                if (procdat)
-                    ch->chPortaDVal = procdat << 4;
+                if (p->procdat)
+                    ch->chPortaDVal = p->procdat << 4;
                 break;
             case xmpCmdPortaNote:
-                if (procdat)
-                    ch->chPortaToVal = procdat << 4;
+                if (p->procdat)
+                    ch->chPortaToVal = p->procdat << 4;
                 break;
             case xmpCmdVibrato:
-                if (procdat & 0xF)
-                    ch->chVibDep = (procdat & 0xF) << (1 + (!linearfreq && !ismod));
-                if (procdat & 0xF0)
-                    ch->chVibRate = (procdat >> 4) << 2;
+                if (p->procdat & 0xF)
+                    ch->chVibDep = (p->procdat & 0xF) << (1 + (!p->linearfreq && !p->ismod));
+                if (p->procdat & 0xF0)
+                    ch->chVibRate = (p->procdat >> 4) << 2;
                 break;
             case xmpCmdPortaVol:
             case xmpCmdVibVol:
             case xmpCmdVolSlide:
-                if (procdat || ismod)
-                    ch->chVolSlideVal = procdat;
+                if (p->procdat || p->ismod)
+                    ch->chVolSlideVal = p->procdat;
                 break;
             case xmpCmdTremolo:
-                if (procdat & 0xF)
-                    ch->chTremDep = (procdat & 0xF) << 2;
-                if (procdat & 0xF0)
-                    ch->chTremRate = (procdat >> 4) << 2;
+                if (p->procdat & 0xF)
+                    ch->chTremDep = (p->procdat & 0xF) << 2;
+                if (p->procdat & 0xF0)
+                    ch->chTremRate = (p->procdat >> 4) << 2;
                 break;
             case xmpCmdPanning:
-                ch->chFinalPan = ch->chPan = procdat - 128;
+                ch->chFinalPan = ch->chPan = p->procdat - 128;
                 break;
             case xmpCmdSetFCutoff:
-                ch->chCutoff = procdat;
+                ch->chCutoff = p->procdat;
                 break;
             case xmpCmdSetFReso:
-                ch->chReso = procdat;
+                ch->chReso = p->procdat;
                 break;
             case xmpCmdSetFHFCutoff:
                 //		mcpSet(0,mcpMasterFHFCutoff,procdat);
@@ -1558,62 +1630,62 @@ static void xmpPlayTick(const gboolean simulation)
 
             case xmpCmdJump:
                 /* Second condition to prevent tracer hanging in some cases */
-                if (!patdelay && !(simulation && procdat <= curord)) {
-                    jumptoord = procdat;
-                    jumptorow = 0;
-                    if (jumptoord <= curord)
-                        player_will_loop = TRUE;
+                if (!p->patdelay && !(simulation && p->procdat <= p->curord)) {
+                    p->jumptoord = p->procdat;
+                    p->jumptorow = 0;
+                    if (p->jumptoord <= p->curord)
+                        p->will_loop = TRUE;
                 }
                 break;
             case xmpCmdVolume:
-                ch->chFinalVol = ch->chVol = volrange(procdat);
+                ch->chFinalVol = ch->chVol = volrange(p->procdat);
                 break;
             case xmpCmdBreak:
-                if (!patdelay) {
-                    if (jumptoord == -1)
-                        jumptoord = curord + 1;
-                    jumptorow = (procdat & 0xF) + (procdat >> 4) * 10;
+                if (!p->patdelay) {
+                    if (p->jumptoord == -1)
+                        p->jumptoord = p->curord + 1;
+                    p->jumptorow = (p->procdat & 0xF) + (p->procdat >> 4) * 10;
                 }
                 break;
             case xmpCmdSpeed:
-                if (!procdat) {
-                    jumptoord = procdat;
-                    jumptorow = 0;
-                    player_will_loop = TRUE;
+                if (!p->procdat) {
+                    p->jumptoord = p->procdat;
+                    p->jumptorow = 0;
+                    p->will_loop = TRUE;
                     break;
                 }
-                if (procdat >= 0x20) {
-                    player_bpm = procdat;
+                if (p->procdat >= 0x20) {
+                    p->bpm = p->procdat;
                 } else {
-                    player_tempo = procdat;
+                    p->tempo = p->procdat;
                 }
                 break;
             case xmpCmdMODtTempo:
-                if (!procdat) {
-                    jumptoord = procdat;
-                    jumptorow = 0;
+                if (!p->procdat) {
+                    p->jumptoord = p->procdat;
+                    p->jumptorow = 0;
                 } else {
-                    player_tempo = procdat;
+                    p->tempo = p->procdat;
                 }
                 break;
             case xmpCmdGVolume:
-                globalvol = volrange(procdat);
+                p->globalvol = volrange(p->procdat);
                 break;
             case xmpCmdGVolSlide:
-                if (procdat)
-                    ch->chGVolSlideVal = procdat;
+                if (p->procdat)
+                    ch->chGVolSlideVal = p->procdat;
                 break;
             case xmpCmdKeyOff:
-                ch->chActionTick = procdat;
+                ch->chActionTick = p->procdat;
                 break;
             case xmpCmdRetrigger:
-                ch->chActionTick = procdat;
+                ch->chActionTick = p->procdat;
                 break;
             case xmpCmdNoteCut:
-                ch->chActionTick = procdat;
+                ch->chActionTick = p->procdat;
                 break;
             case xmpCmdEnvPos:
-                ch->chVolEnvPos = ch->chPanEnvPos = procdat;
+                ch->chVolEnvPos = ch->chPanEnvPos = p->procdat;
                 if (!ch->curins)
                     break;
                 if (ch->curins->vol_env.flags & EF_ON)
@@ -1624,143 +1696,143 @@ static void xmpPlayTick(const gboolean simulation)
                         ch->chPanEnvPos = env_length(&ch->curins->pan_env);
                 break;
             case xmpCmdPanSlide:
-                if (procdat)
-                    ch->chPanSlideVal = procdat;
+                if (p->procdat)
+                    ch->chPanSlideVal = p->procdat;
                 break;
             case xmpCmdMRetrigger:
-                if (procdat) {
-                    ch->chActionTick = procdat & 0xF;
-                    ch->chMRetrigAct = procdat >> 4;
+                if (p->procdat) {
+                    ch->chActionTick = p->procdat & 0xF;
+                    ch->chMRetrigAct = p->procdat >> 4;
                 }
                 break;
             case xmpCmdTremor:
-                if (procdat) {
-                    ch->chTremorLen = (procdat & 0xF) + (procdat >> 4) + 2;
-                    ch->chTremorOff = (procdat >> 4) + 1;
+                if (p->procdat) {
+                    ch->chTremorLen = (p->procdat & 0xF) + (p->procdat >> 4) + 2;
+                    ch->chTremorOff = (p->procdat >> 4) + 1;
                     ch->chTremorPos = 0;
                 }
                 break;
             case xmpCmdXPorta:
-                if ((procdat >> 4) == 1) {
-                    if (procdat & 0xF)
-                        ch->chXFinePortaUVal = procdat & 0xF;
-                    ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch - (ch->chXFinePortaUVal << 2));
-                } else if ((procdat >> 4) == 2) {
-                    if (procdat & 0xF)
-                        ch->chXFinePortaDVal = procdat & 0xF;
-                    ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch + (ch->chXFinePortaDVal << 2));
+                if ((p->procdat >> 4) == 1) {
+                    if (p->procdat & 0xF)
+                        ch->chXFinePortaUVal = p->procdat & 0xF;
+                    ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch - (ch->chXFinePortaUVal << 2));
+                } else if ((p->procdat >> 4) == 2) {
+                    if (p->procdat & 0xF)
+                        ch->chXFinePortaDVal = p->procdat & 0xF;
+                    ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch + (ch->chXFinePortaDVal << 2));
                 }
                 break;
             case xmpCmdFPortaU:
-                if (procdat || ismod)
-                    ch->chFinePortaUVal = procdat;
-                ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch - (ch->chFinePortaUVal << 4));
+                if (p->procdat || p->ismod)
+                    ch->chFinePortaUVal = p->procdat;
+                ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch - (ch->chFinePortaUVal << 4));
                 break;
             case xmpCmdFPortaD:
-                if (procdat || ismod)
-                    ch->chFinePortaDVal = procdat;
-                ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch + (ch->chFinePortaDVal << 4));
+                if (p->procdat || p->ismod)
+                    ch->chFinePortaDVal = p->procdat;
+                ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch + (ch->chFinePortaDVal << 4));
                 break;
             case xmpCmdGlissando:
-                ch->chGlissando = procdat;
+                ch->chGlissando = p->procdat;
                 break;
             case xmpCmdVibType:
-                ch->chVibType = procdat;
+                ch->chVibType = p->procdat;
                 break;
             case xmpCmdPatLoop:
-                if (!procdat)
-                    ch->chPatLoopStart = currow;
+                if (!p->procdat)
+                    ch->chPatLoopStart = p->currow;
                 else {
                     ch->chPatLoopCount++;
-                    if (ch->chPatLoopCount <= procdat) {
-                        jumptorow = ch->chPatLoopStart;
-                        jumptoord = curord;
+                    if (ch->chPatLoopCount <= p->procdat) {
+                        p->jumptorow = ch->chPatLoopStart;
+                        p->jumptoord = p->curord;
                     } else {
                         ch->chPatLoopCount = 0;
-                        ch->chPatLoopStart = currow + 1;
+                        ch->chPatLoopStart = p->currow + 1;
                     }
                 }
                 break;
             case xmpCmdTremType:
-                ch->chTremType = procdat;
+                ch->chTremType = p->procdat;
                 break;
             case xmpCmdSPanning:
-                ch->chFinalPan = ch->chPan = procdat * 0x11 - 128;
+                ch->chFinalPan = ch->chPan = p->procdat * 0x11 - 128;
                 break;
             case xmpCmdFVolSlideU:
-                if (procdat || ismod)
-                    ch->chFineVolSlideUVal = procdat;
+                if (p->procdat || p->ismod)
+                    ch->chFineVolSlideUVal = p->procdat;
                 ch->chFinalVol = ch->chVol = volrange(ch->chVol + ch->chFineVolSlideUVal);
                 break;
             case xmpCmdFVolSlideD:
-                if (procdat || ismod)
-                    ch->chFineVolSlideDVal = procdat;
+                if (p->procdat || p->ismod)
+                    ch->chFineVolSlideDVal = p->procdat;
                 ch->chFinalVol = ch->chVol = volrange(ch->chVol - ch->chFineVolSlideDVal);
                 break;
             case xmpCmdPatDelay:
-                if (!patdelay)
-                    patdelay = procdat + 1;
+                if (!p->patdelay)
+                    p->patdelay = p->procdat + 1;
                 break;
             case xmpCmdDelayNote:
-                if (procnot)
-                    ch->chDelayNote = procnot;
+                if (p->procnot)
+                    ch->chDelayNote = p->procnot;
                 else
                     ch->chDelayNote = ch->lastnote;
-                if (procins)
-                    ch->chDelayIns = procins;
+                if (p->procins)
+                    ch->chDelayIns = p->procins;
                 else
                     ch->chDelayIns = ch->chCurIns;
-                ch->chDelayVol = procvol;
-                ch->chActionTick = procdat;
+                ch->chDelayVol = p->procvol;
+                ch->chActionTick = p->procdat;
                 break;
             }
         }
     }
-    if (!curtick && patdelay) {
-        patdelay--;
+    if (!p->curtick && p->patdelay) {
+        p->patdelay--;
     }
 
     for (i = fromch; i < toch; i++) {
-        channel* ch = &channels[i];
+        xmplayer_channel* ch = &p->channels[i];
 
         switch (ch->chVCommand) {
         case xmpVCmdVolSlideD:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol - ch->chVVolPanSlideVal);
             break;
         case xmpVCmdVolSlideU:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ch->chVVolPanSlideVal);
             break;
         case xmpVCmdVibDep: // KB says "FICKEN" :)
             switch (ch->chVibType) {
             case 0:
-                ch->chFinalPitch = freqrange((16 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep) + (double)ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (16 * freq_tables_sine[ch->chVibPos] * (double)ch->chVibDep) + (double)ch->chPitch);
                 break;
             case 1:
-                ch->chFinalPitch = freqrange((((ch->chVibPos - 0x80) * ch->chVibDep) >> 3) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (((ch->chVibPos - 0x80) * ch->chVibDep) >> 3) + ch->chPitch);
                 break;
             case 2:
-                ch->chFinalPitch = freqrange(((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 2) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, ((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 2) + ch->chPitch);
                 break;
             }
-            if (!tick0)
+            if (!p->tick0)
                 ch->chVibPos += ch->chVibRate;
             break;
         case xmpVCmdPanSlideL:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalPan = ch->chPan = panrange(ch->chPan - ch->chVVolPanSlideVal);
             break;
         case xmpVCmdPanSlideR:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalPan = ch->chPan = panrange(ch->chPan + ch->chVVolPanSlideVal);
             break;
         case xmpVCmdPortaNote:
-            if (!tick0) {
+            if (!p->tick0) {
                 if (ch->chPitch < ch->chPortaToPitch) {
                     ch->chPitch += ch->chPortaToVal;
                     if (ch->chPitch > ch->chPortaToPitch)
@@ -1771,19 +1843,19 @@ static void xmpPlayTick(const gboolean simulation)
                         ch->chPitch = ch->chPortaToPitch;
                 }
             }
-            ch->chFinalPitch = xm_player_handle_glissando(ch);
+            ch->chFinalPitch = xm_player_handle_glissando(p, ch);
             break;
         }
 
         switch (ch->chCommand) {
         case xmpCmdArpeggio:
-            if (ismod) {
-                ch->chFinalPitch = freqrange((ch->chPitch * notetab[ch->chArpOffsets[curtick % 3]]) >> 15);
+            if (p->ismod) {
+                ch->chFinalPitch = freqrange(p, (ch->chPitch * notetab[ch->chArpOffsets[p->curtick % 3]]) >> 15);
             } else {
-                if (linearfreq)
-                    ch->chFinalPitch = freqrange(ch->chPitch - (ch->chArpOffsets[ch->chArpPos] << 8));
+                if (p->linearfreq)
+                    ch->chFinalPitch = freqrange(p, ch->chPitch - (ch->chArpOffsets[ch->chArpPos] << 8));
                 else
-                    ch->chFinalPitch = freqrange((ch->chPitch * notetab[ch->chArpOffsets[ch->chArpPos]]) >> 15);
+                    ch->chFinalPitch = freqrange(p, (ch->chPitch * notetab[ch->chArpOffsets[ch->chArpPos]]) >> 15);
                 /* not sure if this is correct, even for XM's. One should think
 		   ArpPos is equivalent to the tick counter (-mkrause). */
                 ch->chArpPos++;
@@ -1792,17 +1864,17 @@ static void xmpPlayTick(const gboolean simulation)
             }
             break;
         case xmpCmdPortaU:
-            if (tick0)
+            if (p->tick0)
                 break;
-            ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch - ch->chPortaUVal);
+            ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch - ch->chPortaUVal);
             break;
         case xmpCmdPortaD:
-            if (tick0)
+            if (p->tick0)
                 break;
-            ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch + ch->chPortaDVal);
+            ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch + ch->chPortaDVal);
             break;
         case xmpCmdPortaNote:
-            if (!tick0) {
+            if (!p->tick0) {
                 if (ch->chPitch < ch->chPortaToPitch) {
                     ch->chPitch += ch->chPortaToVal;
                     if (ch->chPitch > ch->chPortaToPitch)
@@ -1813,25 +1885,25 @@ static void xmpPlayTick(const gboolean simulation)
                         ch->chPitch = ch->chPortaToPitch;
                 }
             }
-            ch->chFinalPitch = xm_player_handle_glissando(ch);
+            ch->chFinalPitch = xm_player_handle_glissando(p, ch);
             break;
         case xmpCmdVibrato:
             switch (ch->chVibType) {
             case 0:
-                ch->chFinalPitch = freqrange(8 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep + (double)ch->chPitch);
+                ch->chFinalPitch = freqrange(p, 8 * freq_tables_sine[ch->chVibPos] * (double)ch->chVibDep + (double)ch->chPitch);
                 break;
             case 1:
-                ch->chFinalPitch = freqrange((((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
                 break;
             case 2:
-                ch->chFinalPitch = freqrange(((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, ((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
                 break;
             }
-            if (!tick0)
+            if (!p->tick0)
                 ch->chVibPos += ch->chVibRate;
             break;
         case xmpCmdPortaVol:
-            if (!tick0) {
+            if (!p->tick0) {
                 if (ch->chPitch < ch->chPortaToPitch) {
                     ch->chPitch += ch->chPortaToVal;
                     if (ch->chPitch > ch->chPortaToPitch)
@@ -1842,34 +1914,34 @@ static void xmpPlayTick(const gboolean simulation)
                         ch->chPitch = ch->chPortaToPitch;
                 }
             }
-            ch->chFinalPitch = xm_player_handle_glissando(ch);
-            if (tick0)
+            ch->chFinalPitch = xm_player_handle_glissando(p, ch);
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ((ch->chVolSlideVal & 0xF0) ? (ch->chVolSlideVal >> 4) : -(ch->chVolSlideVal & 0xF)));
             break;
         case xmpCmdVibVol:
             switch (ch->chVibType & 3) {
             case 0:
-                ch->chFinalPitch = freqrange(8 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep + (double)ch->chPitch);
+                ch->chFinalPitch = freqrange(p, 8 * freq_tables_sine[ch->chVibPos] * (double)ch->chVibDep + (double)ch->chPitch);
                 break;
             case 1:
-                ch->chFinalPitch = freqrange((((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
                 break;
             case 2:
-                ch->chFinalPitch = freqrange(((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, ((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
                 break;
             }
-            if (!tick0)
+            if (!p->tick0)
                 ch->chVibPos += ch->chVibRate;
 
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ((ch->chVolSlideVal & 0xF0) ? (ch->chVolSlideVal >> 4) : -(ch->chVolSlideVal & 0xF)));
             break;
         case xmpCmdTremolo:
             switch (ch->chTremType & 3) {
             case 0:
-                ch->chFinalVol += sin(2 * M_PI * (double)ch->chTremPos / 256) * (double)ch->chTremDep;
+                ch->chFinalVol += freq_tables_sine[ch->chTremPos] * (double)ch->chTremDep;
                 break;
             case 1:
                 ch->chFinalVol += (((ch->chTremPos - 0x80) * ch->chTremDep) >> 7);
@@ -1879,42 +1951,42 @@ static void xmpPlayTick(const gboolean simulation)
                 break;
             }
             ch->chFinalVol = volrange(ch->chFinalVol);
-            if (!tick0)
+            if (!p->tick0)
                 ch->chTremPos += ch->chTremRate;
             break;
         case xmpCmdVolSlide:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ((ch->chVolSlideVal & 0xF0) ? (ch->chVolSlideVal >> 4) : -(ch->chVolSlideVal & 0xF)));
             break;
         case xmpCmdGVolSlide:
-            if (tick0)
+            if (p->tick0)
                 break;
             if (ch->chGVolSlideVal & 0xF0)
-                globalvol = volrange(globalvol + (ch->chGVolSlideVal >> 4));
+                p->globalvol = volrange(p->globalvol + (ch->chGVolSlideVal >> 4));
             else
-                globalvol = volrange(globalvol - (ch->chGVolSlideVal & 0xF));
+                p->globalvol = volrange(p->globalvol - (ch->chGVolSlideVal & 0xF));
             break;
         case xmpCmdKeyOff:
-            if (tick0)
+            if (p->tick0)
                 break;
-            if (curtick == ch->chActionTick) {
+            if (p->curtick == ch->chActionTick) {
                 ch->chSustain = 0;
                 if (ch->cursamp && !(ch->curins->vol_env.flags & EF_ON))
                     ch->chFadeVol = 0;
             }
             break;
         case xmpCmdPanSlide:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalPan = ch->chPan = panrange(ch->chPan + ((ch->chPanSlideVal & 0xF0) ? (ch->chPanSlideVal >> 4) : -(ch->chPanSlideVal & 0xF)));
             break;
         case xmpCmdMRetrigger:
-            if (tick0)
+            if (p->tick0)
                 break;
             if (!ch->chActionTick)
                 break;
-            if (!((curtick + (gui_settings.rxx_bug_emu ? 1 : 0)) % ch->chActionTick)) {
+            if (!((p->curtick + (gui_settings.rxx_bug_emu ? 1 : 0)) % ch->chActionTick)) {
                 /* Retrig envelops and so on... */
                 if (!(ch->chVibType & 4))
                     ch->chVibPos = 0;
@@ -1967,18 +2039,18 @@ static void xmpPlayTick(const gboolean simulation)
         case xmpCmdTremor:
             if (ch->chTremorPos >= ch->chTremorOff)
                 ch->chFinalVol = 0;
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chTremorPos++;
             if (ch->chTremorPos == ch->chTremorLen)
                 ch->chTremorPos = 0;
             break;
         case xmpCmdRetrigger:
-            if (tick0)
+            if (p->tick0)
                 break;
             if (!ch->chActionTick)
                 break;
-            if (!(curtick % ch->chActionTick) && ch->lastnote) {
+            if (!(p->curtick % ch->chActionTick) && ch->lastnote) {
                 gint32 nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
 
                 /* Retrig envelops and so on... */
@@ -1998,24 +2070,24 @@ static void xmpPlayTick(const gboolean simulation)
 
                 ch->chCurNormNote = nn;
                 ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch =
-                    xm_player_get_note_pitch(ch, ch->lastnote);
+                    xm_player_get_note_pitch(p, ch, ch->lastnote);
             }
             break;
         case xmpCmdNoteCut:
-            if (curtick == ch->chActionTick)
+            if (p->curtick == ch->chActionTick)
                 ch->chFinalVol = ch->chVol = 0;
             break;
         case xmpCmdDelayNote:
-            if (tick0)
+            if (p->tick0)
                 break;
-            if (curtick != ch->chActionTick)
+            if (p->curtick != ch->chActionTick)
                 break;
-            procnot = ch->chDelayNote;
-            procins = ch->chDelayIns;
-            proccmd = 0;
-            procdat = 0;
-            procvol = 0;
-            PlayNote(i);
+            p->procnot = ch->chDelayNote;
+            p->procins = ch->chDelayIns;
+            p->proccmd = 0;
+            p->procdat = 0;
+            p->procvol = 0;
+            PlayNote(p, i);
             switch (ch->chDelayVol >> 4) {
             case xmpVCmdVol0x:
             case xmpVCmdVol1x:
@@ -2034,154 +2106,205 @@ static void xmpPlayTick(const gboolean simulation)
         }
 
         if (!ch->cursamp) {
+            xmplayer_midi_note_off(p, ch);
             if (ch->curnote >= 0) {
-                driver_stopnote(i);
+                driver_stopnote(p, i);
                 ch->curnote = -1;
             }
         } else {
-            xmplayer_final_channel_ops(i);
+            xmplayer_final_channel_ops(p, i);
         }
     }
 }
 
-void xmplayer_init_module(void)
+xmplayer*
+xmplayer_new(XM* xm, st_mixer* mixer, void* mixer_object)
+{
+    xmplayer* p = g_new0(xmplayer, 1);
+
+    freq_tables_init();
+    p->xm = xm;
+    p->mixer = mixer;
+    p->mixer_object = mixer_object;
+    p->events = g_new(xmplayer_events, 1);
+    p->events->pattern = NULL;
+
+    return p;
+}
+
+void xmplayer_destroy(xmplayer* p)
+{
+    g_free(p->events);
+    g_free(p);
+}
+
+void xmplayer_init_module(xmplayer* p, XM* xm)
 {
     g_assert(xm != NULL);
 
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
+    p->xm = xm;
+
+    p->tempo = xm->tempo;
+    p->bpm = xm->bpm;
 }
 
 static gboolean
-xmplayer_init_playing(gboolean init_all, gboolean all)
+xmplayer_init_playing(xmplayer* p, gboolean init_all, gboolean all)
 {
     int i;
 
-    nchan = all ? 32 : xm->num_channels;
-    driver_setnumch(nchan);
+    p->nchan = all ? 32 : p->xm->num_channels;
+    driver_setnumch(p, p->nchan);
 
-    current_time = 0.0;
+    p->current_time = 0.0;
 
-    ninst = 128;
-    nord = xm->song_length;
-    nsamp = 128;
-    ismod = xm->flags & XM_FLAGS_IS_MOD;
-    linearfreq = !(xm->flags & XM_FLAGS_AMIGA_FREQ);
-    loopord = xm->restart_position;
-    curtick = player_tempo - 1;
-    patdelay = 0;
+    p->ninst = 128;
+    p->nord = p->xm->song_length;
+    /* The module can be another one at the same address */
+    p->order_generation = -1;
+    p->events->pattern = NULL;
+    p->nsamp = 128;
+    p->ismod = p->xm->flags & XM_FLAGS_IS_MOD;
+    p->linearfreq = !(p->xm->flags & XM_FLAGS_AMIGA_FREQ);
+    p->loopord = p->xm->restart_position;
+    p->curtick = p->tempo - 1;
+    p->patdelay = 0;
 
     if (init_all) {
-        globalvol = 0x40;
-        realgvol = 0x40;
+        p->globalvol = 0x40;
+        p->realgvol = 0x40;
 
-        memset(channels, 0, sizeof(channels));
+        memset(p->channels, 0, sizeof(p->channels));
 
-        for (i = 0; i < nchan; i++) {
-            channels[i].chCutoff = 0xff;
-            channels[i].chReso = 0;
+        for (i = 0; i < p->nchan; i++) {
+            p->channels[i].chCutoff = 0xff;
+            p->channels[i].chReso = 0;
+        }
+        for (i = 0; i < G_N_ELEMENTS(p->midi_program); i++) {
+            p->midi_program[i] = -1;
+            p->midi_bend[i] = G_MAXINT;
         }
     }
 
     return TRUE;
 }
 
-void xmplayer_set_tempo(int tempo)
+void xmplayer_set_tempo(xmplayer* p, int tempo)
 {
-    player_tempo = tempo;
+    p->tempo = tempo;
 }
 
-void xmplayer_set_bpm(int bpm)
+void xmplayer_set_bpm(xmplayer* p, int bpm)
 {
-    player_bpm = bpm;
+    p->bpm = bpm;
 }
 
 gboolean
-xmplayer_init_play_song(int songpos,
+xmplayer_init_play_song(xmplayer* p,
+    int songpos,
     int patpos,
     gboolean init_all)
 {
-    jumptorow = patpos;
-    currow = patpos;
-    play_only_row = -1;
-    jumptoord = songpos;
-    curord = songpos;
-    player_will_loop = FALSE;
-    player_looped = FALSE;
-    xmplayer_playmode = PLAYING_SONG;
+    p->jumptorow = patpos;
+    p->currow = patpos;
+    p->play_only_row = -1;
+    p->jumptoord = songpos;
+    p->curord = songpos;
+    p->will_loop = FALSE;
+    p->looped = FALSE;
+    p->playmode = PLAYING_SONG;
 
     if (songpos == 0 && init_all)
-        xmplayer_init_module();
+        xmplayer_init_module(p, p->xm);
 
-    return xmplayer_init_playing(init_all, FALSE);
+    return xmplayer_init_playing(p, init_all, FALSE);
+}
+
+void xmplayer_set_song_end(xmplayer* p, int songpos)
+{
+    if (songpos >= 0 && songpos < p->xm->song_length)
+        p->nord = songpos + 1;
 }
 
 gboolean
-xmplayer_init_play_pattern(int pattern,
+xmplayer_init_play_pattern(xmplayer* p,
+    int pattern,
     int patpos,
     int only1row,
     int stoppos,
     int startch,
     int numch)
 {
-    jumptorow = patpos;
-    stoprow = stoppos;
-    currow = startrow = patpos;
-    ch_start = startch;
-    ch_num = numch;
-    play_only_row = only1row ? patpos : -1;
-    jumptoord = 0;
-    curord = 0;
-    patlen = xm->patterns[pattern].length;
-    curpattern = &xm->patterns[player_patno = pattern];
-    player_will_loop = FALSE;
-    player_looped = FALSE;
-    xmplayer_playmode = PLAYING_PATTERN;
-
-    return xmplayer_init_playing(TRUE, FALSE);
+    p->jumptorow = patpos;
+    p->stoprow = stoppos;
+    p->currow = p->startrow = patpos;
+    p->ch_start = startch;
+    p->ch_num = numch;
+    p->play_only_row = only1row ? patpos : -1;
+    p->jumptoord = 0;
+    p->curord = 0;
+    xmplayer_set_curpattern(p, pattern);
+    p->will_loop = FALSE;
+    p->looped = FALSE;
+    p->playmode = PLAYING_PATTERN;
+
+    return xmplayer_init_playing(p, TRUE, FALSE);
 }
 
-void xmplayer_stop(void)
+void xmplayer_stop(xmplayer* p)
 {
-    xmplayer_playmode = 0;
+    int i;
+
+    p->playmode = 0;
+
+    driver_midi_reset(p);
+    for (i = 0; i < G_N_ELEMENTS(p->channels); i++)
+        p->channels[i].midi_note = 0;
+    for (i = 0; i < G_N_ELEMENTS(p->midi_program); i++) {
+        p->midi_program[i] = -1;
+        p->midi_bend[i] = G_MAXINT;
+    }
 }
 
 gboolean
-xmplayer_play_note(int channel,
+xmplayer_play_note(xmplayer* p,
+    int channel,
     int note,
     int instrument,
     gboolean all)
 {
-    if (!xmplayer_playmode) {
-        xmplayer_playmode = PLAYING_NOTE;
-        if (!xmplayer_init_playing(TRUE, all))
+    if (!p->playmode) {
+        p->playmode = PLAYING_NOTE;
+        if (!xmplayer_init_playing(p, TRUE, all))
             return FALSE;
     }
 
     /* start note here */
-    memset(&channels[channel], 0, sizeof(channels[channel]));
+    xmplayer_midi_note_off(p, &p->channels[channel]);
+    memset(&p->channels[channel], 0, sizeof(p->channels[channel]));
 
-    proccmd = 0;
-    procnot = note;
-    procins = channels[channel].chCurIns = instrument;
-    procdat = 0;
-    procvol = 0;
+    p->proccmd = 0;
+    p->procnot = note;
+    p->procins = p->channels[channel].chCurIns = instrument;
+    p->procdat = 0;
+    p->procvol = 0;
 
-    PlayNote(channel);
+    PlayNote(p, channel);
 
-    channels[channel].chCutoff = 0xff;
-    channels[channel].chReso = 0;
+    p->channels[channel].chCutoff = 0xff;
+    p->channels[channel].chReso = 0;
 
-    channels[channel].nextpos = -1;
-    channels[channel].sampleplayend = -1;
-    channels[channel].nextstop = 1;
-    xmplayer_final_channel_ops(channel);
+    p->channels[channel].nextpos = -1;
+    p->channels[channel].sampleplayend = -1;
+    p->channels[channel].nextstop = 1;
+    xmplayer_final_channel_ops(p, channel);
 
     return TRUE;
 }
 
 gboolean
-xmplayer_play_note_full(const gint chnr,
+xmplayer_play_note_full(xmplayer* p,
+    const gint chnr,
     const gint note,
     STSample* sample,
     const guint32 offset,
@@ -2191,25 +2314,26 @@ xmplayer_play_note_full(const gint chnr,
     const gint smpl)
 {
     gint32 nn;
-    channel* ch = &channels[chnr];
+    xmplayer_channel* ch = &p->channels[chnr];
 
-    if (!xmplayer_playmode) {
-        xmplayer_playmode = PLAYING_NOTE;
+    if (!p->playmode) {
+        p->playmode = PLAYING_NOTE;
         /* In sample editor the polyphony is not needed to try a sample */
-        if (!xmplayer_init_playing(TRUE, all))
+        if (!xmplayer_init_playing(p, TRUE, all))
             return FALSE;
     }
 
-    memset(&channels[chnr], 0, sizeof(channels[chnr]));
+    xmplayer_midi_note_off(p, ch);
+    memset(&p->channels[chnr], 0, sizeof(p->channels[chnr]));
 
     /* Oh, how I HATE HATE HATE this replayer source code. It's so messy.
        But I can't rewrite it since I lose FT compatibility then... */
 
-    proccmd = 0;
-    procnot = note;
-    procins = 0;
-    procdat = 0;
-    procvol = 0;
+    p->proccmd = 0;
+    p->procnot = note;
+    p->procins = 0;
+    p->procdat = 0;
+    p->procvol = 0;
 
     ch->cursamp = sample;
     ch->chDefVol = ch->cursamp->volume;
@@ -2221,7 +2345,7 @@ xmplayer_play_note_full(const gint chnr,
     nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
     ch->chCurNormNote = nn;
 
-    ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(ch, procnot);
+    ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(p, ch, p->procnot);
 
     ch->chVibPos = 0;
     ch->chTremPos = 0;
@@ -2247,49 +2371,51 @@ xmplayer_play_note_full(const gint chnr,
     ch->sampleplayend = playend;
     ch->chCurIns = inst;
     ch->chCurSamp = smpl;
-    xmplayer_final_channel_ops(chnr);
+    xmplayer_final_channel_ops(p, chnr);
 
     return TRUE;
 }
 
-void xmplayer_play_note_keyoff(int channel)
+void xmplayer_play_note_keyoff(xmplayer* p, int channel)
 {
-    channels[channel].chSustain = 0;
+    p->channels[channel].chSustain = 0;
 }
 
-void xmplayer_stop_note(int channel)
+void xmplayer_stop_note(xmplayer* p, int channel)
 {
-    driver_stopnote(channel);
-    channels[channel].curnote = -1;
+    driver_stopnote(p, channel);
+    p->channels[channel].curnote = -1;
 }
 
 double
-xmplayer_play(const gboolean simulation)
+xmplayer_play(xmplayer* p, const gboolean simulation)
 {
-    g_assert(xmplayer_playmode != 0);
-    xmpPlayTick(simulation);
+    g_assert(p->playmode != 0);
+    /* The pattern tracks are dereferenced here */
+    epoch_enter();
+    xmpPlayTick(p, simulation);
+    epoch_leave();
 
-    player_songpos = curord;
-    player_patpos = currow;
+    p->songpos = p->curord;
+    p->patpos = p->currow;
 
-    current_time += (double)125 / (player_bpm * 50);
-    return current_time;
+    p->current_time += (double)125 / (p->bpm * 50);
+    return p->current_time;
 }
 
-void xmplayer_set_songpos(int songpos)
+void xmplayer_set_songpos(xmplayer* p, int songpos)
 {
-    jumptorow = currow = player_patpos = 0;
-    jumptoord = curord = player_songpos = songpos;
-    curtick = player_tempo - 1;
-    globalvol = 64;
+    p->jumptorow = p->currow = p->patpos = 0;
+    p->jumptoord = p->curord = p->songpos = songpos;
+    p->curtick = p->tempo - 1;
+    p->globalvol = 64;
 }
 
-void xmplayer_set_pattern(int pattern)
+void xmplayer_set_pattern(xmplayer* p, int pattern)
 {
-    patlen = xm->patterns[pattern].length;
-    curpattern = &xm->patterns[player_patno = pattern];
+    xmplayer_set_curpattern(p, pattern);
 
-    if (currow >= patlen) {
-        currow = jumptorow = 0;
+    if (p->currow >= p->patlen) {
+        p->currow = p->jumptorow = 0;
     }
 }
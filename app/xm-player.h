@@ -24,6 +24,8 @@
 
 #include <glib.h>
 
+#include "mixer.h"
+#include "pattern-sync.h"
 #include "xm.h"
 
 enum {
@@ -91,21 +93,169 @@ enum {
 /* Making an extended FX parameter from a sub-command and a sub-parameter */
 #define XMP_CMD_EXTENDED(cmd, param) (((cmd - 36) << 4) | (param & 0xf))
 
-extern int player_songpos, player_patpos, player_patno;
-extern int player_tempo, player_bpm;
-extern gboolean player_looped;
-extern guint8 curtick;
+typedef struct xmplayer_channel {
+    int chVol;
+    int chFinalVol;
+    int chPan;
+    int chFinalPan;
+    gint32 chPitch; /* Pitch really means 'period' in nonlinear and module frequencies */
+    gint32 chFinalPitch;
+    gint32 chOldPitch;
+    int curnote; /* -1 indicates that the channel is not playing */
+    gint lastnote;
+    long chCutoff;
+    long chReso;
 
-void xmplayer_init_module(void);
-gboolean xmplayer_init_play_song(int songpos, int patpos, gboolean initall);
-gboolean xmplayer_init_play_pattern(int pattern,
+    gint chCurIns;
+    gint chCurSamp;
+    gint chLastIns;
+    int chCurNormNote;
+    guint8 chSustain;
+    guint16 chFadeVol;
+    guint16 chAVibPos;
+    guint32 chAVibSwpPos;
+    guint32 chVolEnvPos;
+    guint32 chPanEnvPos;
+
+    guint8 chDefVol;
+    int chDefPan;
+    guint8 chCommand;
+    guint8 chVCommand;
+    gint32 chPortaToPitch;
+    gint32 chPortaToVal;
+    guint8 chVolSlideVal;
+    guint8 chGVolSlideVal;
+    guint8 chVVolPanSlideVal;
+    guint8 chPanSlideVal;
+    guint8 chFineVolSlideUVal;
+    guint8 chFineVolSlideDVal;
+    gint32 chPortaUVal;
+    gint32 chPortaDVal;
+    guint8 chFinePortaUVal;
+    guint8 chFinePortaDVal;
+    guint8 chXFinePortaUVal;
+    guint8 chXFinePortaDVal;
+    guint8 chVibRate;
+    guint8 chVibPos;
+    guint8 chVibType;
+    guint8 chVibDep;
+    guint8 chTremRate;
+    guint8 chTremPos;
+    guint8 chTremType;
+    guint8 chTremDep;
+    guint8 chPatLoopCount;
+    guint8 chPatLoopStart;
+    guint8 chArpPos;
+    guint8 chArpOffsets[3];
+    guint8 chActionTick;
+    guint8 chMRetrigAct;
+    guint8 chDelayNote;
+    guint8 chDelayIns;
+    guint8 chDelayVol;
+    guint8 chOffset;
+    guint8 chGlissando;
+    guint8 chTremorPos;
+    guint8 chTremorLen;
+    guint8 chTremorOff;
+
+    int nextstop;
+    STSample* nextsamp;
+    int nextpos;
+    int sampleplayend; /* don't play all of the sample, but stop at (here) */
+    STSample* cursamp;
+    STInstrument* curins;
+    int hacksample; /* if 1, then simply play the sample pointed to by cursamp */
+
+    /* MIDI output: the note sounding plus one (0 if none), the MIDI channel
+       it's on and the frequency of the sample it's been started with */
+    gint midi_note;
+    gint midi_ch;
+    double midi_freq;
+} xmplayer_channel;
+
+typedef struct xmplayer_events xmplayer_events;
+
+/* The whole state of a player. Players don't share any data, so several
+   of them can run concurrently, each one rendering a module through its
+   own mixer instance. A player can be copied as a whole to take a
+   snapshot of the playback state; the compiled pattern belongs to the
+   player though, so restoring a snapshot must keep the player's own
+   events pointer. */
+typedef struct xmplayer {
+    XM* xm;
+    st_mixer* mixer;
+    void* mixer_object;
+
+    /* Position info, can be read after xmplayer_play() */
+    int songpos, patpos, patno;
+    int tempo, bpm;
+    guint8 curtick;
+    gboolean looped;
+
+    double current_time;
+    int playmode;
+    gboolean live; /* The player heard while editing, follows player_mute_channels */
+
+    xmplayer_channel channels[32];
+
+    guint8 globalvol;
+
+    guint8 tick0;
+
+    int currow, play_only_row, startrow, stoprow;
+    int ch_start, ch_num;
+    XMPattern* curpattern;
+    pattern_sync_state pat; /* The structure of curpattern being played */
+    xmplayer_events* events; /* curpattern compiled, see xmplayer_compile_pattern() */
+    int patlen;
+    int curord;
+    guint8 order[256]; /* Own copy of the order list */
+    gint order_generation; /* -1 if not copied yet */
+
+    int nord;
+    int ninst;
+    int nsamp;
+    int linearfreq;
+    int nchan;
+    int loopord;
+    int ismod;
+
+    int jumptoord;
+    int jumptorow;
+    int patdelay;
+    gboolean will_loop;
+
+    guint8 procnot;
+    guint8 procins;
+    guint8 procvol;
+    guint8 proccmd;
+    guint8 procdat;
+
+    int realgvol;
+
+    /* The last program and pitch bend sent on each MIDI channel, -1 and
+       G_MAXINT if unknown */
+    gint midi_program[16];
+    gint midi_bend[16];
+} xmplayer;
+
+xmplayer* xmplayer_new(XM* xm, st_mixer* mixer, void* mixer_object);
+void xmplayer_destroy(xmplayer* p);
+
+void xmplayer_init_module(xmplayer* p, XM* xm);
+gboolean xmplayer_init_play_song(xmplayer* p, int songpos, int patpos, gboolean initall);
+/* Makes the song end after the given position as if it were the last one */
+void xmplayer_set_song_end(xmplayer* p, int songpos);
+gboolean xmplayer_init_play_pattern(xmplayer* p,
+    int pattern,
     int patpos,
     int only1row,
     int stoppos,
     int ch_start,
     int num_ch);
-gboolean xmplayer_play_note(int channel, int note, int instrument, gboolean all);
-gboolean xmplayer_play_note_full(const gint channel,
+gboolean xmplayer_play_note(xmplayer* p, int channel, int note, int instrument, gboolean all);
+gboolean xmplayer_play_note_full(xmplayer* p,
+    const gint channel,
     const gint note,
     STSample* sample,
     const guint32 offset,
@@ -113,13 +263,13 @@ gboolean xmplayer_play_note_full(const gint channel,
     const gboolean use_all_channels,
     const gint inst,
     const gint smpl);
-void xmplayer_play_note_keyoff(int channel);
-void xmplayer_stop_note(int channel);
-double xmplayer_play(const gboolean simulation);
-void xmplayer_stop(void);
-void xmplayer_set_songpos(int songpos);
-void xmplayer_set_pattern(int pattern);
-void xmplayer_set_tempo(int tempo);
-void xmplayer_set_bpm(int bpm);
+void xmplayer_play_note_keyoff(xmplayer* p, int channel);
+void xmplayer_stop_note(xmplayer* p, int channel);
+double xmplayer_play(xmplayer* p, const gboolean simulation);
+void xmplayer_stop(xmplayer* p);
+void xmplayer_set_songpos(xmplayer* p, int songpos);
+void xmplayer_set_pattern(xmplayer* p, int pattern);
+void xmplayer_set_tempo(xmplayer* p, int tempo);
+void xmplayer_set_bpm(xmplayer* p, int bpm);
 
 #endif /* _ST_XMPLAYER_H */
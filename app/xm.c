@@ -1137,7 +1137,7 @@ xm_init_locks(XM* xm)
     for (i = 0; i < XM_NUM_INSTRUMENTS; i++) {
         STInstrument* ins = &xm->instruments[i];
         for (j = 0; j < XM_NUM_SAMPLES; j++) {
-            g_mutex_init(&ins->samples[j].sample.lock);
+            g_rec_mutex_init(&ins->samples[j].sample.sync.lock);
         }
     }
 }
@@ -1155,7 +1155,7 @@ xm_free_full(XM *xm, gboolean free_muteces)
             st_clean_instrument(ins, NULL);
             if (free_muteces)
                 for (j = 0; j < XM_NUM_SAMPLES; j++) {
-                    g_mutex_clear(&ins->samples[j].sample.lock);
+                    g_rec_mutex_clear(&ins->samples[j].sample.sync.lock);
                 }
         }
 
@@ -1255,8 +1255,6 @@ xm_load_mod(FILE* f,
 
     xm->tempo = 6;
     xm->bpm = 125;
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
     xm->flags = XM_FLAGS_IS_MOD | XM_FLAGS_AMIGA_FREQ;
 
     switch (xm_load_patterns(xm->patterns, n + 1, xm->num_channels, f, xm_load_mod_pattern)) {
@@ -1417,8 +1415,6 @@ XM* XM_Load(const gchar* filename,
     }
     xm->tempo = get_le_16(xh + 76);
     xm->bpm = get_le_16(xh + 78);
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
     if (fread(xm->pattern_order_table, 1, 256, f) != 256) {
         gui_error_dialog(&dialog, _("Error while loading pattern order table."), TRUE);
         goto ende;
@@ -1641,8 +1637,6 @@ XM* XM_New()
     xm->num_channels = 8;
     xm->tempo = 6;
     xm->bpm = 125;
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
     if (xm_load_patterns(xm->patterns, 0, xm->num_channels, NULL, NULL) != XM_NO_ERROR)
         goto ende;
 
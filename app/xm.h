@@ -53,9 +53,17 @@ typedef struct XMNote {
     unsigned char fxparam;
 } XMNote;
 
+/* See pattern-sync.h */
+typedef struct XMSync {
+    gint generation; /* odd while being changed */
+    guint depth; /* of the nested changes */
+    gint notes; /* counts the changes of the notes made in place */
+} XMSync;
+
 typedef struct XMPattern {
     int length, alloc_length;
     XMNote* channels[32];
+    XMSync sync;
 } XMPattern;
 
 /* -- Sample definitions -- */
@@ -141,6 +149,7 @@ typedef struct XM {
     int song_length;
     int restart_position;
     guint8 pattern_order_table[256];
+    XMSync order_sync;
 
     XMPattern patterns[XM_NUM_PATTERNS];
     STInstrument instruments[XM_NUM_INSTRUMENTS];